@@ -0,0 +1 @@
+c++ -I.. -pthread -DZT_ENABLE_CLUSTER -o mkgeoip ../node/C25519.cpp ../node/Salsa20.cpp ../node/SHA512.cpp ../node/Utils.cpp ../node/InetAddress.cpp ../osdep/OSUtils.cpp ../service/ClusterGeoIpService.cpp mkgeoip.cpp
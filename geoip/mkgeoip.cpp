@@ -0,0 +1,57 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2016  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This utility compiles a geo-IP CSV into the binary index that cluster
+ * members can memory map instead of parsing the CSV at startup. Point the
+ * cluster definition's "geo" line at the output file. It can be rebuilt
+ * while the service is running; the new index is picked up automatically.
+ *
+ * Usage: mkgeoip <CSV> <ip start column> <ip end column> <latitude column> <longitude column> <output index>
+ *
+ * Column indexes start at zero. For the db-ip.com city CSV this is
+ * typically: mkgeoip dbip-city.csv 0 1 5 6 dbip-city.ztgeo
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <node/Constants.hpp>
+#include <node/Utils.hpp>
+#include <service/ClusterGeoIpService.hpp>
+
+using namespace ZeroTier;
+
+int main(int argc,char **argv)
+{
+	if (argc != 7) {
+		fprintf(stderr,"Usage: %s <CSV> <ip start column> <ip end column> <latitude column> <longitude column> <output index>"ZT_EOL_S,argv[0]);
+		return 1;
+	}
+
+	const long n = ClusterGeoIpService::compile(argv[1],Utils::strToInt(argv[2]),Utils::strToInt(argv[3]),Utils::strToInt(argv[4]),Utils::strToInt(argv[5]),argv[6]);
+	if (n < 0) {
+		fprintf(stderr,"FATAL: unable to read %s or write %s"ZT_EOL_S,argv[1],argv[6]);
+		return 1;
+	}
+
+	fprintf(stderr,"INFO: wrote %ld ranges to %s"ZT_EOL_S,n,argv[6]);
+	return 0;
+}
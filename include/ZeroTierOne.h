@@ -334,6 +334,16 @@ typedef struct
 	 * True if some kind of connectivity appears available
 	 */
 	int online;
+
+	/**
+	 * Number of packets (e.g. new peers' HELLOs) waiting for background processing
+	 */
+	unsigned long deferredPacketsQueued;
+
+	/**
+	 * Number of packets dropped because background processing queues were full
+	 */
+	unsigned long deferredPacketsDropped;
 } ZT_NodeStatus;
 
 /**
@@ -1488,6 +1498,52 @@ enum ZT_ResultCode ZT_Node_processWirePacket(
 	unsigned int packetLength,
 	volatile uint64_t *nextBackgroundTaskDeadline);
 
+/**
+ * Get an empty buffer to receive a packet from the physical wire into
+ *
+ * Receiving directly into this buffer and then passing it to
+ * ZT_Node_processWirePacketBuffer() saves copying the packet. Each buffer
+ * obtained here must be passed to either that or ZT_Node_freeWirePacketBuffer()
+ * exactly once. Buffers can be used from any thread.
+ *
+ * @param node Node instance
+ * @param data Result: writable packet storage
+ * @param capacity Result: size of packet storage in bytes
+ * @return Buffer handle or NULL on failure (out of memory)
+ */
+void *ZT_Node_getWirePacketBuffer(ZT_Node *node,void **data,unsigned int *capacity);
+
+/**
+ * Return an unused buffer from ZT_Node_getWirePacketBuffer()
+ *
+ * @param node Node instance
+ * @param packetBuffer Buffer handle
+ */
+void ZT_Node_freeWirePacketBuffer(ZT_Node *node,void *packetBuffer);
+
+/**
+ * Process a packet received from the physical wire into a node buffer
+ *
+ * This takes ownership of the buffer, even if an error is returned.
+ *
+ * @param node Node instance
+ * @param now Current clock in milliseconds
+ * @param localAddress Local address, or point to ZT_SOCKADDR_NULL if unspecified
+ * @param remoteAddress Origin of packet
+ * @param packetBuffer Buffer handle from ZT_Node_getWirePacketBuffer()
+ * @param packetLength Length of packet written to the buffer's data
+ * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+ * @return OK (0) or error code if a fatal error condition has occurred
+ */
+enum ZT_ResultCode ZT_Node_processWirePacketBuffer(
+	ZT_Node *node,
+	uint64_t now,
+	const struct sockaddr_storage *localAddress,
+	const struct sockaddr_storage *remoteAddress,
+	void *packetBuffer,
+	unsigned int packetLength,
+	volatile uint64_t *nextBackgroundTaskDeadline);
+
 /**
  * Process a frame from a virtual network port (tap)
  *
@@ -1878,6 +1934,10 @@ void ZT_Node_setTrustedPaths(ZT_Node *node,const struct sockaddr_storage *networ
  * not return until the Node is shut down. If threading is not enabled in
  * this build it will return immediately and will do nothing.
  *
+ * Any number of threads may run this. ZT_Node_delete() waits for all of them
+ * to return, so they must have been started (and join them if desired)
+ * before then.
+ *
  * This is completely optional. If this is never called, all processing is
  * done in the foreground in the various processXXXX() methods.
  *
@@ -31,6 +31,7 @@ LOCAL_SRC_FILES := \
 	$(ZT1)/node/Salsa20.cpp \
 	$(ZT1)/node/SelfAwareness.cpp \
 	$(ZT1)/node/SHA512.cpp \
+	$(ZT1)/node/SizeClassPool.cpp \
 	$(ZT1)/node/Switch.cpp \
 	$(ZT1)/node/Topology.cpp \
 	$(ZT1)/node/Utils.cpp \
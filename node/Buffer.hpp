@@ -457,6 +457,16 @@ public:
 	 */
 	inline const void *data() const throw() { return _b; }
 
+	/**
+	 * Get a writable pointer to the buffer's full capacity
+	 *
+	 * This is for filling the buffer in place, e.g. from a socket. The caller
+	 * must then set the size with setSize().
+	 *
+	 * @return Pointer to capacity() bytes of storage
+	 */
+	inline void *unsafeData() throw() { return _b; }
+
 	/**
 	 * @return Size of data in buffer
 	 */
@@ -22,6 +22,11 @@ Derived from public domain code by D. J. Bernstein.
 #pragma warning(disable: 4146)
 #endif
 
+// 64-bit field arithmetic needs 128-bit products
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__aarch64__)) && defined(__SIZEOF_INT128__) && (!defined(ZT_C25519_NO_FE51))
+#define ZT_C25519_FE51 1
+#endif
+
 namespace ZeroTier {
 
 //////////////////////////////////////////////////////////////////////////////
@@ -2267,13 +2272,900 @@ static int crypto_sign_open(
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
 
+// 64-bit field arithmetic in radix 2^51 (five limbs, 128-bit products) for
+// both Curve25519 and Ed25519, after the curve25519-donna-c64 and ref10
+// designs. The group operations below mirror the SUPERCOP ones above and
+// share its scalar code and base point tables. The portable code above is
+// kept for other platforms and as a reference for the selftest.
+
+#ifdef ZT_C25519_FE51
+
+typedef unsigned __int128 fe51_uint128;
+
+typedef struct
+{
+  crypto_uint64 v[5];
+}
+fe51;
+
+#define FE51_MASK 0x7ffffffffffffULL
+
+/* Limbs are kept below 2^52 between operations, which keeps products in range */
+static inline void fe51_carry(fe51 *r)
+{
+  crypto_uint64 c;
+  c = r->v[0] >> 51; r->v[0] &= FE51_MASK; r->v[1] += c;
+  c = r->v[1] >> 51; r->v[1] &= FE51_MASK; r->v[2] += c;
+  c = r->v[2] >> 51; r->v[2] &= FE51_MASK; r->v[3] += c;
+  c = r->v[3] >> 51; r->v[3] &= FE51_MASK; r->v[4] += c;
+  c = r->v[4] >> 51; r->v[4] &= FE51_MASK; r->v[0] += c * 19;
+}
+
+static inline crypto_uint64 fe51_load64(const unsigned char *x)
+{
+  return ((crypto_uint64)x[0]) | (((crypto_uint64)x[1]) << 8) | (((crypto_uint64)x[2]) << 16) | (((crypto_uint64)x[3]) << 24) |
+    (((crypto_uint64)x[4]) << 32) | (((crypto_uint64)x[5]) << 40) | (((crypto_uint64)x[6]) << 48) | (((crypto_uint64)x[7]) << 56);
+}
+
+static inline void fe51_store64(unsigned char *r, crypto_uint64 x)
+{
+  int i;
+  for(i=0;i<8;i++) { r[i] = (unsigned char)x; x >>= 8; }
+}
+
+/* Ignores bit 255, like fe25519_unpack() */
+static inline void fe51_unpack(fe51 *r, const unsigned char x[32])
+{
+  const crypto_uint64 x0 = fe51_load64(x);
+  const crypto_uint64 x1 = fe51_load64(x + 8);
+  const crypto_uint64 x2 = fe51_load64(x + 16);
+  const crypto_uint64 x3 = fe51_load64(x + 24);
+  r->v[0] = x0 & FE51_MASK;
+  r->v[1] = ((x0 >> 51) | (x1 << 13)) & FE51_MASK;
+  r->v[2] = ((x1 >> 38) | (x2 << 26)) & FE51_MASK;
+  r->v[3] = ((x2 >> 25) | (x3 << 39)) & FE51_MASK;
+  r->v[4] = (x3 >> 12) & FE51_MASK;
+}
+
+static inline void fe51_pack(unsigned char r[32], const fe51 *x)
+{
+  fe51 t = *x;
+  fe51_carry(&t);
+  fe51_carry(&t);
+  /* t is now below 2^255; adding 19 carries into bit 255 exactly when t >= p */
+  t.v[0] += 19;
+  fe51_carry(&t);
+  /* subtract the 19 again, borrowing from an added 2^255 that is then dropped */
+  t.v[0] += 0x8000000000000ULL - 19;
+  t.v[1] += 0x8000000000000ULL - 1;
+  t.v[2] += 0x8000000000000ULL - 1;
+  t.v[3] += 0x8000000000000ULL - 1;
+  t.v[4] += 0x8000000000000ULL - 1;
+  t.v[1] += t.v[0] >> 51; t.v[0] &= FE51_MASK;
+  t.v[2] += t.v[1] >> 51; t.v[1] &= FE51_MASK;
+  t.v[3] += t.v[2] >> 51; t.v[2] &= FE51_MASK;
+  t.v[4] += t.v[3] >> 51; t.v[3] &= FE51_MASK;
+  t.v[4] &= FE51_MASK;
+  fe51_store64(r,t.v[0] | (t.v[1] << 51));
+  fe51_store64(r + 8,(t.v[1] >> 13) | (t.v[2] << 38));
+  fe51_store64(r + 16,(t.v[2] >> 26) | (t.v[3] << 25));
+  fe51_store64(r + 24,(t.v[3] >> 39) | (t.v[4] << 12));
+}
+
+static inline void fe51_from_fe25519(fe51 *r, const fe25519 *x)
+{
+  unsigned char b[32];
+  int i;
+  for(i=0;i<32;i++) b[i] = (unsigned char)x->v[i];
+  fe51_unpack(r,b);
+}
+
+static inline int fe51_iseq_vartime(const fe51 *x, const fe51 *y)
+{
+  unsigned char a[32],b[32];
+  fe51_pack(a,x);
+  fe51_pack(b,y);
+  return (memcmp(a,b,32) == 0);
+}
+
+static inline unsigned char fe51_getparity(const fe51 *x)
+{
+  unsigned char b[32];
+  fe51_pack(b,x);
+  return b[0] & 1;
+}
+
+static inline void fe51_cmov(fe51 *r, const fe51 *x, unsigned char b)
+{
+  int i;
+  crypto_uint64 mask = b;
+  mask = -mask;
+  for(i=0;i<5;i++) r->v[i] ^= mask & (x->v[i] ^ r->v[i]);
+}
+
+static inline void fe51_cswap(fe51 *r, fe51 *s, crypto_uint64 b)
+{
+  int i;
+  crypto_uint64 x;
+  const crypto_uint64 mask = -b;
+  for(i=0;i<5;i++) {
+    x = mask & (r->v[i] ^ s->v[i]);
+    r->v[i] ^= x;
+    s->v[i] ^= x;
+  }
+}
+
+static inline void fe51_setone(fe51 *r)
+{
+  r->v[0] = 1; r->v[1] = 0; r->v[2] = 0; r->v[3] = 0; r->v[4] = 0;
+}
+
+static inline void fe51_setzero(fe51 *r)
+{
+  r->v[0] = 0; r->v[1] = 0; r->v[2] = 0; r->v[3] = 0; r->v[4] = 0;
+}
+
+static inline void fe51_add(fe51 *r, const fe51 *x, const fe51 *y)
+{
+  int i;
+  for(i=0;i<5;i++) r->v[i] = x->v[i] + y->v[i];
+  fe51_carry(r);
+}
+
+/* Adds 2p to x first so that limbs can't go negative */
+static inline void fe51_sub(fe51 *r, const fe51 *x, const fe51 *y)
+{
+  r->v[0] = (x->v[0] + 0xfffffffffffdaULL) - y->v[0];
+  r->v[1] = (x->v[1] + 0xffffffffffffeULL) - y->v[1];
+  r->v[2] = (x->v[2] + 0xffffffffffffeULL) - y->v[2];
+  r->v[3] = (x->v[3] + 0xffffffffffffeULL) - y->v[3];
+  r->v[4] = (x->v[4] + 0xffffffffffffeULL) - y->v[4];
+  fe51_carry(r);
+}
+
+static inline void fe51_neg(fe51 *r, const fe51 *x)
+{
+  fe51 z;
+  fe51_setzero(&z);
+  fe51_sub(r,&z,x);
+}
+
+static inline void fe51_reduce128(fe51 *r, fe51_uint128 r0, fe51_uint128 r1, fe51_uint128 r2, fe51_uint128 r3, fe51_uint128 r4)
+{
+  crypto_uint64 c;
+  r1 += (crypto_uint64)(r0 >> 51); r->v[0] = (crypto_uint64)r0 & FE51_MASK;
+  r2 += (crypto_uint64)(r1 >> 51); r->v[1] = (crypto_uint64)r1 & FE51_MASK;
+  r3 += (crypto_uint64)(r2 >> 51); r->v[2] = (crypto_uint64)r2 & FE51_MASK;
+  r4 += (crypto_uint64)(r3 >> 51); r->v[3] = (crypto_uint64)r3 & FE51_MASK;
+  c = (crypto_uint64)(r4 >> 51); r->v[4] = (crypto_uint64)r4 & FE51_MASK;
+  r->v[0] += c * 19;
+  r->v[1] += r->v[0] >> 51; r->v[0] &= FE51_MASK;
+}
+
+static inline void fe51_mul(fe51 *r, const fe51 *x, const fe51 *y)
+{
+  const crypto_uint64 x0 = x->v[0], x1 = x->v[1], x2 = x->v[2], x3 = x->v[3], x4 = x->v[4];
+  const crypto_uint64 y0 = y->v[0], y1 = y->v[1], y2 = y->v[2], y3 = y->v[3], y4 = y->v[4];
+  const crypto_uint64 y1_19 = y1 * 19, y2_19 = y2 * 19, y3_19 = y3 * 19, y4_19 = y4 * 19;
+  fe51_reduce128(r,
+    (fe51_uint128)x0 * y0 + (fe51_uint128)x1 * y4_19 + (fe51_uint128)x2 * y3_19 + (fe51_uint128)x3 * y2_19 + (fe51_uint128)x4 * y1_19,
+    (fe51_uint128)x0 * y1 + (fe51_uint128)x1 * y0 + (fe51_uint128)x2 * y4_19 + (fe51_uint128)x3 * y3_19 + (fe51_uint128)x4 * y2_19,
+    (fe51_uint128)x0 * y2 + (fe51_uint128)x1 * y1 + (fe51_uint128)x2 * y0 + (fe51_uint128)x3 * y4_19 + (fe51_uint128)x4 * y3_19,
+    (fe51_uint128)x0 * y3 + (fe51_uint128)x1 * y2 + (fe51_uint128)x2 * y1 + (fe51_uint128)x3 * y0 + (fe51_uint128)x4 * y4_19,
+    (fe51_uint128)x0 * y4 + (fe51_uint128)x1 * y3 + (fe51_uint128)x2 * y2 + (fe51_uint128)x3 * y1 + (fe51_uint128)x4 * y0);
+}
+
+static inline void fe51_square(fe51 *r, const fe51 *x)
+{
+  const crypto_uint64 x0 = x->v[0], x1 = x->v[1], x2 = x->v[2], x3 = x->v[3], x4 = x->v[4];
+  const crypto_uint64 x0_2 = x0 * 2, x1_2 = x1 * 2;
+  const crypto_uint64 x3_19 = x3 * 19, x3_38 = x3 * 38, x4_19 = x4 * 19, x4_38 = x4 * 38;
+  fe51_reduce128(r,
+    (fe51_uint128)x0 * x0 + (fe51_uint128)x1 * x4_38 + (fe51_uint128)x2 * x3_38,
+    (fe51_uint128)x0_2 * x1 + (fe51_uint128)x2 * x4_38 + (fe51_uint128)x3 * x3_19,
+    (fe51_uint128)x0_2 * x2 + (fe51_uint128)x1 * x1 + (fe51_uint128)x3 * x4_38,
+    (fe51_uint128)x0_2 * x3 + (fe51_uint128)x1_2 * x2 + (fe51_uint128)x4 * x4_19,
+    (fe51_uint128)x0_2 * x4 + (fe51_uint128)x1_2 * x3 + (fe51_uint128)x2 * x2);
+}
+
+static inline void fe51_squaren(fe51 *r, const fe51 *x, int n)
+{
+  fe51_square(r,x);
+  while (--n > 0)
+    fe51_square(r,r);
+}
+
+static inline void fe51_mul121665(fe51 *r, const fe51 *x)
+{
+  fe51_reduce128(r,
+    (fe51_uint128)x->v[0] * 121665,
+    (fe51_uint128)x->v[1] * 121665,
+    (fe51_uint128)x->v[2] * 121665,
+    (fe51_uint128)x->v[3] * 121665,
+    (fe51_uint128)x->v[4] * 121665);
+}
+
+/* r = x^(p-2) = x^(2^255-21) */
+static void fe51_invert(fe51 *r, const fe51 *x)
+{
+  fe51 t0,t1,t2,t3;
+  fe51_square(&t0,x);         /* 2 */
+  fe51_squaren(&t1,&t0,2);    /* 8 */
+  fe51_mul(&t1,x,&t1);        /* 9 */
+  fe51_mul(&t0,&t0,&t1);      /* 11 */
+  fe51_square(&t2,&t0);       /* 22 */
+  fe51_mul(&t1,&t1,&t2);      /* 2^5 - 2^0 = 31 */
+  fe51_squaren(&t2,&t1,5);    /* 2^10 - 2^5 */
+  fe51_mul(&t1,&t2,&t1);      /* 2^10 - 2^0 */
+  fe51_squaren(&t2,&t1,10);   /* 2^20 - 2^10 */
+  fe51_mul(&t2,&t2,&t1);      /* 2^20 - 2^0 */
+  fe51_squaren(&t3,&t2,20);   /* 2^40 - 2^20 */
+  fe51_mul(&t2,&t3,&t2);      /* 2^40 - 2^0 */
+  fe51_squaren(&t2,&t2,10);   /* 2^50 - 2^10 */
+  fe51_mul(&t1,&t2,&t1);      /* 2^50 - 2^0 */
+  fe51_squaren(&t2,&t1,50);   /* 2^100 - 2^50 */
+  fe51_mul(&t2,&t2,&t1);      /* 2^100 - 2^0 */
+  fe51_squaren(&t3,&t2,100);  /* 2^200 - 2^100 */
+  fe51_mul(&t2,&t3,&t2);      /* 2^200 - 2^0 */
+  fe51_squaren(&t2,&t2,50);   /* 2^250 - 2^50 */
+  fe51_mul(&t1,&t2,&t1);      /* 2^250 - 2^0 */
+  fe51_squaren(&t1,&t1,5);    /* 2^255 - 2^5 */
+  fe51_mul(r,&t1,&t0);        /* 2^255 - 21 */
+}
+
+/* r = x^((p-5)/8) = x^(2^252-3) */
+static void fe51_pow2523(fe51 *r, const fe51 *x)
+{
+  fe51 t0,t1,t2;
+  fe51_square(&t0,x);         /* 2 */
+  fe51_squaren(&t1,&t0,2);    /* 8 */
+  fe51_mul(&t1,x,&t1);        /* 9 */
+  fe51_mul(&t0,&t0,&t1);      /* 11 */
+  fe51_square(&t0,&t0);       /* 22 */
+  fe51_mul(&t0,&t1,&t0);      /* 2^5 - 2^0 */
+  fe51_squaren(&t1,&t0,5);    /* 2^10 - 2^5 */
+  fe51_mul(&t0,&t1,&t0);      /* 2^10 - 2^0 */
+  fe51_squaren(&t1,&t0,10);   /* 2^20 - 2^10 */
+  fe51_mul(&t1,&t1,&t0);      /* 2^20 - 2^0 */
+  fe51_squaren(&t2,&t1,20);   /* 2^40 - 2^20 */
+  fe51_mul(&t1,&t2,&t1);      /* 2^40 - 2^0 */
+  fe51_squaren(&t1,&t1,10);   /* 2^50 - 2^10 */
+  fe51_mul(&t0,&t1,&t0);      /* 2^50 - 2^0 */
+  fe51_squaren(&t1,&t0,50);   /* 2^100 - 2^50 */
+  fe51_mul(&t1,&t1,&t0);      /* 2^100 - 2^0 */
+  fe51_squaren(&t2,&t1,100);  /* 2^200 - 2^100 */
+  fe51_mul(&t1,&t2,&t1);      /* 2^200 - 2^0 */
+  fe51_squaren(&t1,&t1,50);   /* 2^250 - 2^50 */
+  fe51_mul(&t0,&t1,&t0);      /* 2^250 - 2^0 */
+  fe51_squaren(&t0,&t0,2);    /* 2^252 - 2^2 */
+  fe51_mul(r,&t0,x);          /* 2^252 - 3 */
+}
+
+/* Montgomery ladder as in RFC 7748, same results as crypto_scalarmult() */
+static void crypto_scalarmult_fe51(unsigned char *q, const unsigned char *n, const unsigned char *p)
+{
+  unsigned char e[32];
+  fe51 x1,x2,z2,x3,z3,a,aa,b,bb,c,d,da,cb,t;
+  crypto_uint64 swap = 0,bit;
+  int i;
+
+  for (i = 0;i < 32;++i) e[i] = n[i];
+  e[0] &= 248;
+  e[31] &= 127;
+  e[31] |= 64;
+
+  /* the reference code doesn't mask bit 255 of the point, it just reduces */
+  fe51_unpack(&x1,p);
+  x1.v[0] += 19 * (crypto_uint64)(p[31] >> 7);
+
+  fe51_setone(&x2);
+  fe51_setzero(&z2);
+  x3 = x1;
+  fe51_setone(&z3);
+
+  for (i = 254;i >= 0;--i) {
+    bit = (e[i >> 3] >> (i & 7)) & 1;
+    swap ^= bit;
+    fe51_cswap(&x2,&x3,swap);
+    fe51_cswap(&z2,&z3,swap);
+    swap = bit;
+
+    fe51_add(&a,&x2,&z2);
+    fe51_square(&aa,&a);
+    fe51_sub(&b,&x2,&z2);
+    fe51_square(&bb,&b);
+    fe51_add(&c,&x3,&z3);
+    fe51_sub(&d,&x3,&z3);
+    fe51_mul(&da,&d,&a);
+    fe51_mul(&cb,&c,&b);
+    fe51_add(&t,&da,&cb);
+    fe51_square(&x3,&t);
+    fe51_sub(&t,&da,&cb);
+    fe51_square(&t,&t);
+    fe51_mul(&z3,&x1,&t);
+    fe51_mul(&x2,&aa,&bb);
+    fe51_sub(&t,&aa,&bb); /* E */
+    fe51_mul121665(&a,&t);
+    fe51_add(&a,&a,&aa);
+    fe51_mul(&z2,&t,&a);
+  }
+  fe51_cswap(&x2,&x3,swap);
+  fe51_cswap(&z2,&z3,swap);
+
+  fe51_invert(&z2,&z2);
+  fe51_mul(&x2,&x2,&z2);
+  fe51_pack(q,&x2);
+}
+
+typedef struct
+{
+  fe51 x;
+  fe51 y;
+  fe51 z;
+  fe51 t;
+} ge51_p3;
+
+typedef struct
+{
+  fe51 x;
+  fe51 z;
+  fe51 y;
+  fe51 t;
+} ge51_p1p1;
+
+typedef struct
+{
+  fe51 x;
+  fe51 y;
+  fe51 z;
+} ge51_p2;
+
+typedef struct
+{
+  fe51 x;
+  fe51 y;
+} ge51_aff;
+
+/* Converted copies of the constants and base point tables above */
+static fe51 ge51_ecd;
+static fe51 ge51_ec2d;
+static fe51 ge51_sqrtm1;
+static ge51_p3 ge51_base;
+static ge51_aff ge51_base_multiples_affine[425];
+
+static struct _ge51_tables_init
+{
+  _ge51_tables_init()
+  {
+    fe51_from_fe25519(&ge51_ecd,&ge25519_ecd);
+    fe51_from_fe25519(&ge51_ec2d,&ge25519_ec2d);
+    fe51_from_fe25519(&ge51_sqrtm1,&ge25519_sqrtm1);
+    fe51_from_fe25519(&ge51_base.x,&ge25519_base.x);
+    fe51_from_fe25519(&ge51_base.y,&ge25519_base.y);
+    fe51_from_fe25519(&ge51_base.z,&ge25519_base.z);
+    fe51_from_fe25519(&ge51_base.t,&ge25519_base.t);
+    for(int i=0;i<425;i++) {
+      fe51_from_fe25519(&ge51_base_multiples_affine[i].x,&ge25519_base_multiples_affine[i].x);
+      fe51_from_fe25519(&ge51_base_multiples_affine[i].y,&ge25519_base_multiples_affine[i].y);
+    }
+  }
+} _ge51_tables_init_instance;
+
+static inline void ge51_p1p1_to_p2(ge51_p2 *r, const ge51_p1p1 *p)
+{
+  fe51_mul(&r->x, &p->x, &p->t);
+  fe51_mul(&r->y, &p->y, &p->z);
+  fe51_mul(&r->z, &p->z, &p->t);
+}
+
+static inline void ge51_p1p1_to_p3(ge51_p3 *r, const ge51_p1p1 *p)
+{
+  fe51_mul(&r->x, &p->x, &p->t);
+  fe51_mul(&r->y, &p->y, &p->z);
+  fe51_mul(&r->z, &p->z, &p->t);
+  fe51_mul(&r->t, &p->x, &p->y);
+}
+
+static inline void ge51_p3_to_p2(ge51_p2 *r, const ge51_p3 *p)
+{
+  r->x = p->x;
+  r->y = p->y;
+  r->z = p->z;
+}
+
+static void ge51_mixadd2(ge51_p3 *r, const ge51_aff *q)
+{
+  fe51 a,b,t1,t2,c,d,e,f,g,h,qt;
+  fe51_mul(&qt, &q->x, &q->y);
+  fe51_sub(&a, &r->y, &r->x); /* A = (Y1-X1)*(Y2-X2) */
+  fe51_add(&b, &r->y, &r->x); /* B = (Y1+X1)*(Y2+X2) */
+  fe51_sub(&t1, &q->y, &q->x);
+  fe51_add(&t2, &q->y, &q->x);
+  fe51_mul(&a, &a, &t1);
+  fe51_mul(&b, &b, &t2);
+  fe51_sub(&e, &b, &a); /* E = B-A */
+  fe51_add(&h, &b, &a); /* H = B+A */
+  fe51_mul(&c, &r->t, &qt); /* C = T1*k*T2 */
+  fe51_mul(&c, &c, &ge51_ec2d);
+  fe51_add(&d, &r->z, &r->z); /* D = Z1*2 */
+  fe51_sub(&f, &d, &c); /* F = D-C */
+  fe51_add(&g, &d, &c); /* G = D+C */
+  fe51_mul(&r->x, &e, &f);
+  fe51_mul(&r->y, &h, &g);
+  fe51_mul(&r->z, &g, &f);
+  fe51_mul(&r->t, &e, &h);
+}
+
+static void ge51_add_p1p1(ge51_p1p1 *r, const ge51_p3 *p, const ge51_p3 *q)
+{
+  fe51 a, b, c, d, t;
+  fe51_sub(&a, &p->y, &p->x); /* A = (Y1-X1)*(Y2-X2) */
+  fe51_sub(&t, &q->y, &q->x);
+  fe51_mul(&a, &a, &t);
+  fe51_add(&b, &p->x, &p->y); /* B = (Y1+X1)*(Y2+X2) */
+  fe51_add(&t, &q->x, &q->y);
+  fe51_mul(&b, &b, &t);
+  fe51_mul(&c, &p->t, &q->t); /* C = T1*k*T2 */
+  fe51_mul(&c, &c, &ge51_ec2d);
+  fe51_mul(&d, &p->z, &q->z); /* D = Z1*2*Z2 */
+  fe51_add(&d, &d, &d);
+  fe51_sub(&r->x, &b, &a); /* E = B-A */
+  fe51_sub(&r->t, &d, &c); /* F = D-C */
+  fe51_add(&r->z, &d, &c); /* G = D+C */
+  fe51_add(&r->y, &b, &a); /* H = B+A */
+}
+
+static void ge51_dbl_p1p1(ge51_p1p1 *r, const ge51_p2 *p)
+{
+  fe51 a,b,c,d;
+  fe51_square(&a, &p->x);
+  fe51_square(&b, &p->y);
+  fe51_square(&c, &p->z);
+  fe51_add(&c, &c, &c);
+  fe51_neg(&d, &a);
+
+  fe51_add(&r->x, &p->x, &p->y);
+  fe51_square(&r->x, &r->x);
+  fe51_sub(&r->x, &r->x, &a);
+  fe51_sub(&r->x, &r->x, &b);
+  fe51_add(&r->z, &d, &b);
+  fe51_sub(&r->t, &r->z, &c);
+  fe51_sub(&r->y, &d, &b);
+}
+
+static inline void ge51_cmov_aff(ge51_aff *r, const ge51_aff *p, unsigned char b)
+{
+  fe51_cmov(&r->x, &p->x, b);
+  fe51_cmov(&r->y, &p->y, b);
+}
+
+static inline void ge51_choose_t(ge51_aff *t, unsigned long long pos, signed char b)
+{
+  /* constant time */
+  fe51 v;
+  *t = ge51_base_multiples_affine[5*pos+0];
+  ge51_cmov_aff(t, &ge51_base_multiples_affine[5*pos+1],equal(b,1) | equal(b,-1));
+  ge51_cmov_aff(t, &ge51_base_multiples_affine[5*pos+2],equal(b,2) | equal(b,-2));
+  ge51_cmov_aff(t, &ge51_base_multiples_affine[5*pos+3],equal(b,3) | equal(b,-3));
+  ge51_cmov_aff(t, &ge51_base_multiples_affine[5*pos+4],equal(b,-4));
+  fe51_neg(&v, &t->x);
+  fe51_cmov(&t->x, &v, negative(b));
+}
+
+static inline void ge51_setneutral(ge51_p3 *r)
+{
+  fe51_setzero(&r->x);
+  fe51_setone(&r->y);
+  fe51_setone(&r->z);
+  fe51_setzero(&r->t);
+}
+
+/* return 0 on success, -1 otherwise */
+static int ge51_unpackneg_vartime(ge51_p3 *r, const unsigned char p[32])
+{
+  unsigned char par;
+  fe51 t, chk, num, den, den2, den4, den6;
+  fe51_setone(&r->z);
+  par = p[31] >> 7;
+  fe51_unpack(&r->y, p);
+  fe51_square(&num, &r->y); /* x = y^2 */
+  fe51_mul(&den, &num, &ge51_ecd); /* den = dy^2 */
+  fe51_sub(&num, &num, &r->z); /* x = y^2-1 */
+  fe51_add(&den, &r->z, &den); /* den = dy^2+1 */
+
+  /* Computation of sqrt(num/den) */
+  /* 1.: computation of num^((p-5)/8)*den^((7p-35)/8) = (num*den^7)^((p-5)/8) */
+  fe51_square(&den2, &den);
+  fe51_square(&den4, &den2);
+  fe51_mul(&den6, &den4, &den2);
+  fe51_mul(&t, &den6, &num);
+  fe51_mul(&t, &t, &den);
+
+  fe51_pow2523(&t, &t);
+  /* 2. computation of r->x = t * num * den^3 */
+  fe51_mul(&t, &t, &num);
+  fe51_mul(&t, &t, &den);
+  fe51_mul(&t, &t, &den);
+  fe51_mul(&r->x, &t, &den);
+
+  /* 3. Check whether sqrt computation gave correct result, multiply by sqrt(-1) if not: */
+  fe51_square(&chk, &r->x);
+  fe51_mul(&chk, &chk, &den);
+  if (!fe51_iseq_vartime(&chk, &num))
+    fe51_mul(&r->x, &r->x, &ge51_sqrtm1);
+
+  /* 4. Now we have one of the two square roots, except if input was not a square */
+  fe51_square(&chk, &r->x);
+  fe51_mul(&chk, &chk, &den);
+  if (!fe51_iseq_vartime(&chk, &num))
+    return -1;
+
+  /* 5. Choose the desired square root according to parity: */
+  if(fe51_getparity(&r->x) != (1-par))
+    fe51_neg(&r->x, &r->x);
+
+  fe51_mul(&r->t, &r->x, &r->y);
+  return 0;
+}
+
+static inline void ge51_pack(unsigned char r[32], const ge51_p3 *p)
+{
+  fe51 tx, ty, zi;
+  fe51_invert(&zi, &p->z);
+  fe51_mul(&tx, &p->x, &zi);
+  fe51_mul(&ty, &p->y, &zi);
+  fe51_pack(r, &ty);
+  r[31] ^= fe51_getparity(&tx) << 7;
+}
+
+/* computes [s1]p1 + [s2]p2 */
+static void ge51_double_scalarmult_vartime(ge51_p3 *r, const ge51_p3 *p1, const sc25519 *s1, const ge51_p3 *p2, const sc25519 *s2)
+{
+  ge51_p1p1 tp1p1;
+  ge51_p2 tp2;
+  ge51_p3 pre[16];
+  unsigned char b[127];
+  int i;
+
+  /* precomputation                                                             s2 s1 */
+  ge51_setneutral(pre);                                                      /* 00 00 */
+  pre[1] = *p1;                                                              /* 00 01 */
+  ge51_p3_to_p2(&tp2,p1);   ge51_dbl_p1p1(&tp1p1,&tp2);     ge51_p1p1_to_p3( &pre[2], &tp1p1); /* 00 10 */
+  ge51_add_p1p1(&tp1p1,&pre[1], &pre[2]);                   ge51_p1p1_to_p3( &pre[3], &tp1p1); /* 00 11 */
+  pre[4] = *p2;                                                              /* 01 00 */
+  ge51_add_p1p1(&tp1p1,&pre[1], &pre[4]);                   ge51_p1p1_to_p3( &pre[5], &tp1p1); /* 01 01 */
+  ge51_add_p1p1(&tp1p1,&pre[2], &pre[4]);                   ge51_p1p1_to_p3( &pre[6], &tp1p1); /* 01 10 */
+  ge51_add_p1p1(&tp1p1,&pre[3], &pre[4]);                   ge51_p1p1_to_p3( &pre[7], &tp1p1); /* 01 11 */
+  ge51_p3_to_p2(&tp2,p2);   ge51_dbl_p1p1(&tp1p1,&tp2);     ge51_p1p1_to_p3( &pre[8], &tp1p1); /* 10 00 */
+  ge51_add_p1p1(&tp1p1,&pre[1], &pre[8]);                   ge51_p1p1_to_p3( &pre[9], &tp1p1); /* 10 01 */
+  ge51_p3_to_p2(&tp2,&pre[5]); ge51_dbl_p1p1(&tp1p1,&tp2);  ge51_p1p1_to_p3(&pre[10], &tp1p1); /* 10 10 */
+  ge51_add_p1p1(&tp1p1,&pre[3], &pre[8]);                   ge51_p1p1_to_p3(&pre[11], &tp1p1); /* 10 11 */
+  ge51_add_p1p1(&tp1p1,&pre[4], &pre[8]);                   ge51_p1p1_to_p3(&pre[12], &tp1p1); /* 11 00 */
+  ge51_add_p1p1(&tp1p1,&pre[1],&pre[12]);                   ge51_p1p1_to_p3(&pre[13], &tp1p1); /* 11 01 */
+  ge51_add_p1p1(&tp1p1,&pre[2],&pre[12]);                   ge51_p1p1_to_p3(&pre[14], &tp1p1); /* 11 10 */
+  ge51_add_p1p1(&tp1p1,&pre[3],&pre[12]);                   ge51_p1p1_to_p3(&pre[15], &tp1p1); /* 11 11 */
+
+  sc25519_2interleave2(b,s1,s2);
+
+  /* scalar multiplication */
+  *r = pre[b[126]];
+  ge51_p3_to_p2(&tp2,r);
+  for(i=125;i>=0;i--)
+  {
+    ge51_dbl_p1p1(&tp1p1, &tp2);
+    ge51_p1p1_to_p2(&tp2, &tp1p1);
+    ge51_dbl_p1p1(&tp1p1, &tp2);
+    if(b[i]!=0)
+    {
+      ge51_p1p1_to_p3(r, &tp1p1);
+      ge51_add_p1p1(&tp1p1, r, &pre[b[i]]);
+    }
+    if(i != 0) ge51_p1p1_to_p2(&tp2, &tp1p1);
+    else ge51_p1p1_to_p3(r, &tp1p1);
+  }
+}
+
+static inline void ge51_scalarmult_base(ge51_p3 *r, const sc25519 *s)
+{
+  signed char b[85];
+  int i;
+  ge51_aff t;
+  sc25519_window3(b,s);
+
+  ge51_choose_t(&t, 0, b[0]);
+  r->x = t.x;
+  r->y = t.y;
+  fe51_setone(&r->z);
+  fe51_mul(&r->t, &r->x, &r->y);
+  for(i=1;i<85;i++)
+  {
+    ge51_choose_t(&t, (unsigned long long) i, b[i]);
+    ge51_mixadd2(r, &t);
+  }
+}
+
+/* Signed sliding window form of a scalar with odd digits in -15..15 (from ref10) */
+static void ge51_slide(signed char r[256], const unsigned char a[32])
+{
+  int i,b,k;
+  for (i = 0;i < 256;++i)
+    r[i] = 1 & (a[i >> 3] >> (i & 7));
+  for (i = 0;i < 256;++i) {
+    if (r[i]) {
+      for (b = 1;(b <= 6)&&((i + b) < 256);++b) {
+        if (r[i + b]) {
+          if ((r[i] + (r[i + b] << b)) <= 15) {
+            r[i] += r[i + b] << b;
+            r[i + b] = 0;
+          } else if ((r[i] - (r[i + b] << b)) >= -15) {
+            r[i] -= r[i + b] << b;
+            for (k = i + b;k < 256;++k) {
+              if (!r[k]) {
+                r[k] = 1;
+                break;
+              }
+              r[k] = 0;
+            }
+          } else break;
+        }
+      }
+    }
+  }
+}
+
+static inline void ge51_neg(ge51_p3 *r, const ge51_p3 *p)
+{
+  fe51_neg(&r->x, &p->x);
+  r->y = p->y;
+  r->z = p->z;
+  fe51_neg(&r->t, &p->t);
+}
+
+#define ZT_C25519_BATCH_MAX 8
+
+/*
+ * Checks that (sum z[i]*S[i])*B - sum z[i]*R[i] - sum z[i]*h[i]*A[i] is the
+ * neutral element for random 128-bit z[i], which holds if every signature
+ * is valid and fails with overwhelming probability if any is not (unless
+ * the signer itself planted a small-order component). The caller falls back
+ * to checking signatures one at a time if this fails.
+ */
+static bool ge51_verify_batch(const unsigned char *const *pk, const unsigned char *const *sig, unsigned int n)
+{
+  ge51_p3 pts[ZT_C25519_BATCH_MAX * 2];
+  sc25519 scs[ZT_C25519_BATCH_MAX * 2];
+  const unsigned char *ptpk[ZT_C25519_BATCH_MAX];
+  ge51_p3 pre[ZT_C25519_BATCH_MAX * 2][8]; /* 1,3,...,15 times each point */
+  signed char slides[ZT_C25519_BATCH_MAX * 2][256];
+  unsigned char z[ZT_C25519_BATCH_MAX][16];
+  unsigned char tmp[64];
+  unsigned char hram[crypto_hash_sha512_BYTES];
+  unsigned char m[96];
+  sc25519 sb, sct, sch, scz;
+  ge51_p3 q, t, nt;
+  ge51_p2 q2;
+  ge51_p1p1 tp1p1;
+  unsigned int np = 0, na = 0;
+  int i, j, top;
+
+  if (n > ZT_C25519_BATCH_MAX)
+    return false;
+
+  Utils::getSecureRandom(z,sizeof(z));
+  memset(tmp,0,sizeof(tmp));
+  sc25519_from32bytes(&sb,tmp); /* zero */
+
+  for(unsigned int k=0;k<n;++k) {
+    z[k][0] |= 1; /* never zero */
+    memset(tmp,0,sizeof(tmp));
+    memcpy(tmp,z[k],16);
+    sc25519_from32bytes(&scz,tmp);
+
+    /* -R with weight z, where R must be encoded exactly as single verification would re-encode it */
+    if ((sig[k][31] & 0x7f) == 0x7f) {
+      for(i=30;i>0;--i) {
+        if (sig[k][i] != 0xff)
+          break;
+      }
+      if ((i == 0)&&(sig[k][0] >= 0xed))
+        return false; /* y >= p */
+    }
+    if (ge51_unpackneg_vartime(&pts[np],sig[k]))
+      return false;
+    if (sig[k][31] & 0x80) {
+      fe51_pack(tmp,&pts[np].x);
+      for(i=0;i<32;++i) {
+        if (tmp[i])
+          break;
+      }
+      if (i == 32)
+        return false; /* x = 0 can't have its sign bit set */
+    }
+    scs[np++] = scz;
+
+    /* sum of z*S for the base point */
+    sc25519_from32bytes(&sct,sig[k] + 32);
+    sc25519_mul(&sct,&sct,&scz);
+    sc25519_add(&sb,&sb,&sct);
+
+    /* -A with weight z*h, sharing a point among signatures by the same key */
+    get_hram(hram,sig[k],pk[k],m,96);
+    sc25519_from64bytes(&sch,hram);
+    sc25519_mul(&sch,&sch,&scz);
+    for(j=0;j<(int)na;++j) {
+      if (!memcmp(ptpk[j],pk[k],32))
+        break;
+    }
+    if (j < (int)na) {
+      sc25519_add(&scs[ZT_C25519_BATCH_MAX + j],&scs[ZT_C25519_BATCH_MAX + j],&sch);
+    } else {
+      if (ge51_unpackneg_vartime(&pts[ZT_C25519_BATCH_MAX + na],pk[k]))
+        return false;
+      ptpk[na] = pk[k];
+      scs[ZT_C25519_BATCH_MAX + na++] = sch;
+    }
+  }
+
+  /* pack the A points after the R points */
+  for(unsigned int k=0;k<na;++k) {
+    pts[np + k] = pts[ZT_C25519_BATCH_MAX + k];
+    scs[np + k] = scs[ZT_C25519_BATCH_MAX + k];
+  }
+  np += na;
+  for(unsigned int k=0;k<np;++k) {
+    sc25519_to32bytes(tmp,&scs[k]);
+    ge51_slide(slides[k],tmp);
+  }
+
+  for(unsigned int k=0;k<np;++k) {
+    ge51_p3_to_p2(&q2,&pts[k]);
+    ge51_dbl_p1p1(&tp1p1,&q2);
+    ge51_p1p1_to_p3(&t,&tp1p1); /* 2P */
+    pre[k][0] = pts[k];
+    for(int w=1;w<8;++w) {
+      ge51_add_p1p1(&tp1p1,&pre[k][w-1],&t);
+      ge51_p1p1_to_p3(&pre[k][w],&tp1p1);
+    }
+  }
+
+  /* Straus' method over all the points at once, sharing the doublings */
+  top = -1;
+  for(i=255;i>=0;--i) {
+    for(unsigned int k=0;k<np;++k) {
+      if (slides[k][i]) {
+        top = i;
+        break;
+      }
+    }
+    if (top >= 0)
+      break;
+  }
+
+  ge51_setneutral(&q);
+  for(i=top;i>=0;--i) {
+    ge51_p3_to_p2(&q2,&q);
+    ge51_dbl_p1p1(&tp1p1,&q2);
+    ge51_p1p1_to_p3(&q,&tp1p1);
+    for(unsigned int k=0;k<np;++k) {
+      j = slides[k][i];
+      if (j > 0) {
+        ge51_add_p1p1(&tp1p1,&q,&pre[k][j >> 1]);
+        ge51_p1p1_to_p3(&q,&tp1p1);
+      } else if (j < 0) {
+        ge51_neg(&nt,&pre[k][(-j) >> 1]);
+        ge51_add_p1p1(&tp1p1,&q,&nt);
+        ge51_p1p1_to_p3(&q,&tp1p1);
+      }
+    }
+  }
+
+  ge51_scalarmult_base(&t,&sb);
+  ge51_add_p1p1(&tp1p1,&q,&t);
+  ge51_p1p1_to_p3(&q,&tp1p1);
+
+  /* neutral element is x = 0, y = z */
+  fe51_pack(tmp,&q.x);
+  for(i=0;i<32;++i) {
+    if (tmp[i])
+      return false;
+  }
+  return (fe51_iseq_vartime(&q.y,&q.z) != 0);
+}
+
+#endif // ZT_C25519_FE51
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+// Implementation selection, in the same manner as Salsa20 and Poly1305
+
+static const char *const C25519_KERNEL_NAMES[] = {
+  "ref",
+#ifdef ZT_C25519_FE51
+  "radix-2^51",
+#endif
+};
+#define C25519_KERNEL_COUNT ((unsigned int)(sizeof(C25519_KERNEL_NAMES) / sizeof(const char *)))
+
+static volatile unsigned int c25519_current = C25519_KERNEL_COUNT - 1;
+
+/* q = n * p on Curve25519 */
+static inline void c25519_scalarmult(unsigned char *q, const unsigned char *n, const unsigned char *p)
+{
+#ifdef ZT_C25519_FE51
+  if (c25519_current) {
+    crypto_scalarmult_fe51(q,n,p);
+    return;
+  }
+#endif
+  crypto_scalarmult(q,n,p);
+}
+
+/* r = packed s * B on Ed25519 */
+static inline void c25519_scalarmult_base_pack(unsigned char r[32], const sc25519 *s)
+{
+#ifdef ZT_C25519_FE51
+  if (c25519_current) {
+    ge51_p3 ger;
+    ge51_scalarmult_base(&ger,s);
+    ge51_pack(r,&ger);
+    return;
+  }
+#endif
+  ge25519 ger;
+  ge25519_scalarmult_base(&ger,s);
+  ge25519_pack(r,&ger);
+}
+
+/* r = packed s1 * -A + s2 * B on Ed25519, where A is unpacked from pk; returns -1 if pk is invalid */
+static inline int c25519_verify_point_pack(unsigned char r[32], const unsigned char pk[32], const sc25519 *s1, const sc25519 *s2)
+{
+#ifdef ZT_C25519_FE51
+  if (c25519_current) {
+    ge51_p3 get1, get2;
+    if (ge51_unpackneg_vartime(&get1,pk))
+      return -1;
+    ge51_double_scalarmult_vartime(&get2,&get1,s1,&ge51_base,s2);
+    ge51_pack(r,&get2);
+    return 0;
+  }
+#endif
+  ge25519 get1, get2;
+  if (ge25519_unpackneg_vartime(&get1,pk))
+    return -1;
+  ge25519_double_scalarmult_vartime(&get2,&get1,s1,&ge25519_base,s2);
+  ge25519_pack(r,&get2);
+  return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+unsigned int C25519::kernelCount()
+  throw()
+{
+  return C25519_KERNEL_COUNT;
+}
+
+const char *C25519::kernelName(unsigned int k)
+  throw()
+{
+  return ((k < C25519_KERNEL_COUNT) ? C25519_KERNEL_NAMES[k] : "(none)");
+}
+
+void C25519::setKernel(unsigned int k)
+  throw()
+{
+  c25519_current = (k < C25519_KERNEL_COUNT) ? k : (C25519_KERNEL_COUNT - 1);
+}
+
 void C25519::agree(const C25519::Private &mine,const C25519::Public &their,void *keybuf,unsigned int keylen)
   throw()
 {
 	unsigned char rawkey[32];
 	unsigned char digest[64];
 
-	crypto_scalarmult(rawkey,mine.data,their.data);
+	c25519_scalarmult(rawkey,mine.data,their.data);
 	SHA512::hash(digest,rawkey,32);
 	for(unsigned int i=0,k=0;i<keylen;) {
 		if (k == 64) {
@@ -2288,7 +3180,6 @@ void C25519::sign(const C25519::Private &myPrivate,const C25519::Public &myPubli
   throw()
 {
   sc25519 sck, scs, scsk;
-  ge25519 ger;
   unsigned char r[32];
   unsigned char s[32];
   unsigned char extsk[64];
@@ -2314,8 +3205,7 @@ void C25519::sign(const C25519::Private &myPrivate,const C25519::Public &myPubli
 
   /* Computation of R */
   sc25519_from64bytes(&sck, hmg);
-  ge25519_scalarmult_base(&ger, &sck);
-  ge25519_pack(r, &ger);
+  c25519_scalarmult_base_pack(r, &sck);
   
   /* Computation of s */
   for(unsigned int i=0;i<32;i++)
@@ -2338,7 +3228,6 @@ bool C25519::verify(const C25519::Public &their,const void *msg,unsigned int len
   throw()
 {
   unsigned char t2[32];
-  ge25519 get1, get2;
   sc25519 schram, scs;
   unsigned char hram[crypto_hash_sha512_BYTES];
   unsigned char m[96];
@@ -2350,27 +3239,70 @@ bool C25519::verify(const C25519::Public &their,const void *msg,unsigned int len
   if (!Utils::secureEq(sig + 64,digest,32))
     return false;
 
-  if (ge25519_unpackneg_vartime(&get1,their.data + 32))
-    return false;
-
   get_hram(hram,sig,their.data + 32,m,96);
 
   sc25519_from64bytes(&schram, hram);
 
   sc25519_from32bytes(&scs, sig+32);
 
-  ge25519_double_scalarmult_vartime(&get2, &get1, &schram, &ge25519_base, &scs);
-  ge25519_pack(t2, &get2);
+  if (c25519_verify_point_pack(t2,their.data + 32,&schram,&scs))
+    return false;
 
   return Utils::secureEq(sig,t2,32);
 }
 
+bool C25519::verifyBatch(const C25519::Public *const *their,const void *const *msg,const unsigned int *len,const void *const *signature,unsigned int n,bool *ok)
+  throw()
+{
+  bool all = true;
+  unsigned int i = 0;
+  while (i < n) {
+#ifdef ZT_C25519_FE51
+    if ((c25519_current)&&((n - i) >= 2)) {
+      const unsigned char *pk[ZT_C25519_BATCH_MAX];
+      const unsigned char *sig[ZT_C25519_BATCH_MAX];
+      unsigned char digest[64];
+      unsigned int cnt = 0;
+      while ((i + cnt < n)&&(cnt < ZT_C25519_BATCH_MAX)) {
+        pk[cnt] = their[i + cnt]->data + 32;
+        sig[cnt] = (const unsigned char *)signature[i + cnt];
+        ++cnt;
+      }
+
+      // The message digest check is cheap, so anything failing it goes the slow way
+      bool digestsOk = true;
+      for(unsigned int k=0;k<cnt;++k) {
+        SHA512::hash(digest,msg[i + k],len[i + k]);
+        if (!Utils::secureEq(sig[k] + 64,digest,32)) {
+          digestsOk = false;
+          break;
+        }
+      }
+
+      if ((digestsOk)&&(ge51_verify_batch(pk,sig,cnt))) {
+        for(unsigned int k=0;k<cnt;++k)
+          ok[i + k] = true;
+      } else {
+        // At least one is bad, so find out which
+        for(unsigned int k=0;k<cnt;++k)
+          all &= (ok[i + k] = verify(*their[i + k],msg[i + k],len[i + k],signature[i + k]));
+      }
+      i += cnt;
+      continue;
+    }
+#endif
+    all &= (ok[i] = verify(*their[i],msg[i],len[i],signature[i]));
+    ++i;
+  }
+  return all;
+}
+
 void C25519::_calcPubDH(C25519::Pair &kp)
   throw()
 {
   // First 32 bytes of pub and priv are the keys for ECDH key
   // agreement. This generates the public portion from the private.
-  crypto_scalarmult_base(kp.pub.data,kp.priv.data);
+  c25519_scalarmult(kp.pub.data,kp.priv.data,base);
 }
 
 void C25519::_calcPubED(C25519::Pair &kp)
@@ -2378,7 +3310,6 @@ void C25519::_calcPubED(C25519::Pair &kp)
 {
   unsigned char extsk[64];
   sc25519 scsk;
-  ge25519 gepk;
 
   // Second 32 bytes of pub and priv are the keys for ed25519
   // signing and verification.
@@ -2387,8 +3318,7 @@ void C25519::_calcPubED(C25519::Pair &kp)
   extsk[31] &= 127;
   extsk[31] |= 64;
   sc25519_from32bytes(&scsk,extsk);
-  ge25519_scalarmult_base(&gepk,&scsk);
-  ge25519_pack(kp.pub.data + 32,&gepk);
+  c25519_scalarmult_base_pack(kp.pub.data + 32,&scsk);
   // In NaCl, the public key is crammed into the next 32 bytes
   // of the private key for signing since both keys are required
   // to sign. In this version we just get it from kp.pub, so we
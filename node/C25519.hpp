@@ -196,6 +196,50 @@ public:
 		return verify(their,msg,len,signature.data);
 	}
 
+	/**
+	 * Verify several signatures at once
+	 *
+	 * This gives the same results as calling verify() for each signature, but
+	 * valid signatures are checked together as one multi-scalar equation with
+	 * random weights, which is much cheaper than checking them one by one. If
+	 * a group doesn't check out its signatures are verified individually.
+	 *
+	 * @param their Public keys of signers
+	 * @param msg Signed messages
+	 * @param len Length of each message in bytes
+	 * @param signature Signatures (ZT_C25519_SIGNATURE_LEN bytes each)
+	 * @param n Number of signatures
+	 * @param ok Set to the result for each signature
+	 * @return True if all signatures are valid
+	 */
+	static bool verifyBatch(const Public *const *their,const void *const *msg,const unsigned int *len,const void *const *signature,unsigned int n,bool *ok)
+		throw();
+
+	/**
+	 * @return Number of implementations available on this platform (at least 1)
+	 */
+	static unsigned int kernelCount()
+		throw();
+
+	/**
+	 * @param k Implementation index from 0 to kernelCount()-1
+	 * @return Human-readable implementation name
+	 */
+	static const char *kernelName(unsigned int k)
+		throw();
+
+	/**
+	 * Select implementation
+	 *
+	 * Implementation 0 is the portable reference code. On 64-bit x86 and ARM
+	 * there is also a faster one using 64-bit limbs, which is the default.
+	 * All give identical results. This is for testing and benchmarking.
+	 *
+	 * @param k Implementation index (values past the end select the default)
+	 */
+	static void setKernel(unsigned int k)
+		throw();
+
 private:
 	// derive first 32 bytes of kp.pub from first 32 bytes of kp.priv
 	// this is the ECDH key
@@ -227,4 +227,41 @@ bool CertificateOfMembership::verify(const Identity &id) const
 	return valid;
 }
 
+void CertificateOfMembership::verifyBatch(const CertificateOfMembership *const *coms,const Identity *const *ids,unsigned int n,bool *ok)
+{
+	uint64_t buf[16][ZT_NETWORK_COM_MAX_QUALIFIERS * 3];
+	const C25519::Public *keys[16];
+	const void *msgs[16];
+	unsigned int lens[16];
+	const void *sigs[16];
+	unsigned int idx[16];
+
+	for(unsigned int i=0;i<n;) {
+		unsigned int cnt = 0;
+		while ((i < n)&&(cnt < 16)) {
+			const CertificateOfMembership &com = *coms[i];
+			if ((!com._signedBy)||(ids[i]->address() != com._signedBy)) {
+				ok[i++] = false;
+				continue;
+			}
+			unsigned int ptr = 0;
+			for(unsigned int q=0;q<com._qualifierCount;++q) {
+				buf[cnt][ptr++] = Utils::hton(com._qualifiers[q].id);
+				buf[cnt][ptr++] = Utils::hton(com._qualifiers[q].value);
+				buf[cnt][ptr++] = Utils::hton(com._qualifiers[q].maxDelta);
+			}
+			keys[cnt] = &(ids[i]->publicKey());
+			msgs[cnt] = buf[cnt];
+			lens[cnt] = ptr * sizeof(uint64_t);
+			sigs[cnt] = com._signature.data;
+			idx[cnt++] = i++;
+		}
+
+		bool results[16];
+		C25519::verifyBatch(keys,msgs,lens,sigs,cnt,results);
+		for(unsigned int k=0;k<cnt;++k)
+			ok[idx[k]] = results[k];
+	}
+}
+
 } // namespace ZeroTier
@@ -328,6 +328,19 @@ public:
 	 */
 	bool verify(const Identity &id) const;
 
+	/**
+	 * Verify several certificates at once
+	 *
+	 * This gives the same results as calling verify() on each, but checks
+	 * signatures in batches, which is faster when there are several.
+	 *
+	 * @param coms Certificates to verify
+	 * @param ids Identity to verify each certificate against
+	 * @param n Number of certificates
+	 * @param ok Set to the result for each certificate
+	 */
+	static void verifyBatch(const CertificateOfMembership *const *coms,const Identity *const *ids,unsigned int n,bool *ok);
+
 	/**
 	 * @return True if signed
 	 */
@@ -164,16 +164,100 @@
 /**
  * Size of RX queue
  *
- * This is about 2mb, and can be decreased for small devices. A queue smaller
- * than about 4 is probably going to cause a lot of lost packets.
+ * This is split evenly across ZT_RX_QUEUE_SHARDS shards. Entries point to
+ * packet pool buffers, so memory is only used by packets actually waiting.
+ * Shards of fewer than about 4 entries are probably going to cause a lot of
+ * lost packets.
  */
-#define ZT_RX_QUEUE_SIZE 64
+#ifndef ZT_RX_QUEUE_SIZE
+#define ZT_RX_QUEUE_SIZE 128
+#endif
+
+/**
+ * Number of separately locked RX queue shards (must be a power of two)
+ *
+ * Entries are placed by packet ID, so threads reassembling different packets
+ * rarely wait on each other and lookups only scan one small shard.
+ */
+#ifndef ZT_RX_QUEUE_SHARDS
+#define ZT_RX_QUEUE_SHARDS 16
+#endif
+
+/**
+ * Entries per RX queue shard
+ */
+#define ZT_RX_QUEUE_SHARD_SIZE (ZT_RX_QUEUE_SIZE / ZT_RX_QUEUE_SHARDS)
 
 /**
  * RX queue entries older than this do not "exist"
  */
 #define ZT_RX_QUEUE_EXPIRE 4000
 
+/**
+ * Default number of background threads for deferred (expensive) packets
+ *
+ * The service starts this many threads unless told otherwise.
+ */
+#ifndef ZT_DEFERRED_PACKETS_WORKERS
+#define ZT_DEFERRED_PACKETS_WORKERS 2
+#endif
+
+/**
+ * Maximum number of deferred packet queues
+ *
+ * Each background thread gets its own queue up to this many. Threads past
+ * this share queues.
+ */
+#ifndef ZT_DEFERRED_PACKETS_MAX_QUEUES
+#define ZT_DEFERRED_PACKETS_MAX_QUEUES 16
+#endif
+
+/**
+ * Size of each deferred packet queue (must be a power of two)
+ *
+ * Queue slots only hold pointers. The packets themselves come from the
+ * packet pool.
+ */
+#ifndef ZT_DEFERRED_PACKETS_QUEUE_SIZE
+#define ZT_DEFERRED_PACKETS_QUEUE_SIZE 128
+#endif
+
+/**
+ * Maximum number of idle receive buffers kept for reuse
+ *
+ * Each is a full IncomingPacket of about 6kb. Buffers released when the
+ * pool is already full are freed.
+ */
+#ifndef ZT_PACKET_POOL_SIZE
+#define ZT_PACKET_POOL_SIZE 512
+#endif
+
+/**
+ * Number of separately locked packet pool shards (must be a power of two)
+ */
+#ifndef ZT_PACKET_POOL_SHARDS
+#define ZT_PACKET_POOL_SHARDS 8
+#endif
+
+/**
+ * Free blocks of each size class a thread keeps for itself in SizeClassPool
+ *
+ * Blocks move between a thread and the shared free list half this many at
+ * a time.
+ */
+#ifndef ZT_SIZE_CLASS_POOL_THREAD_CACHE
+#define ZT_SIZE_CLASS_POOL_THREAD_CACHE 16
+#endif
+
+/**
+ * Maximum bytes of free blocks SizeClassPool keeps per size class
+ *
+ * Blocks freed past this go back to the system.
+ */
+#ifndef ZT_SIZE_CLASS_POOL_MAX_IDLE_BYTES
+#define ZT_SIZE_CLASS_POOL_MAX_IDLE_BYTES 4194304
+#endif
+
 /**
  * Length of secret key in bytes -- 256-bit -- do not change
  */
@@ -194,6 +278,37 @@
  */
 #define ZT_PEER_IN_MEMORY_EXPIRATION 600000
 
+/**
+ * How often a peer that keeps talking to us is re-persisted even if it has learned no new paths
+ */
+#define ZT_PEER_PERSIST_INTERVAL 3600000
+
+/**
+ * Persisted peer records older than this are deleted instead of loaded (30 days)
+ */
+#define ZT_PEER_STORE_EXPIRATION 2592000000ULL
+
+/**
+ * Maximum number of validated identities and agreed keys to remember
+ *
+ * These are kept for peers that have fallen out of memory (or were loaded
+ * from the peer cache at startup) so they can be brought back without repeating
+ * identity validation and key agreement. Each entry is about 200 bytes.
+ */
+#ifndef ZT_IDENTITY_CACHE_SIZE
+#define ZT_IDENTITY_CACHE_SIZE 16384
+#endif
+
+/**
+ * Maximum number of recently verified certificates of membership to remember
+ *
+ * Peers resend the same COM periodically. If it's identical to one whose
+ * signature we checked recently, it's accepted after a hash comparison.
+ */
+#ifndef ZT_VERIFIED_COM_CACHE_SIZE
+#define ZT_VERIFIED_COM_CACHE_SIZE 8192
+#endif
+
 /**
  * Delay between WHOIS retries in ms
  */
@@ -209,6 +324,16 @@
  */
 #define ZT_TRANSMIT_QUEUE_TIMEOUT (ZT_WHOIS_RETRY_DELAY * (ZT_MAX_WHOIS_RETRIES + 1))
 
+/**
+ * Maximum packets queued for one destination while waiting to send
+ *
+ * If more are sent before the destination is reachable the oldest are
+ * dropped.
+ */
+#ifndef ZT_TRANSMIT_QUEUE_PER_DESTINATION
+#define ZT_TRANSMIT_QUEUE_PER_DESTINATION 32
+#endif
+
 /**
  * Receive queue entry timeout
  */
@@ -243,6 +368,20 @@
  */
 #define ZT_MULTICAST_DEFAULT_LIMIT 32
 
+/**
+ * Number of separately locked shards of the multicast group table (must be a power of two)
+ */
+#ifndef ZT_MULTICASTER_SHARDS
+#define ZT_MULTICASTER_SHARDS 16
+#endif
+
+/**
+ * How often Multicaster::clean() is called, cleaning one shard each time
+ *
+ * This sweeps the whole table about once per housekeeping period.
+ */
+#define ZT_MULTICASTER_CLEAN_PERIOD (ZT_HOUSEKEEPING_PERIOD / ZT_MULTICASTER_SHARDS)
+
 /**
  * How frequently to send a zero-byte UDP keepalive packet
  *
@@ -21,80 +21,184 @@
 #include "IncomingPacket.hpp"
 #include "RuntimeEnvironment.hpp"
 #include "Node.hpp"
+#include "PacketPool.hpp"
 
 namespace ZeroTier {
 
+static inline bool _casUL(volatile unsigned long *p,unsigned long o,unsigned long n)
+{
+#ifdef __WINDOWS__
+	return (InterlockedCompareExchange((volatile LONG *)p,(LONG)n,(LONG)o) == (LONG)o);
+#else
+	return __sync_bool_compare_and_swap(p,o,n);
+#endif
+}
+
+static inline void _fence()
+{
+#ifdef __WINDOWS__
+	MemoryBarrier();
+#else
+	__sync_synchronize();
+#endif
+}
+
+DeferredPackets::_Queue::_Queue() :
+	_enqueuePos(0),
+	_dequeuePos(0)
+{
+	for(unsigned long i=0;i<ZT_DEFERRED_PACKETS_QUEUE_SIZE;++i)
+		_slots[i].seq = i;
+}
+
+bool DeferredPackets::_Queue::push(IncomingPacket *pkt)
+{
+	_Slot *s;
+	unsigned long pos = _enqueuePos;
+	for(;;) {
+		s = &(_slots[pos & (ZT_DEFERRED_PACKETS_QUEUE_SIZE - 1)]);
+		const long dif = (long)(s->seq - pos);
+		if (dif == 0) {
+			if (_casUL(&_enqueuePos,pos,pos + 1))
+				break;
+		} else if (dif < 0) {
+			return false; // full
+		}
+		pos = _enqueuePos;
+	}
+
+	_fence();
+	s->pkt = pkt;
+	_fence(); // packet must be complete before it can be taken
+	s->seq = pos + 1;
+	return true;
+}
+
+IncomingPacket *DeferredPackets::_Queue::pop()
+{
+	_Slot *s;
+	unsigned long pos = _dequeuePos;
+	for(;;) {
+		s = &(_slots[pos & (ZT_DEFERRED_PACKETS_QUEUE_SIZE - 1)]);
+		const long dif = (long)(s->seq - (pos + 1));
+		if (dif == 0) {
+			if (_casUL(&_dequeuePos,pos,pos + 1))
+				break;
+		} else if (dif < 0) {
+			return (IncomingPacket *)0; // empty
+		}
+		pos = _dequeuePos;
+	}
+
+	_fence();
+	IncomingPacket *const pkt = s->pkt;
+	_fence();
+	s->seq = pos + ZT_DEFERRED_PACKETS_QUEUE_SIZE;
+	return pkt;
+}
+
 DeferredPackets::DeferredPackets(const RuntimeEnvironment *renv) :
+	_q(new _Queue[ZT_DEFERRED_PACKETS_MAX_QUEUES]),
 	RR(renv),
-	_waiting(0),
 	_die(false)
 {
 }
 
 DeferredPackets::~DeferredPackets()
 {
-	_q_m.lock();
 	_die = true;
-	_q_m.unlock();
+	_fence();
 
-	for(;;) {
-		_q_s.post();
+	// Wait until every registered worker has returned -1 from process()
+	while ((int)_running > 0) {
+		for(unsigned int i=0;i<ZT_DEFERRED_PACKETS_MAX_QUEUES;++i)
+			_q[i].wake.post();
+	}
 
-		_q_m.lock();
-		if (_waiting <= 0) {
-			_q_m.unlock();
-			break;
-		} else {
-			_q_m.unlock();
-		}
+	for(unsigned int i=0;i<ZT_DEFERRED_PACKETS_MAX_QUEUES;++i) {
+		IncomingPacket *pkt;
+		while ((pkt = _q[i].pop()))
+			RR->pool->put(pkt);
 	}
+
+	delete [] _q;
+}
+
+unsigned int DeferredPackets::newWorker()
+{
+	++_running;
+	return (unsigned int)((++_workerCount) - 1) % ZT_DEFERRED_PACKETS_MAX_QUEUES;
 }
 
 bool DeferredPackets::enqueue(IncomingPacket *pkt)
 {
-	{
-		Mutex::Lock _l(_q_m);
-		if (_q.size() >= ZT_DEFFEREDPACKETS_MAX)
+	// Spread sources over queues in use, spilling over if one is full
+	const unsigned int nq = _queues();
+	const unsigned int home = (unsigned int)(pkt->source().toInt() % nq);
+	unsigned int q = home;
+	while (!_q[q].push(pkt)) {
+		q = (q + 1) % nq;
+		if (q == home) {
+			++_dropped;
 			return false;
-		_q.push_back(*pkt);
+		}
+	}
+
+	// Wake a waiting thread only if there is one, preferring this queue's own
+	for(unsigned int k=0;k<nq;++k) {
+		_Queue &wq = _q[(q + k) % nq];
+		if ((int)wq.waiting > 0) {
+			wq.wake.post();
+			break;
+		}
 	}
-	_q_s.post();
+
 	return true;
 }
 
-int DeferredPackets::process()
+int DeferredPackets::process(unsigned int worker)
 {
-	std::list<IncomingPacket> pkt;
-
-	_q_m.lock();
-
-	if (_die) {
-		_q_m.unlock();
-		return -1;
-	}
+	worker %= ZT_DEFERRED_PACKETS_MAX_QUEUES;
 
-	while (_q.empty()) {
-		++_waiting;
-		_q_m.unlock();
-		_q_s.wait();
-		_q_m.lock();
-		--_waiting;
+	for(;;) {
 		if (_die) {
-			_q_m.unlock();
+			--_running; // must be the last thing done with this object
 			return -1;
 		}
-	}
 
-	// Move item from _q list to a dummy list here to avoid copying packet
-	pkt.splice(pkt.end(),_q,_q.begin());
-
-	_q_m.unlock();
-
-	try {
-		pkt.front().tryDecode(RR,true);
-	} catch ( ... ) {} // drop invalids
+		// Drain our own queue, then help with any others
+		const unsigned int nq = _queues();
+		int n = 0;
+		for(unsigned int k=0;k<nq;++k) {
+			_Queue &q = _q[(worker + k) % nq];
+			IncomingPacket *pkt;
+			while ((pkt = q.pop())) {
+				try {
+					pkt->tryDecode(RR,true);
+				} catch ( ... ) {} // drop invalids
+				RR->pool->put(pkt);
+				++n;
+			}
+		}
+		if (n > 0)
+			return n;
+
+		// Announce we're waiting, then check once more so a packet enqueued
+		// just before the announcement isn't missed.
+		_Queue &mq = _q[worker];
+		++mq.waiting;
+		if ((!_die)&&(!queued()))
+			mq.wake.wait();
+		--mq.waiting;
+	}
+}
 
-	return 1;
+unsigned long DeferredPackets::queued() const
+{
+	unsigned long n = 0;
+	for(unsigned int i=0;i<ZT_DEFERRED_PACKETS_MAX_QUEUES;++i)
+		n += _q[i].size();
+	return n;
 }
 
 } // namespace ZeroTier
@@ -19,34 +19,33 @@
 #ifndef ZT_DEFERREDPACKETS_HPP
 #define ZT_DEFERREDPACKETS_HPP
 
-#include <list>
-
 #include "Constants.hpp"
-#include "SharedPtr.hpp"
-#include "Mutex.hpp"
-#include "DeferredPackets.hpp"
+#include "IncomingPacket.hpp"
+#include "AtomicCounter.hpp"
 #include "BinarySemaphore.hpp"
-
-/**
- * Maximum number of deferred packets
- */
-#define ZT_DEFFEREDPACKETS_MAX 256
+#include "NonCopyable.hpp"
 
 namespace ZeroTier {
 
-class IncomingPacket;
 class RuntimeEnvironment;
 
 /**
  * Deferred packets
  *
- * IncomingPacket can defer its decoding this way by enqueueing itself here.
- * When this is done, deferredDecode() is called later. This is done for
- * operations that may be expensive to allow them to potentially be handled
- * in the background or rate limited to maintain quality of service for more
- * routine operations.
+ * IncomingPacket can ask for its decoding to be deferred, in which case
+ * Switch enqueues it here and tryDecode() is called again later. This is
+ * done for operations that may be expensive to allow them to potentially be
+ * handled in the background or rate limited to maintain quality of service
+ * for more routine operations.
+ *
+ * There is one fixed-size queue per worker thread, up to a maximum, so the
+ * number of workers is whatever the host starts. Packets are spread across
+ * queues by source address, spilling over to other queues if one is full.
+ * Idle workers also take from other queues, so packets are not necessarily
+ * decoded in the order they arrived, even from the same peer. Queues are
+ * lock-free rings that any number of threads can add to or take from.
  */
-class DeferredPackets
+class DeferredPackets : NonCopyable
 {
 public:
 	DeferredPackets(const RuntimeEnvironment *renv);
@@ -55,29 +54,87 @@ public:
 	/**
 	 * Enqueue a packet
 	 *
-	 * @param pkt Packet to process later (possibly in the background)
-	 * @return False if queue is full
+	 * If this succeeds the queue owns the packet and returns it to the
+	 * packet pool once it has been decoded.
+	 *
+	 * @param pkt Packet from the packet pool to process later (possibly in the background)
+	 * @return False if queue is full (caller still owns packet)
 	 */
 	bool enqueue(IncomingPacket *pkt);
 
 	/**
-	 * Wait for and then process a deferred packet
+	 * Register a new background thread and get its worker number
+	 *
+	 * The thread counts as running until process() returns -1, and the
+	 * destructor waits for every registered thread to get there.
+	 *
+	 * @return Worker number to pass to process()
+	 */
+	unsigned int newWorker();
+
+	/**
+	 * Wait for and then process deferred packets
 	 *
-	 * If we are shutting down (in destructor), this returns -1 and should
-	 * not be called again. Otherwise it returns the number of packets
-	 * processed.
+	 * Packets in this worker's own queue are processed first, then those in
+	 * other queues. If we are shutting down (in destructor), this returns -1
+	 * and neither this object nor anything it refers to may be touched by the
+	 * caller again. Otherwise it returns the number of packets processed.
 	 *
+	 * @param worker Worker number from newWorker()
 	 * @return Number processed or -1 if shutting down
 	 */
-	int process();
+	int process(unsigned int worker);
+
+	/**
+	 * @return Number of packets currently waiting in all queues
+	 */
+	unsigned long queued() const;
+
+	/**
+	 * @return Number of packets dropped because all queues were full
+	 */
+	inline unsigned long dropped() const throw() { return (unsigned long)((int)_dropped); }
 
 private:
-	std::list<IncomingPacket> _q;
+	// Bounded MPMC ring after Dmitry Vyukov's design: each slot's sequence
+	// number says whether it is ready to be written or read at a position.
+	class _Queue : NonCopyable
+	{
+	public:
+		_Queue();
+		bool push(IncomingPacket *pkt);
+		IncomingPacket *pop(); // NULL if empty
+		inline unsigned long size() const throw() { const unsigned long e = _enqueuePos,d = _dequeuePos; return ((e > d) ? (e - d) : 0); }
+
+		AtomicCounter waiting; // threads waiting on wake
+		BinarySemaphore wake;
+
+	private:
+		struct _Slot
+		{
+			volatile unsigned long seq;
+			IncomingPacket *pkt;
+		};
+		_Slot _slots[ZT_DEFERRED_PACKETS_QUEUE_SIZE];
+		char _pad0[64];
+		volatile unsigned long _enqueuePos;
+		char _pad1[64];
+		volatile unsigned long _dequeuePos;
+	};
+
+	// Number of queues in use: one per registered worker, at least one
+	inline unsigned int _queues() const throw()
+	{
+		const int w = (int)_workerCount;
+		return ((w <= 1) ? 1 : ((w > ZT_DEFERRED_PACKETS_MAX_QUEUES) ? ZT_DEFERRED_PACKETS_MAX_QUEUES : (unsigned int)w));
+	}
+
+	_Queue *const _q;
 	const RuntimeEnvironment *const RR;
- 	volatile int _waiting;
+	AtomicCounter _workerCount;
+	AtomicCounter _running; // registered workers that have not yet seen shutdown
+	AtomicCounter _dropped;
 	volatile bool _die;
-	Mutex _q_m;
-	BinarySemaphore _q_s;
 };
 
 } // namespace ZeroTier
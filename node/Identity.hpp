@@ -215,6 +215,11 @@ public:
 	 */
 	inline const Address &address() const throw() { return _address; }
 
+	/**
+	 * @return This identity's public key
+	 */
+	inline const C25519::Public &publicKey() const throw() { return _publicKey; }
+
 	/**
 	 * Serialize this identity (binary)
 	 *
@@ -36,7 +36,6 @@
 #include "World.hpp"
 #include "Cluster.hpp"
 #include "Node.hpp"
-#include "DeferredPackets.hpp"
 
 namespace ZeroTier {
 
@@ -63,8 +62,8 @@ bool IncomingPacket::tryDecode(const RuntimeEnvironment *RR,bool deferred)
 			// Unencrypted HELLOs require some potentially expensive verification, so
 			// do this in the background if background processing is enabled.
 			if ((RR->dpEnabled > 0)&&(!deferred)) {
-				RR->dp->enqueue(this);
-				return true; // 'handled' via deferring to background thread(s)
+				_wantsDeferral = true;
+				return true; // 'handled' via deferring to background thread(s), which our caller does
 			} else {
 				// A null pointer for peer to _doHELLO() tells it to run its own
 				// special internal authentication logic. This is done for unencrypted
@@ -76,8 +75,8 @@ bool IncomingPacket::tryDecode(const RuntimeEnvironment *RR,bool deferred)
 
 		SharedPtr<Peer> peer(RR->topology->getPeer(sourceAddress));
 		if (peer) {
-			if (!trusted) {
-				if (!dearmor(peer->key())) {
+			if ((!trusted)&&(!_authenticated)) {
+				if (!dearmor(peer->armorKey())) {
 					TRACE("dropped packet from %s(%s), MAC authentication failed (size: %u)",sourceAddress.toString().c_str(),_remoteAddress.toString().c_str(),size());
 					return true;
 				}
@@ -127,6 +126,39 @@ bool IncomingPacket::tryDecode(const RuntimeEnvironment *RR,bool deferred)
 	}
 }
 
+void IncomingPacket::authenticateBatch(IncomingPacket *const *packets,unsigned int n,const Packet::ArmorKey &key)
+{
+	Packet *batch[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	IncomingPacket *ip[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	const Packet::ArmorKey *keys[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	bool ok[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	unsigned int cnt = 0;
+
+	for(unsigned int i=0;i<n;++i) {
+		IncomingPacket *const p = packets[i];
+		if (p->_authenticated)
+			continue;
+		const unsigned int c = p->cipher();
+		if ( (c == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012) || ((c == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE)&&(p->verb() != Packet::VERB_HELLO)) ) {
+			batch[cnt] = p;
+			ip[cnt] = p;
+			keys[cnt] = &key;
+			if (++cnt == ZT_PACKET_CRYPTO_BATCH_SIZE) {
+				Packet::dearmorBatch(batch,keys,cnt,ok);
+				for(unsigned int j=0;j<cnt;++j)
+					ip[j]->_authenticated = ok[j];
+				cnt = 0;
+			}
+		}
+	}
+
+	if (cnt) {
+		Packet::dearmorBatch(batch,keys,cnt,ok);
+		for(unsigned int j=0;j<cnt;++j)
+			ip[j]->_authenticated = ok[j];
+	}
+}
+
 bool IncomingPacket::_doERROR(const RuntimeEnvironment *RR,const SharedPtr<Peer> &peer)
 {
 	try {
@@ -167,7 +199,7 @@ bool IncomingPacket::_doERROR(const RuntimeEnvironment *RR,const SharedPtr<Peer>
 				if ((network)&&(network->hasConfig())&&(network->config().com)) {
 					Packet outp(peer->address(),RR->identity.address(),Packet::VERB_NETWORK_MEMBERSHIP_CERTIFICATE);
 					network->config().com.serialize(outp);
-					outp.armor(peer->key(),true);
+					outp.armor(peer->armorKey(),true);
 					RR->node->putPacket(_localAddress,_remoteAddress,outp.data(),outp.size());
 				}
 			}	break;
@@ -265,7 +297,7 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,SharedPtr<Peer> &peer
 				} else {
 					// Identity is the same as the one we already have -- check packet integrity
 
-					if (!dearmor(peer->key())) {
+					if (!dearmor(peer->armorKey())) {
 						TRACE("rejected HELLO from %s(%s): packet failed authentication",id.address().toString().c_str(),_remoteAddress.toString().c_str());
 						return true;
 					}
@@ -283,7 +315,7 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,SharedPtr<Peer> &peer
 
 				// Check packet integrity and authentication
 				SharedPtr<Peer> newPeer(new Peer(RR,RR->identity,id));
-				if (!dearmor(newPeer->key())) {
+				if (!dearmor(newPeer->armorKey())) {
 					TRACE("rejected HELLO from %s(%s): packet failed authentication",id.address().toString().c_str(),_remoteAddress.toString().c_str());
 					return true;
 				}
@@ -347,7 +379,7 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,SharedPtr<Peer> &peer
 			outp.append((uint16_t)0); // no world update needed
 		}
 
-		outp.armor(peer->key(),true);
+		outp.armor(peer->armorKey(),true);
 		RR->node->putPacket(_localAddress,_remoteAddress,outp.data(),outp.size());
 
 		peer->setRemoteVersion(protoVersion,vMajor,vMinor,vRevision); // important for this to go first so received() knows the version
@@ -487,7 +519,7 @@ bool IncomingPacket::_doWHOIS(const RuntimeEnvironment *RR,const SharedPtr<Peer>
 				outp.append((unsigned char)Packet::VERB_WHOIS);
 				outp.append(packetId());
 				queried.serialize(outp,false);
-				outp.armor(peer->key(),true);
+				outp.armor(peer->armorKey(),true);
 				RR->node->putPacket(_localAddress,_remoteAddress,outp.data(),outp.size());
 			} else {
 #ifdef ZT_ENABLE_CLUSTER
@@ -649,7 +681,7 @@ bool IncomingPacket::_doECHO(const RuntimeEnvironment *RR,const SharedPtr<Peer>
 		outp.append((uint64_t)pid);
 		if (size() > ZT_PACKET_IDX_PAYLOAD)
 			outp.append(reinterpret_cast<const unsigned char *>(data()) + ZT_PACKET_IDX_PAYLOAD,size() - ZT_PACKET_IDX_PAYLOAD);
-		outp.armor(peer->key(),true);
+		outp.armor(peer->armorKey(),true);
 		RR->node->putPacket(_localAddress,_remoteAddress,outp.data(),outp.size());
 		peer->received(_localAddress,_remoteAddress,hops(),pid,Packet::VERB_ECHO,0,Packet::VERB_NOP);
 	} catch ( ... ) {
@@ -680,12 +712,15 @@ bool IncomingPacket::_doMULTICAST_LIKE(const RuntimeEnvironment *RR,const Shared
 bool IncomingPacket::_doNETWORK_MEMBERSHIP_CERTIFICATE(const RuntimeEnvironment *RR,const SharedPtr<Peer> &peer)
 {
 	try {
-		CertificateOfMembership com;
+		CertificateOfMembership coms[16];
 
+		// These often come in bunches, so check their signatures in batches
 		unsigned int ptr = ZT_PACKET_IDX_PAYLOAD;
 		while (ptr < size()) {
-			ptr += com.deserialize(*this,ptr);
-			peer->validateAndSetNetworkMembershipCertificate(com.networkId(),com);
+			unsigned int n = 0;
+			while ((ptr < size())&&(n < 16))
+				ptr += coms[n++].deserialize(*this,ptr);
+			peer->validateAndSetNetworkMembershipCertificates(coms,n);
 		}
 
 		peer->received(_localAddress,_remoteAddress,hops(),packetId(),Packet::VERB_NETWORK_MEMBERSHIP_CERTIFICATE,0,Packet::VERB_NOP);
@@ -735,7 +770,7 @@ bool IncomingPacket::_doNETWORK_CONFIG_REQUEST(const RuntimeEnvironment *RR,cons
 					outp.append(pid);
 					outp.append((unsigned char)Packet::ERROR_OBJ_NOT_FOUND);
 					outp.append(nwid);
-					outp.armor(peer->key(),true);
+					outp.armor(peer->armorKey(),true);
 					RR->node->putPacket(_localAddress,_remoteAddress,outp.data(),outp.size());
 				}	break;
 
@@ -745,7 +780,7 @@ bool IncomingPacket::_doNETWORK_CONFIG_REQUEST(const RuntimeEnvironment *RR,cons
 					outp.append(pid);
 					outp.append((unsigned char)Packet::ERROR_NETWORK_ACCESS_DENIED_);
 					outp.append(nwid);
-					outp.armor(peer->key(),true);
+					outp.armor(peer->armorKey(),true);
 					RR->node->putPacket(_localAddress,_remoteAddress,outp.data(),outp.size());
 				} break;
 
@@ -767,7 +802,7 @@ bool IncomingPacket::_doNETWORK_CONFIG_REQUEST(const RuntimeEnvironment *RR,cons
 			outp.append(pid);
 			outp.append((unsigned char)Packet::ERROR_UNSUPPORTED_OPERATION);
 			outp.append(nwid);
-			outp.armor(peer->key(),true);
+			outp.armor(peer->armorKey(),true);
 			RR->node->putPacket(_localAddress,_remoteAddress,outp.data(),outp.size());
 		}
 	} catch ( ... ) {
@@ -812,7 +847,7 @@ bool IncomingPacket::_doMULTICAST_GATHER(const RuntimeEnvironment *RR,const Shar
 			outp.append((uint32_t)mg.adi());
 			const unsigned int gatheredLocally = RR->mc->gather(peer->address(),nwid,mg,outp,gatherLimit);
 			if (gatheredLocally) {
-				outp.armor(peer->key(),true);
+				outp.armor(peer->armorKey(),true);
 				RR->node->putPacket(_localAddress,_remoteAddress,outp.data(),outp.size());
 			}
 
@@ -905,7 +940,7 @@ bool IncomingPacket::_doMULTICAST_FRAME(const RuntimeEnvironment *RR,const Share
 				outp.append((uint32_t)to.adi());
 				outp.append((unsigned char)0x02); // flag 0x02 = contains gather results
 				if (RR->mc->gather(peer->address(),nwid,to,outp,gatherLimit)) {
-					outp.armor(peer->key(),true);
+					outp.armor(peer->armorKey(),true);
 					RR->node->putPacket(_localAddress,_remoteAddress,outp.data(),outp.size());
 				}
 			}
@@ -1244,14 +1279,14 @@ bool IncomingPacket::_doREQUEST_PROOF_OF_WORK(const RuntimeEnvironment *RR,const
 						outp.append(pid);
 						outp.append((uint16_t)sizeof(result));
 						outp.append(result,sizeof(result));
-						outp.armor(peer->key(),true);
+						outp.armor(peer->armorKey(),true);
 						RR->node->putPacket(_localAddress,_remoteAddress,outp.data(),outp.size());
 					} else {
 						Packet outp(peer->address(),RR->identity.address(),Packet::VERB_ERROR);
 						outp.append((unsigned char)Packet::VERB_REQUEST_PROOF_OF_WORK);
 						outp.append(pid);
 						outp.append((unsigned char)Packet::ERROR_INVALID_REQUEST);
-						outp.armor(peer->key(),true);
+						outp.armor(peer->armorKey(),true);
 						RR->node->putPacket(_localAddress,_remoteAddress,outp.data(),outp.size());
 					}
 				}	break;
@@ -1356,7 +1391,7 @@ void IncomingPacket::_sendErrorNeedCertificate(const RuntimeEnvironment *RR,cons
 	outp.append(packetId());
 	outp.append((unsigned char)Packet::ERROR_NEED_MEMBERSHIP_CERTIFICATE);
 	outp.append(nwid);
-	outp.armor(peer->key(),true);
+	outp.armor(peer->armorKey(),true);
 	RR->node->putPacket(_localAddress,_remoteAddress,outp.data(),outp.size());
 }
 
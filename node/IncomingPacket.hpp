@@ -58,16 +58,12 @@ public:
 		Packet(),
 		_receiveTime(0),
 		_localAddress(),
-		_remoteAddress()
+		_remoteAddress(),
+		_authenticated(false),
+		_wantsDeferral(false)
 	{
 	}
 
-	IncomingPacket(const IncomingPacket &p)
-	{
-		// All fields including InetAddress are memcpy'able
-		memcpy(this,&p,sizeof(IncomingPacket));
-	}
-
 	/**
 	 * Create a new packet-in-decode
 	 *
@@ -82,17 +78,12 @@ public:
 		Packet(data,len),
 		_receiveTime(now),
 		_localAddress(localAddress),
-		_remoteAddress(remoteAddress)
+		_remoteAddress(remoteAddress),
+		_authenticated(false),
+		_wantsDeferral(false)
 	{
 	}
 
-	inline IncomingPacket &operator=(const IncomingPacket &p)
-	{
-		// All fields including InetAddress are memcpy'able
-		memcpy(this,&p,sizeof(IncomingPacket));
-		return *this;
-	}
-
 	/**
 	 * Init packet-in-decode in place
 	 *
@@ -106,9 +97,26 @@ public:
 	inline void init(const void *data,unsigned int len,const InetAddress &localAddress,const InetAddress &remoteAddress,uint64_t now)
 	{
 		copyFrom(data,len);
+		init(len,localAddress,remoteAddress,now);
+	}
+
+	/**
+	 * Init packet-in-decode whose data was already written to unsafeData()
+	 *
+	 * @param len Packet length
+	 * @param localAddress Local interface address
+	 * @param remoteAddress Address from which packet came
+	 * @param now Current time
+	 * @throws std::out_of_range Range error processing packet
+	 */
+	inline void init(unsigned int len,const InetAddress &localAddress,const InetAddress &remoteAddress,uint64_t now)
+	{
+		setSize(len);
 		_receiveTime = now;
 		_localAddress = localAddress;
 		_remoteAddress = remoteAddress;
+		_authenticated = false;
+		_wantsDeferral = false;
 	}
 
 	/**
@@ -120,9 +128,9 @@ public:
 	 * Once true is returned, this must not be called again. The packet's state
 	 * may no longer be valid. The only exception is deferred decoding. In this
 	 * case true is returned to indicate to the normal decode path that it is
-	 * finished with the packet. The packet will have added itself to the
-	 * deferred queue and will expect tryDecode() to be called one more time
-	 * with deferred set to true.
+	 * finished with the packet, and wantsDeferral() returns true. The caller
+	 * then hands the packet to the deferred queue, which will call tryDecode()
+	 * one more time with deferred set to true.
 	 *
 	 * Deferred decoding is performed by DeferredPackets.cpp and should not be
 	 * done elsewhere. Under deferred decoding packets only get one shot and
@@ -134,11 +142,44 @@ public:
 	 */
 	bool tryDecode(const RuntimeEnvironment *RR,bool deferred);
 
+	/**
+	 * Authenticate and decrypt several packets from the same peer at once
+	 *
+	 * Packets that pass are flagged so that tryDecode() will not dearmor them
+	 * again. Packets that fail, unencrypted HELLOs, and trusted path packets
+	 * are left alone and are handled by tryDecode() as usual.
+	 *
+	 * This is only worth doing where packets already sit together, such as
+	 * those held in the RX queue until a WHOIS reply arrives. The live receive
+	 * path gets one packet per processWirePacket() call, and each is dearmored
+	 * as it is decoded.
+	 *
+	 * @param packets Packets, all with the same source address
+	 * @param n Number of packets
+	 * @param key Source peer's prepared key
+	 */
+	static void authenticateBatch(IncomingPacket *const *packets,unsigned int n,const Packet::ArmorKey &key);
+
+	/**
+	 * @return True if tryDecode() returned true but wants this to go to DeferredPackets
+	 */
+	inline bool wantsDeferral() const throw() { return _wantsDeferral; }
+
 	/**
 	 * @return Time of packet receipt / start of decode
 	 */
 	inline uint64_t receiveTime() const throw() { return _receiveTime; }
 
+	/**
+	 * @return Local interface address packet was received on
+	 */
+	inline const InetAddress &localAddress() const throw() { return _localAddress; }
+
+	/**
+	 * @return Address from which packet came
+	 */
+	inline const InetAddress &remoteAddress() const throw() { return _remoteAddress; }
+
 	/**
 	 * Compute the Salsa20/12+SHA512 proof of work function
 	 *
@@ -161,6 +202,10 @@ public:
 	static bool testSalsa2012Sha512ProofOfWorkResult(unsigned int difficulty,const void *challenge,unsigned int challengeLength,const unsigned char proposedResult[16]);
 
 private:
+	// Packets are passed around by pointer and not copied
+	IncomingPacket(const IncomingPacket &) {}
+	inline IncomingPacket &operator=(const IncomingPacket &) { return *this; }
+
 	// These are called internally to handle packet contents once it has
 	// been authenticated, decrypted, decompressed, and classified.
 	bool _doERROR(const RuntimeEnvironment *RR,const SharedPtr<Peer> &peer);
@@ -188,6 +233,8 @@ private:
 	uint64_t _receiveTime;
 	InetAddress _localAddress;
 	InetAddress _remoteAddress;
+	bool _authenticated;
+	bool _wantsDeferral;
 };
 
 } // namespace ZeroTier
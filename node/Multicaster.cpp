@@ -32,10 +32,56 @@
 
 namespace ZeroTier {
 
+/**
+ * Visits the indexes 0..n-1 in random order
+ *
+ * This is a Fisher-Yates shuffle that is carried out only as far as it is
+ * read and remembers only the positions it has swapped, so picking k of n
+ * members costs O(k) no matter how large the group is.
+ */
+class _RandomIndexOrder
+{
+public:
+	_RandomIndexOrder(const RuntimeEnvironment *renv,unsigned long n) :
+		RR(renv),
+		_n(n),
+		_i(0),
+		_swapped(16)
+	{
+	}
+
+	/**
+	 * @param idx Set to next index
+	 * @return False if all indexes have been visited
+	 */
+	inline bool next(unsigned long &idx)
+	{
+		if (_i >= _n)
+			return false;
+		const unsigned long j = _i + (unsigned long)(RR->node->prng() % (uint64_t)(_n - _i));
+		idx = _at(j);
+		if (j != _i)
+			_swapped.set((uint64_t)j,_at(_i)); // position _i is never read again so it needn't be updated
+		++_i;
+		return true;
+	}
+
+private:
+	inline unsigned long _at(unsigned long pos) const
+	{
+		const unsigned long *const v = _swapped.get((uint64_t)pos);
+		return ((v) ? *v : pos);
+	}
+
+	const RuntimeEnvironment *RR;
+	const unsigned long _n;
+	unsigned long _i;
+	Hashtable< uint64_t,unsigned long > _swapped;
+};
+
 Multicaster::Multicaster(const RuntimeEnvironment *renv) :
 	RR(renv),
-	_groups(1024),
-	_groups_m()
+	_cleanShard(0)
 {
 }
 
@@ -47,8 +93,9 @@ void Multicaster::addMultiple(uint64_t now,uint64_t nwid,const MulticastGroup &m
 {
 	const unsigned char *p = (const unsigned char *)addresses;
 	const unsigned char *e = p + (5 * count);
-	Mutex::Lock _l(_groups_m);
-	MulticastGroupStatus &gs = _groups[Multicaster::Key(nwid,mg)];
+	_GroupShard &sh = _shard(nwid);
+	Mutex::Lock _l(sh.lock);
+	MulticastGroupStatus &gs = sh.groups[Multicaster::Key(nwid,mg)];
 	while (p != e) {
 		_add(now,nwid,mg,gs,Address(p,5));
 		p += 5;
@@ -57,14 +104,19 @@ void Multicaster::addMultiple(uint64_t now,uint64_t nwid,const MulticastGroup &m
 
 void Multicaster::remove(uint64_t nwid,const MulticastGroup &mg,const Address &member)
 {
-	Mutex::Lock _l(_groups_m);
-	MulticastGroupStatus *s = _groups.get(Multicaster::Key(nwid,mg));
+	_GroupShard &sh = _shard(nwid);
+	Mutex::Lock _l(sh.lock);
+	MulticastGroupStatus *s = sh.groups.get(Multicaster::Key(nwid,mg));
 	if (s) {
-		for(std::vector<MulticastGroupMember>::iterator m(s->members.begin());m!=s->members.end();++m) {
-			if (m->address == member) {
-				s->members.erase(m);
-				break;
+		const unsigned long *const i = s->memberIndex.get(member);
+		if (i) {
+			const unsigned long idx = *i;
+			if (idx != (s->members.size() - 1)) {
+				s->members[idx] = s->members.back();
+				s->memberIndex.set(s->members[idx].address,idx);
 			}
+			s->members.pop_back();
+			s->memberIndex.erase(member);
 		}
 	}
 }
@@ -72,8 +124,9 @@ void Multicaster::remove(uint64_t nwid,const MulticastGroup &mg,const Address &m
 unsigned int Multicaster::gather(const Address &queryingPeer,uint64_t nwid,const MulticastGroup &mg,Buffer<ZT_PROTO_MAX_PACKET_LENGTH> &appendTo,unsigned int limit) const
 {
 	unsigned char *p;
-	unsigned int added = 0,i,k,rptr,totalKnown = 0;
-	uint64_t a,picked[(ZT_PROTO_MAX_PACKET_LENGTH / 5) + 2];
+	unsigned int added = 0,totalKnown = 0;
+	unsigned long idx;
+	uint64_t a;
 
 	if (!limit)
 		return 0;
@@ -94,28 +147,18 @@ unsigned int Multicaster::gather(const Address &queryingPeer,uint64_t nwid,const
 		}
 	}
 
-	Mutex::Lock _l(_groups_m);
+	const _GroupShard &sh = _shard(nwid);
+	Mutex::Lock _l(sh.lock);
 
-	const MulticastGroupStatus *s = _groups.get(Multicaster::Key(nwid,mg));
+	const MulticastGroupStatus *s = sh.groups.get(Multicaster::Key(nwid,mg));
 	if ((s)&&(!s->members.empty())) {
 		totalKnown += (unsigned int)s->members.size();
 
 		// Members are returned in random order so that repeated gather queries
 		// will return different subsets of a large multicast group.
-		k = 0;
-		while ((added < limit)&&(k < s->members.size())&&((appendTo.size() + ZT_ADDRESS_LENGTH) <= ZT_UDP_DEFAULT_PAYLOAD_MTU)) {
-			rptr = (unsigned int)RR->node->prng();
-
-restart_member_scan:
-			a = s->members[rptr % (unsigned int)s->members.size()].address.toInt();
-			for(i=0;i<k;++i) {
-				if (picked[i] == a) {
-					++rptr;
-					goto restart_member_scan;
-				}
-			}
-			picked[k++] = a;
-
+		_RandomIndexOrder order(RR,(unsigned long)s->members.size());
+		while ((added < limit)&&((appendTo.size() + ZT_ADDRESS_LENGTH) <= ZT_UDP_DEFAULT_PAYLOAD_MTU)&&(order.next(idx))) {
+			a = s->members[idx].address.toInt();
 			if (queryingPeer.toInt() != a) { // do not return the peer that is making the request as a result
 				p = (unsigned char *)appendTo.appendField(ZT_ADDRESS_LENGTH);
 				*(p++) = (unsigned char)((a >> 32) & 0xff);
@@ -139,8 +182,9 @@ restart_member_scan:
 std::vector<Address> Multicaster::getMembers(uint64_t nwid,const MulticastGroup &mg,unsigned int limit) const
 {
 	std::vector<Address> ls;
-	Mutex::Lock _l(_groups_m);
-	const MulticastGroupStatus *s = _groups.get(Multicaster::Key(nwid,mg));
+	const _GroupShard &sh = _shard(nwid);
+	Mutex::Lock _l(sh.lock);
+	const MulticastGroupStatus *s = sh.groups.get(Multicaster::Key(nwid,mg));
 	if (!s)
 		return ls;
 	for(std::vector<MulticastGroupMember>::const_reverse_iterator m(s->members.rbegin());m!=s->members.rend();++m) {
@@ -163,61 +207,42 @@ void Multicaster::send(
 	const void *data,
 	unsigned int len)
 {
-	unsigned long idxbuf[8194];
-	unsigned long *indexes = idxbuf;
+	// If these are set, the work they describe is done after the shard lock is released
+	std::vector<Address> sendOnlyTo;
+	bool sendOnly = false;
+	bool explicitGather = false;
+	unsigned int explicitGatherLimit = 0;
+
+	// Members already covered by alwaysSendTo are skipped when picking at random
+	Hashtable< Address,bool > always(16);
+	for(std::vector<Address>::const_iterator ast(alwaysSendTo.begin());ast!=alwaysSendTo.end();++ast)
+		always.set(*ast,true);
 
 	try {
-		Mutex::Lock _l(_groups_m);
-		MulticastGroupStatus &gs = _groups[Multicaster::Key(nwid,mg)];
-
-		if (!gs.members.empty()) {
-			// Allocate a memory buffer if group is monstrous
-			if (gs.members.size() > (sizeof(idxbuf) / sizeof(unsigned long)))
-				indexes = new unsigned long[gs.members.size()];
-
-			// Generate a random permutation of member indexes
-			for(unsigned long i=0;i<gs.members.size();++i)
-				indexes[i] = i;
-			for(unsigned long i=(unsigned long)gs.members.size()-1;i>0;--i) {
-				unsigned long j = (unsigned long)RR->node->prng() % (i + 1);
-				unsigned long tmp = indexes[j];
-				indexes[j] = indexes[i];
-				indexes[i] = tmp;
-			}
-		}
+		_GroupShard &sh = _shard(nwid);
+		Mutex::Lock _l(sh.lock);
+		MulticastGroupStatus &gs = sh.groups[Multicaster::Key(nwid,mg)];
+		_RandomIndexOrder order(RR,(unsigned long)gs.members.size());
+		unsigned long idx;
 
 		if (gs.members.size() >= limit) {
-			// Skip queue if we already have enough members to complete the send operation
-			OutboundMulticast out;
-
-			out.init(
-				RR,
-				now,
-				nwid,
-				com,
-				limit,
-				1, // we'll still gather a little from peers to keep multicast list fresh
-				src,
-				mg,
-				etherType,
-				data,
-				len);
+			// Skip queue if we already have enough members to complete the send operation. Only
+			// the recipients are picked here; encrypting and sending is done without the lock.
+			sendOnly = true;
+			sendOnlyTo.reserve(limit);
 
 			unsigned int count = 0;
-
 			for(std::vector<Address>::const_iterator ast(alwaysSendTo.begin());ast!=alwaysSendTo.end();++ast) {
 				if (*ast != RR->identity.address()) {
-					out.sendOnly(RR,*ast); // optimization: don't use dedup log if it's a one-pass send
 					if (++count >= limit)
 						break;
 				}
 			}
 
-			unsigned long idx = 0;
-			while ((count < limit)&&(idx < gs.members.size())) {
-				Address ma(gs.members[indexes[idx++]].address);
-				if (std::find(alwaysSendTo.begin(),alwaysSendTo.end(),ma) == alwaysSendTo.end()) {
-					out.sendOnly(RR,ma); // optimization: don't use dedup log if it's a one-pass send
+			while ((count < limit)&&(order.next(idx))) {
+				const Address &ma = gs.members[idx].address;
+				if (!always.contains(ma)) {
+					sendOnlyTo.push_back(ma);
 					++count;
 				}
 			}
@@ -226,34 +251,8 @@ void Multicaster::send(
 
 			if ((gs.members.empty())||((now - gs.lastExplicitGather) >= ZT_MULTICAST_EXPLICIT_GATHER_DELAY)) {
 				gs.lastExplicitGather = now;
-				SharedPtr<Peer> explicitGatherPeers[2];
-				explicitGatherPeers[0] = RR->topology->getBestRoot();
-				const Address nwidc(Network::controllerFor(nwid));
-				if (nwidc != RR->identity.address())
-					explicitGatherPeers[1] = RR->topology->getPeer(nwidc);
-				for(unsigned int k=0;k<2;++k) {
-					const SharedPtr<Peer> &p = explicitGatherPeers[k];
-					if (!p)
-						continue;
-					//TRACE(">>MC upstream GATHER up to %u for group %.16llx/%s",gatherLimit,nwid,mg.toString().c_str());
-
-					const CertificateOfMembership *com = (CertificateOfMembership *)0;
-					{
-						SharedPtr<Network> nw(RR->node->network(nwid));
-						if ((nw)&&(nw->hasConfig())&&(nw->config().com)&&(nw->config().isPrivate())&&(p->needsOurNetworkMembershipCertificate(nwid,now,true)))
-							com = &(nw->config().com);
-					}
-
-					Packet outp(p->address(),RR->identity.address(),Packet::VERB_MULTICAST_GATHER);
-					outp.append(nwid);
-					outp.append((uint8_t)(com ? 0x01 : 0x00));
-					mg.mac().appendTo(outp);
-					outp.append((uint32_t)mg.adi());
-					outp.append((uint32_t)gatherLimit);
-					if (com)
-						com->serialize(outp);
-					RR->sw->send(outp,true,0);
-				}
+				explicitGather = true;
+				explicitGatherLimit = gatherLimit;
 				gatherLimit = 0;
 			}
 
@@ -273,41 +272,104 @@ void Multicaster::send(
 				data,
 				len);
 
-			unsigned int count = 0;
+			std::vector<Address> recipients;
+			recipients.reserve(limit);
 
 			for(std::vector<Address>::const_iterator ast(alwaysSendTo.begin());ast!=alwaysSendTo.end();++ast) {
 				if (*ast != RR->identity.address()) {
-					out.sendAndLog(RR,*ast);
-					if (++count >= limit)
+					recipients.push_back(*ast);
+					if (recipients.size() >= limit)
 						break;
 				}
 			}
 
-			unsigned long idx = 0;
-			while ((count < limit)&&(idx < gs.members.size())) {
-				Address ma(gs.members[indexes[idx++]].address);
-				if (std::find(alwaysSendTo.begin(),alwaysSendTo.end(),ma) == alwaysSendTo.end()) {
-					out.sendAndLog(RR,ma);
-					++count;
+			while ((recipients.size() < limit)&&(order.next(idx))) {
+				const Address &ma = gs.members[idx].address;
+				if (!always.contains(ma))
+					recipients.push_back(ma);
+			}
+
+			if (!recipients.empty())
+				out.sendAndLog(RR,&(recipients[0]),(unsigned int)recipients.size());
+		}
+	} catch ( ... ) {}
+
+	try {
+		if (sendOnly) {
+			OutboundMulticast out;
+
+			out.init(
+				RR,
+				now,
+				nwid,
+				com,
+				limit,
+				1, // we'll still gather a little from peers to keep multicast list fresh
+				src,
+				mg,
+				etherType,
+				data,
+				len);
+
+			// One-pass send, so the dedup log isn't needed
+			std::vector<Address> recipients;
+			recipients.reserve(sendOnlyTo.size() + alwaysSendTo.size());
+			for(std::vector<Address>::const_iterator ast(alwaysSendTo.begin());ast!=alwaysSendTo.end();++ast) {
+				if (*ast != RR->identity.address()) {
+					recipients.push_back(*ast);
+					if (recipients.size() >= limit)
+						break;
 				}
 			}
+			recipients.insert(recipients.end(),sendOnlyTo.begin(),sendOnlyTo.end());
+
+			if (!recipients.empty())
+				out.sendOnly(RR,&(recipients[0]),(unsigned int)recipients.size());
 		}
-	} catch ( ... ) {} // this is a sanity check to catch any failures and make sure indexes[] still gets deleted
 
-	// Free allocated memory buffer if any
-	if (indexes != idxbuf)
-		delete [] indexes;
+		if (explicitGather) {
+			SharedPtr<Peer> explicitGatherPeers[2];
+			explicitGatherPeers[0] = RR->topology->getBestRoot();
+			const Address nwidc(Network::controllerFor(nwid));
+			if (nwidc != RR->identity.address())
+				explicitGatherPeers[1] = RR->topology->getPeer(nwidc);
+			for(unsigned int k=0;k<2;++k) {
+				const SharedPtr<Peer> &p = explicitGatherPeers[k];
+				if (!p)
+					continue;
+				//TRACE(">>MC upstream GATHER up to %u for group %.16llx/%s",explicitGatherLimit,nwid,mg.toString().c_str());
+
+				const CertificateOfMembership *com = (CertificateOfMembership *)0;
+				{
+					SharedPtr<Network> nw(RR->node->network(nwid));
+					if ((nw)&&(nw->hasConfig())&&(nw->config().com)&&(nw->config().isPrivate())&&(p->needsOurNetworkMembershipCertificate(nwid,now,true)))
+						com = &(nw->config().com);
+				}
+
+				Packet outp(p->address(),RR->identity.address(),Packet::VERB_MULTICAST_GATHER);
+				outp.append(nwid);
+				outp.append((uint8_t)(com ? 0x01 : 0x00));
+				mg.mac().appendTo(outp);
+				outp.append((uint32_t)mg.adi());
+				outp.append((uint32_t)explicitGatherLimit);
+				if (com)
+					com->serialize(outp);
+				RR->sw->send(outp,true,0);
+			}
+		}
+	} catch ( ... ) {}
 }
 
 void Multicaster::clean(uint64_t now)
 {
-	Mutex::Lock _l(_groups_m);
+	_GroupShard &sh = _groups[_cleanShard++ % ZT_MULTICASTER_SHARDS];
+	Mutex::Lock _l(sh.lock);
 
 	Multicaster::Key *k = (Multicaster::Key *)0;
 	MulticastGroupStatus *s = (MulticastGroupStatus *)0;
-	Hashtable<Multicaster::Key,MulticastGroupStatus>::Iterator mm(_groups);
+	Hashtable<Multicaster::Key,MulticastGroupStatus>::Iterator mm(sh.groups);
 	while (mm.next(k,s)) {
-		for(std::list<OutboundMulticast>::iterator tx(s->txQueue.begin());tx!=s->txQueue.end();) {
+		for(std::list< OutboundMulticast,PoolAllocator<OutboundMulticast> >::iterator tx(s->txQueue.begin());tx!=s->txQueue.end();) {
 			if ((tx->expired(now))||(tx->atLimit()))
 				s->txQueue.erase(tx++);
 			else ++tx;
@@ -328,35 +390,41 @@ void Multicaster::clean(uint64_t now)
 		}
 
 		if (count) {
-			s->members.resize(count);
+			if (count != s->members.size()) {
+				s->members.resize(count);
+				s->memberIndex.clear();
+				for(unsigned long i=0;i<count;++i)
+					s->memberIndex.set(s->members[i].address,i);
+			}
 		} else if (s->txQueue.empty()) {
-			_groups.erase(*k);
+			sh.groups.erase(*k);
 		} else {
 			s->members.clear();
+			s->memberIndex.clear();
 		}
 	}
 }
 
 void Multicaster::_add(uint64_t now,uint64_t nwid,const MulticastGroup &mg,MulticastGroupStatus &gs,const Address &member)
 {
-	// assumes _groups_m is locked
+	// assumes the shard lock for nwid is held
 
 	// Do not add self -- even if someone else returns it
 	if (member == RR->identity.address())
 		return;
 
-	for(std::vector<MulticastGroupMember>::iterator m(gs.members.begin());m!=gs.members.end();++m) {
-		if (m->address == member) {
-			m->timestamp = now;
-			return;
-		}
+	const unsigned long *const i = gs.memberIndex.get(member);
+	if (i) {
+		gs.members[*i].timestamp = now;
+		return;
 	}
 
+	gs.memberIndex.set(member,(unsigned long)gs.members.size());
 	gs.members.push_back(MulticastGroupMember(member,now));
 
 	//TRACE("..MC %s joined multicast group %.16llx/%s via %s",member.toString().c_str(),nwid,mg.toString().c_str(),((learnedFrom) ? learnedFrom.toString().c_str() : "(direct)"));
 
-	for(std::list<OutboundMulticast>::iterator tx(gs.txQueue.begin());tx!=gs.txQueue.end();) {
+	for(std::list< OutboundMulticast,PoolAllocator<OutboundMulticast> >::iterator tx(gs.txQueue.begin());tx!=gs.txQueue.end();) {
 		if (tx->atLimit())
 			gs.txQueue.erase(tx++);
 		else {
@@ -32,6 +32,7 @@
 #include "MAC.hpp"
 #include "MulticastGroup.hpp"
 #include "OutboundMulticast.hpp"
+#include "SizeClassPool.hpp"
 #include "Utils.hpp"
 #include "Mutex.hpp"
 #include "NonCopyable.hpp"
@@ -71,11 +72,12 @@ private:
 
 	struct MulticastGroupStatus
 	{
-		MulticastGroupStatus() : lastExplicitGather(0) {}
+		MulticastGroupStatus() : lastExplicitGather(0),memberIndex(8) {}
 
 		uint64_t lastExplicitGather;
-		std::list<OutboundMulticast> txQueue; // pending outbound multicasts
+		std::list< OutboundMulticast,PoolAllocator<OutboundMulticast> > txQueue; // pending outbound multicasts
 		std::vector<MulticastGroupMember> members; // members of this group
+		Hashtable< Address,unsigned long > memberIndex; // address -> index in members
 	};
 
 public:
@@ -92,8 +94,9 @@ public:
 	 */
 	inline void add(uint64_t now,uint64_t nwid,const MulticastGroup &mg,const Address &member)
 	{
-		Mutex::Lock _l(_groups_m);
-		_add(now,nwid,mg,_groups[Multicaster::Key(nwid,mg)],member);
+		_GroupShard &sh = _shard(nwid);
+		Mutex::Lock _l(sh.lock);
+		_add(now,nwid,mg,sh.groups[Multicaster::Key(nwid,mg)],member);
 	}
 
 	/**
@@ -174,19 +177,34 @@ public:
 		unsigned int len);
 
 	/**
-	 * Clean up and resort database
+	 * Clean up and resort one shard of the database
+	 *
+	 * Each call cleans the next shard in turn, so only one shard's lock is
+	 * held and other networks are not held up while a big one is cleaned.
+	 * This is called every ZT_MULTICASTER_CLEAN_PERIOD.
 	 *
-	 * @param RR Runtime environment
 	 * @param now Current time
 	 */
 	void clean(uint64_t now);
 
 private:
+	// All groups of a network are in the same shard, so a busy network only
+	// contends with the few others that happen to share its shard.
+	struct _GroupShard
+	{
+		_GroupShard() : groups(64) {}
+		Hashtable<Multicaster::Key,MulticastGroupStatus> groups;
+		Mutex lock;
+	};
+
+	inline _GroupShard &_shard(uint64_t nwid) { return _groups[(unsigned int)(nwid ^ (nwid >> 32) ^ (nwid >> 16)) & (ZT_MULTICASTER_SHARDS - 1)]; }
+	inline const _GroupShard &_shard(uint64_t nwid) const { return _groups[(unsigned int)(nwid ^ (nwid >> 32) ^ (nwid >> 16)) & (ZT_MULTICASTER_SHARDS - 1)]; }
+
 	void _add(uint64_t now,uint64_t nwid,const MulticastGroup &mg,MulticastGroupStatus &gs,const Address &member);
 
 	const RuntimeEnvironment *RR;
-	Hashtable<Multicaster::Key,MulticastGroupStatus> _groups;
-	Mutex _groups_m;
+	_GroupShard _groups[ZT_MULTICASTER_SHARDS];
+	unsigned int _cleanShard; // shard to clean next, one per clean()
 };
 
 } // namespace ZeroTier
@@ -122,7 +122,7 @@ void Network::multicastSubscribe(const MulticastGroup &mg)
 		_myMulticastGroups.push_back(mg);
 		std::sort(_myMulticastGroups.begin(),_myMulticastGroups.end());
 	}
-	_announceMulticastGroups();
+	_announceMulticastGroups(std::vector<MulticastGroup>(1,mg));
 }
 
 void Network::multicastUnsubscribe(const MulticastGroup &mg)
@@ -137,7 +137,7 @@ void Network::multicastUnsubscribe(const MulticastGroup &mg)
 		_myMulticastGroups.swap(nmg);
 }
 
-bool Network::tryAnnounceMulticastGroupsTo(const SharedPtr<Peer> &peer)
+bool Network::tryAnnounceMulticastGroupsTo(const SharedPtr<Peer> &peer,Packet &outp)
 {
 	Mutex::Lock _l(_lock);
 	if (
@@ -145,7 +145,7 @@ bool Network::tryAnnounceMulticastGroupsTo(const SharedPtr<Peer> &peer)
 	    (peer->address() == this->controller()) ||
 	    (RR->topology->isRoot(peer->identity()))
 	   ) {
-		_announceMulticastGroupsTo(peer,_allMulticastGroups());
+		_announceMulticastGroupsTo(peer,_allMulticastGroups(),outp);
 		return true;
 	}
 	return false;
@@ -313,7 +313,7 @@ void Network::learnBridgedMulticastGroup(const MulticastGroup &mg,uint64_t now)
 	const unsigned long tmp = (unsigned long)_multicastGroupsBehindMe.size();
 	_multicastGroupsBehindMe.set(mg,now);
 	if (tmp != _multicastGroupsBehindMe.size())
-		_announceMulticastGroups();
+		_announceMulticastGroups(std::vector<MulticastGroup>(1,mg));
 }
 
 void Network::destroy()
@@ -422,45 +422,44 @@ private:
 	const std::vector<Address> _anchors;
 	const std::vector<Address> _rootAddresses;
 };
-void Network::_announceMulticastGroups()
+void Network::_announceMulticastGroups(const std::vector<MulticastGroup> &groups)
 {
 	// Assumes _lock is locked
-	std::vector<MulticastGroup> allMulticastGroups(_allMulticastGroups());
+
+	// Only newly added groups are announced here. Everything is announced
+	// again to each peer periodically to keep it from expiring (see Peer).
 	_MulticastAnnounceAll gpfunc(RR,this);
 	RR->topology->eachPeer<_MulticastAnnounceAll &>(gpfunc);
-	for(std::vector< SharedPtr<Peer> >::const_iterator i(gpfunc.peers.begin());i!=gpfunc.peers.end();++i)
-		_announceMulticastGroupsTo(*i,allMulticastGroups);
+	for(std::vector< SharedPtr<Peer> >::const_iterator i(gpfunc.peers.begin());i!=gpfunc.peers.end();++i) {
+		Packet outp((*i)->address(),RR->identity.address(),Packet::VERB_MULTICAST_LIKE);
+		_announceMulticastGroupsTo(*i,groups,outp);
+		if (outp.size() > ZT_PROTO_MIN_PACKET_LENGTH)
+			RR->sw->send(outp,true,0);
+	}
 }
 
-void Network::_announceMulticastGroupsTo(const SharedPtr<Peer> &peer,const std::vector<MulticastGroup> &allMulticastGroups) const
+void Network::_announceMulticastGroupsTo(const SharedPtr<Peer> &peer,const std::vector<MulticastGroup> &groups,Packet &outp) const
 {
 	// Assumes _lock is locked
 
 	// We push COMs ahead of MULTICAST_LIKE since they're used for access control -- a COM is a public
 	// credential so "over-sharing" isn't really an issue (and we only do so with roots).
 	if ((_config)&&(_config.com)&&(!_config.isPublic())&&(peer->needsOurNetworkMembershipCertificate(_id,RR->node->now(),true))) {
-		Packet outp(peer->address(),RR->identity.address(),Packet::VERB_NETWORK_MEMBERSHIP_CERTIFICATE);
-		_config.com.serialize(outp);
-		RR->sw->send(outp,true,0);
+		Packet coutp(peer->address(),RR->identity.address(),Packet::VERB_NETWORK_MEMBERSHIP_CERTIFICATE);
+		_config.com.serialize(coutp);
+		RR->sw->send(coutp,true,0);
 	}
 
-	{
-		Packet outp(peer->address(),RR->identity.address(),Packet::VERB_MULTICAST_LIKE);
-
-		for(std::vector<MulticastGroup>::const_iterator mg(allMulticastGroups.begin());mg!=allMulticastGroups.end();++mg) {
-			if ((outp.size() + 18) >= ZT_UDP_DEFAULT_PAYLOAD_MTU) {
-				RR->sw->send(outp,true,0);
-				outp.reset(peer->address(),RR->identity.address(),Packet::VERB_MULTICAST_LIKE);
-			}
-
-			// network ID, MAC, ADI
-			outp.append((uint64_t)_id);
-			mg->mac().appendTo(outp);
-			outp.append((uint32_t)mg->adi());
+	for(std::vector<MulticastGroup>::const_iterator mg(groups.begin());mg!=groups.end();++mg) {
+		if ((outp.size() + 18) >= ZT_UDP_DEFAULT_PAYLOAD_MTU) {
+			RR->sw->send(outp,true,0);
+			outp.reset(peer->address(),RR->identity.address(),Packet::VERB_MULTICAST_LIKE);
 		}
 
-		if (outp.size() > ZT_PROTO_MIN_PACKET_LENGTH)
-			RR->sw->send(outp,true,0);
+		// network ID, MAC, ADI
+		outp.append((uint64_t)_id);
+		mg->mac().appendTo(outp);
+		outp.append((uint32_t)mg->adi());
 	}
 }
 
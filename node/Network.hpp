@@ -135,10 +135,16 @@ public:
 	/**
 	 * Announce multicast groups to a peer if that peer is authorized on this network
 	 *
+	 * Groups are appended to a MULTICAST_LIKE packet that the caller is
+	 * building for this peer, so one packet can carry LIKEs for several
+	 * networks. Full packets are sent and the packet is reset to carry on.
+	 * The caller sends whatever is left once it's done with all networks.
+	 *
 	 * @param peer Peer to try to announce multicast groups to
+	 * @param outp MULTICAST_LIKE packet addressed to peer
 	 * @return True if peer was authorized and groups were announced
 	 */
-	bool tryAnnounceMulticastGroupsTo(const SharedPtr<Peer> &peer);
+	bool tryAnnounceMulticastGroupsTo(const SharedPtr<Peer> &peer,Packet &outp);
 
 	/**
 	 * Apply a NetworkConfig to this network
@@ -304,8 +310,8 @@ private:
 	ZT_VirtualNetworkStatus _status() const;
 	void _externalConfig(ZT_VirtualNetworkConfig *ec) const; // assumes _lock is locked
 	bool _isAllowed(const SharedPtr<Peer> &peer) const;
-	void _announceMulticastGroups();
-	void _announceMulticastGroupsTo(const SharedPtr<Peer> &peer,const std::vector<MulticastGroup> &allMulticastGroups) const;
+	void _announceMulticastGroups(const std::vector<MulticastGroup> &groups);
+	void _announceMulticastGroupsTo(const SharedPtr<Peer> &peer,const std::vector<MulticastGroup> &groups,Packet &outp) const;
 	std::vector<MulticastGroup> _allMulticastGroups() const;
 
 	const RuntimeEnvironment *RR;
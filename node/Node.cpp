@@ -38,6 +38,7 @@
 #include "SelfAwareness.hpp"
 #include "Cluster.hpp"
 #include "DeferredPackets.hpp"
+#include "PacketPool.hpp"
 
 const struct sockaddr_storage ZT_SOCKADDR_NULL = {0};
 
@@ -72,7 +73,8 @@ Node::Node(
 	_prngStreamPtr(0),
 	_now(now),
 	_lastPingCheck(0),
-	_lastHousekeepingRun(0)
+	_lastHousekeepingRun(0),
+	_lastMulticastClean(0)
 {
 	_online = false;
 
@@ -104,6 +106,7 @@ Node::Node(
 	}
 
 	try {
+		RR->pool = new PacketPool();
 		RR->sw = new Switch(RR);
 		RR->mc = new Multicaster(RR);
 		RR->topology = new Topology(RR);
@@ -115,6 +118,7 @@ Node::Node(
 		delete RR->topology;
 		delete RR->mc;
 		delete RR->sw;
+		delete RR->pool;
 		throw;
 	}
 
@@ -136,6 +140,7 @@ Node::~Node()
 #ifdef ZT_ENABLE_CLUSTER
 	delete RR->cluster;
 #endif
+	delete RR->pool;
 }
 
 ZT_ResultCode Node::processWirePacket(
@@ -146,8 +151,42 @@ ZT_ResultCode Node::processWirePacket(
 	unsigned int packetLength,
 	volatile uint64_t *nextBackgroundTaskDeadline)
 {
+	if (packetLength > ZT_PROTO_MAX_PACKET_LENGTH)
+		return ZT_RESULT_OK; // too big to be valid, so just drop
+	IncomingPacket *const pkt = RR->pool->get();
+	memcpy(pkt->unsafeData(),packetData,packetLength);
+	return processWirePacketBuffer(now,localAddress,remoteAddress,pkt,packetLength,nextBackgroundTaskDeadline);
+}
+
+void *Node::getWirePacketBuffer(void **data,unsigned int *capacity)
+{
+	IncomingPacket *const pkt = RR->pool->get();
+	*data = pkt->unsafeData();
+	*capacity = pkt->capacity();
+	return pkt;
+}
+
+void Node::freeWirePacketBuffer(void *packetBuffer)
+{
+	RR->pool->put(reinterpret_cast<IncomingPacket *>(packetBuffer));
+}
+
+ZT_ResultCode Node::processWirePacketBuffer(
+	uint64_t now,
+	const struct sockaddr_storage *localAddress,
+	const struct sockaddr_storage *remoteAddress,
+	void *packetBuffer,
+	unsigned int packetLength,
+	volatile uint64_t *nextBackgroundTaskDeadline)
+{
+	IncomingPacket *const pkt = reinterpret_cast<IncomingPacket *>(packetBuffer);
+	if (packetLength > pkt->capacity()) {
+		RR->pool->put(pkt);
+		return ZT_RESULT_OK;
+	}
 	_now = now;
-	RR->sw->onRemotePacket(*(reinterpret_cast<const InetAddress *>(localAddress)),*(reinterpret_cast<const InetAddress *>(remoteAddress)),packetData,packetLength);
+	pkt->init(packetLength,*(reinterpret_cast<const InetAddress *>(localAddress)),*(reinterpret_cast<const InetAddress *>(remoteAddress)),now);
+	RR->sw->onRemotePacket(pkt);
 	return ZT_RESULT_OK;
 }
 
@@ -258,9 +297,6 @@ public:
 			}
 
 			lastReceiveFromUpstream = std::max(p->lastReceive(),lastReceiveFromUpstream);
-		} else if (p->activelyTransferringFrames(_now)) {
-			// Normal nodes get their preferred link kept alive if the node has generated frame traffic recently
-			p->doPingAndKeepalive(_now,0);
 		}
 	}
 
@@ -302,9 +338,18 @@ ZT_ResultCode Node::processBackgroundTasks(uint64_t now,volatile uint64_t *nextB
 			for(std::vector< SharedPtr<Network> >::const_iterator n(needConfig.begin());n!=needConfig.end();++n)
 				(*n)->requestConfiguration();
 
-			// Do pings and keepalives
+			// Do pings and keepalives for upstream peers. Everyone else is kept alive by their Topology timers.
+			std::vector<Address> upstreams(RR->topology->rootAddresses());
+			for(std::vector<NetworkConfig::Relay>::const_iterator r(networkRelays.begin());r!=networkRelays.end();++r)
+				upstreams.push_back(r->address);
+			std::sort(upstreams.begin(),upstreams.end());
+			upstreams.erase(std::unique(upstreams.begin(),upstreams.end()),upstreams.end());
 			_PingPeersThatNeedPing pfunc(RR,now,networkRelays);
-			RR->topology->eachPeer<_PingPeersThatNeedPing &>(pfunc);
+			for(std::vector<Address>::const_iterator a(upstreams.begin());a!=upstreams.end();++a) {
+				const SharedPtr<Peer> p(RR->topology->getPeerNoCache(*a));
+				if (p)
+					pfunc(*(RR->topology),p);
+			}
 
 			// Update online status, post status change as event
 			const bool oldOnline = _online;
@@ -323,22 +368,36 @@ ZT_ResultCode Node::processBackgroundTasks(uint64_t now,volatile uint64_t *nextB
 			_lastHousekeepingRun = now;
 			RR->topology->clean(now);
 			RR->sa->clean(now);
-			RR->mc->clean(now);
 		} catch ( ... ) {
 			return ZT_RESULT_FATAL_ERROR_INTERNAL;
 		}
 	}
 
+	unsigned long timeUntilNextMulticastClean = ZT_MULTICASTER_CLEAN_PERIOD;
+	const uint64_t timeSinceLastMulticastClean = now - _lastMulticastClean;
+	if (timeSinceLastMulticastClean >= ZT_MULTICASTER_CLEAN_PERIOD) {
+		try {
+			_lastMulticastClean = now;
+			RR->mc->clean(now); // one shard per call
+		} catch ( ... ) {
+			return ZT_RESULT_FATAL_ERROR_INTERNAL;
+		}
+	} else {
+		timeUntilNextMulticastClean -= (unsigned long)timeSinceLastMulticastClean;
+	}
+
 	try {
 #ifdef ZT_ENABLE_CLUSTER
 		// If clustering is enabled we have to call cluster->doPeriodicTasks() very often, so we override normal timer deadline behavior
 		if (RR->cluster) {
 			RR->sw->doTimerTasks(now);
+			RR->topology->doTimerTasks(now);
 			RR->cluster->doPeriodicTasks();
 			*nextBackgroundTaskDeadline = now + ZT_CLUSTER_PERIODIC_TASK_PERIOD; // this is really short so just tick at this rate
 		} else {
 #endif
-			*nextBackgroundTaskDeadline = now + (uint64_t)std::max(std::min(timeUntilNextPingCheck,RR->sw->doTimerTasks(now)),(unsigned long)ZT_CORE_TIMER_TASK_GRANULARITY);
+			const unsigned long timeUntilNextTimerTasks = std::min(RR->sw->doTimerTasks(now),RR->topology->doTimerTasks(now));
+			*nextBackgroundTaskDeadline = now + (uint64_t)std::max(std::min(std::min(timeUntilNextPingCheck,timeUntilNextMulticastClean),timeUntilNextTimerTasks),(unsigned long)ZT_CORE_TIMER_TASK_GRANULARITY);
 #ifdef ZT_ENABLE_CLUSTER
 		}
 #endif
@@ -407,6 +466,8 @@ void Node::status(ZT_NodeStatus *status) const
 	status->publicIdentity = RR->publicIdentityStr.c_str();
 	status->secretIdentity = RR->secretIdentityStr.c_str();
 	status->online = _online ? 1 : 0;
+	status->deferredPacketsQueued = RR->dp->queued();
+	status->deferredPacketsDropped = RR->dp->dropped();
 }
 
 ZT_PeerList *Node::peers() const
@@ -641,14 +702,16 @@ void Node::clusterStatus(ZT_ClusterStatus *cs)
 
 void Node::backgroundThreadMain()
 {
+	const unsigned int worker = RR->dp->newWorker();
 	++RR->dpEnabled;
 	for(;;) {
 		try {
-			if (RR->dp->process() < 0)
-				break;
+			// Once this returns -1 the node may already be gone, and ~Node()
+			// has zeroed dpEnabled itself
+			if (RR->dp->process(worker) < 0)
+				return;
 		} catch ( ... ) {} // sanity check -- should not throw
 	}
-	--RR->dpEnabled;
 }
 
 /****************************************************************************/
@@ -809,6 +872,40 @@ enum ZT_ResultCode ZT_Node_processWirePacket(
 	}
 }
 
+void *ZT_Node_getWirePacketBuffer(ZT_Node *node,void **data,unsigned int *capacity)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->getWirePacketBuffer(data,capacity);
+	} catch ( ... ) {
+		return (void *)0;
+	}
+}
+
+void ZT_Node_freeWirePacketBuffer(ZT_Node *node,void *packetBuffer)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->freeWirePacketBuffer(packetBuffer);
+	} catch ( ... ) {}
+}
+
+enum ZT_ResultCode ZT_Node_processWirePacketBuffer(
+	ZT_Node *node,
+	uint64_t now,
+	const struct sockaddr_storage *localAddress,
+	const struct sockaddr_storage *remoteAddress,
+	void *packetBuffer,
+	unsigned int packetLength,
+	volatile uint64_t *nextBackgroundTaskDeadline)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->processWirePacketBuffer(now,localAddress,remoteAddress,packetBuffer,packetLength,nextBackgroundTaskDeadline);
+	} catch (std::bad_alloc &exc) {
+		return ZT_RESULT_FATAL_ERROR_OUT_OF_MEMORY;
+	} catch ( ... ) {
+		return ZT_RESULT_OK; // "OK" since invalid packets are simply dropped, but the system is still up
+	}
+}
+
 enum ZT_ResultCode ZT_Node_processVirtualNetworkFrame(
 	ZT_Node *node,
 	uint64_t now,
@@ -76,6 +76,15 @@ public:
 		const void *packetData,
 		unsigned int packetLength,
 		volatile uint64_t *nextBackgroundTaskDeadline);
+	void *getWirePacketBuffer(void **data,unsigned int *capacity);
+	void freeWirePacketBuffer(void *packetBuffer);
+	ZT_ResultCode processWirePacketBuffer(
+		uint64_t now,
+		const struct sockaddr_storage *localAddress,
+		const struct sockaddr_storage *remoteAddress,
+		void *packetBuffer,
+		unsigned int packetLength,
+		volatile uint64_t *nextBackgroundTaskDeadline);
 	ZT_ResultCode processVirtualNetworkFrame(
 		uint64_t now,
 		uint64_t nwid,
@@ -300,6 +309,7 @@ private:
 	uint64_t _now;
 	uint64_t _lastPingCheck;
 	uint64_t _lastHousekeepingRun;
+	uint64_t _lastMulticastClean;
 	bool _online;
 };
 
@@ -91,23 +91,28 @@ void OutboundMulticast::init(
 	} else _haveCom = false;
 }
 
-void OutboundMulticast::sendOnly(const RuntimeEnvironment *RR,const Address &toAddr)
+void OutboundMulticast::sendOnly(const RuntimeEnvironment *RR,const Address *toAddrs,unsigned int count)
 {
+	// Split recipients by which packet they get, then let the switch copy and
+	// armor each version for its recipients in batches.
+	std::vector<Address> withCom,noCom;
 	if (_haveCom) {
-		SharedPtr<Peer> peer(RR->topology->getPeer(toAddr));
-		if ( (!peer) || (peer->needsOurNetworkMembershipCertificate(_nwid,RR->node->now(),true)) ) {
-			//TRACE(">>MC %.16llx -> %s (with COM)",(unsigned long long)this,toAddr.toString().c_str());
-			_packetWithCom.newInitializationVector();
-			_packetWithCom.setDestination(toAddr);
-			RR->sw->send(_packetWithCom,true,_nwid);
-			return;
+		const uint64_t now = RR->node->now();
+		for(unsigned int i=0;i<count;++i) {
+			SharedPtr<Peer> peer(RR->topology->getPeer(toAddrs[i]));
+			if ( (!peer) || (peer->needsOurNetworkMembershipCertificate(_nwid,now,true)) ) {
+				//TRACE(">>MC %.16llx -> %s (with COM)",(unsigned long long)this,toAddrs[i].toString().c_str());
+				withCom.push_back(toAddrs[i]);
+			} else noCom.push_back(toAddrs[i]);
 		}
+		if (!withCom.empty())
+			RR->sw->sendCopies(_packetWithCom,&(withCom[0]),(unsigned int)withCom.size(),true,_nwid);
+		if (!noCom.empty())
+			RR->sw->sendCopies(_packetNoCom,&(noCom[0]),(unsigned int)noCom.size(),true,_nwid);
+	} else if (count) {
+		//TRACE(">>MC %.16llx -> %u recipients (without COM)",(unsigned long long)this,count);
+		RR->sw->sendCopies(_packetNoCom,toAddrs,count,true,_nwid);
 	}
-
-	//TRACE(">>MC %.16llx -> %s (without COM)",(unsigned long long)this,toAddr.toString().c_str());
-	_packetNoCom.newInitializationVector();
-	_packetNoCom.setDestination(toAddr);
-	RR->sw->send(_packetNoCom,true,_nwid);
 }
 
 } // namespace ZeroTier
@@ -29,6 +29,7 @@
 #include "MulticastGroup.hpp"
 #include "Address.hpp"
 #include "Packet.hpp"
+#include "Hashtable.hpp"
 
 namespace ZeroTier {
 
@@ -48,7 +49,7 @@ public:
 	 *
 	 * It must be initialized with init().
 	 */
-	OutboundMulticast() {}
+	OutboundMulticast() : _alreadySentTo(16) {}
 
 	/**
 	 * Initialize outbound multicast
@@ -95,26 +96,48 @@ public:
 	 */
 	inline bool atLimit() const throw() { return (_alreadySentTo.size() >= _limit); }
 
+	/**
+	 * Just send to several recipients without checking log
+	 *
+	 * The frame was compressed once by init(). Copies for all recipients are
+	 * armored together in batches by Switch::sendCopies().
+	 *
+	 * @param RR Runtime environment
+	 * @param toAddrs Destination addresses
+	 * @param count Number of destination addresses
+	 */
+	void sendOnly(const RuntimeEnvironment *RR,const Address *toAddrs,unsigned int count);
+
 	/**
 	 * Just send without checking log
 	 *
 	 * @param RR Runtime environment
 	 * @param toAddr Destination address
 	 */
-	void sendOnly(const RuntimeEnvironment *RR,const Address &toAddr);
+	inline void sendOnly(const RuntimeEnvironment *RR,const Address &toAddr) { sendOnly(RR,&toAddr,1); }
 
 	/**
-	 * Just send and log but do not check sent log
+	 * Just send to several recipients and log but do not check sent log
 	 *
 	 * @param RR Runtime environment
-	 * @param toAddr Destination address
+	 * @param toAddrs Destination addresses
+	 * @param count Number of destination addresses
 	 */
-	inline void sendAndLog(const RuntimeEnvironment *RR,const Address &toAddr)
+	inline void sendAndLog(const RuntimeEnvironment *RR,const Address *toAddrs,unsigned int count)
 	{
-		_alreadySentTo.push_back(toAddr);
-		sendOnly(RR,toAddr);
+		for(unsigned int i=0;i<count;++i)
+			_alreadySentTo.set(toAddrs[i],true);
+		sendOnly(RR,toAddrs,count);
 	}
 
+	/**
+	 * Just send and log but do not check sent log
+	 *
+	 * @param RR Runtime environment
+	 * @param toAddr Destination address
+	 */
+	inline void sendAndLog(const RuntimeEnvironment *RR,const Address &toAddr) { sendAndLog(RR,&toAddr,1); }
+
 	/**
 	 * Try to send this to a given peer if it hasn't been sent to them already
 	 *
@@ -124,7 +147,7 @@ public:
 	 */
 	inline bool sendIfNew(const RuntimeEnvironment *RR,const Address &toAddr)
 	{
-		if (std::find(_alreadySentTo.begin(),_alreadySentTo.end(),toAddr) == _alreadySentTo.end()) {
+		if (!_alreadySentTo.contains(toAddr)) {
 			sendAndLog(RR,toAddr);
 			return true;
 		} else return false;
@@ -136,7 +159,7 @@ private:
 	unsigned int _limit;
 	Packet _packetNoCom;
 	Packet _packetWithCom;
-	std::vector<Address> _alreadySentTo;
+	Hashtable< Address,bool > _alreadySentTo;
 	bool _haveCom;
 };
 
@@ -70,9 +70,8 @@ const char *Packet::errorString(ErrorCode e)
 
 //#endif // ZT_TRACE
 
-void Packet::armor(const void *key,bool encryptPayload)
+void Packet::armor(const ArmorKey &key,bool encryptPayload)
 {
-	unsigned char mangledKey[32];
 	unsigned char macKey[32];
 	unsigned char mac[16];
 	const unsigned int payloadLen = size() - ZT_PACKET_IDX_VERB;
@@ -81,8 +80,8 @@ void Packet::armor(const void *key,bool encryptPayload)
 	// Set flag now, since it affects key mangle function
 	setCipher(encryptPayload ? ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012 : ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE);
 
-	_salsa20MangleKey((const unsigned char *)key,mangledKey);
-	Salsa20 s20(mangledKey,256,field(ZT_PACKET_IDX_IV,8)/*,ZT_PROTO_SALSA20_ROUNDS*/);
+	Salsa20 s20;
+	_armorCipher(key,s20);
 
 	// MAC key is always the first 32 bytes of the Salsa20 key stream
 	// This is the same construction DJB's NaCl library uses
@@ -95,9 +94,8 @@ void Packet::armor(const void *key,bool encryptPayload)
 	memcpy(field(ZT_PACKET_IDX_MAC,8),mac,8);
 }
 
-bool Packet::dearmor(const void *key)
+bool Packet::dearmor(const ArmorKey &key)
 {
-	unsigned char mangledKey[32];
 	unsigned char macKey[32];
 	unsigned char mac[16];
 	const unsigned int payloadLen = size() - ZT_PACKET_IDX_VERB;
@@ -105,8 +103,8 @@ bool Packet::dearmor(const void *key)
 	unsigned int cs = cipher();
 
 	if ((cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE)||(cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012)) {
-		_salsa20MangleKey((const unsigned char *)key,mangledKey);
-		Salsa20 s20(mangledKey,256,field(ZT_PACKET_IDX_IV,8)/*,ZT_PROTO_SALSA20_ROUNDS*/);
+		Salsa20 s20;
+		_armorCipher(key,s20);
 
 		s20.encrypt12(ZERO_KEY,macKey,sizeof(macKey));
 		Poly1305::compute(mac,payload,payloadLen,macKey);
@@ -120,6 +118,100 @@ bool Packet::dearmor(const void *key)
 	} else return false; // unrecognized cipher suite
 }
 
+void Packet::armorBatch(Packet *const *packets,const ArmorKey *const *keys,unsigned int n,bool encryptPayload)
+{
+	Salsa20 s20[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	Salsa20 *s20p[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	unsigned char macKeys[ZT_PACKET_CRYPTO_BATCH_SIZE][32];
+	unsigned char macs[ZT_PACKET_CRYPTO_BATCH_SIZE][16];
+	const void *zeroes[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	void *macKeyPtrs[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	void *macPtrs[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	void *payloads[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	unsigned int payloadLens[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	unsigned int macKeyLens[ZT_PACKET_CRYPTO_BATCH_SIZE];
+
+	for(unsigned int base=0;base<n;base+=ZT_PACKET_CRYPTO_BATCH_SIZE) {
+		const unsigned int cnt = std::min(n - base,(unsigned int)ZT_PACKET_CRYPTO_BATCH_SIZE);
+
+		for(unsigned int i=0;i<cnt;++i) {
+			Packet &p = *(packets[base + i]);
+			p.setCipher(encryptPayload ? ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012 : ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE);
+			p._armorCipher(*(keys[base + i]),s20[i]);
+			s20p[i] = &(s20[i]);
+			zeroes[i] = ZERO_KEY;
+			macKeyPtrs[i] = macKeys[i];
+			macKeyLens[i] = 32;
+			macPtrs[i] = macs[i];
+			payloadLens[i] = p.size() - ZT_PACKET_IDX_VERB;
+			payloads[i] = p.field(ZT_PACKET_IDX_VERB,payloadLens[i]);
+		}
+
+		Salsa20::encrypt12Multi(s20p,zeroes,macKeyPtrs,macKeyLens,cnt);
+		if (encryptPayload)
+			Salsa20::encrypt12Multi(s20p,payloads,payloads,payloadLens,cnt);
+		Poly1305::computeMulti(macPtrs,payloads,payloadLens,macKeyPtrs,cnt);
+
+		for(unsigned int i=0;i<cnt;++i)
+			memcpy(packets[base + i]->field(ZT_PACKET_IDX_MAC,8),macs[i],8);
+	}
+}
+
+void Packet::dearmorBatch(Packet *const *packets,const ArmorKey *const *keys,unsigned int n,bool *ok)
+{
+	Salsa20 s20[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	Salsa20 *s20p[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	unsigned int idx[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	unsigned char macKeys[ZT_PACKET_CRYPTO_BATCH_SIZE][32];
+	unsigned char macs[ZT_PACKET_CRYPTO_BATCH_SIZE][16];
+	const void *zeroes[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	void *macKeyPtrs[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	void *macPtrs[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	void *payloads[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	unsigned int payloadLens[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	unsigned int macKeyLens[ZT_PACKET_CRYPTO_BATCH_SIZE];
+
+	for(unsigned int base=0;base<n;base+=ZT_PACKET_CRYPTO_BATCH_SIZE) {
+		const unsigned int cnt = std::min(n - base,(unsigned int)ZT_PACKET_CRYPTO_BATCH_SIZE);
+
+		unsigned int m = 0;
+		for(unsigned int i=0;i<cnt;++i) {
+			Packet &p = *(packets[base + i]);
+			const unsigned int cs = p.cipher();
+			if ((cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE)||(cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012)) {
+				p._armorCipher(*(keys[base + i]),s20[m]);
+				s20p[m] = &(s20[m]);
+				idx[m] = base + i;
+				zeroes[m] = ZERO_KEY;
+				macKeyPtrs[m] = macKeys[m];
+				macKeyLens[m] = 32;
+				macPtrs[m] = macs[m];
+				payloadLens[m] = p.size() - ZT_PACKET_IDX_VERB;
+				payloads[m] = p.field(ZT_PACKET_IDX_VERB,payloadLens[m]);
+				++m;
+			} else ok[base + i] = false; // unrecognized cipher suite
+		}
+
+		Salsa20::encrypt12Multi(s20p,zeroes,macKeyPtrs,macKeyLens,m);
+		Poly1305::computeMulti(macPtrs,payloads,payloadLens,macKeyPtrs,m);
+
+		// Compact down to the authentic packets that also need decryption
+		unsigned int d = 0;
+		for(unsigned int j=0;j<m;++j) {
+			Packet &p = *(packets[idx[j]]);
+			if ((ok[idx[j]] = Utils::secureEq(macs[j],p.field(ZT_PACKET_IDX_MAC,8),8))) {
+				if (p.cipher() == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012) {
+					s20p[d] = s20p[j];
+					payloads[d] = payloads[j];
+					payloadLens[d] = payloadLens[j];
+					++d;
+				}
+			}
+		}
+		Salsa20::encrypt12Multi(s20p,payloads,payloads,payloadLens,d);
+	}
+}
+
 bool Packet::compress()
 {
 	unsigned char buf[ZT_PROTO_MAX_PACKET_LENGTH * 2];
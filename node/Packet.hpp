@@ -25,6 +25,7 @@
 
 #include <string>
 #include <iostream>
+#include <algorithm>
 
 #include "Constants.hpp"
 
@@ -224,6 +225,13 @@
  */
 #define ZT_PROTO_MAX_PACKET_LENGTH (ZT_MAX_PACKET_FRAGMENTS * ZT_UDP_DEFAULT_PAYLOAD_MTU)
 
+/**
+ * Maximum number of packets armored/dearmored together by armorBatch/dearmorBatch
+ *
+ * Larger batches are processed in chunks of this size.
+ */
+#define ZT_PACKET_CRYPTO_BATCH_SIZE 16
+
 /**
  * Minimum viable packet length (a.k.a. header length)
  */
@@ -515,6 +523,35 @@ public:
 		}
 	};
 
+	/**
+	 * A 32-byte key prepared for repeated use by armor() and dearmor()
+	 *
+	 * This holds a Salsa20 instance keyed once with the raw key. Each packet
+	 * then only XORs its IV, addresses, flags, and size into a copy instead
+	 * of mangling the key and running Salsa20 setup from scratch. Peer keeps
+	 * one of these alongside its agreed secret.
+	 */
+	class ArmorKey
+	{
+		friend class Packet;
+
+	public:
+		ArmorKey() {}
+
+		/**
+		 * @param key 32-byte key
+		 */
+		ArmorKey(const void *key) { init(key); }
+
+		/**
+		 * @param key 32-byte key
+		 */
+		inline void init(const void *key) { _s20.init(key,256,ZERO_KEY); }
+
+	private:
+		Salsa20 _s20;
+	};
+
 	/**
 	 * ZeroTier protocol verbs
 	 */
@@ -1297,13 +1334,21 @@ public:
 	 */
 	inline const unsigned char *payload() const { return field(ZT_PACKET_IDX_PAYLOAD,size() - ZT_PACKET_IDX_PAYLOAD); }
 
+	/**
+	 * Armor packet for transport
+	 *
+	 * @param key Prepared key
+	 * @param encryptPayload If true, encrypt packet payload, else just MAC
+	 */
+	void armor(const ArmorKey &key,bool encryptPayload);
+
 	/**
 	 * Armor packet for transport
 	 *
 	 * @param key 32-byte key
 	 * @param encryptPayload If true, encrypt packet payload, else just MAC
 	 */
-	void armor(const void *key,bool encryptPayload);
+	inline void armor(const void *key,bool encryptPayload) { armor(ArmorKey(key),encryptPayload); }
 
 	/**
 	 * Verify and (if encrypted) decrypt packet
@@ -1312,10 +1357,45 @@ public:
 	 * for these. These are handled in IncomingPacket if the sending physical
 	 * address and MAC field match a trusted path.
 	 *
+	 * @param key Prepared key
+	 * @return False if packet is invalid or failed MAC authenticity check
+	 */
+	bool dearmor(const ArmorKey &key);
+
+	/**
+	 * Verify and (if encrypted) decrypt packet
+	 *
 	 * @param key 32-byte key
 	 * @return False if packet is invalid or failed MAC authenticity check
 	 */
-	bool dearmor(const void *key);
+	inline bool dearmor(const void *key) { return dearmor(ArmorKey(key)); }
+
+	/**
+	 * Armor several packets at once
+	 *
+	 * This has the same result as calling armor() on each packet, but Salsa20
+	 * and Poly1305 work for different packets is interleaved (see
+	 * Salsa20::encrypt12Multi() and Poly1305::computeMulti()).
+	 *
+	 * @param packets Packets to armor
+	 * @param keys Prepared keys, one per packet
+	 * @param n Number of packets
+	 * @param encryptPayload If true, encrypt packet payloads, else just MAC
+	 */
+	static void armorBatch(Packet *const *packets,const ArmorKey *const *keys,unsigned int n,bool encryptPayload);
+
+	/**
+	 * Verify and (if encrypted) decrypt several packets at once
+	 *
+	 * This has the same result as calling dearmor() on each packet. Packets
+	 * that fail authentication are left unmodified.
+	 *
+	 * @param packets Packets to dearmor
+	 * @param keys Prepared keys, one per packet
+	 * @param n Number of packets
+	 * @param ok Array to receive dearmor() result for each packet
+	 */
+	static void dearmorBatch(Packet *const *packets,const ArmorKey *const *keys,unsigned int n,bool *ok);
 
 	/**
 	 * Attempt to compress payload if not already (must be unencrypted)
@@ -1343,38 +1423,34 @@ private:
 	static const unsigned char ZERO_KEY[32];
 
 	/**
-	 * Deterministically mangle a 256-bit crypto key based on packet
+	 * Set up this packet's Salsa20 instance from a prepared key
 	 *
-	 * This uses extra data from the packet to mangle the secret, giving us an
+	 * This mangles the key using extra data from the packet, giving us an
 	 * effective IV that is somewhat more than 64 bits. This is "free" for
 	 * Salsa20 since it has negligible key setup time so using a different
 	 * key each time is fine.
 	 *
-	 * @param in Input key (32 bytes)
-	 * @param out Output buffer (32 bytes)
+	 * The first 21 bytes of the key are XORed with: the IV and source and
+	 * destination addresses (using the addresses divides the key space into
+	 * two halves-- A->B and B->A), the flags with the hop count masked off
+	 * (hop count is altered by forwarding nodes and is one of the only parts
+	 * of a packet modifiable without the key), and the raw packet size in
+	 * bytes, little-endian (so each packet size defines a new key space).
+	 * The rest of the raw key is used unchanged.
+	 *
+	 * @param key Prepared key
+	 * @param s20 Salsa20 instance to initialize
 	 */
-	inline void _salsa20MangleKey(const unsigned char *in,unsigned char *out) const
+	inline void _armorCipher(const ArmorKey &key,Salsa20 &s20) const
 	{
 		const unsigned char *d = (const unsigned char *)data();
-
-		// IV and source/destination addresses. Using the addresses divides the
-		// key space into two halves-- A->B and B->A (since order will change).
-		for(unsigned int i=0;i<18;++i) // 8 + (ZT_ADDRESS_LENGTH * 2) == 18
-			out[i] = in[i] ^ d[i];
-
-		// Flags, but with hop count masked off. Hop count is altered by forwarding
-		// nodes. It's one of the only parts of a packet modifiable by people
-		// without the key.
-		out[18] = in[18] ^ (d[ZT_PACKET_IDX_FLAGS] & 0xf8);
-
-		// Raw packet size in bytes -- thus each packet size defines a new
-		// key space.
-		out[19] = in[19] ^ (unsigned char)(size() & 0xff);
-		out[20] = in[20] ^ (unsigned char)((size() >> 8) & 0xff); // little endian
-
-		// Rest of raw key is used unchanged
-		for(unsigned int i=21;i<32;++i)
-			out[i] = in[i];
+		const unsigned int sz = size();
+		uint32_t tweak[6];
+		for(unsigned int i=0;i<16;i+=4) // IV (8) and destination and first 3 bytes of source address
+			tweak[i >> 2] = (uint32_t)d[i] | ((uint32_t)d[i + 1] << 8) | ((uint32_t)d[i + 2] << 16) | ((uint32_t)d[i + 3] << 24);
+		tweak[4] = (uint32_t)d[16] | ((uint32_t)d[17] << 8) | ((uint32_t)(d[ZT_PACKET_IDX_FLAGS] & 0xf8) << 16) | ((uint32_t)(sz & 0xff) << 24);
+		tweak[5] = (uint32_t)((sz >> 8) & 0xff);
+		s20.initFrom(key._s20,tweak,d);
 	}
 };
 
@@ -0,0 +1,116 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2016  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZT_PACKETPOOL_HPP
+#define ZT_PACKETPOOL_HPP
+
+#include "Constants.hpp"
+#include "IncomingPacket.hpp"
+#include "SizeClassPool.hpp"
+#include "AtomicCounter.hpp"
+#include "Mutex.hpp"
+#include "NonCopyable.hpp"
+
+namespace ZeroTier {
+
+/**
+ * Pool of receive buffers
+ *
+ * Received packets are written straight into an IncomingPacket from here
+ * and then passed by pointer through reassembly, decode, and deferral.
+ * Whichever of these ends up owning the packet last puts it back. Idle
+ * buffers are spread across a few separately locked shards so packet
+ * worker threads don't all wait on one lock. New buffers come from
+ * SizeClassPool.
+ */
+class PacketPool : NonCopyable
+{
+public:
+	PacketPool()
+	{
+		for(unsigned int s=0;s<ZT_PACKET_POOL_SHARDS;++s)
+			_shards[s].count = 0;
+	}
+
+	~PacketPool()
+	{
+		for(unsigned int s=0;s<ZT_PACKET_POOL_SHARDS;++s) {
+			for(unsigned int i=0;i<_shards[s].count;++i)
+				_free(_shards[s].free[i]);
+		}
+	}
+
+	/**
+	 * Get an empty packet
+	 *
+	 * @return Packet, which must be returned with put() (never NULL)
+	 * @throws std::bad_alloc Out of memory
+	 */
+	inline IncomingPacket *get()
+	{
+		const unsigned int first = (unsigned int)(++_next);
+		for(unsigned int k=0;k<ZT_PACKET_POOL_SHARDS;++k) {
+			_Shard &s = _shards[(first + k) & (ZT_PACKET_POOL_SHARDS - 1)];
+			Mutex::Lock _l(s.lock);
+			if (s.count)
+				return s.free[--s.count];
+		}
+		return new(SizeClassPool::alloc(sizeof(IncomingPacket))) IncomingPacket();
+	}
+
+	/**
+	 * Return a packet to the pool
+	 *
+	 * @param pkt Packet from get() (NULL is ignored)
+	 */
+	inline void put(IncomingPacket *pkt)
+	{
+		if (!pkt)
+			return;
+		_Shard &s = _shards[(unsigned int)(((uintptr_t)pkt) >> 12) & (ZT_PACKET_POOL_SHARDS - 1)];
+		{
+			Mutex::Lock _l(s.lock);
+			if (s.count < (ZT_PACKET_POOL_SIZE / ZT_PACKET_POOL_SHARDS)) {
+				s.free[s.count++] = pkt;
+				return;
+			}
+		}
+		_free(pkt);
+	}
+
+private:
+	static inline void _free(IncomingPacket *pkt)
+	{
+		pkt->~IncomingPacket();
+		SizeClassPool::free(pkt,sizeof(IncomingPacket));
+	}
+
+	struct _Shard
+	{
+		IncomingPacket *free[ZT_PACKET_POOL_SIZE / ZT_PACKET_POOL_SHARDS];
+		unsigned int count;
+		Mutex lock;
+	};
+
+	_Shard _shards[ZT_PACKET_POOL_SHARDS];
+	AtomicCounter _next;
+};
+
+} // namespace ZeroTier
+
+#endif
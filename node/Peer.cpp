@@ -46,6 +46,9 @@ Peer::Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Ident
 	_lastDirectPathPushSent(0),
 	_lastDirectPathPushReceive(0),
 	_lastPathSort(0),
+	_timerDeadline(0),
+	_lastPathLearned(0),
+	_lastPersisted(0),
 	_vProto(0),
 	_vMajor(0),
 	_vMinor(0),
@@ -59,6 +62,35 @@ Peer::Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Ident
 {
 	if (!myIdentity.agree(peerIdentity,_key,ZT_PEER_SECRET_KEY_LENGTH))
 		throw std::runtime_error("new peer identity key agreement failed");
+	_armorKey.init(_key);
+}
+
+Peer::Peer(const RuntimeEnvironment *renv,const Identity &peerIdentity,const unsigned char *key) :
+	RR(renv),
+	_lastUsed(0),
+	_lastReceive(0),
+	_lastUnicastFrame(0),
+	_lastMulticastFrame(0),
+	_lastAnnouncedTo(0),
+	_lastDirectPathPushSent(0),
+	_lastDirectPathPushReceive(0),
+	_lastPathSort(0),
+	_timerDeadline(0),
+	_lastPathLearned(0),
+	_lastPersisted(0),
+	_vProto(0),
+	_vMajor(0),
+	_vMinor(0),
+	_vRevision(0),
+	_id(peerIdentity),
+	_numPaths(0),
+	_latency(0),
+	_directPathPushCutoffCount(0),
+	_networkComs(4),
+	_lastPushedComs(4)
+{
+	memcpy(_key,key,ZT_PEER_SECRET_KEY_LENGTH);
+	_armorKey.init(_key);
 }
 
 void Peer::received(
@@ -93,7 +125,7 @@ void Peer::received(
 					outp.append(redirectTo.rawIpData(),16);
 				}
 				outp.append((uint16_t)redirectTo.port());
-				outp.armor(_key,true);
+				outp.armor(_armorKey,true);
 				RR->node->putPacket(localAddr,remoteAddr,outp.data(),outp.size());
 			} else {
 				// For older peers we use RENDEZVOUS to coax them into contacting us elsewhere.
@@ -108,7 +140,7 @@ void Peer::received(
 					outp.append((uint8_t)16);
 					outp.append(redirectTo.rawIpData(),16);
 				}
-				outp.armor(_key,true);
+				outp.armor(_armorKey,true);
 				RR->node->putPacket(localAddr,remoteAddr,outp.data(),outp.size());
 			}
 			suboptimalPath = true;
@@ -118,10 +150,14 @@ void Peer::received(
 
 	const uint64_t now = RR->node->now();
 	_lastReceive = now;
-	if ((verb == Packet::VERB_FRAME)||(verb == Packet::VERB_EXT_FRAME))
-		_lastUnicastFrame = now;
-	else if (verb == Packet::VERB_MULTICAST_FRAME)
-		_lastMulticastFrame = now;
+	if ((verb == Packet::VERB_FRAME)||(verb == Packet::VERB_EXT_FRAME)||(verb == Packet::VERB_MULTICAST_FRAME)) {
+		// Peers that start sending frames need their link kept alive, so bring their timer forward
+		if ((!activelyTransferringFrames(now))&&(!RR->topology->amRoot()))
+			RR->topology->schedulePeer(*this,now + ZT_PING_CHECK_INVERVAL);
+		if (verb == Packet::VERB_MULTICAST_FRAME)
+			_lastMulticastFrame = now;
+		else _lastUnicastFrame = now;
+	}
 
 	if (hops == 0) {
 		bool pathIsConfirmed = false;
@@ -161,6 +197,7 @@ void Peer::received(
 				if (slot) {
 					*slot = Path(localAddr,remoteAddr);
 					slot->received(now);
+					_lastPathLearned = now;
 #ifdef ZT_ENABLE_CLUSTER
 					slot->setClusterSuboptimal(suboptimalPath);
 #endif
@@ -178,7 +215,7 @@ void Peer::received(
 
 				if ( (_vProto >= 5) && ( !((_vMajor == 1)&&(_vMinor == 1)&&(_vRevision == 0)) ) ) {
 					Packet outp(_id.address(),RR->identity.address(),Packet::VERB_ECHO);
-					outp.armor(_key,true);
+					outp.armor(_armorKey,true);
 					RR->node->putPacket(localAddr,remoteAddr,outp.data(),outp.size());
 				} else {
 					sendHELLO(localAddr,remoteAddr,now);
@@ -190,9 +227,15 @@ void Peer::received(
 
 	if ((now - _lastAnnouncedTo) >= ((ZT_MULTICAST_LIKE_EXPIRE / 2) - 1000)) {
 		_lastAnnouncedTo = now;
+
+		// LIKEs for all networks share packets, so a peer we have many networks
+		// in common with gets a few full packets rather than one per network.
+		Packet outp(_id.address(),RR->identity.address(),Packet::VERB_MULTICAST_LIKE);
 		const std::vector< SharedPtr<Network> > networks(RR->node->allNetworks());
 		for(std::vector< SharedPtr<Network> >::const_iterator n(networks.begin());n!=networks.end();++n)
-			(*n)->tryAnnounceMulticastGroupsTo(SharedPtr<Peer>(this));
+			(*n)->tryAnnounceMulticastGroupsTo(SharedPtr<Peer>(this),outp);
+		if (outp.size() > ZT_PROTO_MIN_PACKET_LENGTH)
+			RR->sw->send(outp,true,0);
 	}
 }
 
@@ -209,7 +252,7 @@ void Peer::sendHELLO(const InetAddress &localAddr,const InetAddress &atAddress,u
 	outp.append((uint64_t)RR->topology->worldId());
 	outp.append((uint64_t)RR->topology->worldTimestamp());
 
-	outp.armor(_key,false); // HELLO is sent in the clear
+	outp.armor(_armorKey,false); // HELLO is sent in the clear
 	RR->node->putPacket(localAddr,atAddress,outp.data(),outp.size(),ttl);
 }
 
@@ -321,7 +364,7 @@ bool Peer::pushDirectPaths(const InetAddress &localAddr,const InetAddress &toAdd
 
 		if (count) {
 			outp.setAt(ZT_PACKET_IDX_PAYLOAD,(uint16_t)count);
-			outp.armor(_key,true);
+			outp.armor(_armorKey,true);
 			RR->node->putPacket(localAddr,toAddress,outp.data(),outp.size(),0);
 		}
 	}
@@ -382,57 +425,80 @@ bool Peer::networkMembershipCertificatesAgree(uint64_t nwid,const CertificateOfM
 
 bool Peer::validateAndSetNetworkMembershipCertificate(uint64_t nwid,const CertificateOfMembership &com)
 {
-	// Sanity checks
-	if ((!com)||(com.issuedTo() != _id.address()))
-		return false;
+	SharedPtr<Peer> signer;
+	const int c = _checkNetworkMembershipCertificate(nwid,com,signer);
+	if (c <= 0)
+		return (c == 0);
 
-	// Return true if we already have this *exact* COM
-	{
-		Mutex::Lock _l(_networkComs_m);
-		_NetworkCom *ourCom = _networkComs.get(nwid);
-		if ((ourCom)&&(ourCom->com == com))
-			return true;
+	const Identity &signerId = (signer) ? signer->identity() : RR->identity;
+	const uint64_t now = RR->node->now();
+	if (!RR->topology->comVerified(com,signerId,now)) {
+		if (!com.verify(signerId)) {
+			TRACE("rejected network membership certificate for %.16llx signed by %s: signature check failed",(unsigned long long)nwid,com.signedBy().toString().c_str());
+			return false; // invalid signature
+		}
+		RR->topology->setComVerified(com,signerId,now);
 	}
 
-	// Check signature, log and return if cert is invalid
-	if (com.signedBy() != Network::controllerFor(nwid)) {
-		TRACE("rejected network membership certificate for %.16llx signed by %s: signer not a controller of this network",(unsigned long long)nwid,com.signedBy().toString().c_str());
-		return false; // invalid signer
+	// If we made it past all those checks, add or update cert in our cert info store
+	{
+		Mutex::Lock _l(_networkComs_m);
+		_networkComs.set(nwid,_NetworkCom(now,com));
 	}
 
-	if (com.signedBy() == RR->identity.address()) {
-
-		// We are the controller: RR->identity.address() == controller() == cert.signedBy()
-		// So, verify that we signed th cert ourself
-		if (!com.verify(RR->identity)) {
-			TRACE("rejected network membership certificate for %.16llx self signed by %s: signature check failed",(unsigned long long)nwid,com.signedBy().toString().c_str());
-			return false; // invalid signature
-		}
-
-	} else {
+	return true;
+}
 
-		SharedPtr<Peer> signer(RR->topology->getPeer(com.signedBy()));
+unsigned int Peer::validateAndSetNetworkMembershipCertificates(const CertificateOfMembership *coms,unsigned int n)
+{
+	const CertificateOfMembership *check[16];
+	const Identity *ids[16];
+	SharedPtr<Peer> signers[16];
+	bool ok[16];
+	const CertificateOfMembership *known[16];
+	unsigned int valid = 0;
+	const uint64_t now = RR->node->now();
 
-		if (!signer) {
-			// This would be rather odd, since this is our controller... could happen
-			// if we get packets before we've gotten config.
-			RR->sw->requestWhois(com.signedBy());
-			return false; // signer unknown
+	for(unsigned int i=0;i<n;) {
+		unsigned int cnt = 0,nknown = 0;
+		while ((i < n)&&((cnt + nknown) < 16)) {
+			const CertificateOfMembership &com = coms[i++];
+			const int c = _checkNetworkMembershipCertificate(com.networkId(),com,signers[cnt]);
+			if (c > 0) {
+				const Identity *const signerId = (signers[cnt]) ? &(signers[cnt]->identity()) : &(RR->identity);
+				if (RR->topology->comVerified(com,*signerId,now)) {
+					known[nknown++] = &com;
+				} else {
+					check[cnt] = &com;
+					ids[cnt] = signerId;
+					++cnt;
+				}
+			} else if (c == 0) {
+				++valid;
+			}
 		}
 
-		if (!com.verify(signer->identity())) {
-			TRACE("rejected network membership certificate for %.16llx signed by %s: signature check failed",(unsigned long long)nwid,com.signedBy().toString().c_str());
-			return false; // invalid signature
+		CertificateOfMembership::verifyBatch(check,ids,cnt,ok);
+		for(unsigned int k=0;k<cnt;++k) {
+			if (ok[k])
+				RR->topology->setComVerified(*check[k],*ids[k],now);
 		}
-	}
 
-	// If we made it past all those checks, add or update cert in our cert info store
-	{
 		Mutex::Lock _l(_networkComs_m);
-		_networkComs.set(nwid,_NetworkCom(RR->node->now(),com));
+		for(unsigned int k=0;k<nknown;++k)
+			_networkComs.set(known[k]->networkId(),_NetworkCom(now,*known[k]));
+		valid += nknown;
+		for(unsigned int k=0;k<cnt;++k) {
+			if (ok[k]) {
+				_networkComs.set(check[k]->networkId(),_NetworkCom(now,*check[k]));
+				++valid;
+			} else {
+				TRACE("rejected network membership certificate for %.16llx signed by %s: signature check failed",(unsigned long long)check[k]->networkId(),check[k]->signedBy().toString().c_str());
+			}
+		}
 	}
 
-	return true;
+	return valid;
 }
 
 bool Peer::needsOurNetworkMembershipCertificate(uint64_t nwid,uint64_t now,bool updateLastPushedTime)
@@ -510,7 +576,7 @@ void Peer::_doDeadPathDetection(Path &p,const uint64_t now)
 
 		if ( (_vProto >= 5) && ( !((_vMajor == 1)&&(_vMinor == 1)&&(_vRevision == 0)) ) ) {
 			Packet outp(_id.address(),RR->identity.address(),Packet::VERB_ECHO);
-			outp.armor(_key,true);
+			outp.armor(_armorKey,true);
 			p.send(RR,outp.data(),outp.size(),now);
 			p.pinged(now);
 		} else {
@@ -523,6 +589,42 @@ void Peer::_doDeadPathDetection(Path &p,const uint64_t now)
 	}
 }
 
+int Peer::_checkNetworkMembershipCertificate(uint64_t nwid,const CertificateOfMembership &com,SharedPtr<Peer> &signer)
+{
+	// Sanity checks
+	if ((!com)||(com.issuedTo() != _id.address()))
+		return -1;
+
+	// Accept if we already have this *exact* COM
+	{
+		Mutex::Lock _l(_networkComs_m);
+		_NetworkCom *ourCom = _networkComs.get(nwid);
+		if ((ourCom)&&(ourCom->com == com))
+			return 0;
+	}
+
+	if (com.signedBy() != Network::controllerFor(nwid)) {
+		TRACE("rejected network membership certificate for %.16llx signed by %s: signer not a controller of this network",(unsigned long long)nwid,com.signedBy().toString().c_str());
+		return -1; // invalid signer
+	}
+
+	if (com.signedBy() == RR->identity.address()) {
+		// We are the controller: RR->identity.address() == controller() == cert.signedBy()
+		// So, verify that we signed th cert ourself
+		signer.zero();
+	} else {
+		signer = RR->topology->getPeer(com.signedBy());
+		if (!signer) {
+			// This would be rather odd, since this is our controller... could happen
+			// if we get packets before we've gotten config.
+			RR->sw->requestWhois(com.signedBy());
+			return -1; // signer unknown
+		}
+	}
+
+	return 1;
+}
+
 Path *Peer::_getBestPath(const uint64_t now)
 {
 	Path *bestPath = (Path *)0;
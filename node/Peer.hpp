@@ -73,6 +73,15 @@ public:
 	 */
 	Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Identity &peerIdentity);
 
+	/**
+	 * Construct a new peer with a key that was already agreed
+	 *
+	 * @param renv Runtime environment
+	 * @param peerIdentity Identity of peer
+	 * @param key Key from earlier agreement with this identity (ZT_PEER_SECRET_KEY_LENGTH bytes)
+	 */
+	Peer(const RuntimeEnvironment *renv,const Identity &peerIdentity,const unsigned char *key);
+
 	/**
 	 * @return Time peer record was last used in any way
 	 */
@@ -85,6 +94,32 @@ public:
 	 */
 	inline void use(uint64_t now) throw() { _lastUsed = now; }
 
+	/**
+	 * @return Deadline of this peer's pending Topology timer or 0 if none (guarded by Topology)
+	 */
+	inline uint64_t timerDeadline() const throw() { return _timerDeadline; }
+
+	/**
+	 * @param d New deadline of this peer's pending Topology timer or 0 if none
+	 */
+	inline void setTimerDeadline(uint64_t d) throw() { _timerDeadline = d; }
+
+	/**
+	 * @param now Current time
+	 * @return True if this peer has learned a path, or been heard from for ZT_PEER_PERSIST_INTERVAL, since it was last persisted
+	 */
+	inline bool needsPersist(uint64_t now) const throw()
+	{
+		return ((_lastPathLearned > _lastPersisted)||((_lastReceive > _lastPersisted)&&((now - _lastPersisted) >= ZT_PEER_PERSIST_INTERVAL)));
+	}
+
+	/**
+	 * Log that this peer has been written to (or read from) the data store
+	 *
+	 * @param now Current time
+	 */
+	inline void persisted(uint64_t now) throw() { _lastPersisted = now; }
+
 	/**
 	 * @return This peer's ZT address (short for identity().address())
 	 */
@@ -327,6 +362,11 @@ public:
 	 */
 	inline const unsigned char *key() const throw() { return _key; }
 
+	/**
+	 * @return Secret key prepared for Packet::armor() and Packet::dearmor()
+	 */
+	inline const Packet::ArmorKey &armorKey() const throw() { return _armorKey; }
+
 	/**
 	 * Set the currently known remote version of this peer's client
 	 *
@@ -379,6 +419,19 @@ public:
 	 */
 	bool validateAndSetNetworkMembershipCertificate(uint64_t nwid,const CertificateOfMembership &com);
 
+	/**
+	 * Check the validity of several COMs and add/update those that are valid and new
+	 *
+	 * This does the same as validateAndSetNetworkMembershipCertificate() for
+	 * each COM, with the network ID taken from the COM, but checks signatures
+	 * in batches.
+	 *
+	 * @param coms Externally supplied COMs
+	 * @param n Number of COMs
+	 * @return Number of COMs that were valid
+	 */
+	unsigned int validateAndSetNetworkMembershipCertificates(const CertificateOfMembership *coms,unsigned int n);
+
 	/**
 	 * @param nwid Network ID
 	 * @param now Current time
@@ -565,7 +618,11 @@ private:
 	Path *_getBestPath(const uint64_t now);
 	Path *_getBestPath(const uint64_t now,int inetAddressFamily);
 
+	// Returns 1 if com's signature must be checked against signer (NULL for us), 0 if we already have it, or -1 if it's rejected
+	int _checkNetworkMembershipCertificate(uint64_t nwid,const CertificateOfMembership &com,SharedPtr<Peer> &signer);
+
 	unsigned char _key[ZT_PEER_SECRET_KEY_LENGTH]; // computed with key agreement, not serialized
+	Packet::ArmorKey _armorKey; // prepared from _key
 
 	const RuntimeEnvironment *RR;
 	uint64_t _lastUsed;
@@ -576,6 +633,9 @@ private:
 	uint64_t _lastDirectPathPushSent;
 	uint64_t _lastDirectPathPushReceive;
 	uint64_t _lastPathSort;
+	uint64_t _timerDeadline;
+	uint64_t _lastPathLearned; // not serialized
+	uint64_t _lastPersisted; // not serialized
 	uint16_t _vProto;
 	uint16_t _vMajor;
 	uint16_t _vMinor;
@@ -16,6 +16,12 @@ Public domain.
 #pragma warning(disable: 4146)
 #endif
 
+// SIMD versions need the 64-bit donna state below and GCC/clang target attributes
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__SSE2__) && (!defined(ZT_POLY1305_NO_SIMD))
+#define ZT_POLY1305_SIMD 1
+#include <immintrin.h>
+#endif
+
 namespace ZeroTier {
 
 #if 0
@@ -288,6 +294,66 @@ poly1305_blocks(poly1305_state_internal_t *st, const unsigned char *m, size_t by
   st->h[2] = h2;
 }
 
+/* two independent messages in lockstep: the multiply chains don't depend on
+   each other, so the CPU can overlap them (multi-buffer) */
+#define POLY1305_HAVE_BLOCKS2 1
+static inline void
+poly1305_blocks2(poly1305_state_internal_t *sta, const unsigned char *ma, poly1305_state_internal_t *stb, const unsigned char *mb, size_t bytes) {
+  const unsigned long long hibit = ((unsigned long long)1 << 40); /* 1 << 128 */
+  unsigned long long ra0,ra1,ra2,sa1,sa2,ha0,ha1,ha2,ca;
+  unsigned long long rb0,rb1,rb2,sb1,sb2,hb0,hb1,hb2,cb;
+  uint128_t da0,da1,da2,da,db0,db1,db2,db;
+
+  ra0 = sta->r[0]; ra1 = sta->r[1]; ra2 = sta->r[2];
+  rb0 = stb->r[0]; rb1 = stb->r[1]; rb2 = stb->r[2];
+  ha0 = sta->h[0]; ha1 = sta->h[1]; ha2 = sta->h[2];
+  hb0 = stb->h[0]; hb1 = stb->h[1]; hb2 = stb->h[2];
+  sa1 = ra1 * (5 << 2); sa2 = ra2 * (5 << 2);
+  sb1 = rb1 * (5 << 2); sb2 = rb2 * (5 << 2);
+
+  while (bytes >= poly1305_block_size) {
+    unsigned long long ta0,ta1,tb0,tb1;
+
+    ta0 = U8TO64(&ma[0]); ta1 = U8TO64(&ma[8]);
+    tb0 = U8TO64(&mb[0]); tb1 = U8TO64(&mb[8]);
+
+    ha0 += (( ta0                     ) & 0xfffffffffff);
+    hb0 += (( tb0                     ) & 0xfffffffffff);
+    ha1 += (((ta0 >> 44) | (ta1 << 20)) & 0xfffffffffff);
+    hb1 += (((tb0 >> 44) | (tb1 << 20)) & 0xfffffffffff);
+    ha2 += (((ta1 >> 24)              ) & 0x3ffffffffff) | hibit;
+    hb2 += (((tb1 >> 24)              ) & 0x3ffffffffff) | hibit;
+
+    MUL(da0, ha0, ra0); MUL(db0, hb0, rb0);
+    MUL(da, ha1, sa2); ADD(da0, da); MUL(db, hb1, sb2); ADD(db0, db);
+    MUL(da, ha2, sa1); ADD(da0, da); MUL(db, hb2, sb1); ADD(db0, db);
+    MUL(da1, ha0, ra1); MUL(db1, hb0, rb1);
+    MUL(da, ha1, ra0); ADD(da1, da); MUL(db, hb1, rb0); ADD(db1, db);
+    MUL(da, ha2, sa2); ADD(da1, da); MUL(db, hb2, sb2); ADD(db1, db);
+    MUL(da2, ha0, ra2); MUL(db2, hb0, rb2);
+    MUL(da, ha1, ra1); ADD(da2, da); MUL(db, hb1, rb1); ADD(db2, db);
+    MUL(da, ha2, ra0); ADD(da2, da); MUL(db, hb2, rb0); ADD(db2, db);
+
+                    ca = SHR(da0, 44); ha0 = LO(da0) & 0xfffffffffff;
+                    cb = SHR(db0, 44); hb0 = LO(db0) & 0xfffffffffff;
+    ADDLO(da1, ca); ca = SHR(da1, 44); ha1 = LO(da1) & 0xfffffffffff;
+    ADDLO(db1, cb); cb = SHR(db1, 44); hb1 = LO(db1) & 0xfffffffffff;
+    ADDLO(da2, ca); ca = SHR(da2, 42); ha2 = LO(da2) & 0x3ffffffffff;
+    ADDLO(db2, cb); cb = SHR(db2, 42); hb2 = LO(db2) & 0x3ffffffffff;
+    ha0 += ca * 5; ca = (ha0 >> 44); ha0 = ha0 & 0xfffffffffff;
+    hb0 += cb * 5; cb = (hb0 >> 44); hb0 = hb0 & 0xfffffffffff;
+    ha1 += ca;
+    hb1 += cb;
+
+    ma += poly1305_block_size;
+    mb += poly1305_block_size;
+    bytes -= poly1305_block_size;
+  }
+
+  sta->h[0] = ha0; sta->h[1] = ha1; sta->h[2] = ha2;
+  stb->h[0] = hb0; stb->h[1] = hb1; stb->h[2] = hb2;
+}
+
 static inline void
 poly1305_finish(poly1305_context *ctx, unsigned char mac[16]) {
   poly1305_state_internal_t *st = (poly1305_state_internal_t *)ctx;
@@ -614,15 +680,291 @@ poly1305_update(poly1305_context *ctx, const unsigned char *m, size_t bytes) {
   }
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// SIMD multi-block back ends (SSE2 2-way, AVX2 4-way)
+//
+// These use radix 2^26 limbs so that 32x32->64 vector multiplies can be used.
+// With W lanes, lane j accumulates blocks j, j+W, j+2W, ... multiplied by r^W
+// each step, except the final step where lane j is multiplied by r^(W-j). The
+// sum of the lanes is then exactly the h that the scalar code would have after
+// the same blocks, so the scalar code can carry on from there with the tail.
+
+#ifdef ZT_POLY1305_SIMD
+
+// Only use SIMD for messages at least this long; the r^n setup isn't free
+#define ZT_POLY1305_SIMD_MIN_BYTES 256
+
+static inline void
+poly1305_r26(const unsigned char key[16], uint32_t r[5]) {
+  const unsigned long long t0 = U8TO64(&key[0]);
+  const unsigned long long t1 = U8TO64(&key[8]);
+  r[0] = (uint32_t)( t0                     ) & 0x3ffffff;
+  r[1] = (uint32_t)((t0 >> 26)              ) & 0x3ffff03;
+  r[2] = (uint32_t)((t0 >> 52) | (t1 << 12) ) & 0x3ffc0ff;
+  r[3] = (uint32_t)((t1 >> 14)              ) & 0x3f03fff;
+  r[4] = (uint32_t)((t1 >> 40)              ) & 0x00fffff;
+}
+
+/* o = a * b mod p (2^26 limbs, carried so each limb fits in 26 bits plus a little) */
+static inline void
+poly1305_mul26(uint32_t o[5], const uint32_t a[5], const uint32_t b[5]) {
+  const unsigned long long s1 = b[1] * 5, s2 = b[2] * 5, s3 = b[3] * 5, s4 = b[4] * 5;
+  unsigned long long d0,d1,d2,d3,d4,c;
+  d0 = (unsigned long long)a[0]*b[0] + (unsigned long long)a[1]*s4 + (unsigned long long)a[2]*s3 + (unsigned long long)a[3]*s2 + (unsigned long long)a[4]*s1;
+  d1 = (unsigned long long)a[0]*b[1] + (unsigned long long)a[1]*b[0] + (unsigned long long)a[2]*s4 + (unsigned long long)a[3]*s3 + (unsigned long long)a[4]*s2;
+  d2 = (unsigned long long)a[0]*b[2] + (unsigned long long)a[1]*b[1] + (unsigned long long)a[2]*b[0] + (unsigned long long)a[3]*s4 + (unsigned long long)a[4]*s3;
+  d3 = (unsigned long long)a[0]*b[3] + (unsigned long long)a[1]*b[2] + (unsigned long long)a[2]*b[1] + (unsigned long long)a[3]*b[0] + (unsigned long long)a[4]*s4;
+  d4 = (unsigned long long)a[0]*b[4] + (unsigned long long)a[1]*b[3] + (unsigned long long)a[2]*b[2] + (unsigned long long)a[3]*b[1] + (unsigned long long)a[4]*b[0];
+               c = d0 >> 26; d0 &= 0x3ffffff;
+  d1 += c;     c = d1 >> 26; d1 &= 0x3ffffff;
+  d2 += c;     c = d2 >> 26; d2 &= 0x3ffffff;
+  d3 += c;     c = d3 >> 26; d3 &= 0x3ffffff;
+  d4 += c;     c = d4 >> 26; d4 &= 0x3ffffff;
+  d0 += c * 5; c = d0 >> 26; d0 &= 0x3ffffff;
+  d1 += c;
+  o[0] = (uint32_t)d0; o[1] = (uint32_t)d1; o[2] = (uint32_t)d2; o[3] = (uint32_t)d3; o[4] = (uint32_t)d4;
+}
+
+/* fold summed 2^26 lanes (each under 2^32) into the 44/44/42-bit scalar state */
+static inline void
+poly1305_h26_to_state(poly1305_state_internal_t *st, const unsigned long long h[5]) {
+  unsigned long long v,c;
+  v = h[0] + (h[1] << 26);                      st->h[0] = v & 0xfffffffffff; c = v >> 44;
+  v = c + (h[2] << 8) + (h[3] << 34);           st->h[1] = v & 0xfffffffffff; c = v >> 44;
+  v = c + (h[4] << 16);                         st->h[2] = v & 0x3ffffffffff; c = v >> 42;
+  st->h[0] += c * 5; c = st->h[0] >> 44; st->h[0] &= 0xfffffffffff;
+  st->h[1] += c;
+}
+
+/* one step: H = (H + M) * R, then partial carry */
+#define ZT_POLY1305_VSTEP(ADD,MUL,SRL,AND,SLL,H,M,R,S,MASK) { \
+  H[0] = ADD(H[0],M[0]); H[1] = ADD(H[1],M[1]); H[2] = ADD(H[2],M[2]); H[3] = ADD(H[3],M[3]); H[4] = ADD(H[4],M[4]); \
+  __typeof__(H[0]) d0 = ADD(ADD(ADD(ADD(MUL(H[0],R[0]),MUL(H[1],S[4])),MUL(H[2],S[3])),MUL(H[3],S[2])),MUL(H[4],S[1])); \
+  __typeof__(H[0]) d1 = ADD(ADD(ADD(ADD(MUL(H[0],R[1]),MUL(H[1],R[0])),MUL(H[2],S[4])),MUL(H[3],S[3])),MUL(H[4],S[2])); \
+  __typeof__(H[0]) d2 = ADD(ADD(ADD(ADD(MUL(H[0],R[2]),MUL(H[1],R[1])),MUL(H[2],R[0])),MUL(H[3],S[4])),MUL(H[4],S[3])); \
+  __typeof__(H[0]) d3 = ADD(ADD(ADD(ADD(MUL(H[0],R[3]),MUL(H[1],R[2])),MUL(H[2],R[1])),MUL(H[3],R[0])),MUL(H[4],S[4])); \
+  __typeof__(H[0]) d4 = ADD(ADD(ADD(ADD(MUL(H[0],R[4]),MUL(H[1],R[3])),MUL(H[2],R[2])),MUL(H[3],R[1])),MUL(H[4],R[0])); \
+  d1 = ADD(d1,SRL(d0,26)); H[0] = AND(d0,MASK); \
+  d2 = ADD(d2,SRL(d1,26)); H[1] = AND(d1,MASK); \
+  d3 = ADD(d3,SRL(d2,26)); H[2] = AND(d2,MASK); \
+  d4 = ADD(d4,SRL(d3,26)); H[3] = AND(d3,MASK); \
+  const __typeof__(H[0]) c4 = SRL(d4,26); H[4] = AND(d4,MASK); \
+  H[0] = ADD(H[0],ADD(c4,SLL(c4,2))); \
+  H[1] = ADD(H[1],SRL(H[0],26)); H[0] = AND(H[0],MASK); \
+}
+
+/* split LO/HI 64-bit halves of blocks into 2^26 limbs with the 2^128 bit set */
+#define ZT_POLY1305_VLIMBS(SRL,SLL,AND,OR,LO,HI,M,MASK,HIBIT) { \
+  M[0] = AND(LO,MASK); \
+  M[1] = AND(SRL(LO,26),MASK); \
+  M[2] = AND(OR(SRL(LO,52),SLL(HI,12)),MASK); \
+  M[3] = AND(SRL(HI,14),MASK); \
+  M[4] = OR(SRL(HI,40),HIBIT); \
+}
+
+static void
+poly1305_blocks_sse2(poly1305_state_internal_t *st, const uint32_t r1[5], const unsigned char *m, size_t blocks) {
+  const __m128i mask = _mm_set1_epi64x(0x3ffffff);
+  const __m128i hibit = _mm_set1_epi64x(1 << 24);
+  uint32_t r2[5];
+  __m128i H[5],M[5],R[5],S[5];
+  unsigned long long h[5],lanes[2];
+  int i;
+
+  poly1305_mul26(r2,r1,r1);
+  for (i = 0; i < 5; i++) {
+    H[i] = _mm_setzero_si128();
+    R[i] = _mm_set1_epi64x(r2[i]);
+    S[i] = _mm_set1_epi64x(r2[i] * 5);
+  }
+
+  for (;;) {
+    const __m128i a = _mm_loadu_si128((const __m128i *)m);
+    const __m128i b = _mm_loadu_si128((const __m128i *)(m + 16));
+    const __m128i lo = _mm_unpacklo_epi64(a,b);
+    const __m128i hi = _mm_unpackhi_epi64(a,b);
+    ZT_POLY1305_VLIMBS(_mm_srli_epi64,_mm_slli_epi64,_mm_and_si128,_mm_or_si128,lo,hi,M,mask,hibit);
+    m += 32;
+    blocks -= 2;
+    if (!blocks) {
+      for (i = 0; i < 5; i++) {
+        R[i] = _mm_set_epi64x(r1[i],r2[i]);
+        S[i] = _mm_set_epi64x(r1[i] * 5,r2[i] * 5);
+      }
+      ZT_POLY1305_VSTEP(_mm_add_epi64,_mm_mul_epu32,_mm_srli_epi64,_mm_and_si128,_mm_slli_epi64,H,M,R,S,mask);
+      break;
+    }
+    ZT_POLY1305_VSTEP(_mm_add_epi64,_mm_mul_epu32,_mm_srli_epi64,_mm_and_si128,_mm_slli_epi64,H,M,R,S,mask);
+  }
+
+  for (i = 0; i < 5; i++) {
+    _mm_storeu_si128((__m128i *)lanes,H[i]);
+    h[i] = lanes[0] + lanes[1];
+  }
+  poly1305_h26_to_state(st,h);
+}
+
+__attribute__((target("avx2")))
+static void
+poly1305_blocks_avx2(poly1305_state_internal_t *st, const uint32_t r1[5], const unsigned char *m, size_t blocks) {
+  const __m256i mask = _mm256_set1_epi64x(0x3ffffff);
+  const __m256i hibit = _mm256_set1_epi64x(1 << 24);
+  uint32_t r2[5],r3[5],r4[5];
+  __m256i H[5],M[5],R[5],S[5];
+  unsigned long long h[5],lanes[4];
+  int i;
+
+  poly1305_mul26(r2,r1,r1);
+  poly1305_mul26(r3,r2,r1);
+  poly1305_mul26(r4,r2,r2);
+  for (i = 0; i < 5; i++) {
+    H[i] = _mm256_setzero_si256();
+    R[i] = _mm256_set1_epi64x(r4[i]);
+    S[i] = _mm256_set1_epi64x(r4[i] * 5);
+  }
+
+  for (;;) {
+    const __m256i a = _mm256_loadu_si256((const __m256i *)m);
+    const __m256i b = _mm256_loadu_si256((const __m256i *)(m + 32));
+    const __m256i lo = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a,b),0xd8);
+    const __m256i hi = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(a,b),0xd8);
+    ZT_POLY1305_VLIMBS(_mm256_srli_epi64,_mm256_slli_epi64,_mm256_and_si256,_mm256_or_si256,lo,hi,M,mask,hibit);
+    m += 64;
+    blocks -= 4;
+    if (!blocks) {
+      for (i = 0; i < 5; i++) {
+        R[i] = _mm256_set_epi64x(r1[i],r2[i],r3[i],r4[i]);
+        S[i] = _mm256_set_epi64x(r1[i] * 5,r2[i] * 5,r3[i] * 5,r4[i] * 5);
+      }
+      ZT_POLY1305_VSTEP(_mm256_add_epi64,_mm256_mul_epu32,_mm256_srli_epi64,_mm256_and_si256,_mm256_slli_epi64,H,M,R,S,mask);
+      break;
+    }
+    ZT_POLY1305_VSTEP(_mm256_add_epi64,_mm256_mul_epu32,_mm256_srli_epi64,_mm256_and_si256,_mm256_slli_epi64,H,M,R,S,mask);
+  }
+
+  for (i = 0; i < 5; i++) {
+    _mm256_storeu_si256((__m256i *)lanes,H[i]);
+    h[i] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+  poly1305_h26_to_state(st,h);
+}
+
+#endif // ZT_POLY1305_SIMD
+
+struct poly1305_kernel {
+  const char *name;
+#ifdef ZT_POLY1305_SIMD
+  void (*blocks)(poly1305_state_internal_t *,const uint32_t *,const unsigned char *,size_t);
+#endif
+  unsigned int lanes;
+};
+static const poly1305_kernel POLY1305_KERNELS[] = {
+#ifdef ZT_POLY1305_SIMD
+  { "donna-64",(void (*)(poly1305_state_internal_t *,const uint32_t *,const unsigned char *,size_t))0,1 },
+  { "SSE2 x2",&poly1305_blocks_sse2,2 },
+  { "AVX2 x4",&poly1305_blocks_avx2,4 },
+#else
+  { "donna",1 },
+#endif
+};
+
+/* number of kernels usable on this CPU, detected at first use */
+static unsigned int
+poly1305_detect_kernels(void) {
+#ifdef ZT_POLY1305_SIMD
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("avx2"))
+    return 2;
+#endif
+  return (unsigned int)(sizeof(POLY1305_KERNELS) / sizeof(poly1305_kernel));
+}
+static unsigned int
+poly1305_kernel_count(void) {
+  static const unsigned int c = poly1305_detect_kernels();
+  return c;
+}
+
+/* kernel in use, or ~0 if not chosen yet (racing to set it is harmless) */
+static volatile unsigned int poly1305_current = ~((unsigned int)0);
+static inline unsigned int
+poly1305_kernel(void) {
+  unsigned int k = poly1305_current;
+  if (k == ~((unsigned int)0))
+    poly1305_current = k = poly1305_kernel_count() - 1;
+  return k;
+}
+
 } // anonymous namespace
 
+unsigned int Poly1305::kernelCount()
+  throw()
+{
+  return poly1305_kernel_count();
+}
+
+const char *Poly1305::kernelName(unsigned int k)
+  throw()
+{
+  return ((k < poly1305_kernel_count()) ? POLY1305_KERNELS[k].name : "(none)");
+}
+
+void Poly1305::setKernel(unsigned int k)
+  throw()
+{
+  const unsigned int c = poly1305_kernel_count();
+  poly1305_current = (k < c) ? k : (c - 1);
+}
+
 void Poly1305::compute(void *auth,const void *data,unsigned int len,const void *key)
   throw()
 {
   poly1305_context ctx;
   poly1305_init(&ctx,reinterpret_cast<const unsigned char *>(key));
+#ifdef ZT_POLY1305_SIMD
+  const unsigned int k = poly1305_kernel();
+  if ((k)&&(len >= ZT_POLY1305_SIMD_MIN_BYTES)) {
+    const size_t stride = POLY1305_KERNELS[k].lanes * poly1305_block_size;
+    const size_t vbytes = ((size_t)len / stride) * stride;
+    uint32_t r[5];
+    poly1305_r26(reinterpret_cast<const unsigned char *>(key),r);
+    POLY1305_KERNELS[k].blocks((poly1305_state_internal_t *)&ctx,r,reinterpret_cast<const unsigned char *>(data),vbytes / poly1305_block_size);
+    data = reinterpret_cast<const unsigned char *>(data) + vbytes;
+    len -= (unsigned int)vbytes;
+  }
+#endif
   poly1305_update(&ctx,reinterpret_cast<const unsigned char *>(data),(size_t)len);
   poly1305_finish(&ctx,reinterpret_cast<unsigned char *>(auth));
 }
 
+void Poly1305::computeMulti(void *const *auth,const void *const *data,const unsigned int *len,const void *const *key,unsigned int n)
+  throw()
+{
+  unsigned int i = 0;
+#ifdef POLY1305_HAVE_BLOCKS2
+  for(;(i + 1) < n;i += 2) {
+#ifdef ZT_POLY1305_SIMD
+    if ((poly1305_kernel())&&((len[i] >= ZT_POLY1305_SIMD_MIN_BYTES)||(len[i + 1] >= ZT_POLY1305_SIMD_MIN_BYTES))) {
+      // long messages do better with a SIMD kernel on their own
+      compute(auth[i],data[i],len[i],key[i]);
+      compute(auth[i + 1],data[i + 1],len[i + 1],key[i + 1]);
+      continue;
+    }
+#endif
+    poly1305_context ctx[2];
+    const unsigned char *const ma = reinterpret_cast<const unsigned char *>(data[i]);
+    const unsigned char *const mb = reinterpret_cast<const unsigned char *>(data[i + 1]);
+    const size_t common = (size_t)(((len[i] < len[i + 1]) ? len[i] : len[i + 1]) & ~(poly1305_block_size - 1));
+    poly1305_init(&ctx[0],reinterpret_cast<const unsigned char *>(key[i]));
+    poly1305_init(&ctx[1],reinterpret_cast<const unsigned char *>(key[i + 1]));
+    poly1305_blocks2((poly1305_state_internal_t *)&ctx[0],ma,(poly1305_state_internal_t *)&ctx[1],mb,common);
+    poly1305_update(&ctx[0],ma + common,(size_t)len[i] - common);
+    poly1305_update(&ctx[1],mb + common,(size_t)len[i + 1] - common);
+    poly1305_finish(&ctx[0],reinterpret_cast<unsigned char *>(auth[i]));
+    poly1305_finish(&ctx[1],reinterpret_cast<unsigned char *>(auth[i + 1]));
+  }
+#endif
+  for(;i < n;++i)
+    compute(auth[i],data[i],len[i],key[i]);
+}
+
 } // namespace ZeroTier
@@ -48,6 +48,47 @@ public:
 	 */
 	static void compute(void *auth,const void *data,unsigned int len,const void *key)
 		throw();
+
+	/**
+	 * Compute one-time authentication codes for several messages at once
+	 *
+	 * This gives the same results as calling compute() for each message, but
+	 * independent messages are processed in lockstep so their work overlaps.
+	 *
+	 * @param auth Buffers to receive codes (16 bytes each)
+	 * @param data Data to authenticate
+	 * @param len Length of each message in bytes
+	 * @param key 32-byte one-time use keys, one per message
+	 * @param n Number of messages
+	 */
+	static void computeMulti(void *const *auth,const void *const *data,const unsigned int *len,const void *const *key,unsigned int n)
+		throw();
+
+	/**
+	 * @return Number of implementations usable on this CPU (at least 1)
+	 */
+	static unsigned int kernelCount()
+		throw();
+
+	/**
+	 * @param k Implementation index from 0 to kernelCount()-1
+	 * @return Human-readable implementation name
+	 */
+	static const char *kernelName(unsigned int k)
+		throw();
+
+	/**
+	 * Select implementation
+	 *
+	 * Implementation 0 is the portable scalar code. Others are SIMD versions
+	 * that process several 16-byte blocks at once and are used for longer
+	 * messages. The default is the last one the CPU supports, as detected at
+	 * first use. This is for testing and benchmarking.
+	 *
+	 * @param k Implementation index (values past the end select the default)
+	 */
+	static void setKernel(unsigned int k)
+		throw();
 };
 
 } // namespace ZeroTier
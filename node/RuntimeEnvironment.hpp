@@ -36,6 +36,7 @@ class NetworkController;
 class SelfAwareness;
 class Cluster;
 class DeferredPackets;
+class PacketPool;
 
 /**
  * Holds global state for an instance of ZeroTier::Node
@@ -47,6 +48,7 @@ public:
 		node(n)
 		,identity()
 		,localNetworkController((NetworkController *)0)
+		,pool((PacketPool *)0)
 		,sw((Switch *)0)
 		,mc((Multicaster *)0)
 		,topology((Topology *)0)
@@ -78,6 +80,7 @@ public:
 	 * These are constant and never null after startup unless indicated.
 	 */
 
+	PacketPool *pool;
 	Switch *sw;
 	Multicaster *mc;
 	Topology *topology;
@@ -10,6 +10,8 @@
 #include "Constants.hpp"
 #include "Salsa20.hpp"
 
+#include <algorithm>
+
 #define ROTATE(v,c) (((v) << (c)) | ((v) >> (32 - (c))))
 #define XOR(v,w) ((v) ^ (w))
 #define PLUS(v,w) ((uint32_t)((v) + (w)))
@@ -62,6 +64,13 @@ public:
 	__m128i maskLo32,maskHi32;
 };
 static const _s20sseconsts _S20SSECONSTANTS;
+
+// Multi-lane kernels above SSE2 are built with per-function target attributes
+// and selected at runtime, so they don't need -mavx2 etc. for the whole build.
+#if (!defined(ZT_SALSA20_NO_AVX)) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ZT_SALSA20_AVX 1
+#include <immintrin.h>
+#endif
 #endif
 
 namespace ZeroTier {
@@ -123,6 +132,35 @@ void Salsa20::init(const void *key,unsigned int kbits,const void *iv)
 #endif
 }
 
+void Salsa20::initFrom(const Salsa20 &base,const uint32_t tweak[6],const void *iv)
+	throw()
+{
+	_state = base._state;
+#ifdef ZT_SALSA20_SSE
+	_state.i[13] ^= tweak[0];
+	_state.i[10] ^= tweak[1];
+	_state.i[7] ^= tweak[2];
+	_state.i[4] ^= tweak[3];
+	_state.i[15] ^= tweak[4];
+	_state.i[12] ^= tweak[5];
+	_state.i[14] = ((const uint32_t *)iv)[0];
+	_state.i[11] = ((const uint32_t *)iv)[1];
+	_state.i[5] = 0;
+	_state.i[8] = 0;
+#else
+	_state.i[1] ^= tweak[0];
+	_state.i[2] ^= tweak[1];
+	_state.i[3] ^= tweak[2];
+	_state.i[4] ^= tweak[3];
+	_state.i[11] ^= tweak[4];
+	_state.i[12] ^= tweak[5];
+	_state.i[6] = U8TO32_LITTLE(((const uint8_t *)iv) + 0);
+	_state.i[7] = U8TO32_LITTLE(((const uint8_t *)iv) + 4);
+	_state.i[8] = 0;
+	_state.i[9] = 0;
+#endif
+}
+
 void Salsa20::encrypt12(const void *in,void *out,unsigned int bytes)
 	throw()
 {
@@ -140,6 +178,17 @@ void Salsa20::encrypt12(const void *in,void *out,unsigned int bytes)
 	if (!bytes)
 		return;
 
+#ifdef ZT_SALSA20_SSE
+	if (bytes >= 256) { // at least 4 blocks: use a multi-block kernel if one is enabled
+		const unsigned int done = _multiBlock(in,out,bytes,12);
+		if (done == bytes)
+			return;
+		m += done;
+		c += done;
+		bytes -= done;
+	}
+#endif
+
 #ifndef ZT_SALSA20_SSE
 	j0 = _state.i[0];
 	j1 = _state.i[1];
@@ -640,6 +689,17 @@ void Salsa20::encrypt20(const void *in,void *out,unsigned int bytes)
 	if (!bytes)
 		return;
 
+#ifdef ZT_SALSA20_SSE
+	if (bytes >= 256) { // at least 4 blocks: use a multi-block kernel if one is enabled
+		const unsigned int done = _multiBlock(in,out,bytes,20);
+		if (done == bytes)
+			return;
+		m += done;
+		c += done;
+		bytes -= done;
+	}
+#endif
+
 #ifndef ZT_SALSA20_SSE
 	j0 = _state.i[0];
 	j1 = _state.i[1];
@@ -1355,4 +1415,393 @@ void Salsa20::encrypt20(const void *in,void *out,unsigned int bytes)
 	}
 }
 
+void Salsa20::_getState(uint32_t x[16]) const
+	throw()
+{
+#ifdef ZT_SALSA20_SSE
+	// Canonical word i lives at (i * 13) % 16 in the SSE-friendly layout
+	for(unsigned int k=0;k<16;++k)
+		x[k] = _state.i[(k * 13) & 15];
+#else
+	for(unsigned int k=0;k<16;++k)
+		x[k] = _state.i[k];
+#endif
+}
+
+void Salsa20::_setCounter(const uint32_t x[16])
+	throw()
+{
+#ifdef ZT_SALSA20_SSE
+	_state.i[8] = x[8];
+	_state.i[5] = x[9];
+#else
+	_state.i[8] = x[8];
+	_state.i[9] = x[9];
+#endif
+}
+
+#ifdef ZT_SALSA20_SSE
+
+/*
+ * Multi-lane Salsa20 core
+ *
+ * These generate one 64-byte key stream block for each of N lanes, where each
+ * lane has its own complete state in canonical word order. Lane l's block is
+ * written to ks + (l * 64). Working state is kept "vertically": vector k holds
+ * word k of every lane, so the rounds are plain lane-wise vector ops and the
+ * only shuffling is a 4x4 transpose on the way in and out.
+ */
+
+#define ZT_S20_QR(A,X,R,a,b,c,d) \
+	b = X(b,R(A(a,d),7)); \
+	c = X(c,R(A(b,a),9)); \
+	d = X(d,R(A(c,b),13)); \
+	a = X(a,R(A(d,c),18))
+
+#define ZT_S20_DOUBLEROUND(A,X,R,v) \
+	ZT_S20_QR(A,X,R,v[0],v[4],v[8],v[12]); \
+	ZT_S20_QR(A,X,R,v[5],v[9],v[13],v[1]); \
+	ZT_S20_QR(A,X,R,v[10],v[14],v[2],v[6]); \
+	ZT_S20_QR(A,X,R,v[15],v[3],v[7],v[11]); \
+	ZT_S20_QR(A,X,R,v[0],v[1],v[2],v[3]); \
+	ZT_S20_QR(A,X,R,v[5],v[6],v[7],v[4]); \
+	ZT_S20_QR(A,X,R,v[10],v[11],v[8],v[9]); \
+	ZT_S20_QR(A,X,R,v[15],v[12],v[13],v[14])
+
+// 4x4 transpose of 32-bit words within each 128-bit lane (works for 128, 256, and 512-bit vectors)
+#define ZT_S20_TRANSPOSE(T,UL32,UH32,UL64,UH64,a,b,c,d) { \
+	const T _t0 = UL32(a,b); \
+	const T _t1 = UL32(c,d); \
+	const T _t2 = UH32(a,b); \
+	const T _t3 = UH32(c,d); \
+	a = UL64(_t0,_t1); \
+	b = UH64(_t0,_t1); \
+	c = UL64(_t2,_t3); \
+	d = UH64(_t2,_t3); \
+}
+
+#define ZT_S20_SSE2_ROTL(v,c) _mm_or_si128(_mm_slli_epi32((v),(c)),_mm_srli_epi32((v),32 - (c)))
+
+static void _salsa20LanesSSE2(const uint32_t *const *x,unsigned int rounds,uint8_t *ks)
+{
+	__m128i v[16],o[16];
+	for(unsigned int g=0;g<16;g+=4) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(x[0] + g));
+		__m128i b = _mm_loadu_si128((const __m128i *)(x[1] + g));
+		__m128i c = _mm_loadu_si128((const __m128i *)(x[2] + g));
+		__m128i d = _mm_loadu_si128((const __m128i *)(x[3] + g));
+		ZT_S20_TRANSPOSE(__m128i,_mm_unpacklo_epi32,_mm_unpackhi_epi32,_mm_unpacklo_epi64,_mm_unpackhi_epi64,a,b,c,d);
+		o[g] = v[g] = a;
+		o[g + 1] = v[g + 1] = b;
+		o[g + 2] = v[g + 2] = c;
+		o[g + 3] = v[g + 3] = d;
+	}
+	for(unsigned int r=0;r<rounds;r+=2) {
+		ZT_S20_DOUBLEROUND(_mm_add_epi32,_mm_xor_si128,ZT_S20_SSE2_ROTL,v);
+	}
+	for(unsigned int g=0;g<16;g+=4) {
+		__m128i a = _mm_add_epi32(v[g],o[g]);
+		__m128i b = _mm_add_epi32(v[g + 1],o[g + 1]);
+		__m128i c = _mm_add_epi32(v[g + 2],o[g + 2]);
+		__m128i d = _mm_add_epi32(v[g + 3],o[g + 3]);
+		ZT_S20_TRANSPOSE(__m128i,_mm_unpacklo_epi32,_mm_unpackhi_epi32,_mm_unpacklo_epi64,_mm_unpackhi_epi64,a,b,c,d);
+		_mm_storeu_si128((__m128i *)(ks + (g * 4)),a);
+		_mm_storeu_si128((__m128i *)(ks + 64 + (g * 4)),b);
+		_mm_storeu_si128((__m128i *)(ks + 128 + (g * 4)),c);
+		_mm_storeu_si128((__m128i *)(ks + 192 + (g * 4)),d);
+	}
+}
+
+#ifdef ZT_SALSA20_AVX
+
+#define ZT_S20_AVX2_ROTL(v,c) _mm256_or_si256(_mm256_slli_epi32((v),(c)),_mm256_srli_epi32((v),32 - (c)))
+
+__attribute__((target("avx2")))
+static void _salsa20LanesAVX2(const uint32_t *const *x,unsigned int rounds,uint8_t *ks)
+{
+	// 128-bit half h of each vector holds lanes (h * 4) .. (h * 4) + 3
+	__m256i v[16],o[16];
+	for(unsigned int g=0;g<16;g+=4) {
+		__m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(x[0] + g))),_mm_loadu_si128((const __m128i *)(x[4] + g)),1);
+		__m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(x[1] + g))),_mm_loadu_si128((const __m128i *)(x[5] + g)),1);
+		__m256i c = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(x[2] + g))),_mm_loadu_si128((const __m128i *)(x[6] + g)),1);
+		__m256i d = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(x[3] + g))),_mm_loadu_si128((const __m128i *)(x[7] + g)),1);
+		ZT_S20_TRANSPOSE(__m256i,_mm256_unpacklo_epi32,_mm256_unpackhi_epi32,_mm256_unpacklo_epi64,_mm256_unpackhi_epi64,a,b,c,d);
+		o[g] = v[g] = a;
+		o[g + 1] = v[g + 1] = b;
+		o[g + 2] = v[g + 2] = c;
+		o[g + 3] = v[g + 3] = d;
+	}
+	for(unsigned int r=0;r<rounds;r+=2) {
+		ZT_S20_DOUBLEROUND(_mm256_add_epi32,_mm256_xor_si256,ZT_S20_AVX2_ROTL,v);
+	}
+	for(unsigned int g=0;g<16;g+=4) {
+		__m256i a = _mm256_add_epi32(v[g],o[g]);
+		__m256i b = _mm256_add_epi32(v[g + 1],o[g + 1]);
+		__m256i c = _mm256_add_epi32(v[g + 2],o[g + 2]);
+		__m256i d = _mm256_add_epi32(v[g + 3],o[g + 3]);
+		ZT_S20_TRANSPOSE(__m256i,_mm256_unpacklo_epi32,_mm256_unpackhi_epi32,_mm256_unpacklo_epi64,_mm256_unpackhi_epi64,a,b,c,d);
+		_mm_storeu_si128((__m128i *)(ks + (g * 4)),_mm256_castsi256_si128(a));
+		_mm_storeu_si128((__m128i *)(ks + 64 + (g * 4)),_mm256_castsi256_si128(b));
+		_mm_storeu_si128((__m128i *)(ks + 128 + (g * 4)),_mm256_castsi256_si128(c));
+		_mm_storeu_si128((__m128i *)(ks + 192 + (g * 4)),_mm256_castsi256_si128(d));
+		_mm_storeu_si128((__m128i *)(ks + 256 + (g * 4)),_mm256_extracti128_si256(a,1));
+		_mm_storeu_si128((__m128i *)(ks + 320 + (g * 4)),_mm256_extracti128_si256(b,1));
+		_mm_storeu_si128((__m128i *)(ks + 384 + (g * 4)),_mm256_extracti128_si256(c,1));
+		_mm_storeu_si128((__m128i *)(ks + 448 + (g * 4)),_mm256_extracti128_si256(d,1));
+	}
+}
+
+/* GCC implements the unmasked AVX-512 unpack and rotate intrinsics with an
+ * _mm512_undefined_epi32() pass-through, which -Wuninitialized flags. The
+ * all-ones zero-masking forms compute the same thing from defined inputs.
+ * _salsa20Store4x128() uses the masked 128-bit extract for the same reason. */
+#define ZT_S20_AVX512_ROTL(v,c) _mm512_maskz_rol_epi32((__mmask16)0xffff,(v),(c))
+#define ZT_S20_AVX512_UNPACKLO32(a,b) _mm512_maskz_unpacklo_epi32((__mmask16)0xffff,(a),(b))
+#define ZT_S20_AVX512_UNPACKHI32(a,b) _mm512_maskz_unpackhi_epi32((__mmask16)0xffff,(a),(b))
+#define ZT_S20_AVX512_UNPACKLO64(a,b) _mm512_maskz_unpacklo_epi64((__mmask8)0xff,(a),(b))
+#define ZT_S20_AVX512_UNPACKHI64(a,b) _mm512_maskz_unpackhi_epi64((__mmask8)0xff,(a),(b))
+
+__attribute__((target("avx512f")))
+static inline __m512i _salsa20Load4x128(const uint32_t *const *x,unsigned int l,unsigned int g)
+{
+	// Start from zero; _mm512_castsi128_si512() leaves the upper bits undefined
+	__m512i r = _mm512_inserti32x4(_mm512_setzero_si512(),_mm_loadu_si128((const __m128i *)(x[l] + g)),0);
+	r = _mm512_inserti32x4(r,_mm_loadu_si128((const __m128i *)(x[l + 4] + g)),1);
+	r = _mm512_inserti32x4(r,_mm_loadu_si128((const __m128i *)(x[l + 8] + g)),2);
+	return _mm512_inserti32x4(r,_mm_loadu_si128((const __m128i *)(x[l + 12] + g)),3);
+}
+
+__attribute__((target("avx512f")))
+static inline void _salsa20Store4x128(uint8_t *ks,const __m512i v)
+{
+	_mm_storeu_si128((__m128i *)ks,_mm512_maskz_extracti32x4_epi32((__mmask8)0xf,v,0));
+	_mm_storeu_si128((__m128i *)(ks + 256),_mm512_maskz_extracti32x4_epi32((__mmask8)0xf,v,1));
+	_mm_storeu_si128((__m128i *)(ks + 512),_mm512_maskz_extracti32x4_epi32((__mmask8)0xf,v,2));
+	_mm_storeu_si128((__m128i *)(ks + 768),_mm512_maskz_extracti32x4_epi32((__mmask8)0xf,v,3));
+}
+
+__attribute__((target("avx512f")))
+static void _salsa20LanesAVX512(const uint32_t *const *x,unsigned int rounds,uint8_t *ks)
+{
+	// 128-bit quarter q of each vector holds lanes (q * 4) .. (q * 4) + 3
+	__m512i v[16],o[16];
+	for(unsigned int g=0;g<16;g+=4) {
+		__m512i a = _salsa20Load4x128(x,0,g);
+		__m512i b = _salsa20Load4x128(x,1,g);
+		__m512i c = _salsa20Load4x128(x,2,g);
+		__m512i d = _salsa20Load4x128(x,3,g);
+		ZT_S20_TRANSPOSE(__m512i,ZT_S20_AVX512_UNPACKLO32,ZT_S20_AVX512_UNPACKHI32,ZT_S20_AVX512_UNPACKLO64,ZT_S20_AVX512_UNPACKHI64,a,b,c,d);
+		o[g] = v[g] = a;
+		o[g + 1] = v[g + 1] = b;
+		o[g + 2] = v[g + 2] = c;
+		o[g + 3] = v[g + 3] = d;
+	}
+	for(unsigned int r=0;r<rounds;r+=2) {
+		ZT_S20_DOUBLEROUND(_mm512_add_epi32,_mm512_xor_si512,ZT_S20_AVX512_ROTL,v);
+	}
+	for(unsigned int g=0;g<16;g+=4) {
+		__m512i a = _mm512_add_epi32(v[g],o[g]);
+		__m512i b = _mm512_add_epi32(v[g + 1],o[g + 1]);
+		__m512i c = _mm512_add_epi32(v[g + 2],o[g + 2]);
+		__m512i d = _mm512_add_epi32(v[g + 3],o[g + 3]);
+		ZT_S20_TRANSPOSE(__m512i,ZT_S20_AVX512_UNPACKLO32,ZT_S20_AVX512_UNPACKHI32,ZT_S20_AVX512_UNPACKLO64,ZT_S20_AVX512_UNPACKHI64,a,b,c,d);
+		_salsa20Store4x128(ks + (g * 4),a);
+		_salsa20Store4x128(ks + 64 + (g * 4),b);
+		_salsa20Store4x128(ks + 128 + (g * 4),c);
+		_salsa20Store4x128(ks + 192 + (g * 4),d);
+	}
+}
+
+#endif // ZT_SALSA20_AVX
+
+#define ZT_SALSA20_MAX_LANES 16
+
+static inline void _salsa20Xor(const uint8_t *m,uint8_t *c,const uint8_t *ks,unsigned int len)
+{
+	unsigned int k = 0;
+	for(;(k + 16)<=len;k+=16)
+		_mm_storeu_si128((__m128i *)(c + k),_mm_xor_si128(_mm_loadu_si128((const __m128i *)(m + k)),_mm_loadu_si128((const __m128i *)(ks + k))));
+	for(;k<len;++k)
+		c[k] = m[k] ^ ks[k];
+}
+
+#endif // ZT_SALSA20_SSE
+
+/*
+ * Kernels in order of width. Kernel 0 is the one-block-at-a-time code in
+ * encrypt12() and encrypt20(); the rest are the multi-lane cores above.
+ */
+struct _Salsa20Kernel
+{
+	const char *name;
+#ifdef ZT_SALSA20_SSE
+	void (*f)(const uint32_t *const *,unsigned int,uint8_t *);
+#endif
+	unsigned int lanes;
+};
+static const _Salsa20Kernel _SALSA20_KERNELS[] = {
+#ifdef ZT_SALSA20_SSE
+	{ "SSE2",(void (*)(const uint32_t *const *,unsigned int,uint8_t *))0,1 },
+	{ "SSE2 x4",&_salsa20LanesSSE2,4 },
+#ifdef ZT_SALSA20_AVX
+	{ "AVX2 x8",&_salsa20LanesAVX2,8 },
+	{ "AVX-512 x16",&_salsa20LanesAVX512,16 },
+#endif
+#else
+	{ "C",1 },
+#endif
+};
+
+// Number of kernels usable on this CPU, detected at first use
+static unsigned int _salsa20DetectKernels()
+{
+#ifdef ZT_SALSA20_AVX
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return 4;
+	if (__builtin_cpu_supports("avx2"))
+		return 3;
+	return 2; // SSE2 only, the AVX kernels would fault
+#else
+	return (unsigned int)(sizeof(_SALSA20_KERNELS) / sizeof(_Salsa20Kernel));
+#endif
+}
+static unsigned int _salsa20KernelCount()
+{
+	static const unsigned int c = _salsa20DetectKernels();
+	return c;
+}
+
+// Widest kernel currently in use, or ~0 if not chosen yet (racing to set it is harmless)
+static volatile unsigned int _salsa20Kernel = ~((unsigned int)0);
+static inline unsigned int _salsa20CurrentKernel()
+{
+	unsigned int k = _salsa20Kernel;
+	if (k == ~((unsigned int)0))
+		_salsa20Kernel = k = _salsa20KernelCount() - 1;
+	return k;
+}
+
+unsigned int Salsa20::kernelCount()
+	throw()
+{
+	return _salsa20KernelCount();
+}
+
+const char *Salsa20::kernelName(unsigned int k)
+	throw()
+{
+	return ((k < _salsa20KernelCount()) ? _SALSA20_KERNELS[k].name : "(none)");
+}
+
+void Salsa20::setKernel(unsigned int k)
+	throw()
+{
+	_salsa20Kernel = std::min(k,_salsa20KernelCount() - 1);
+}
+
+unsigned int Salsa20::_multiBlock(const void *in,void *out,unsigned int bytes,unsigned int rounds)
+	throw()
+{
+	unsigned int done = 0;
+#ifdef ZT_SALSA20_SSE
+	unsigned int k = _salsa20CurrentKernel();
+	if (!k)
+		return 0;
+
+	uint32_t x[ZT_SALSA20_MAX_LANES][16];
+	const uint32_t *xp[ZT_SALSA20_MAX_LANES];
+	uint8_t ks[ZT_SALSA20_MAX_LANES * 64];
+
+	// Lane l gets block counter + l. Step down through narrower kernels to
+	// cover as much as possible; whatever is left over is done one block at
+	// a time by the caller.
+	_getState(x[0]);
+	for(;k>0;--k) {
+		const unsigned int lanes = _SALSA20_KERNELS[k].lanes;
+		const unsigned int chunk = lanes * 64;
+		if ((bytes - done) < chunk)
+			continue;
+
+		const uint64_t ctr = ((uint64_t)x[0][9] << 32) | (uint64_t)x[0][8];
+		for(unsigned int l=0;l<lanes;++l) {
+			if (l)
+				memcpy(x[l],x[0],sizeof(x[0]));
+			x[l][8] = (uint32_t)(ctr + l);
+			x[l][9] = (uint32_t)((ctr + l) >> 32);
+			xp[l] = x[l];
+		}
+
+		while ((bytes - done) >= chunk) {
+			_SALSA20_KERNELS[k].f(xp,rounds,ks);
+			_salsa20Xor((const uint8_t *)in + done,(uint8_t *)out + done,ks,chunk);
+			done += chunk;
+			for(unsigned int l=0;l<lanes;++l) {
+				const uint64_t c = (((uint64_t)x[l][9] << 32) | (uint64_t)x[l][8]) + lanes;
+				x[l][8] = (uint32_t)c;
+				x[l][9] = (uint32_t)(c >> 32);
+			}
+		}
+	}
+	_setCounter(x[0]);
+
+	Utils::burn(x,sizeof(x));
+	Utils::burn(ks,sizeof(ks));
+#endif
+	return done;
+}
+
+void Salsa20::encrypt12Multi(Salsa20 *const *s,const void *const *in,void *const *out,const unsigned int *bytes,unsigned int n)
+	throw()
+{
+#ifdef ZT_SALSA20_SSE
+	const unsigned int k = _salsa20CurrentKernel();
+	const unsigned int lanes = _SALSA20_KERNELS[k].lanes;
+
+	uint32_t x[ZT_SALSA20_MAX_LANES][16];
+	const uint32_t *xp[ZT_SALSA20_MAX_LANES];
+	uint8_t ks[ZT_SALSA20_MAX_LANES * 64];
+
+	for(unsigned int base=0;base<n;base+=lanes) {
+		const unsigned int cnt = std::min(n - base,lanes);
+		if (cnt == 1) {
+			s[base]->encrypt12(in[base],out[base],bytes[base]);
+			continue;
+		}
+
+		unsigned int maxBytes = 0;
+		for(unsigned int l=0;l<cnt;++l) {
+			s[base + l]->_getState(x[l]);
+			xp[l] = x[l];
+			if (bytes[base + l] > maxBytes)
+				maxBytes = bytes[base + l];
+		}
+		for(unsigned int l=cnt;l<lanes;++l)
+			xp[l] = x[0]; // idle lanes just recompute lane 0
+
+		for(unsigned int off=0;off<maxBytes;off+=64) {
+			_SALSA20_KERNELS[k].f(xp,12,ks);
+			for(unsigned int l=0;l<cnt;++l) {
+				const unsigned int len = bytes[base + l];
+				if (off < len) {
+					_salsa20Xor((const uint8_t *)in[base + l] + off,(uint8_t *)out[base + l] + off,ks + (l * 64),std::min(len - off,64U));
+					if (!(++x[l][8]))
+						++x[l][9];
+				}
+			}
+		}
+
+		for(unsigned int l=0;l<cnt;++l)
+			s[base + l]->_setCounter(x[l]);
+	}
+
+	Utils::burn(x,sizeof(x));
+	Utils::burn(ks,sizeof(ks));
+#else
+	for(unsigned int k=0;k<n;++k)
+		s[k]->encrypt12(in[k],out[k],bytes[k]);
+#endif
+}
+
 } // namespace ZeroTier
@@ -55,6 +55,20 @@ public:
 	void init(const void *key,unsigned int kbits,const void *iv)
 		throw();
 
+	/**
+	 * Initialize as a copy of another 256-bit cipher with a tweaked key
+	 *
+	 * The first six key words (interpreted little-endian) of base are XORed
+	 * with tweak, the IV is replaced, and the block counter is reset. This is
+	 * cheaper than init() when only the start of the key varies per message.
+	 *
+	 * @param base Cipher initialized with the base key
+	 * @param tweak Values to XOR into key words 0-5
+	 * @param iv 64-bit initialization vector
+	 */
+	void initFrom(const Salsa20 &base,const uint32_t tweak[6],const void *iv)
+		throw();
+
 	/**
 	 * Encrypt data using Salsa20/12
 	 *
@@ -101,7 +115,59 @@ public:
 		encrypt20(in,out,bytes);
 	}
 
+	/**
+	 * Encrypt several independent messages at once using Salsa20/12
+	 *
+	 * This is equivalent to calling encrypt12() on each cipher instance, but
+	 * blocks from different instances are interleaved across SIMD lanes (4
+	 * with SSE2, 8 with AVX2, 16 with AVX-512) so that many short messages
+	 * such as packets fill the vector unit the way one long message would.
+	 * The kernel used is the one selected by setKernel() (see below).
+	 *
+	 * @param s Cipher instances, one per message (each is advanced as by encrypt12())
+	 * @param in Input buffers
+	 * @param out Output buffers (may be the same as input buffers)
+	 * @param bytes Length of each message in bytes
+	 * @param n Number of messages
+	 */
+	static void encrypt12Multi(Salsa20 *const *s,const void *const *in,void *const *out,const unsigned int *bytes,unsigned int n)
+		throw();
+
+	/**
+	 * @return Number of encryption kernels usable on this CPU (at least 1)
+	 */
+	static unsigned int kernelCount()
+		throw();
+
+	/**
+	 * @param k Kernel index from 0 to kernelCount()-1
+	 * @return Human-readable kernel name
+	 */
+	static const char *kernelName(unsigned int k)
+		throw();
+
+	/**
+	 * Select the widest encryption kernel to use
+	 *
+	 * Kernel 0 generates one block at a time. Higher kernels generate 4, 8,
+	 * or 16 blocks at once and are used for longer messages and by
+	 * encrypt12Multi(). The default is the widest kernel the CPU supports,
+	 * as detected at first use. This is for testing and benchmarking.
+	 *
+	 * @param k Kernel index (values past the end select the widest supported)
+	 */
+	static void setKernel(unsigned int k)
+		throw();
+
 private:
+	// Encrypt as many whole multi-block chunks as possible, returning bytes done
+	unsigned int _multiBlock(const void *in,void *out,unsigned int bytes,unsigned int rounds)
+		throw();
+
+	// Get state in canonical Salsa20 word order, or set counter from such a state
+	void _getState(uint32_t x[16]) const throw();
+	void _setCounter(const uint32_t x[16]) throw();
+
 	union {
 #ifdef ZT_SALSA20_SSE
 		__m128i v[4];
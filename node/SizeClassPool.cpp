@@ -0,0 +1,170 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2016  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "Constants.hpp"
+#include "SizeClassPool.hpp"
+#include "Mutex.hpp"
+#include "AtomicCounter.hpp"
+
+#ifdef __WINDOWS__
+#define ZT_SIZE_CLASS_POOL_TLS __declspec(thread)
+#else
+#define ZT_SIZE_CLASS_POOL_TLS __thread
+#endif
+
+namespace ZeroTier {
+
+namespace {
+
+// Free blocks are chained through their first word
+struct _Block
+{
+	_Block *next;
+};
+
+struct _Class
+{
+	_Class() : free((_Block *)0),idle(0),refills(0),flushes(0) {}
+
+	_Block *free;
+	unsigned long idle;
+	unsigned long refills;
+	unsigned long flushes;
+	AtomicCounter systemAllocs;
+	AtomicCounter systemFrees;
+	Mutex lock;
+};
+
+// Function-local static so it exists before any other static initializer can allocate
+static _Class *_classes()
+{
+	static _Class c[ZT_SIZE_CLASS_POOL_CLASSES];
+	return c;
+}
+
+// Each thread's cache of free blocks by class (POD so it can be thread-local)
+static ZT_SIZE_CLASS_POOL_TLS _Block *_tcFree[ZT_SIZE_CLASS_POOL_CLASSES];
+static ZT_SIZE_CLASS_POOL_TLS unsigned int _tcCount[ZT_SIZE_CLASS_POOL_CLASSES];
+
+} // anonymous namespace
+
+void *SizeClassPool::alloc(unsigned long size)
+{
+	if ((!size)||(size > ZT_SIZE_CLASS_POOL_MAX_SIZE))
+		return ::operator new(size);
+
+	const unsigned int c = sizeClass(size);
+
+	_Block *b = _tcFree[c];
+	if (!b) {
+		// Refill this thread's cache with up to half a cache's worth of blocks
+		_Class &cl = _classes()[c];
+		{
+			Mutex::Lock _l(cl.lock);
+			unsigned int n = 0;
+			while ((cl.free)&&(n < (ZT_SIZE_CLASS_POOL_THREAD_CACHE / 2))) {
+				_Block *const f = cl.free;
+				cl.free = f->next;
+				f->next = _tcFree[c];
+				_tcFree[c] = f;
+				++n;
+			}
+			if (n) {
+				cl.idle -= n;
+				++cl.refills;
+				_tcCount[c] = n;
+			}
+		}
+
+		b = _tcFree[c];
+		if (!b) {
+			void *const p = ::malloc(classSize(c));
+			if (!p)
+				throw std::bad_alloc();
+			++cl.systemAllocs;
+			return p;
+		}
+	}
+
+	_tcFree[c] = b->next;
+	--_tcCount[c];
+	return b;
+}
+
+void SizeClassPool::free(void *p,unsigned long size)
+{
+	if (!p)
+		return;
+	if ((!size)||(size > ZT_SIZE_CLASS_POOL_MAX_SIZE)) {
+		::operator delete(p);
+		return;
+	}
+
+	const unsigned int c = sizeClass(size);
+
+	_Block *const b = reinterpret_cast<_Block *>(p);
+	b->next = _tcFree[c];
+	_tcFree[c] = b;
+	if (++_tcCount[c] < ZT_SIZE_CLASS_POOL_THREAD_CACHE)
+		return;
+
+	// Cache is full, so move half of it to the shared list and give back to
+	// the system anything beyond the class's idle limit.
+	_Class &cl = _classes()[c];
+	const unsigned long maxIdle = ZT_SIZE_CLASS_POOL_MAX_IDLE_BYTES / classSize(c);
+	_Block *release = (_Block *)0;
+	{
+		Mutex::Lock _l(cl.lock);
+		for(unsigned int n=0;n<(ZT_SIZE_CLASS_POOL_THREAD_CACHE / 2);++n) {
+			_Block *const f = _tcFree[c];
+			_tcFree[c] = f->next;
+			--_tcCount[c];
+			if (cl.idle < maxIdle) {
+				f->next = cl.free;
+				cl.free = f;
+				++cl.idle;
+			} else {
+				f->next = release;
+				release = f;
+			}
+		}
+		++cl.flushes;
+	}
+	while (release) {
+		_Block *const f = release;
+		release = f->next;
+		::free(f);
+		++cl.systemFrees;
+	}
+}
+
+void SizeClassPool::stats(unsigned int c,Stats &s)
+{
+	_Class &cl = _classes()[c % ZT_SIZE_CLASS_POOL_CLASSES];
+	Mutex::Lock _l(cl.lock);
+	s.size = classSize(c % ZT_SIZE_CLASS_POOL_CLASSES);
+	s.systemAllocs = (unsigned long)((int)cl.systemAllocs);
+	s.systemFrees = (unsigned long)((int)cl.systemFrees);
+	s.idle = cl.idle;
+	s.refills = cl.refills;
+	s.flushes = cl.flushes;
+}
+
+} // namespace ZeroTier
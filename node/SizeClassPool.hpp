@@ -0,0 +1,181 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2016  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZT_SIZECLASSPOOL_HPP
+#define ZT_SIZECLASSPOOL_HPP
+
+#include <stdlib.h>
+#include <stddef.h>
+
+#include <new>
+
+#include "Constants.hpp"
+
+/**
+ * Largest block size handled by the pool, larger ones go straight to malloc
+ */
+#define ZT_SIZE_CLASS_POOL_MAX_SIZE 16384
+
+/**
+ * Number of size classes: one for 1-64 bytes, then four per power of two
+ */
+#define ZT_SIZE_CLASS_POOL_CLASSES 33
+
+namespace ZeroTier {
+
+/**
+ * Process-wide pool of fixed-size blocks for large, frequently churned objects
+ *
+ * Sizes are rounded up to one of four classes per power of two, so no more
+ * than 25% is wasted. Freed blocks are kept on per-class free lists instead
+ * of going back to malloc, which keeps packet-sized allocations from
+ * fragmenting the heap. Each thread keeps a few blocks of each class to
+ * itself and only takes the class's lock to move blocks in batches.
+ *
+ * Blocks cached by a thread when it exits are not reclaimed. That is at
+ * most ZT_SIZE_CLASS_POOL_THREAD_CACHE blocks per class used, and threads
+ * that handle packets live as long as the service does.
+ */
+class SizeClassPool
+{
+public:
+	/**
+	 * Statistics for one size class
+	 */
+	struct Stats
+	{
+		unsigned long size; // block size in bytes
+		unsigned long systemAllocs; // blocks ever obtained from malloc
+		unsigned long systemFrees; // blocks ever given back to free
+		unsigned long idle; // blocks on the shared free list
+		unsigned long refills; // batches moved from shared list to a thread cache
+		unsigned long flushes; // batches moved from a thread cache to shared list
+	};
+
+	/**
+	 * Allocate a block
+	 *
+	 * @param size Size in bytes (may be larger than ZT_SIZE_CLASS_POOL_MAX_SIZE)
+	 * @return Block of at least size bytes
+	 * @throws std::bad_alloc Out of memory
+	 */
+	static void *alloc(unsigned long size);
+
+	/**
+	 * Free a block from alloc()
+	 *
+	 * @param p Block (NULL is ignored)
+	 * @param size Same size as was passed to alloc()
+	 */
+	static void free(void *p,unsigned long size);
+
+	/**
+	 * @param size Size in bytes (1..ZT_SIZE_CLASS_POOL_MAX_SIZE)
+	 * @return Size class index
+	 */
+	static inline unsigned int sizeClass(unsigned long size)
+	{
+		if (size <= 64)
+			return 0;
+		unsigned int e = 6;
+		while (((size - 1) >> (e + 1)) != 0)
+			++e;
+		const unsigned long step = 1UL << (e - 2);
+		return (1 + ((e - 6) * 4) + (unsigned int)(((size - (1UL << e)) + (step - 1)) / step) - 1);
+	}
+
+	/**
+	 * @param c Size class index
+	 * @return Block size of this class in bytes
+	 */
+	static inline unsigned long classSize(unsigned int c)
+	{
+		if (!c)
+			return 64;
+		const unsigned int e = 6 + ((c - 1) / 4);
+		return ((1UL << e) + ((unsigned long)(((c - 1) % 4) + 1) << (e - 2)));
+	}
+
+	/**
+	 * Get statistics for a size class
+	 *
+	 * @param c Size class index (0..ZT_SIZE_CLASS_POOL_CLASSES-1)
+	 * @param s Statistics structure to fill
+	 */
+	static void stats(unsigned int c,Stats &s);
+};
+
+/**
+ * STL allocator that takes single objects from SizeClassPool
+ *
+ * This is for node-based containers like std::list whose elements hold a
+ * whole Packet. Arrays fall through to the global allocator.
+ *
+ * @tparam T Allocated type
+ */
+template<typename T>
+class PoolAllocator
+{
+public:
+	typedef T value_type;
+	typedef T *pointer;
+	typedef const T *const_pointer;
+	typedef T &reference;
+	typedef const T &const_reference;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+
+	template<typename U>
+	struct rebind { typedef PoolAllocator<U> other; };
+
+	PoolAllocator() throw() {}
+	PoolAllocator(const PoolAllocator &) throw() {}
+	template<typename U>
+	PoolAllocator(const PoolAllocator<U> &) throw() {}
+
+	inline pointer address(reference x) const { return &x; }
+	inline const_pointer address(const_reference x) const { return &x; }
+
+	inline pointer allocate(size_type n,const void * = 0)
+	{
+		if (n == 1)
+			return reinterpret_cast<pointer>(SizeClassPool::alloc(sizeof(T)));
+		return reinterpret_cast<pointer>(::operator new(n * sizeof(T)));
+	}
+
+	inline void deallocate(pointer p,size_type n)
+	{
+		if (n == 1)
+			SizeClassPool::free(p,sizeof(T));
+		else ::operator delete(p);
+	}
+
+	inline size_type max_size() const throw() { return ((size_type)-1) / sizeof(T); }
+
+	inline void construct(pointer p,const T &v) { new((void *)p) T(v); }
+	inline void destroy(pointer p) { p->~T(); }
+
+	template<typename U>
+	inline bool operator==(const PoolAllocator<U> &) const throw() { return true; }
+	template<typename U>
+	inline bool operator!=(const PoolAllocator<U> &) const throw() { return false; }
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -36,6 +36,7 @@
 #include "SelfAwareness.hpp"
 #include "Packet.hpp"
 #include "Cluster.hpp"
+#include "DeferredPackets.hpp"
 
 namespace ZeroTier {
 
@@ -60,18 +61,37 @@ Switch::Switch(const RuntimeEnvironment *renv) :
 	RR(renv),
 	_lastBeaconResponse(0),
 	_outstandingWhoisRequests(32),
-	_lastUniteAttempt(8) // only really used on root servers and upstreams, and it'll grow there just fine
+	_whoisTimers(RR->node->now()),
+	_lastUniteCleanShard(0),
+	_contactQueue(RR->node->now())
 {
 }
 
 Switch::~Switch()
 {
+	for(unsigned int s=0;s<ZT_RX_QUEUE_SHARDS;++s) {
+		for(unsigned int i=0;i<ZT_RX_QUEUE_SHARD_SIZE;++i)
+			_rxQueue[s].claim(RR->pool,i,0,0);
+	}
+
+	Hashtable< Address,TXQueue >::Iterator i(_txQueue);
+	Address *a = (Address *)0;
+	TXQueue *q = (TXQueue *)0;
+	while (i.next(a,q)) {
+		while (q->count)
+			delete q->pop();
+	}
 }
 
-void Switch::onRemotePacket(const InetAddress &localAddr,const InetAddress &fromAddr,const void *data,unsigned int len)
+void Switch::onRemotePacket(IncomingPacket *pkt)
 {
+	// pkt is set to NULL below once it is kept in the RX queue or handed off
 	try {
 		const uint64_t now = RR->node->now();
+		const InetAddress &localAddr = pkt->localAddress();
+		const InetAddress &fromAddr = pkt->remoteAddress();
+		const unsigned int len = pkt->size();
+		const uint8_t *const data = reinterpret_cast<const uint8_t *>(pkt->data());
 
 		if (len == 13) {
 			/* LEGACY: before VERB_PUSH_DIRECT_PATHS, peers used broadcast
@@ -79,40 +99,39 @@ void Switch::onRemotePacket(const InetAddress &localAddr,const InetAddress &from
 			 * no longer send these, but we'll listen for them for a while to
 			 * locate peers with versions <1.0.4. */
 
-			Address beaconAddr(reinterpret_cast<const char *>(data) + 8,5);
-			if (beaconAddr == RR->identity.address())
-				return;
-			if (!RR->node->shouldUsePathForZeroTierTraffic(localAddr,fromAddr))
-				return;
-			SharedPtr<Peer> peer(RR->topology->getPeer(beaconAddr));
-			if (peer) { // we'll only respond to beacons from known peers
-				if ((now - _lastBeaconResponse) >= 2500) { // limit rate of responses
-					_lastBeaconResponse = now;
-					Packet outp(peer->address(),RR->identity.address(),Packet::VERB_NOP);
-					outp.armor(peer->key(),true);
-					RR->node->putPacket(localAddr,fromAddr,outp.data(),outp.size());
+			Address beaconAddr(data + 8,5);
+			if ((beaconAddr != RR->identity.address())&&(RR->node->shouldUsePathForZeroTierTraffic(localAddr,fromAddr))) {
+				SharedPtr<Peer> peer(RR->topology->getPeer(beaconAddr));
+				if (peer) { // we'll only respond to beacons from known peers
+					if ((now - _lastBeaconResponse) >= 2500) { // limit rate of responses
+						_lastBeaconResponse = now;
+						Packet outp(peer->address(),RR->identity.address(),Packet::VERB_NOP);
+						outp.armor(peer->armorKey(),true);
+						RR->node->putPacket(localAddr,fromAddr,outp.data(),outp.size());
+					}
 				}
 			}
 
 		} else if (len > ZT_PROTO_MIN_FRAGMENT_LENGTH) { // min length check is important!
-			if (reinterpret_cast<const uint8_t *>(data)[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_INDICATOR] == ZT_PACKET_FRAGMENT_INDICATOR) {
+			if (data[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_INDICATOR] == ZT_PACKET_FRAGMENT_INDICATOR) {
 				// Handle fragment ----------------------------------------------------
 
-				Packet::Fragment fragment(data,len);
-				const Address destination(fragment.destination());
+				// Fragments share the packet ID and destination fields with packet heads
+				const Address destination(pkt->destination());
 
 				if (destination != RR->identity.address()) {
 					// Fragment is not for us, so try to relay it
-					if (fragment.hops() < ZT_RELAY_MAX_HOPS) {
-						fragment.incrementHops();
+					if ((unsigned int)data[ZT_PACKET_FRAGMENT_IDX_HOPS] < ZT_RELAY_MAX_HOPS) {
+						(*pkt)[ZT_PACKET_FRAGMENT_IDX_HOPS] = (data[ZT_PACKET_FRAGMENT_IDX_HOPS] + 1) & ZT_PROTO_MAX_HOPS;
 
 						// Note: we don't bother initiating NAT-t for fragments, since heads will set that off.
 						// It wouldn't hurt anything, just redundant and unnecessary.
 						SharedPtr<Peer> relayTo = RR->topology->getPeer(destination);
-						if ((!relayTo)||(!relayTo->send(fragment.data(),fragment.size(),now))) {
+						if ((!relayTo)||(!relayTo->send(data,len,now))) {
 #ifdef ZT_ENABLE_CLUSTER
 							if (RR->cluster) {
-								RR->cluster->sendViaCluster(Address(),destination,fragment.data(),fragment.size(),false);
+								RR->cluster->sendViaCluster(Address(),destination,data,len,false);
+								RR->pool->put(pkt);
 								return;
 							}
 #endif
@@ -120,58 +139,65 @@ void Switch::onRemotePacket(const InetAddress &localAddr,const InetAddress &from
 							// Don't know peer or no direct path -- so relay via root server
 							relayTo = RR->topology->getBestRoot();
 							if (relayTo)
-								relayTo->send(fragment.data(),fragment.size(),now);
+								relayTo->send(data,len,now);
 						}
 					} else {
 						TRACE("dropped relay [fragment](%s) -> %s, max hops exceeded",fromAddr.toString().c_str(),destination.toString().c_str());
 					}
 				} else {
 					// Fragment looks like ours
-					const uint64_t fragmentPacketId = fragment.packetId();
-					const unsigned int fragmentNumber = fragment.fragmentNumber();
-					const unsigned int totalFragments = fragment.totalFragments();
+					const uint64_t fragmentPacketId = pkt->packetId();
+					const unsigned int fragmentNumber = (unsigned int)data[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_NO] & 0xf;
+					const unsigned int totalFragments = ((unsigned int)data[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_NO] >> 4) & 0xf;
+					IncomingPacket *full = (IncomingPacket *)0; // set if this completes a packet, decoded after shard lock is released
 
-					if ((totalFragments <= ZT_MAX_PACKET_FRAGMENTS)&&(fragmentNumber < ZT_MAX_PACKET_FRAGMENTS)&&(fragmentNumber > 0)&&(totalFragments > 1)) {
+					if ((totalFragments <= ZT_MAX_PACKET_FRAGMENTS)&&(fragmentNumber < totalFragments)&&(fragmentNumber > 0)&&(totalFragments > 1)) {
 						// Fragment appears basically sane. Its fragment number must be
-						// 1 or more, since a Packet with fragmented bit set is fragment 0.
-						// Total fragments must be more than 1, otherwise why are we
-						// seeing a Packet::Fragment?
-
-						Mutex::Lock _l(_rxQueue_m);
-						RXQueueEntry *const rq = _findRXQueueEntry(now,fragmentPacketId);
-
-						if ((!rq->timestamp)||(rq->packetId != fragmentPacketId)) {
+						// 1 or more, since a Packet with fragmented bit set is fragment 0,
+						// and less than the total. Total fragments must be more than 1,
+						// otherwise why are we seeing a Packet::Fragment?
+
+						RXQueueShard &rqs = _rxQueueShard(fragmentPacketId);
+						Mutex::Lock _l(rqs.lock);
+						const unsigned int rqi = rqs.find(now,fragmentPacketId);
+						RXQueueEntry *rq = &(rqs.entries[rqi]);
+
+						if ((len - ZT_PACKET_FRAGMENT_IDX_PAYLOAD) > ZT_UDP_DEFAULT_PAYLOAD_MTU) {
+							TRACE("dropped fragment of %.16llx from %s: payload too large",fragmentPacketId,fromAddr.toString().c_str());
+						} else if ((!rqs.timestamp[rqi])||(rqs.packetId[rqi] != fragmentPacketId)) {
 							// No packet found, so we received a fragment without its head.
 							//TRACE("fragment (%u/%u) of %.16llx from %s",fragmentNumber + 1,totalFragments,fragmentPacketId,fromAddr.toString().c_str());
 
-							rq->timestamp = now;
-							rq->packetId = fragmentPacketId;
-							rq->frags[fragmentNumber - 1] = fragment;
+							rq = rqs.claim(RR->pool,rqi,now,fragmentPacketId);
+							rq->frags[fragmentNumber - 1] = pkt;
+							pkt = (IncomingPacket *)0;
 							rq->totalFragments = totalFragments; // total fragment count is known
 							rq->haveFragments = 1 << fragmentNumber; // we have only this fragment
 							rq->complete = false;
+						} else if ((rq->complete)||((rq->totalFragments)&&(rq->totalFragments != totalFragments))) {
+							TRACE("dropped fragment of %.16llx from %s: packet already complete or fragment count mismatch",fragmentPacketId,fromAddr.toString().c_str());
 						} else if (!(rq->haveFragments & (1 << fragmentNumber))) {
 							// We have other fragments and maybe the head, so add this one and check
 							//TRACE("fragment (%u/%u) of %.16llx from %s",fragmentNumber + 1,totalFragments,fragmentPacketId,fromAddr.toString().c_str());
 
-							rq->frags[fragmentNumber - 1] = fragment;
+							rq->frags[fragmentNumber - 1] = pkt;
+							pkt = (IncomingPacket *)0;
 							rq->totalFragments = totalFragments;
 
-							if (Utils::countBits(rq->haveFragments |= (1 << fragmentNumber)) == totalFragments) {
+							if ((Utils::countBits(rq->haveFragments |= (1 << fragmentNumber)) == totalFragments)&&(rq->ready())) {
 								// We have all fragments -- assemble and process full Packet
 								//TRACE("packet %.16llx is complete, assembling and processing...",fragmentPacketId);
 
-								for(unsigned int f=1;f<totalFragments;++f)
-									rq->frag0.append(rq->frags[f - 1].payload(),rq->frags[f - 1].payloadLength());
-
-								if (rq->frag0.tryDecode(RR,false)) {
-									rq->timestamp = 0; // packet decoded, free entry
-								} else {
-									rq->complete = true; // set complete flag but leave entry since it probably needs WHOIS or something
-								}
+								rq->assemble(RR->pool);
+								full = rq->frag0;
+								rq->frag0 = (IncomingPacket *)0;
+								rqs.timestamp[rqi] = 0; // free entry, _decode() parks it again if it must wait
 							}
 						} // else this is a duplicate fragment, ignore
 					}
+
+					if (full)
+						_decode(full,now);
 				}
 
 				// --------------------------------------------------------------------
@@ -179,129 +205,99 @@ void Switch::onRemotePacket(const InetAddress &localAddr,const InetAddress &from
 				// Handle packet head -------------------------------------------------
 
 				// See packet format in Packet.hpp to understand this
-				const uint64_t packetId = (
-					(((uint64_t)reinterpret_cast<const uint8_t *>(data)[0]) << 56) |
-					(((uint64_t)reinterpret_cast<const uint8_t *>(data)[1]) << 48) |
-					(((uint64_t)reinterpret_cast<const uint8_t *>(data)[2]) << 40) |
-					(((uint64_t)reinterpret_cast<const uint8_t *>(data)[3]) << 32) |
-					(((uint64_t)reinterpret_cast<const uint8_t *>(data)[4]) << 24) |
-					(((uint64_t)reinterpret_cast<const uint8_t *>(data)[5]) << 16) |
-					(((uint64_t)reinterpret_cast<const uint8_t *>(data)[6]) << 8) |
-					((uint64_t)reinterpret_cast<const uint8_t *>(data)[7])
-				);
-				const Address destination(reinterpret_cast<const uint8_t *>(data) + 8,ZT_ADDRESS_LENGTH);
-				const Address source(reinterpret_cast<const uint8_t *>(data) + 13,ZT_ADDRESS_LENGTH);
+				const uint64_t packetId = pkt->packetId();
+				const Address destination(pkt->destination());
+				const Address source(pkt->source());
 
 				// Catch this and toss it -- it would never work, but it could happen if we somehow
 				// mistakenly guessed an address we're bound to as a destination for another peer.
-				if (source == RR->identity.address())
+				if (source == RR->identity.address()) {
+					RR->pool->put(pkt);
 					return;
+				}
 
 				//TRACE("<< %.16llx %s -> %s (size: %u)",(unsigned long long)packet->packetId(),source.toString().c_str(),destination.toString().c_str(),packet->size());
 
-				if (destination != RR->identity.address()) {
-					Packet packet(data,len);
+				IncomingPacket *full = (IncomingPacket *)0; // complete packet for us, decoded after any shard lock is released
 
+				if (destination != RR->identity.address()) {
 					// Packet is not for us, so try to relay it
-					if (packet.hops() < ZT_RELAY_MAX_HOPS) {
-						packet.incrementHops();
+					if (pkt->hops() < ZT_RELAY_MAX_HOPS) {
+						pkt->incrementHops();
 
 						SharedPtr<Peer> relayTo = RR->topology->getPeer(destination);
-						if ((relayTo)&&((relayTo->send(packet.data(),packet.size(),now)))) {
-							Mutex::Lock _l(_lastUniteAttempt_m);
-							uint64_t &luts = _lastUniteAttempt[_LastUniteKey(source,destination)];
-							if ((now - luts) >= ZT_MIN_UNITE_INTERVAL) {
-								luts = now;
+						if ((relayTo)&&((relayTo->send(data,len,now)))) {
+							if (_shouldUnite(now,source,destination))
 								unite(source,destination);
-							}
 						} else {
 #ifdef ZT_ENABLE_CLUSTER
 							if (RR->cluster) {
-								bool shouldUnite;
-								{
-									Mutex::Lock _l(_lastUniteAttempt_m);
-									uint64_t &luts = _lastUniteAttempt[_LastUniteKey(source,destination)];
-									shouldUnite = ((now - luts) >= ZT_MIN_UNITE_INTERVAL);
-									if (shouldUnite)
-										luts = now;
-								}
-								RR->cluster->sendViaCluster(source,destination,packet.data(),packet.size(),shouldUnite);
+								const bool shouldUnite = _shouldUnite(now,source,destination);
+								RR->cluster->sendViaCluster(source,destination,data,len,shouldUnite);
+								RR->pool->put(pkt);
 								return;
 							}
 #endif
 							relayTo = RR->topology->getBestRoot(&source,1,true);
 							if (relayTo)
-								relayTo->send(packet.data(),packet.size(),now);
+								relayTo->send(data,len,now);
 						}
 					} else {
-						TRACE("dropped relay %s(%s) -> %s, max hops exceeded",packet.source().toString().c_str(),fromAddr.toString().c_str(),destination.toString().c_str());
+						TRACE("dropped relay %s(%s) -> %s, max hops exceeded",source.toString().c_str(),fromAddr.toString().c_str(),destination.toString().c_str());
 					}
-				} else if ((reinterpret_cast<const uint8_t *>(data)[ZT_PACKET_IDX_FLAGS] & ZT_PROTO_FLAG_FRAGMENTED) != 0) {
+				} else if ((data[ZT_PACKET_IDX_FLAGS] & ZT_PROTO_FLAG_FRAGMENTED) != 0) {
 					// Packet is the head of a fragmented packet series
 
-					Mutex::Lock _l(_rxQueue_m);
-					RXQueueEntry *const rq = _findRXQueueEntry(now,packetId);
+					RXQueueShard &rqs = _rxQueueShard(packetId);
+					Mutex::Lock _l(rqs.lock);
+					const unsigned int rqi = rqs.find(now,packetId);
+					RXQueueEntry *rq = &(rqs.entries[rqi]);
 
-					if ((!rq->timestamp)||(rq->packetId != packetId)) {
+					if ((!rqs.timestamp[rqi])||(rqs.packetId[rqi] != packetId)) {
 						// If we have no other fragments yet, create an entry and save the head
 						//TRACE("fragment (0/?) of %.16llx from %s",pid,fromAddr.toString().c_str());
 
-						rq->timestamp = now;
-						rq->packetId = packetId;
-						rq->frag0.init(data,len,localAddr,fromAddr,now);
+						rq = rqs.claim(RR->pool,rqi,now,packetId);
+						rq->frag0 = pkt;
+						pkt = (IncomingPacket *)0;
 						rq->totalFragments = 0;
 						rq->haveFragments = 1;
 						rq->complete = false;
 					} else if (!(rq->haveFragments & 1)) {
 						// If we have other fragments but no head, see if we are complete with the head
 
-						if ((rq->totalFragments > 1)&&(Utils::countBits(rq->haveFragments |= 1) == rq->totalFragments)) {
+						rq->frag0 = pkt;
+						pkt = (IncomingPacket *)0;
+
+						if ((rq->totalFragments > 1)&&(Utils::countBits(rq->haveFragments |= 1) == rq->totalFragments)&&(rq->ready())) {
 							// We have all fragments -- assemble and process full Packet
 							//TRACE("packet %.16llx is complete, assembling and processing...",pid);
 
-							rq->frag0.init(data,len,localAddr,fromAddr,now);
-							for(unsigned int f=1;f<rq->totalFragments;++f)
-								rq->frag0.append(rq->frags[f - 1].payload(),rq->frags[f - 1].payloadLength());
-
-							if (rq->frag0.tryDecode(RR,false)) {
-								rq->timestamp = 0; // packet decoded, free entry
-							} else {
-								rq->complete = true; // set complete flag but leave entry since it probably needs WHOIS or something
-							}
-						} else {
-							// Still waiting on more fragments, but keep the head
-							rq->frag0.init(data,len,localAddr,fromAddr,now);
-						}
+							rq->assemble(RR->pool);
+							full = rq->frag0;
+							rq->frag0 = (IncomingPacket *)0;
+							rqs.timestamp[rqi] = 0; // free entry, _decode() parks it again if it must wait
+						} // else still waiting on more fragments, but keep the head
 					} // else this is a duplicate head, ignore
 				} else {
 					// Packet is unfragmented, so just process it
-					IncomingPacket packet(data,len,localAddr,fromAddr,now);
-					if (!packet.tryDecode(RR,false)) {
-						Mutex::Lock _l(_rxQueue_m);
-						RXQueueEntry *rq = &(_rxQueue[ZT_RX_QUEUE_SIZE - 1]);
-						unsigned long i = ZT_RX_QUEUE_SIZE - 1;
-						while ((i)&&(rq->timestamp)) {
-							RXQueueEntry *tmp = &(_rxQueue[--i]);
-							if (tmp->timestamp < rq->timestamp)
-								rq = tmp;
-						}
-						rq->timestamp = now;
-						rq->packetId = packetId;
-						rq->frag0 = packet;
-						rq->totalFragments = 1;
-						rq->haveFragments = 1;
-						rq->complete = true;
-					}
+					full = pkt;
+					pkt = (IncomingPacket *)0;
 				}
 
+				if (full)
+					_decode(full,now);
+
 				// --------------------------------------------------------------------
 			}
 		}
 	} catch (std::exception &ex) {
-		TRACE("dropped packet from %s: unexpected exception: %s",fromAddr.toString().c_str(),ex.what());
+		TRACE("dropped packet from %s: unexpected exception: %s",(pkt) ? pkt->remoteAddress().toString().c_str() : "(queued)",ex.what());
 	} catch ( ... ) {
-		TRACE("dropped packet from %s: unexpected exception: (unknown)",fromAddr.toString().c_str());
+		TRACE("dropped packet from %s: unexpected exception: (unknown)",(pkt) ? pkt->remoteAddress().toString().c_str() : "(queued)");
 	}
+
+	RR->pool->put(pkt); // NULL if it was kept or handed off
 }
 
 void Switch::onLocalEthernet(const SharedPtr<Network> &network,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
@@ -557,10 +553,8 @@ void Switch::send(const Packet &packet,bool encrypt,uint64_t nwid)
 
 	//TRACE(">> %s to %s (%u bytes, encrypt==%d, nwid==%.16llx)",Packet::verbString(packet.verb()),packet.destination().toString().c_str(),packet.size(),(int)encrypt,nwid);
 
-	if (!_trySend(packet,encrypt,nwid)) {
-		Mutex::Lock _l(_txQueue_m);
-		_txQueue.push_back(TXQueueEntry(packet.destination(),RR->node->now(),packet,encrypt,nwid));
-	}
+	if (!_trySend(packet,encrypt,nwid))
+		_queue(packet,encrypt,nwid);
 }
 
 bool Switch::unite(const Address &p1,const Address &p2)
@@ -608,7 +602,7 @@ bool Switch::unite(const Address &p1,const Address &p2)
 				outp.append((unsigned char)4);
 				outp.append(cg.first.rawIpData(),4);
 			}
-			outp.armor(p1p->key(),true);
+			outp.armor(p1p->armorKey(),true);
 			p1p->send(outp.data(),outp.size(),now);
 		} else {
 			// Tell p2 where to find p1.
@@ -623,7 +617,7 @@ bool Switch::unite(const Address &p1,const Address &p2)
 				outp.append((unsigned char)4);
 				outp.append(cg.second.rawIpData(),4);
 			}
-			outp.armor(p2p->key(),true);
+			outp.armor(p2p->armorKey(),true);
 			p2p->send(outp.data(),outp.size(),now);
 		}
 		++alt; // counts up and also flips LSB
@@ -639,7 +633,8 @@ void Switch::rendezvous(const SharedPtr<Peer> &peer,const InetAddress &localAddr
 	peer->sendHELLO(localAddr,atAddr,now,2); // first attempt: send low-TTL packet to 'open' local NAT
 	{
 		Mutex::Lock _l(_contactQueue_m);
-		_contactQueue.push_back(ContactQueueEntry(peer,now + ZT_NAT_T_TACTICAL_ESCALATION_DELAY,localAddr,atAddr));
+		const ContactQueueEntry qe(peer,now + ZT_NAT_T_TACTICAL_ESCALATION_DELAY,localAddr,atAddr);
+		_contactQueue.schedule(qe,qe.fireAtTime);
 	}
 }
 
@@ -653,6 +648,8 @@ void Switch::requestWhois(const Address &addr)
 			r.retries = 0; // reset retry count if entry already existed, but keep waiting and retry again after normal timeout
 		} else {
 			r.lastSent = RR->node->now();
+			r.retryAt = r.lastSent + ZT_WHOIS_RETRY_DELAY;
+			_whoisTimers.schedule(addr,r.retryAt);
 			inserted = true;
 		}
 	}
@@ -667,26 +664,48 @@ void Switch::doAnythingWaitingForPeer(const SharedPtr<Peer> &peer)
 		_outstandingWhoisRequests.erase(peer->address());
 	}
 
-	{	// finish processing any packets waiting on peer's public key / identity
-		Mutex::Lock _l(_rxQueue_m);
-		unsigned long i = ZT_RX_QUEUE_SIZE;
-		while (i) {
-			RXQueueEntry *rq = &(_rxQueue[--i]);
-			if ((rq->timestamp)&&(rq->complete)) {
-				if (rq->frag0.tryDecode(RR,false))
-					rq->timestamp = 0;
+	// finish processing any packets waiting on peer's public key / identity
+	const uint64_t now = RR->node->now();
+	for(unsigned int s=0;s<ZT_RX_QUEUE_SHARDS;++s) {
+		// Take complete packets out of the shard, then decode without its lock
+		IncomingPacket *waiting[ZT_RX_QUEUE_SHARD_SIZE];
+		unsigned int waitingCount = 0;
+		{
+			RXQueueShard &rqs = _rxQueue[s];
+			Mutex::Lock _l(rqs.lock);
+			for(unsigned int i=0;i<ZT_RX_QUEUE_SHARD_SIZE;++i) {
+				RXQueueEntry &rq = rqs.entries[i];
+				if ((rqs.timestamp[i])&&(rq.complete)) {
+					waiting[waitingCount++] = rq.frag0;
+					rq.frag0 = (IncomingPacket *)0;
+					rqs.timestamp[i] = 0;
+				}
 			}
 		}
+		if (!waitingCount)
+			continue;
+
+		// Authenticate everything this peer sent while we waited in one batch
+		IncomingPacket *fromPeer[ZT_RX_QUEUE_SHARD_SIZE];
+		unsigned int fromPeerCount = 0;
+		for(unsigned int i=0;i<waitingCount;++i) {
+			if (waiting[i]->source() == peer->address())
+				fromPeer[fromPeerCount++] = waiting[i];
+		}
+		if (fromPeerCount > 1)
+			IncomingPacket::authenticateBatch(fromPeer,fromPeerCount,peer->armorKey());
+
+		for(unsigned int i=0;i<waitingCount;++i)
+			_decode(waiting[i],now); // parked again if still waiting
 	}
 
 	{	// finish sending any packets waiting on peer's public key / identity
 		Mutex::Lock _l(_txQueue_m);
-		for(std::list< TXQueueEntry >::iterator txi(_txQueue.begin());txi!=_txQueue.end();) {
-			if (txi->dest == peer->address()) {
-				if (_trySend(txi->packet,txi->encrypt,txi->nwid))
-					_txQueue.erase(txi++);
-				else ++txi;
-			} else ++txi;
+		TXQueue *const q = _txQueue.get(peer->address());
+		if (q) {
+			_trySendQueued(*q);
+			if (!q->count)
+				_txQueue.erase(peer->address());
 		}
 	}
 }
@@ -695,192 +714,334 @@ unsigned long Switch::doTimerTasks(uint64_t now)
 {
 	unsigned long nextDelay = 0xffffffff; // ceiling delay, caller will cap to minimum
 
-	{	// Iterate through NAT traversal strategies for entries in contact queue
-		Mutex::Lock _l(_contactQueue_m);
-		for(std::list<ContactQueueEntry>::iterator qi(_contactQueue.begin());qi!=_contactQueue.end();) {
-			if (now >= qi->fireAtTime) {
-				if (!qi->peer->pushDirectPaths(qi->localAddr,qi->inaddr,now,true,false))
-					qi->peer->sendHELLO(qi->localAddr,qi->inaddr,now);
-				_contactQueue.erase(qi++);
-				continue;
-				/* Old symmetric NAT buster code, obsoleted by port prediction alg in SelfAwareness but left around for now in case we revert
-				if (qi->strategyIteration == 0) {
-					// First strategy: send packet directly to destination
-					qi->peer->sendHELLO(qi->localAddr,qi->inaddr,now);
-				} else if (qi->strategyIteration <= 3) {
-					// Strategies 1-3: try escalating ports for symmetric NATs that remap sequentially
-					InetAddress tmpaddr(qi->inaddr);
-					int p = (int)qi->inaddr.port() + qi->strategyIteration;
-					if (p > 65535)
-						p -= 64511;
-					tmpaddr.setPort((unsigned int)p);
-					qi->peer->sendHELLO(qi->localAddr,tmpaddr,now);
-				} else {
-					// All strategies tried, expire entry
-					_contactQueue.erase(qi++);
-					continue;
-				}
-				++qi->strategyIteration;
-				qi->fireAtTime = now + ZT_NAT_T_TACTICAL_ESCALATION_DELAY;
-				nextDelay = std::min(nextDelay,(unsigned long)ZT_NAT_T_TACTICAL_ESCALATION_DELAY);
-				*/
-			} else {
-				nextDelay = std::min(nextDelay,(unsigned long)(qi->fireAtTime - now));
-			}
-			++qi; // if qi was erased, loop will have continued before here
+	{	// Try NAT traversal for entries in contact queue whose time has come
+		std::vector<ContactQueueEntry> due;
+		{
+			Mutex::Lock _l(_contactQueue_m);
+			_contactQueue.expire(now,due);
+			const uint64_t nd = _contactQueue.nextDeadline();
+			nextDelay = std::min(nextDelay,(nd > now) ? (unsigned long)std::min(nd - now,(uint64_t)0xffffffff) : 0UL);
+		}
+		for(std::vector<ContactQueueEntry>::const_iterator qi(due.begin());qi!=due.end();++qi) {
+			if (!qi->peer->pushDirectPaths(qi->localAddr,qi->inaddr,now,true,false))
+				qi->peer->sendHELLO(qi->localAddr,qi->inaddr,now);
 		}
 	}
 
-	{	// Retry outstanding WHOIS requests
+	{	// Retry outstanding WHOIS requests whose timers are due
 		Mutex::Lock _l(_outstandingWhoisRequests_m);
-		Hashtable< Address,WhoisRequest >::Iterator i(_outstandingWhoisRequests);
-		Address *a = (Address *)0;
-		WhoisRequest *r = (WhoisRequest *)0;
-		while (i.next(a,r)) {
-			const unsigned long since = (unsigned long)(now - r->lastSent);
-			if (since >= ZT_WHOIS_RETRY_DELAY) {
-				if (r->retries >= ZT_MAX_WHOIS_RETRIES) {
-					TRACE("WHOIS %s timed out",a->toString().c_str());
-					_outstandingWhoisRequests.erase(*a);
-				} else {
-					r->lastSent = now;
-					r->peersConsulted[r->retries] = _sendWhoisRequest(*a,r->peersConsulted,r->retries);
-					++r->retries;
-					TRACE("WHOIS %s (retry %u)",a->toString().c_str(),r->retries);
-					nextDelay = std::min(nextDelay,(unsigned long)ZT_WHOIS_RETRY_DELAY);
-				}
+		std::vector<Address> due;
+		_whoisTimers.expire(now,due);
+		for(std::vector<Address>::const_iterator a(due.begin());a!=due.end();++a) {
+			WhoisRequest *const r = _outstandingWhoisRequests.get(*a);
+			if ((!r)||(r->retryAt > now))
+				continue; // answered, or re-requested with a later timer of its own
+			if (r->retries >= ZT_MAX_WHOIS_RETRIES) {
+				TRACE("WHOIS %s timed out",a->toString().c_str());
+				_outstandingWhoisRequests.erase(*a);
 			} else {
-				nextDelay = std::min(nextDelay,ZT_WHOIS_RETRY_DELAY - since);
+				r->lastSent = now;
+				r->retryAt = now + ZT_WHOIS_RETRY_DELAY;
+				_whoisTimers.schedule(*a,r->retryAt);
+				r->peersConsulted[r->retries] = _sendWhoisRequest(*a,r->peersConsulted,r->retries);
+				++r->retries;
+				TRACE("WHOIS %s (retry %u)",a->toString().c_str(),r->retries);
 			}
 		}
+		const uint64_t nd = _whoisTimers.nextDeadline();
+		nextDelay = std::min(nextDelay,(nd > now) ? (unsigned long)std::min(nd - now,(uint64_t)0xffffffff) : 0UL);
 	}
 
 	{	// Time out TX queue packets that never got WHOIS lookups or other info.
 		Mutex::Lock _l(_txQueue_m);
-		for(std::list< TXQueueEntry >::iterator txi(_txQueue.begin());txi!=_txQueue.end();) {
-			if (_trySend(txi->packet,txi->encrypt,txi->nwid))
-				_txQueue.erase(txi++);
-			else if ((now - txi->creationTime) > ZT_TRANSMIT_QUEUE_TIMEOUT) {
-				TRACE("TX %s -> %s timed out",txi->packet.source().toString().c_str(),txi->packet.destination().toString().c_str());
-				_txQueue.erase(txi++);
-			} else ++txi;
+		Hashtable< Address,TXQueue >::Iterator i(_txQueue);
+		Address *a = (Address *)0;
+		TXQueue *q = (TXQueue *)0;
+		while (i.next(a,q)) {
+			// Entries are oldest first, so expired ones are all at the head
+			while ((q->count)&&((now - q->at(0)->creationTime) > ZT_TRANSMIT_QUEUE_TIMEOUT)) {
+				TRACE("TX %s -> %s timed out",q->at(0)->packet.source().toString().c_str(),a->toString().c_str());
+				delete q->pop();
+			}
+
+			// Packets for unknown peers wait for doAnythingWaitingForPeer(), others may be waiting on a path
+			if ((q->count)&&(RR->topology->getPeer(*a)))
+				_trySendQueued(*q);
+
+			if (q->count)
+				nextDelay = std::min(nextDelay,(unsigned long)((q->at(0)->creationTime + ZT_TRANSMIT_QUEUE_TIMEOUT + 1) - now));
+			else _txQueue.erase(*a);
 		}
 	}
 
-	{	// Remove really old last unite attempt entries to keep table size controlled
-		Mutex::Lock _l(_lastUniteAttempt_m);
-		Hashtable< _LastUniteKey,uint64_t >::Iterator i(_lastUniteAttempt);
+	{	// Remove really old last unite attempt entries to keep table size controlled, one shard at a time
+		_LastUniteShard &sh = _lastUniteAttempt[_lastUniteCleanShard++ % ZT_SWITCH_LAST_UNITE_SHARDS];
+		Mutex::Lock _l(sh.lock);
+		Hashtable< _LastUniteKey,uint64_t >::Iterator i(sh.attempts);
 		_LastUniteKey *k = (_LastUniteKey *)0;
 		uint64_t *v = (uint64_t *)0;
 		while (i.next(k,v)) {
 			if ((now - *v) >= (ZT_MIN_UNITE_INTERVAL * 8))
-				_lastUniteAttempt.erase(*k);
+				sh.attempts.erase(*k);
 		}
 	}
 
 	return nextDelay;
 }
 
+void Switch::_trySendQueued(TXQueue &q)
+{
+	for(unsigned int n=q.count;n>0;--n) {
+		TXQueueEntry *const e = q.pop();
+		if (_trySend(e->packet,e->encrypt,e->nwid))
+			delete e;
+		else q.push(e);
+	}
+}
+
+void Switch::_decode(IncomingPacket *pkt,uint64_t now)
+{
+	if (pkt->tryDecode(RR,false)) {
+		_doneWith(pkt);
+	} else {
+		// Probably needs WHOIS, so park it as complete for doAnythingWaitingForPeer().
+		// It keeps its receive time so parking it again doesn't delay its expiry.
+		const uint64_t packetId = pkt->packetId();
+		const uint64_t ts = (pkt->receiveTime()) ? pkt->receiveTime() : now;
+		RXQueueShard &rqs = _rxQueueShard(packetId);
+		Mutex::Lock _l(rqs.lock);
+		RXQueueEntry *const rq = rqs.claim(RR->pool,rqs.find(now,packetId),ts,packetId);
+		rq->frag0 = pkt;
+		rq->totalFragments = 1;
+		rq->haveFragments = 1;
+		rq->complete = true;
+	}
+}
+
+void Switch::_doneWith(IncomingPacket *pkt)
+{
+	if ((pkt->wantsDeferral())&&(RR->dp->enqueue(pkt)))
+		return;
+	RR->pool->put(pkt);
+}
+
+bool Switch::_shouldUnite(const uint64_t now,const Address &source,const Address &destination)
+{
+	const _LastUniteKey k(source,destination);
+	_LastUniteShard &sh = _lastUniteAttempt[k.hashCode() % ZT_SWITCH_LAST_UNITE_SHARDS];
+	Mutex::Lock _l(sh.lock);
+	uint64_t &luts = sh.attempts[k];
+	if ((now - luts) >= ZT_MIN_UNITE_INTERVAL) {
+		luts = now;
+		return true;
+	}
+	return false;
+}
+
 Address Switch::_sendWhoisRequest(const Address &addr,const Address *peersAlreadyConsulted,unsigned int numPeersAlreadyConsulted)
 {
 	SharedPtr<Peer> root(RR->topology->getBestRoot(peersAlreadyConsulted,numPeersAlreadyConsulted,false));
 	if (root) {
 		Packet outp(root->address(),RR->identity.address(),Packet::VERB_WHOIS);
 		addr.appendTo(outp);
-		outp.armor(root->key(),true);
+		outp.armor(root->armorKey(),true);
 		if (root->send(outp.data(),outp.size(),RR->node->now()))
 			return root->address();
 	}
 	return Address();
 }
 
-bool Switch::_trySend(const Packet &packet,bool encrypt,uint64_t nwid)
+void Switch::sendCopies(const Packet &packet,const Address *destinations,unsigned int count,bool encrypt,uint64_t nwid)
 {
-	SharedPtr<Peer> peer(RR->topology->getPeer(packet.destination()));
+	const uint64_t now = RR->node->now();
+	IncomingPacket *batch[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	SharedPtr<Peer> peers[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	Path *paths[ZT_PACKET_CRYPTO_BATCH_SIZE];
+	unsigned int n = 0;
+	IncomingPacket *p = (IncomingPacket *)0; // copy being prepared, not yet in batch[]
 
-	if (peer) {
-		const uint64_t now = RR->node->now();
+	try {
+		for(unsigned int d=0;d<=count;++d) {
+			if (d < count) {
+				if (destinations[d] == RR->identity.address())
+					continue;
 
-		SharedPtr<Network> network;
-		if (nwid) {
-			network = RR->node->network(nwid);
-			if ((!network)||(!network->hasConfig()))
-				return false; // we probably just left this network, let its packets die
-		}
+				p = RR->pool->get();
+				p->copyFrom(packet.data(),packet.size());
+				p->newInitializationVector();
+				p->setDestination(destinations[d]);
+
+				if (!_route(destinations[d],nwid,now,peers[n],paths[n])) {
+					peers[n].zero();
+					try {
+						_queue(*p,encrypt,nwid);
+					} catch ( ... ) {}
+					RR->pool->put(p);
+					p = (IncomingPacket *)0;
+					continue;
+				}
 
-		Path *viaPath = peer->getBestPath(now);
-		SharedPtr<Peer> relay;
-
-		if (!viaPath) {
-			if (network) {
-				unsigned int bestq = ~((unsigned int)0); // max unsigned int since quality is lower==better
-				unsigned int ptr = 0;
-				for(;;) {
-					const Address raddr(network->config().nextRelay(ptr));
-					if (raddr) {
-						SharedPtr<Peer> rp(RR->topology->getPeer(raddr));
-						if (rp) {
-							const unsigned int q = rp->relayQuality(now);
-							if (q < bestq) {
-								bestq = q;
-								rp.swap(relay);
-							}
-						}
-					} else break;
+				p->setFragmented(p->size() > ZT_UDP_DEFAULT_PAYLOAD_MTU);
+				batch[n] = p;
+				p = (IncomingPacket *)0;
+				if (++n < ZT_PACKET_CRYPTO_BATCH_SIZE)
+					continue;
+			}
+
+			if (n) {
+				Packet *armor[ZT_PACKET_CRYPTO_BATCH_SIZE];
+				const Packet::ArmorKey *keys[ZT_PACKET_CRYPTO_BATCH_SIZE];
+				unsigned int na = 0;
+				for(unsigned int i=0;i<n;++i) {
+					const uint64_t trustedPathId = RR->topology->getOutboundPathTrust(paths[i]->address());
+					if (trustedPathId) {
+						batch[i]->setTrusted(trustedPathId);
+					} else {
+						armor[na] = batch[i];
+						keys[na++] = &(peers[i]->armorKey());
+					}
+				}
+				Packet::armorBatch(armor,keys,na,encrypt);
+
+				for(unsigned int i=0;i<n;++i) {
+					if (!_transmit(*batch[i],paths[i],now)) {
+						// Queue an unarmored copy to be retried, as send() would
+						batch[i]->copyFrom(packet.data(),packet.size());
+						batch[i]->newInitializationVector();
+						batch[i]->setDestination(peers[i]->address());
+						try {
+							_queue(*batch[i],encrypt,nwid);
+						} catch ( ... ) {}
+					}
+					RR->pool->put(batch[i]);
+					batch[i] = (IncomingPacket *)0;
+					peers[i].zero();
 				}
+				n = 0;
 			}
+		}
+	} catch ( ... ) {
+		if (p)
+			RR->pool->put(p);
+		for(unsigned int i=0;i<n;++i) {
+			if (batch[i])
+				RR->pool->put(batch[i]);
+		}
+	}
+}
 
-			if (!relay)
-				relay = RR->topology->getBestRoot();
+void Switch::_queue(const Packet &packet,bool encrypt,uint64_t nwid)
+{
+	TXQueueEntry *const e = new TXQueueEntry(RR->node->now(),packet,encrypt,nwid);
+	Mutex::Lock _l(_txQueue_m);
+	TXQueue &q = _txQueue[packet.destination()];
+	if (q.count >= ZT_TRANSMIT_QUEUE_PER_DESTINATION) {
+		TRACE("TX queue for %s full, dropped oldest packet",packet.destination().toString().c_str());
+		delete q.pop();
+	}
+	q.push(e);
+}
 
-			if ( (!relay) || (!(viaPath = relay->getBestPath(now))) )
-				return false;
-		}
-		// viaPath will not be null if we make it here
+bool Switch::_route(const Address &destination,uint64_t nwid,uint64_t now,SharedPtr<Peer> &peer,Path *&viaPath)
+{
+	peer = RR->topology->getPeer(destination);
+	if (!peer) {
+		requestWhois(destination);
+		return false;
+	}
+
+	SharedPtr<Network> network;
+	if (nwid) {
+		network = RR->node->network(nwid);
+		if ((!network)||(!network->hasConfig()))
+			return false; // we probably just left this network, let its packets die
+	}
 
-		// Push possible direct paths to us if we are relaying
-		if (relay) {
-			peer->pushDirectPaths(viaPath->localAddress(),viaPath->address(),now,false,( (network)&&(network->isAllowed(peer)) ));
-			viaPath->sent(now);
+	viaPath = peer->getBestPath(now);
+	SharedPtr<Peer> relay;
+
+	if (!viaPath) {
+		if (network) {
+			unsigned int bestq = ~((unsigned int)0); // max unsigned int since quality is lower==better
+			unsigned int ptr = 0;
+			for(;;) {
+				const Address raddr(network->config().nextRelay(ptr));
+				if (raddr) {
+					SharedPtr<Peer> rp(RR->topology->getPeer(raddr));
+					if (rp) {
+						const unsigned int q = rp->relayQuality(now);
+						if (q < bestq) {
+							bestq = q;
+							rp.swap(relay);
+						}
+					}
+				} else break;
+			}
 		}
 
-		Packet tmp(packet);
+		if (!relay)
+			relay = RR->topology->getBestRoot();
 
-		unsigned int chunkSize = std::min(tmp.size(),(unsigned int)ZT_UDP_DEFAULT_PAYLOAD_MTU);
-		tmp.setFragmented(chunkSize < tmp.size());
+		if ( (!relay) || (!(viaPath = relay->getBestPath(now))) )
+			return false;
+	}
+	// viaPath will not be null if we make it here
 
-		const uint64_t trustedPathId = RR->topology->getOutboundPathTrust(viaPath->address());
-		if (trustedPathId) {
-			tmp.setTrusted(trustedPathId);
-		} else {
-			tmp.armor(peer->key(),encrypt);
-		}
+	// Push possible direct paths to us if we are relaying
+	if (relay) {
+		peer->pushDirectPaths(viaPath->localAddress(),viaPath->address(),now,false,( (network)&&(network->isAllowed(peer)) ));
+		viaPath->sent(now);
+	}
 
-		if (viaPath->send(RR,tmp.data(),chunkSize,now)) {
-			if (chunkSize < tmp.size()) {
-				// Too big for one packet, fragment the rest
-				unsigned int fragStart = chunkSize;
-				unsigned int remaining = tmp.size() - chunkSize;
-				unsigned int fragsRemaining = (remaining / (ZT_UDP_DEFAULT_PAYLOAD_MTU - ZT_PROTO_MIN_FRAGMENT_LENGTH));
-				if ((fragsRemaining * (ZT_UDP_DEFAULT_PAYLOAD_MTU - ZT_PROTO_MIN_FRAGMENT_LENGTH)) < remaining)
-					++fragsRemaining;
-				unsigned int totalFragments = fragsRemaining + 1;
-
-				for(unsigned int fno=1;fno<totalFragments;++fno) {
-					chunkSize = std::min(remaining,(unsigned int)(ZT_UDP_DEFAULT_PAYLOAD_MTU - ZT_PROTO_MIN_FRAGMENT_LENGTH));
-					Packet::Fragment frag(tmp,fragStart,chunkSize,fno,totalFragments);
-					viaPath->send(RR,frag.data(),frag.size(),now);
-					fragStart += chunkSize;
-					remaining -= chunkSize;
-				}
-			}
+	return true;
+}
+
+bool Switch::_transmit(const Packet &packet,Path *viaPath,uint64_t now)
+{
+	unsigned int chunkSize = std::min(packet.size(),(unsigned int)ZT_UDP_DEFAULT_PAYLOAD_MTU);
+	if (!viaPath->send(RR,packet.data(),chunkSize,now))
+		return false;
 
-			return true;
+	if (chunkSize < packet.size()) {
+		// Too big for one packet, fragment the rest
+		unsigned int fragStart = chunkSize;
+		unsigned int remaining = packet.size() - chunkSize;
+		unsigned int fragsRemaining = (remaining / (ZT_UDP_DEFAULT_PAYLOAD_MTU - ZT_PROTO_MIN_FRAGMENT_LENGTH));
+		if ((fragsRemaining * (ZT_UDP_DEFAULT_PAYLOAD_MTU - ZT_PROTO_MIN_FRAGMENT_LENGTH)) < remaining)
+			++fragsRemaining;
+		unsigned int totalFragments = fragsRemaining + 1;
+
+		for(unsigned int fno=1;fno<totalFragments;++fno) {
+			chunkSize = std::min(remaining,(unsigned int)(ZT_UDP_DEFAULT_PAYLOAD_MTU - ZT_PROTO_MIN_FRAGMENT_LENGTH));
+			Packet::Fragment frag(packet,fragStart,chunkSize,fno,totalFragments);
+			viaPath->send(RR,frag.data(),frag.size(),now);
+			fragStart += chunkSize;
+			remaining -= chunkSize;
 		}
+	}
+
+	return true;
+}
+
+bool Switch::_trySend(const Packet &packet,bool encrypt,uint64_t nwid)
+{
+	const uint64_t now = RR->node->now();
+	SharedPtr<Peer> peer;
+	Path *viaPath = (Path *)0;
+	if (!_route(packet.destination(),nwid,now,peer,viaPath))
+		return false;
+
+	Packet tmp(packet);
+	tmp.setFragmented(tmp.size() > ZT_UDP_DEFAULT_PAYLOAD_MTU);
+
+	const uint64_t trustedPathId = RR->topology->getOutboundPathTrust(viaPath->address());
+	if (trustedPathId) {
+		tmp.setTrusted(trustedPathId);
 	} else {
-		requestWhois(packet.destination());
+		tmp.armor(peer->armorKey(),encrypt);
 	}
-	return false;
+
+	return _transmit(tmp,viaPath,now);
 }
 
 } // namespace ZeroTier
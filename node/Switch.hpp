@@ -36,7 +36,15 @@
 #include "Network.hpp"
 #include "SharedPtr.hpp"
 #include "IncomingPacket.hpp"
+#include "PacketPool.hpp"
+#include "SizeClassPool.hpp"
 #include "Hashtable.hpp"
+#include "TimerWheel.hpp"
+
+/**
+ * Number of separately locked shards of the last unite attempt table
+ */
+#define ZT_SWITCH_LAST_UNITE_SHARDS 16
 
 namespace ZeroTier {
 
@@ -60,12 +68,13 @@ public:
 	/**
 	 * Called when a packet is received from the real network
 	 *
-	 * @param localAddr Local interface address
-	 * @param fromAddr Internet IP address of origin
-	 * @param data Packet data
-	 * @param len Packet length
+	 * The packet is parsed in place. It is kept (without copying) if it must
+	 * wait for other fragments or for WHOIS, and is otherwise returned to
+	 * the packet pool or handed to DeferredPackets.
+	 *
+	 * @param pkt Packet from the packet pool, init()'ed with its addresses (this takes ownership)
 	 */
-	void onRemotePacket(const InetAddress &localAddr,const InetAddress &fromAddr,const void *data,unsigned int len);
+	void onRemotePacket(IncomingPacket *pkt);
 
 	/**
 	 * Called when a packet comes from a local Ethernet tap
@@ -102,6 +111,22 @@ public:
 	 */
 	void send(const Packet &packet,bool encrypt,uint64_t nwid);
 
+	/**
+	 * Send copies of a packet to several destinations
+	 *
+	 * Each copy gets its own destination and IV and is armored with its
+	 * recipient's key. Copies are made in pooled buffers and armored in
+	 * batches of up to ZT_PACKET_CRYPTO_BATCH_SIZE with Packet::armorBatch().
+	 * Copies that can't be sent yet are queued as they would be by send().
+	 *
+	 * @param packet Packet to copy (its destination and IV are not used)
+	 * @param destinations Destination addresses (this node's address is skipped)
+	 * @param count Number of destinations
+	 * @param encrypt Encrypt packet payload?
+	 * @param nwid Related network ID or 0 if message is not in-network traffic
+	 */
+	void sendCopies(const Packet &packet,const Address *destinations,unsigned int count,bool encrypt,uint64_t nwid);
+
 	/**
 	 * Send RENDEZVOUS to two peers to permit them to directly connect
 	 *
@@ -152,6 +177,12 @@ public:
 private:
 	Address _sendWhoisRequest(const Address &addr,const Address *peersAlreadyConsulted,unsigned int numPeersAlreadyConsulted);
 	bool _trySend(const Packet &packet,bool encrypt,uint64_t nwid);
+	void _queue(const Packet &packet,bool encrypt,uint64_t nwid); // hold for doAnythingWaitingForPeer() or retry
+	bool _route(const Address &destination,uint64_t nwid,uint64_t now,SharedPtr<Peer> &peer,Path *&viaPath); // requests WHOIS if peer is unknown
+	bool _transmit(const Packet &packet,Path *viaPath,uint64_t now); // packet must already be armored
+	bool _shouldUnite(const uint64_t now,const Address &source,const Address &destination);
+	void _decode(IncomingPacket *pkt,uint64_t now); // pkt is complete; must not be called with an RX shard locked
+	void _doneWith(IncomingPacket *pkt);
 
 	const RuntimeEnvironment *const RR;
 	uint64_t _lastBeaconResponse;
@@ -159,66 +190,147 @@ private:
 	// Outstanding WHOIS requests and how many retries they've undergone
 	struct WhoisRequest
 	{
-		WhoisRequest() : lastSent(0),retries(0) {}
+		WhoisRequest() : lastSent(0),retryAt(0),retries(0) {}
 		uint64_t lastSent;
+		uint64_t retryAt; // deadline of this request's timer in _whoisTimers
 		Address peersConsulted[ZT_MAX_WHOIS_RETRIES]; // by retry
 		unsigned int retries; // 0..ZT_MAX_WHOIS_RETRIES
 	};
 	Hashtable< Address,WhoisRequest > _outstandingWhoisRequests;
+	TimerWheel< Address > _whoisTimers; // may hold stale entries for answered or re-sent requests
 	Mutex _outstandingWhoisRequests_m;
 
 	// Packets waiting for WHOIS replies or other decode info or missing fragments
 	struct RXQueueEntry
 	{
-		RXQueueEntry() : timestamp(0) {}
-		uint64_t timestamp; // 0 if entry is not in use
-		uint64_t packetId;
-		IncomingPacket frag0; // head of packet
-		Packet::Fragment frags[ZT_MAX_PACKET_FRAGMENTS - 1]; // later fragments (if any)
+		IncomingPacket *frag0; // head of packet, or NULL if not yet received
+		IncomingPacket *frags[ZT_MAX_PACKET_FRAGMENTS - 1]; // later fragments as received (if any)
 		unsigned int totalFragments; // 0 if only frag0 received, waiting for frags
 		uint32_t haveFragments; // bit mask, LSB to MSB
 		bool complete; // if true, packet is complete
+
+		/* True if the head and every fragment below totalFragments are here.
+		 * Checked before assemble() since fragment slots are pointers. */
+		inline bool ready() const
+		{
+			if ((!frag0)||(totalFragments < 2)||(totalFragments > ZT_MAX_PACKET_FRAGMENTS))
+				return false;
+			for(unsigned int f=1;f<totalFragments;++f) {
+				if (!frags[f - 1])
+					return false;
+			}
+			return true;
+		}
+
+		/* Appends the payloads of all other fragments to frag0 and returns
+		 * them to the pool. Caller must check ready() first. */
+		inline void assemble(PacketPool *pool)
+		{
+			for(unsigned int f=1;f<totalFragments;++f) {
+				IncomingPacket *const frag = frags[f - 1];
+				const unsigned int plen = frag->size() - ZT_PACKET_FRAGMENT_IDX_PAYLOAD;
+				frag0->append(frag->field(ZT_PACKET_FRAGMENT_IDX_PAYLOAD,plen),plen);
+				frags[f - 1] = (IncomingPacket *)0;
+				pool->put(frag);
+			}
+		}
 	};
-	RXQueueEntry _rxQueue[ZT_RX_QUEUE_SIZE];
-	Mutex _rxQueue_m;
 
-	/* Returns the matching or oldest entry. Caller must check timestamp and
-	 * packet ID to determine which. */
-	inline RXQueueEntry *_findRXQueueEntry(uint64_t now,uint64_t packetId)
+	// One separately locked slice of the RX queue. IDs and timestamps are kept
+	// apart from the entries so a lookup only touches a cache line or two.
+	struct RXQueueShard
 	{
-		RXQueueEntry *rq;
-		RXQueueEntry *oldest = &(_rxQueue[ZT_RX_QUEUE_SIZE - 1]);
-		unsigned long i = ZT_RX_QUEUE_SIZE;
-		while (i) {
-			rq = &(_rxQueue[--i]);
-			if ((rq->packetId == packetId)&&(rq->timestamp))
-				return rq;
-			if ((now - rq->timestamp) >= ZT_RX_QUEUE_EXPIRE)
-				rq->timestamp = 0;
-			if (rq->timestamp < oldest->timestamp)
-				oldest = rq;
+		RXQueueShard()
+		{
+			memset(packetId,0,sizeof(packetId));
+			memset(timestamp,0,sizeof(timestamp));
+			memset(entries,0,sizeof(entries));
+		}
+
+		/* Returns the index of the matching or oldest entry, expiring old ones
+		 * as it goes. Caller must check timestamp and packet ID to determine
+		 * which. Shard must be locked. */
+		inline unsigned int find(uint64_t now,uint64_t pid)
+		{
+			unsigned int oldest = 0;
+			for(unsigned int i=0;i<ZT_RX_QUEUE_SHARD_SIZE;++i) {
+				if ((packetId[i] == pid)&&(timestamp[i]))
+					return i;
+				if ((now - timestamp[i]) >= ZT_RX_QUEUE_EXPIRE)
+					timestamp[i] = 0;
+				if (timestamp[i] < timestamp[oldest])
+					oldest = i;
+			}
+			return oldest;
 		}
-		return oldest;
-	}
+
+		/* Takes entry i for a new packet ID, returning to the pool any packets
+		 * left over from whatever last used it. Shard must be locked. */
+		inline RXQueueEntry *claim(PacketPool *pool,unsigned int i,uint64_t now,uint64_t pid)
+		{
+			RXQueueEntry *const rq = &(entries[i]);
+			pool->put(rq->frag0);
+			rq->frag0 = (IncomingPacket *)0;
+			for(unsigned int f=0;f<(ZT_MAX_PACKET_FRAGMENTS - 1);++f) {
+				pool->put(rq->frags[f]);
+				rq->frags[f] = (IncomingPacket *)0;
+			}
+			timestamp[i] = now;
+			packetId[i] = pid;
+			return rq;
+		}
+
+		uint64_t packetId[ZT_RX_QUEUE_SHARD_SIZE];
+		uint64_t timestamp[ZT_RX_QUEUE_SHARD_SIZE]; // 0 if entry is not in use
+		RXQueueEntry entries[ZT_RX_QUEUE_SHARD_SIZE];
+		Mutex lock;
+	};
+	RXQueueShard _rxQueue[ZT_RX_QUEUE_SHARDS];
+
+	inline RXQueueShard &_rxQueueShard(uint64_t packetId) { return _rxQueue[(unsigned int)(packetId ^ (packetId >> 32)) & (ZT_RX_QUEUE_SHARDS - 1)]; }
 
 	// ZeroTier-layer TX queue entry
 	struct TXQueueEntry
 	{
 		TXQueueEntry() {}
-		TXQueueEntry(Address d,uint64_t ct,const Packet &p,bool enc,uint64_t nw) :
-			dest(d),
+		TXQueueEntry(uint64_t ct,const Packet &p,bool enc,uint64_t nw) :
 			creationTime(ct),
 			nwid(nw),
 			packet(p),
 			encrypt(enc) {}
 
-		Address dest;
+		static inline void *operator new(size_t s) { return SizeClassPool::alloc((unsigned long)s); }
+		static inline void operator delete(void *p,size_t s) { SizeClassPool::free(p,(unsigned long)s); }
+
 		uint64_t creationTime;
 		uint64_t nwid;
 		Packet packet; // unencrypted/unMAC'd packet -- this is done at send time
 		bool encrypt;
 	};
-	std::list< TXQueueEntry > _txQueue;
+
+	// Ring of packets waiting on one destination, oldest first
+	struct TXQueue
+	{
+		TXQueue() : head(0),count(0) {}
+		inline TXQueueEntry *&at(unsigned int i) { return entries[(head + i) % ZT_TRANSMIT_QUEUE_PER_DESTINATION]; }
+		inline TXQueueEntry *pop()
+		{
+			TXQueueEntry *const e = entries[head];
+			head = (head + 1) % ZT_TRANSMIT_QUEUE_PER_DESTINATION;
+			--count;
+			return e;
+		}
+		inline void push(TXQueueEntry *e) { at(count++) = e; }
+
+		TXQueueEntry *entries[ZT_TRANSMIT_QUEUE_PER_DESTINATION];
+		unsigned int head;
+		unsigned int count;
+	};
+
+	// Sends what it can from a destination's queue, keeping the rest in order. Lock must be held.
+	void _trySendQueued(TXQueue &q);
+
+	Hashtable< Address,TXQueue > _txQueue; // by destination
 	Mutex _txQueue_m;
 
 	// Tracks sending of VERB_RENDEZVOUS to relaying peers
@@ -239,8 +351,14 @@ private:
 		inline bool operator==(const _LastUniteKey &k) const throw() { return ((x == k.x)&&(y == k.y)); }
 		uint64_t x,y;
 	};
-	Hashtable< _LastUniteKey,uint64_t > _lastUniteAttempt; // key is always sorted in ascending order, for set-like behavior
-	Mutex _lastUniteAttempt_m;
+	struct _LastUniteShard
+	{
+		_LastUniteShard() : attempts(8) {} // only really used on root servers and upstreams, and it'll grow there just fine
+		Hashtable< _LastUniteKey,uint64_t > attempts; // key is always sorted in ascending order, for set-like behavior
+		Mutex lock;
+	};
+	_LastUniteShard _lastUniteAttempt[ZT_SWITCH_LAST_UNITE_SHARDS]; // sharded since every relayed packet checks this
+	unsigned int _lastUniteCleanShard; // shard to expire next, one per doTimerTasks()
 
 	// Active attempts to contact remote peers, including state of multi-phase NAT traversal
 	struct ContactQueueEntry
@@ -259,7 +377,7 @@ private:
 		InetAddress localAddr;
 		unsigned int strategyIteration;
 	};
-	std::list<ContactQueueEntry> _contactQueue;
+	TimerWheel<ContactQueueEntry> _contactQueue; // by fireAtTime
 	Mutex _contactQueue_m;
 };
 
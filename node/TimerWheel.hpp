@@ -0,0 +1,177 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2016  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZT_TIMERWHEEL_HPP
+#define ZT_TIMERWHEEL_HPP
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "Constants.hpp"
+
+/**
+ * Bits of tick count covered by each level of a timer wheel (256 slots)
+ */
+#define ZT_TIMER_WHEEL_LEVEL_BITS 8
+
+/**
+ * Number of levels in a timer wheel, enough for 2^32 ticks
+ */
+#define ZT_TIMER_WHEEL_LEVELS 4
+
+#define ZT_TIMER_WHEEL_SLOT_MASK ((1 << ZT_TIMER_WHEEL_LEVEL_BITS) - 1)
+
+namespace ZeroTier {
+
+/**
+ * Hierarchical timing wheel
+ *
+ * Time is divided into ticks of ZT_CORE_TIMER_TASK_GRANULARITY. Timers due
+ * within 256 ticks go into a slot of the first level, later ones into a
+ * coarser level, and are moved down a level each time the level below has
+ * gone all the way around. Scheduling is O(1) and expire() touches only
+ * the timers that are due plus the ones being moved down, so the cost of
+ * periodic work scales with what is actually due rather than with how many
+ * things are being tracked.
+ *
+ * Timers can't be cancelled or moved. Users keep the real deadline in their
+ * own state, check it when a key comes due, and ignore or reschedule keys
+ * whose deadline has changed. A key scheduled twice comes due twice.
+ *
+ * Timers fire no earlier than their deadline and up to one tick late.
+ * Deadlines more than 2^32 ticks away are brought in to that distance. This
+ * class is not thread safe.
+ *
+ * @tparam K Key type (copyable)
+ */
+template<typename K>
+class TimerWheel
+{
+public:
+	/**
+	 * @param now Current time
+	 */
+	TimerWheel(uint64_t now) :
+		_tick(now / ZT_CORE_TIMER_TASK_GRANULARITY),
+		_count(0)
+	{
+	}
+
+	/**
+	 * Schedule a key to come due
+	 *
+	 * @param key Key
+	 * @param deadline Time at or after which key should be returned by expire()
+	 */
+	inline void schedule(const K &key,uint64_t deadline)
+	{
+		_Entry e;
+		e.key = key;
+		e.tick = (deadline + (ZT_CORE_TIMER_TASK_GRANULARITY - 1)) / ZT_CORE_TIMER_TASK_GRANULARITY;
+		_insert(e);
+		++_count;
+	}
+
+	/**
+	 * Collect all keys that are due
+	 *
+	 * @param now Current time
+	 * @param due Due keys are appended to this vector
+	 */
+	inline void expire(uint64_t now,std::vector<K> &due)
+	{
+		const uint64_t target = now / ZT_CORE_TIMER_TASK_GRANULARITY;
+		while (_tick <= target) {
+			if (!_count) {
+				_tick = target + 1;
+				break;
+			}
+
+			// Move timers down from higher levels whose current slot is now within reach
+			for(unsigned int l=1;l<ZT_TIMER_WHEEL_LEVELS;++l) {
+				if ((_tick & ((1ULL << (ZT_TIMER_WHEEL_LEVEL_BITS * l)) - 1)) != 0)
+					break;
+				std::vector<_Entry> moving;
+				moving.swap(_slots[l][(unsigned int)(_tick >> (ZT_TIMER_WHEEL_LEVEL_BITS * l)) & ZT_TIMER_WHEEL_SLOT_MASK]);
+				for(typename std::vector<_Entry>::const_iterator e(moving.begin());e!=moving.end();++e)
+					_insert(*e);
+			}
+
+			std::vector<_Entry> &s = _slots[0][(unsigned int)_tick & ZT_TIMER_WHEEL_SLOT_MASK];
+			for(typename std::vector<_Entry>::const_iterator e(s.begin());e!=s.end();++e)
+				due.push_back(e->key);
+			_count -= (unsigned long)s.size();
+			s.clear();
+
+			++_tick;
+		}
+	}
+
+	/**
+	 * Get an early estimate of when expire() next has something to return
+	 *
+	 * This looks only at the first level. If that is empty it returns the
+	 * time at which timers will next be moved down into it.
+	 *
+	 * @return Time at or before which expire() should next be called, or 0xffffffffffffffff if no timers
+	 */
+	inline uint64_t nextDeadline() const
+	{
+		if (!_count)
+			return 0xffffffffffffffffULL;
+		for(uint64_t t=_tick,end=((_tick | ZT_TIMER_WHEEL_SLOT_MASK) + 1);t<end;++t) {
+			if (!_slots[0][(unsigned int)t & ZT_TIMER_WHEEL_SLOT_MASK].empty())
+				return (t * ZT_CORE_TIMER_TASK_GRANULARITY);
+		}
+		return (((_tick | ZT_TIMER_WHEEL_SLOT_MASK) + 1) * ZT_CORE_TIMER_TASK_GRANULARITY);
+	}
+
+	/**
+	 * @return Number of scheduled timers, including ones for stale deadlines
+	 */
+	inline unsigned long size() const throw() { return _count; }
+
+private:
+	struct _Entry
+	{
+		K key;
+		uint64_t tick;
+	};
+
+	inline void _insert(_Entry e)
+	{
+		if (e.tick < _tick)
+			e.tick = _tick;
+		else if ((e.tick - _tick) >= (1ULL << (ZT_TIMER_WHEEL_LEVEL_BITS * ZT_TIMER_WHEEL_LEVELS)))
+			e.tick = _tick + ((1ULL << (ZT_TIMER_WHEEL_LEVEL_BITS * ZT_TIMER_WHEEL_LEVELS)) - 1);
+		const uint64_t delta = e.tick - _tick;
+		unsigned int l = 0;
+		while ((l < (ZT_TIMER_WHEEL_LEVELS - 1))&&(delta >= (1ULL << (ZT_TIMER_WHEEL_LEVEL_BITS * (l + 1)))))
+			++l;
+		_slots[l][(unsigned int)(e.tick >> (ZT_TIMER_WHEEL_LEVEL_BITS * l)) & ZT_TIMER_WHEEL_SLOT_MASK].push_back(e);
+	}
+
+	std::vector<_Entry> _slots[ZT_TIMER_WHEEL_LEVELS][1 << ZT_TIMER_WHEEL_LEVEL_BITS];
+	uint64_t _tick; // next tick expire() will process
+	unsigned long _count;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -23,6 +23,7 @@
 #include "Network.hpp"
 #include "NetworkConfig.hpp"
 #include "Buffer.hpp"
+#include "SHA512.hpp"
 
 namespace ZeroTier {
 
@@ -45,8 +46,14 @@ static const unsigned char ZT_DEFAULT_WORLD[ZT_DEFAULT_WORLD_LENGTH] = {0x01,0x0
 Topology::Topology(const RuntimeEnvironment *renv) :
 	RR(renv),
 	_trustedPathCount(0),
-	_amRoot(false)
+	_peerIndex(new _PeerIndex(64)),
+	_peerCount(0),
+	_epoch(0),
+	_amRoot(false),
+	_peerTimers(RR->node->now())
 {
+	// Older versions saved all peers in one blob at shutdown. Load any such
+	// blob once; its peers get their own peers.d records as they are persisted.
 	std::string alls(RR->node->dataStoreGet("peers.save"));
 	const uint8_t *all = reinterpret_cast<const uint8_t *>(alls.data());
 	RR->node->dataStoreDelete("peers.save");
@@ -68,15 +75,13 @@ Topology::Topology(const RuntimeEnvironment *renv) :
 			if (!p)
 				break; // stop if invalid records
 			if (p->address() != RR->identity.address())
-				_peers.set(p->address(),p);
+				_addPeer(p);
 		} catch ( ... ) {
 			break; // stop if invalid records
 		}
 	}
 	delete deserializeBuf;
 
-	clean(RR->node->now());
-
 	std::string dsWorld(RR->node->dataStoreGet("world"));
 	World cachedWorld;
 	if (dsWorld.length() > 0) {
@@ -101,34 +106,32 @@ Topology::Topology(const RuntimeEnvironment *renv) :
 
 Topology::~Topology()
 {
-	Buffer<ZT_PEER_SUGGESTED_SERIALIZATION_BUFFER_SIZE> *pbuf = 0;
-	try {
-		pbuf = new Buffer<ZT_PEER_SUGGESTED_SERIALIZATION_BUFFER_SIZE>();
-		std::string all;
-
-		Address *a = (Address *)0;
-		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
-		Hashtable< Address,SharedPtr<Peer> >::Iterator i(_peers);
-		while (i.next(a,p)) {
-			if (std::find(_rootAddresses.begin(),_rootAddresses.end(),*a) == _rootAddresses.end()) {
-				pbuf->clear();
-				try {
-					(*p)->serialize(*pbuf);
-					try {
-						all.append((const char *)pbuf->data(),pbuf->size());
-					} catch ( ... ) {
-						return; // out of memory? just skip
-					}
-				} catch ( ... ) {} // peer too big? shouldn't happen, but it so skip
-			}
+	// Write out anything that changed since peers were last persisted by doTimerTasks()
+	const uint64_t now = RR->node->now();
+	_PeerIndex *const idx = _peerIndex;
+	for(unsigned long b=0;b<idx->bucketCount;++b) {
+		for(const _PeerEntry *e=idx->buckets[b];e;e=e->next) {
+			if ((e->peer->needsPersist(now))&&(std::find(_rootAddresses.begin(),_rootAddresses.end(),e->address) == _rootAddresses.end()))
+				_persistPeer(*(e->peer),now);
 		}
+	}
 
-		RR->node->dataStorePut("peers.save",all,true);
-
-		delete pbuf;
-	} catch ( ... ) {
-		delete pbuf;
+	// No readers remain, so everything can be freed now
+	for(unsigned long b=0;b<idx->bucketCount;++b) {
+		_PeerEntry *e = idx->buckets[b];
+		while (e) {
+			_PeerEntry *const n = e->next;
+			delete e;
+			e = n;
+		}
 	}
+	delete idx;
+	_retired.insert(_retired.end(),_retiring.begin(),_retiring.end());
+	for(std::vector<_PeerEntry *>::iterator e(_retired.begin());e!=_retired.end();++e)
+		delete *e;
+	_retiredIndexes.insert(_retiredIndexes.end(),_retiringIndexes.begin(),_retiringIndexes.end());
+	for(std::vector<_PeerIndex *>::iterator i(_retiredIndexes.begin());i!=_retiredIndexes.end();++i)
+		delete *i;
 }
 
 SharedPtr<Peer> Topology::addPeer(const SharedPtr<Peer> &peer)
@@ -145,10 +148,7 @@ SharedPtr<Peer> Topology::addPeer(const SharedPtr<Peer> &peer)
 	SharedPtr<Peer> np;
 	{
 		Mutex::Lock _l(_lock);
-		SharedPtr<Peer> &hp = _peers[peer->address()];
-		if (!hp)
-			hp = peer;
-		np = hp;
+		np = _addPeer(peer);
 	}
 
 	np->use(RR->node->now());
@@ -165,11 +165,40 @@ SharedPtr<Peer> Topology::getPeer(const Address &zta)
 	}
 
 	{
-		Mutex::Lock _l(_lock);
-		const SharedPtr<Peer> *const ap = _peers.get(zta);
+		_PeerIndexReader _r(*this);
+		const SharedPtr<Peer> ap(_findPeer(zta));
 		if (ap) {
-			(*ap)->use(RR->node->now());
-			return *ap;
+			ap->use(RR->node->now());
+			return ap;
+		}
+	}
+
+	{
+		// Evicted peers are both persisted and cached, and the stored record also has their paths
+		SharedPtr<Peer> np(_peerFromStore(zta));
+		if (np) {
+			{
+				Mutex::Lock _l(_identityCache_m);
+				_identityCache.erase(zta);
+			}
+			{
+				Mutex::Lock _l(_lock);
+				np = _addPeer(np);
+			}
+			np->use(RR->node->now());
+			return np;
+		}
+	}
+
+	{
+		SharedPtr<Peer> np(_peerFromIdentityCache(zta));
+		if (np) {
+			{
+				Mutex::Lock _l(_lock);
+				np = _addPeer(np);
+			}
+			np->use(RR->node->now());
+			return np;
 		}
 	}
 
@@ -179,12 +208,10 @@ SharedPtr<Peer> Topology::getPeer(const Address &zta)
 			SharedPtr<Peer> np(new Peer(RR,RR->identity,id));
 			{
 				Mutex::Lock _l(_lock);
-				SharedPtr<Peer> &ap = _peers[zta];
-				if (!ap)
-					ap.swap(np);
-				ap->use(RR->node->now());
-				return ap;
+				np = _addPeer(np);
 			}
+			np->use(RR->node->now());
+			return np;
 		}
 	} catch ( ... ) {
 		fprintf(stderr,"EXCEPTION in getPeer() part 2\n");
@@ -197,10 +224,16 @@ SharedPtr<Peer> Topology::getPeer(const Address &zta)
 Identity Topology::getIdentity(const Address &zta)
 {
 	{
-		Mutex::Lock _l(_lock);
-		const SharedPtr<Peer> *const ap = _peers.get(zta);
+		_PeerIndexReader _r(*this);
+		const SharedPtr<Peer> ap(_findPeer(zta));
 		if (ap)
-			return (*ap)->identity();
+			return ap->identity();
+	}
+	{
+		Mutex::Lock _l(_identityCache_m);
+		const _CachedIdentity *const ci = _identityCache.get(zta);
+		if (ci)
+			return ci->identity;
 	}
 	return _getIdentity(zta);
 }
@@ -214,6 +247,40 @@ void Topology::saveIdentity(const Identity &id)
 	}
 }
 
+bool Topology::comVerified(const CertificateOfMembership &com,const Identity &signer,uint64_t now)
+{
+	unsigned char digest[64];
+	_comDigest(com,signer,digest);
+	uint64_t k;
+	memcpy(&k,digest,8);
+	Mutex::Lock _l(_verifiedComs_m);
+	const _VerifiedCom *const vc = _verifiedComs.get(k);
+	return ((vc)&&(vc->expires > now)&&(!memcmp(vc->digest,digest + 8,32)));
+}
+
+void Topology::setComVerified(const CertificateOfMembership &com,const Identity &signer,uint64_t now)
+{
+	unsigned char digest[64];
+	_comDigest(com,signer,digest);
+	uint64_t dk;
+	memcpy(&dk,digest,8);
+	Mutex::Lock _l(_verifiedComs_m);
+	if (_verifiedComs.size() >= ZT_VERIFIED_COM_CACHE_SIZE) {
+		Hashtable< uint64_t,_VerifiedCom >::Iterator i(_verifiedComs);
+		uint64_t *k = (uint64_t *)0;
+		_VerifiedCom *vc = (_VerifiedCom *)0;
+		while (i.next(k,vc)) {
+			if (vc->expires <= now)
+				_verifiedComs.erase(*k);
+		}
+		if (_verifiedComs.size() >= ZT_VERIFIED_COM_CACHE_SIZE)
+			_verifiedComs.clear(); // all still current, so just start over
+	}
+	_VerifiedCom &vc = _verifiedComs[dk];
+	memcpy(vc.digest,digest + 8,32);
+	vc.expires = now + std::min(com.revisionMaxDelta(),(uint64_t)ZT_PEER_IN_MEMORY_EXPIRATION);
+}
+
 SharedPtr<Peer> Topology::getBestRoot(const Address *avoid,unsigned int avoidCount,bool strictAvoid)
 {
 	const uint64_t now = RR->node->now();
@@ -228,10 +295,10 @@ SharedPtr<Peer> Topology::getBestRoot(const Address *avoid,unsigned int avoidCou
 		for(unsigned long p=0;p<_rootAddresses.size();++p) {
 			if (_rootAddresses[p] == RR->identity.address()) {
 				for(unsigned long q=1;q<_rootAddresses.size();++q) {
-					const SharedPtr<Peer> *const nextsn = _peers.get(_rootAddresses[(p + q) % _rootAddresses.size()]);
-					if ((nextsn)&&((*nextsn)->hasActiveDirectPath(now))) {
-						(*nextsn)->use(now);
-						return *nextsn;
+					const SharedPtr<Peer> nextsn(_findPeer(_rootAddresses[(p + q) % _rootAddresses.size()]));
+					if ((nextsn)&&(nextsn->hasActiveDirectPath(now))) {
+						nextsn->use(now);
+						return nextsn;
 					}
 				}
 				break;
@@ -311,17 +378,251 @@ bool Topology::worldUpdateIfValid(const World &newWorld)
 
 void Topology::clean(uint64_t now)
 {
-	Mutex::Lock _l(_lock);
-	Hashtable< Address,SharedPtr<Peer> >::Iterator i(_peers);
-	Address *a = (Address *)0;
-	SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
-	while (i.next(a,p)) {
-		if (((now - (*p)->lastUsed()) >= ZT_PEER_IN_MEMORY_EXPIRATION)&&(std::find(_rootAddresses.begin(),_rootAddresses.end(),*a) == _rootAddresses.end())) {
-			_peers.erase(*a);
-		} else {
-			(*p)->clean(now);
+	Mutex::Lock _l(_verifiedComs_m);
+	Hashtable< uint64_t,_VerifiedCom >::Iterator i(_verifiedComs);
+	uint64_t *k = (uint64_t *)0;
+	_VerifiedCom *vc = (_VerifiedCom *)0;
+	while (i.next(k,vc)) {
+		if (vc->expires <= now)
+			_verifiedComs.erase(*k);
+	}
+}
+
+unsigned long Topology::doTimerTasks(uint64_t now)
+{
+	std::vector<Address> due;
+	{
+		Mutex::Lock _l(_peerTimers_m);
+		_peerTimers.expire(now,due);
+	}
+
+	for(std::vector<Address>::const_iterator a(due.begin());a!=due.end();++a) {
+		SharedPtr<Peer> p;
+		{
+			_PeerIndexReader _r(*this);
+			p = _findPeer(*a);
+		}
+		if (!p)
+			continue;
+		{
+			Mutex::Lock _l(_peerTimers_m);
+			const uint64_t d = p->timerDeadline();
+			if ((!d)||(d > now))
+				continue; // peer's deadline has moved and it has another timer for it
+			p->setTimerDeadline(0);
+		}
+
+		bool root,evicted = false;
+		{
+			Mutex::Lock _l(_lock);
+			root = (std::find(_rootAddresses.begin(),_rootAddresses.end(),*a) != _rootAddresses.end());
+			if ((!root)&&((now - p->lastUsed()) >= ZT_PEER_IN_MEMORY_EXPIRATION)&&(_removePeer(*a))) {
+				_cacheIdentity(p);
+				evicted = true;
+			}
+		}
+		if (evicted) {
+			if (p->needsPersist(now))
+				_persistPeer(*p,now);
+			continue;
+		}
+
+		p->clean(now);
+		if ((!root)&&(p->needsPersist(now)))
+			_persistPeer(*p,now);
+
+		uint64_t next = now + ZT_HOUSEKEEPING_PERIOD;
+		if (!root)
+			next = std::max(std::min(next,p->lastUsed() + ZT_PEER_IN_MEMORY_EXPIRATION),now + ZT_CORE_TIMER_TASK_GRANULARITY);
+		if ((!_amRoot)&&(p->activelyTransferringFrames(now))&&(!isUpstream(p->identity()))) {
+			// Normal nodes get their preferred link kept alive if the node has generated frame traffic recently
+			p->doPingAndKeepalive(now,0);
+			next = std::min(next,now + ZT_PING_CHECK_INVERVAL);
+		}
+
+		Mutex::Lock _l(_peerTimers_m);
+		_schedulePeer(*p,next);
+	}
+
+	{
+		// Growth in _addPeer() retires entries and bucket arrays too, not just eviction
+		Mutex::Lock _l(_lock);
+		if ((!_retired.empty())||(!_retiredIndexes.empty())||(!_retiring.empty())||(!_retiringIndexes.empty()))
+			_reclaim();
+	}
+
+	Mutex::Lock _l(_peerTimers_m);
+	const uint64_t nd = _peerTimers.nextDeadline();
+	return ((nd > now) ? (unsigned long)std::min(nd - now,(uint64_t)0xffffffff) : 0);
+}
+
+SharedPtr<Peer> Topology::_addPeer(const SharedPtr<Peer> &peer)
+{
+	const SharedPtr<Peer> existing(_findPeer(peer->address()));
+	if (existing)
+		return existing;
+
+	_PeerIndex *idx = _peerIndex;
+	if (++_peerCount > idx->bucketCount) {
+		// Grow by building a new table beside the old one, which readers may still be using
+		_PeerIndex *const nidx = new _PeerIndex(idx->bucketCount * 2);
+		for(unsigned long b=0;b<idx->bucketCount;++b) {
+			for(_PeerEntry *e=idx->buckets[b];e;e=e->next) {
+				_PeerEntry *volatile &nb = nidx->buckets[nidx->bucket(e->address)];
+				nb = new _PeerEntry(e->address,e->peer,nb);
+				_retiring.push_back(e);
+			}
+		}
+		_publish();
+		_peerIndex = nidx;
+		_retiringIndexes.push_back(idx);
+		idx = nidx;
+	}
+
+	_PeerEntry *volatile &b = idx->buckets[idx->bucket(peer->address())];
+	_PeerEntry *const e = new _PeerEntry(peer->address(),peer,b);
+	_publish(); // entry must be complete before readers can reach it
+	b = e;
+
+	{
+		Mutex::Lock _l(_peerTimers_m);
+		_schedulePeer(*peer,RR->node->now() + ZT_HOUSEKEEPING_PERIOD);
+	}
+
+	return peer;
+}
+
+bool Topology::_removePeer(const Address &zta)
+{
+	_PeerIndex *const idx = _peerIndex;
+	_PeerEntry *volatile *prev = &(idx->buckets[idx->bucket(zta)]);
+	_PeerEntry *e;
+	while ((e = *prev)) {
+		if (e->address == zta) {
+			*prev = e->next; // readers at e can still follow e->next
+			_retiring.push_back(e);
+			--_peerCount;
+			return true;
+		}
+		prev = &(e->next);
+	}
+	return false;
+}
+
+void Topology::_reclaim()
+{
+	// Readers can be in the current epoch or the one before it. Once those in
+	// the one before are gone, nothing can reach what was unlinked back then.
+	if ((int)_readers[(_epoch - 1) & 1] != 0)
+		return; // try again next time
+
+	for(std::vector<_PeerEntry *>::iterator e(_retired.begin());e!=_retired.end();++e)
+		delete *e;
+	_retired.clear();
+	for(std::vector<_PeerIndex *>::iterator i(_retiredIndexes.begin());i!=_retiredIndexes.end();++i)
+		delete *i;
+	_retiredIndexes.clear();
+
+	// Start a new epoch so that what was unlinked in this one can be freed later
+	if ((!_retiring.empty())||(!_retiringIndexes.empty())) {
+		_retired.swap(_retiring);
+		_retiredIndexes.swap(_retiringIndexes);
+		_publish();
+		++_epoch;
+		_publish();
+	}
+}
+
+void Topology::_comDigest(const CertificateOfMembership &com,const Identity &signer,unsigned char digest[64])
+{
+	Buffer<ZT_C25519_PUBLIC_KEY_LEN + 512> b;
+	b.append(signer.publicKey().data,ZT_C25519_PUBLIC_KEY_LEN);
+	com.serialize(b);
+	SHA512::hash(digest,b.data(),b.size());
+}
+
+void Topology::_cacheIdentity(const SharedPtr<Peer> &peer)
+{
+	Mutex::Lock _l(_identityCache_m);
+
+	if (_identityCache.size() >= ZT_IDENTITY_CACHE_SIZE) {
+		// Make room by dropping everything used less recently than average
+		uint64_t avg = 0;
+		{
+			Hashtable< Address,_CachedIdentity >::Iterator i(_identityCache);
+			Address *a = (Address *)0;
+			_CachedIdentity *ci = (_CachedIdentity *)0;
+			while (i.next(a,ci))
+				avg += ci->lastUsed / (uint64_t)_identityCache.size();
+		}
+		Hashtable< Address,_CachedIdentity >::Iterator i(_identityCache);
+		Address *a = (Address *)0;
+		_CachedIdentity *ci = (_CachedIdentity *)0;
+		while (i.next(a,ci)) {
+			if (ci->lastUsed <= avg)
+				_identityCache.erase(*a);
 		}
 	}
+
+	_CachedIdentity &ci = _identityCache[peer->address()];
+	ci.identity = peer->identity();
+	memcpy(ci.key,peer->key(),ZT_PEER_SECRET_KEY_LENGTH);
+	ci.lastUsed = peer->lastUsed();
+}
+
+void Topology::_persistPeer(Peer &peer,uint64_t now)
+{
+	Buffer<ZT_PEER_SUGGESTED_SERIALIZATION_BUFFER_SIZE> *pbuf = (Buffer<ZT_PEER_SUGGESTED_SERIALIZATION_BUFFER_SIZE> *)0;
+	try {
+		pbuf = new Buffer<ZT_PEER_SUGGESTED_SERIALIZATION_BUFFER_SIZE>();
+		peer.serialize(*pbuf);
+		char p[128];
+		Utils::snprintf(p,sizeof(p),"peers.d/%.10llx",(unsigned long long)peer.address().toInt());
+		if (RR->node->dataStorePut(p,pbuf->data(),pbuf->size(),true))
+			peer.persisted(now);
+	} catch ( ... ) {} // peer too big or out of memory, so try again next time
+	delete pbuf;
+}
+
+SharedPtr<Peer> Topology::_peerFromStore(const Address &zta)
+{
+	char p[128];
+	Utils::snprintf(p,sizeof(p),"peers.d/%.10llx",(unsigned long long)zta.toInt());
+	const std::string rec(RR->node->dataStoreGet(p));
+	if ((rec.length() < 4)||(rec.length() > ZT_PEER_SUGGESTED_SERIALIZATION_BUFFER_SIZE))
+		return SharedPtr<Peer>();
+
+	SharedPtr<Peer> np;
+	Buffer<ZT_PEER_SUGGESTED_SERIALIZATION_BUFFER_SIZE> *pbuf = (Buffer<ZT_PEER_SUGGESTED_SERIALIZATION_BUFFER_SIZE> *)0;
+	try {
+		pbuf = new Buffer<ZT_PEER_SUGGESTED_SERIALIZATION_BUFFER_SIZE>(rec.data(),(unsigned int)rec.length());
+		unsigned int ptr = 0;
+		np = Peer::deserializeNew(RR,RR->identity,*pbuf,ptr);
+	} catch ( ... ) {
+		np.zero();
+	}
+	delete pbuf;
+
+	const uint64_t now = RR->node->now();
+	if ((!np)||(np->address() != zta)||((now - np->lastReceive()) >= ZT_PEER_STORE_EXPIRATION)) {
+		// Corrupt, misnamed, or too old to be worth keeping
+		RR->node->dataStoreDelete(p);
+		return SharedPtr<Peer>();
+	}
+	np->persisted(now);
+	return np;
+}
+
+SharedPtr<Peer> Topology::_peerFromIdentityCache(const Address &zta)
+{
+	Mutex::Lock _l(_identityCache_m);
+	const _CachedIdentity *const ci = _identityCache.get(zta);
+	if (!ci)
+		return SharedPtr<Peer>();
+	// The peer is going back into memory, where it will be cached again when it expires
+	const SharedPtr<Peer> p(new Peer(RR,ci->identity,ci->key));
+	_identityCache.erase(zta);
+	return p;
 }
 
 Identity Topology::_getIdentity(const Address &zta)
@@ -349,13 +650,12 @@ void Topology::_setWorld(const World &newWorld)
 		if (r->identity.address() == RR->identity.address()) {
 			_amRoot = true;
 		} else {
-			SharedPtr<Peer> *rp = _peers.get(r->identity.address());
+			SharedPtr<Peer> rp(_findPeer(r->identity.address()));
 			if (rp) {
-				_rootPeers.push_back(*rp);
+				_rootPeers.push_back(rp);
 			} else {
-				SharedPtr<Peer> newrp(new Peer(RR,RR->identity,r->identity));
-				_peers.set(r->identity.address(),newrp);
-				_rootPeers.push_back(newrp);
+				rp = _addPeer(SharedPtr<Peer>(new Peer(RR,RR->identity,r->identity)));
+				_rootPeers.push_back(rp);
 			}
 		}
 	}
@@ -36,7 +36,12 @@
 #include "Mutex.hpp"
 #include "InetAddress.hpp"
 #include "Hashtable.hpp"
+#include "AtomicCounter.hpp"
+#include "NonCopyable.hpp"
 #include "World.hpp"
+#include "CertificateOfMembership.hpp"
+#include "Utils.hpp"
+#include "TimerWheel.hpp"
 
 namespace ZeroTier {
 
@@ -82,11 +87,8 @@ public:
 	 */
 	inline SharedPtr<Peer> getPeerNoCache(const Address &zta)
 	{
-		Mutex::Lock _l(_lock);
-		const SharedPtr<Peer> *const ap = _peers.get(zta);
-		if (ap)
-			return *ap;
-		return SharedPtr<Peer>();
+		_PeerIndexReader _r(*this);
+		return _findPeer(zta);
 	}
 
 	/**
@@ -107,6 +109,29 @@ public:
 	 */
 	void saveIdentity(const Identity &id);
 
+	/**
+	 * Check whether a certificate of membership was recently verified
+	 *
+	 * @param com Certificate of membership
+	 * @param signer Identity it was verified against
+	 * @param now Current time
+	 * @return True if this exact certificate was verified against signer and that hasn't expired yet
+	 */
+	bool comVerified(const CertificateOfMembership &com,const Identity &signer,uint64_t now);
+
+	/**
+	 * Remember that a certificate of membership's signature checked out
+	 *
+	 * This is remembered for the certificate's revision max delta (bounded
+	 * by ZT_PEER_IN_MEMORY_EXPIRATION), after which it would no longer agree
+	 * with newer certificates anyway.
+	 *
+	 * @param com Certificate of membership
+	 * @param signer Identity it was verified against
+	 * @param now Current time
+	 */
+	void setComVerified(const CertificateOfMembership &com,const Identity &signer,uint64_t now);
+
 	/**
 	 * Get the current favorite root server
 	 *
@@ -187,10 +212,37 @@ public:
 	bool worldUpdateIfValid(const World &newWorld);
 
 	/**
-	 * Clean and flush database
+	 * Clean and flush caches
+	 *
+	 * Peers themselves are cleaned and expired by doTimerTasks().
 	 */
 	void clean(uint64_t now);
 
+	/**
+	 * Run timers of peers that are due
+	 *
+	 * Every peer in memory has a timer. When it comes due the peer is
+	 * cleaned, expired if it has not been used in ZT_PEER_IN_MEMORY_EXPIRATION,
+	 * and given a keepalive if it is a non-upstream peer that is sending us
+	 * frames. Upstream peers are handled by Node.
+	 *
+	 * @param now Current time
+	 * @return Number of milliseconds until doTimerTasks() should be run again
+	 */
+	unsigned long doTimerTasks(uint64_t now);
+
+	/**
+	 * Make a peer's timer come due no later than a given time
+	 *
+	 * @param peer Peer
+	 * @param deadline New deadline (ignored if later than the current one)
+	 */
+	inline void schedulePeer(Peer &peer,uint64_t deadline)
+	{
+		Mutex::Lock _l(_peerTimers_m);
+		_schedulePeer(peer,deadline);
+	}
+
 	/**
 	 * @param now Current time
 	 * @return Number of peers with active direct paths
@@ -198,12 +250,11 @@ public:
 	inline unsigned long countActive(uint64_t now) const
 	{
 		unsigned long cnt = 0;
-		Mutex::Lock _l(_lock);
-		Hashtable< Address,SharedPtr<Peer> >::Iterator i(const_cast<Topology *>(this)->_peers);
-		Address *a = (Address *)0;
-		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
-		while (i.next(a,p)) {
-			cnt += (unsigned long)((*p)->hasActiveDirectPath(now));
+		_PeerIndexReader _r(*this);
+		const _PeerIndex *const idx = _peerIndex;
+		for(unsigned long b=0;b<idx->bucketCount;++b) {
+			for(const _PeerEntry *e=idx->buckets[b];e;e=e->next)
+				cnt += (unsigned long)(e->peer->hasActiveDirectPath(now));
 		}
 		return cnt;
 	}
@@ -214,9 +265,9 @@ public:
 	 * Note: explicitly template this by reference if you want the object
 	 * passed by reference instead of copied.
 	 *
-	 * Warning: be careful not to use features in these that call any other
-	 * methods of Topology that may lock _lock, otherwise a recursive lock
-	 * and deadlock or lock corruption may occur.
+	 * This does not lock out lookups or peers being added or removed. Peers
+	 * added or removed while this runs may or may not be visited. Since the
+	 * table can't be reclaimed while this runs, don't do anything slow.
 	 *
 	 * @param f Function to apply
 	 * @tparam F Function or function object type
@@ -224,18 +275,18 @@ public:
 	template<typename F>
 	inline void eachPeer(F f)
 	{
-		Mutex::Lock _l(_lock);
-		Hashtable< Address,SharedPtr<Peer> >::Iterator i(_peers);
-		Address *a = (Address *)0;
-		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
-		while (i.next(a,p)) {
+		_PeerIndexReader _r(*this);
+		const _PeerIndex *const idx = _peerIndex;
+		for(unsigned long b=0;b<idx->bucketCount;++b) {
+			for(const _PeerEntry *e=idx->buckets[b];e;e=e->next) {
 #ifdef ZT_TRACE
-			if (!(*p)) {
-				fprintf(stderr,"FATAL BUG: eachPeer() caught NULL peer for %s -- peer pointers in Topology should NEVER be NULL" ZT_EOL_S,a->toString().c_str());
-				abort();
-			}
+				if (!(e->peer)) {
+					fprintf(stderr,"FATAL BUG: eachPeer() caught NULL peer for %s -- peer pointers in Topology should NEVER be NULL" ZT_EOL_S,e->address.toString().c_str());
+					abort();
+				}
 #endif
-			f(*this,*((const SharedPtr<Peer> *)p));
+				f(*this,e->peer);
+			}
 		}
 	}
 
@@ -244,8 +295,14 @@ public:
 	 */
 	inline std::vector< std::pair< Address,SharedPtr<Peer> > > allPeers() const
 	{
-		Mutex::Lock _l(_lock);
-		return _peers.entries();
+		std::vector< std::pair< Address,SharedPtr<Peer> > > r;
+		_PeerIndexReader _r(*this);
+		const _PeerIndex *const idx = _peerIndex;
+		for(unsigned long b=0;b<idx->bucketCount;++b) {
+			for(const _PeerEntry *e=idx->buckets[b];e;e=e->next)
+				r.push_back(std::pair< Address,SharedPtr<Peer> >(e->address,e->peer));
+		}
+		return r;
 	}
 
 	/**
@@ -303,6 +360,125 @@ public:
 	}
 
 private:
+	/*
+	 * Peers are kept in a hash table that can be read without locking, in the
+	 * manner of RCU. Writers hold _lock and never modify an entry that a
+	 * reader might be looking at: new entries are fully built before being
+	 * linked in, removed entries are unlinked but left intact, and growing the
+	 * table builds a new one and swaps the pointer. Unlinked entries and old
+	 * tables are freed by doTimerTasks() once every reader that might have seen them
+	 * is done, which is tracked by counting readers in two alternating epochs.
+	 */
+
+	struct _PeerEntry
+	{
+		_PeerEntry(const Address &a,const SharedPtr<Peer> &p,_PeerEntry *n) : next(n),address(a),peer(p) {}
+		_PeerEntry *volatile next;
+		const Address address;
+		const SharedPtr<Peer> peer;
+	};
+
+	struct _PeerIndex
+	{
+		_PeerIndex(unsigned long bc) :
+			buckets(new _PeerEntry *volatile[bc]),
+			bucketCount(bc)
+		{
+			for(unsigned long b=0;b<bc;++b)
+				buckets[b] = (_PeerEntry *)0;
+		}
+		~_PeerIndex() { delete [] buckets; }
+		inline unsigned long bucket(const Address &a) const throw() { return (a.hashCode() & (bucketCount - 1)); }
+		_PeerEntry *volatile *const buckets;
+		const unsigned long bucketCount; // always a power of two
+	};
+
+	// Marks a lock-free read of the peer index for the life of this object
+	class _PeerIndexReader : NonCopyable
+	{
+	public:
+		_PeerIndexReader(const Topology &t) throw() :
+			_t(t)
+		{
+			for(;;) {
+				const unsigned int e = _t._epoch;
+				++_t._readers[e & 1];
+				if (_t._epoch == e) {
+					_slot = e & 1;
+					break;
+				}
+				--_t._readers[e & 1]; // raced with _reclaim(), try again in new epoch
+			}
+		}
+		~_PeerIndexReader() { --_t._readers[_slot]; }
+	private:
+		const Topology &_t;
+		unsigned int _slot;
+	};
+
+	static inline void _publish() throw()
+	{
+#ifdef __GNUC__
+		__sync_synchronize();
+#else
+#ifdef __WINDOWS__
+		MemoryBarrier();
+#endif
+#endif
+	}
+
+	// Caller must be a _PeerIndexReader or hold _lock
+	inline SharedPtr<Peer> _findPeer(const Address &zta) const
+	{
+		const _PeerIndex *const idx = _peerIndex;
+		for(const _PeerEntry *e=idx->buckets[idx->bucket(zta)];e;e=e->next) {
+			if (e->address == zta)
+				return e->peer;
+		}
+		return SharedPtr<Peer>();
+	}
+
+	// Identity and agreed key of a peer that is no longer in memory
+	struct _CachedIdentity
+	{
+		_CachedIdentity() : lastUsed(0) {}
+		~_CachedIdentity() { Utils::burn(key,sizeof(key)); }
+		Identity identity;
+		unsigned char key[ZT_PEER_SECRET_KEY_LENGTH];
+		uint64_t lastUsed;
+	};
+
+	struct _VerifiedCom
+	{
+		_VerifiedCom() : expires(0) {}
+		unsigned char digest[32];
+		uint64_t expires;
+	};
+
+	static void _comDigest(const CertificateOfMembership &com,const Identity &signer,unsigned char digest[64]);
+
+	// _peerTimers_m must be held
+	inline void _schedulePeer(Peer &peer,uint64_t deadline)
+	{
+		const uint64_t current = peer.timerDeadline();
+		if ((!current)||(deadline < current)) {
+			peer.setTimerDeadline(deadline);
+			_peerTimers.schedule(peer.address(),deadline);
+		}
+	}
+
+	// These must be called with _lock held
+	SharedPtr<Peer> _addPeer(const SharedPtr<Peer> &peer);
+	bool _removePeer(const Address &zta);
+	void _reclaim();
+	void _cacheIdentity(const SharedPtr<Peer> &peer);
+
+	SharedPtr<Peer> _peerFromIdentityCache(const Address &zta);
+
+	// Peers are persisted one record per peer as peers.d/<address>, loaded on first lookup
+	void _persistPeer(Peer &peer,uint64_t now);
+	SharedPtr<Peer> _peerFromStore(const Address &zta);
+
 	Identity _getIdentity(const Address &zta);
 	void _setWorld(const World &newWorld);
 
@@ -312,11 +488,28 @@ private:
 	InetAddress _trustedPathNetworks[ZT_MAX_TRUSTED_PATHS];
 	unsigned int _trustedPathCount;
 	World _world;
-	Hashtable< Address,SharedPtr<Peer> > _peers;
+
+	_PeerIndex *volatile _peerIndex;
+	unsigned long _peerCount;
+	std::vector<_PeerEntry *> _retiring; // unlinked during current epoch
+	std::vector<_PeerIndex *> _retiringIndexes;
+	std::vector<_PeerEntry *> _retired; // unlinked during previous epoch
+	std::vector<_PeerIndex *> _retiredIndexes;
+	volatile unsigned int _epoch;
+	mutable AtomicCounter _readers[2];
 	std::vector< Address > _rootAddresses;
 	std::vector< SharedPtr<Peer> > _rootPeers;
 	bool _amRoot;
 
+	Hashtable< Address,_CachedIdentity > _identityCache;
+	Mutex _identityCache_m;
+
+	Hashtable< uint64_t,_VerifiedCom > _verifiedComs; // keyed by first 8 bytes of digest
+	Mutex _verifiedComs_m;
+
+	TimerWheel< Address > _peerTimers; // stale entries are skipped using Peer::timerDeadline()
+	Mutex _peerTimers_m;
+
 	Mutex _lock;
 };
 
@@ -18,6 +18,7 @@ OBJS=\
 	node/Salsa20.o \
 	node/SelfAwareness.o \
 	node/SHA512.o \
+	node/SizeClassPool.o \
 	node/Switch.o \
 	node/Topology.o \
 	node/Utils.o \
@@ -988,6 +988,8 @@ static void printHelp(const char *cn,FILE *out)
 	fprintf(out,"  -v                - Show version" ZT_EOL_S);
 	fprintf(out,"  -U                - Run as unprivileged user (skip privilege check)" ZT_EOL_S);
 	fprintf(out,"  -p<port>          - Port for UDP and TCP/HTTP (default: 9993, 0 for random)" ZT_EOL_S);
+	fprintf(out,"  -w<threads>       - Packet processing threads (default: 0, use main thread)" ZT_EOL_S);
+	fprintf(out,"  -b<threads>       - Background threads for expensive packets (default: %u)" ZT_EOL_S,(unsigned int)ZT_DEFERRED_PACKETS_WORKERS);
 
 #ifdef __UNIX_LIKE__
 	fprintf(out,"  -d                - Fork and run as daemon (Unix-ish OSes)" ZT_EOL_S);
@@ -1054,6 +1056,8 @@ int main(int argc,char **argv)
 
 	std::string homeDir;
 	unsigned int port = ZT_DEFAULT_PORT;
+	unsigned int packetWorkers = 0;
+	unsigned int deferredWorkers = ZT_DEFERRED_PACKETS_WORKERS;
 	bool skipRootCheck = false;
 
 	for(int i=1;i<argc;++i) {
@@ -1068,6 +1072,14 @@ int main(int argc,char **argv)
 					}
 					break;
 
+				case 'w': // number of packet processing threads, 0 to process in main loop
+					packetWorkers = Utils::strToUInt(argv[i] + 2);
+					break;
+
+				case 'b': // number of background threads for deferred packets, 0 to process inline
+					deferredWorkers = Utils::strToUInt(argv[i] + 2);
+					break;
+
 #ifdef __UNIX_LIKE__
 				case 'd': // Run in background as daemon
 					runAsDaemon = true;
@@ -1235,7 +1247,7 @@ int main(int argc,char **argv)
 	unsigned int returnValue = 0;
 
 	for(;;) {
-		zt1Service = OneService::newInstance(homeDir.c_str(),port);
+		zt1Service = OneService::newInstance(homeDir.c_str(),port,packetWorkers,deferredWorkers);
 		switch(zt1Service->run()) {
 			case OneService::ONE_STILL_RUNNING: // shouldn't happen, run() won't return until done
 			case OneService::ONE_NORMAL_TERMINATION:
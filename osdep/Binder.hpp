@@ -305,6 +305,53 @@ public:
 		}
 	}
 
+	/**
+	 * Send a batch of UDP packets that all go out from the same local address
+	 *
+	 * If a specific local address is given this can coalesce the whole batch
+	 * into as few system calls as possible (see Phy<>::udpSendBatch()).
+	 * Packets from the wildcard (null) address are sent one at a time via all
+	 * bindings of the matching family, exactly as udpSend() does.
+	 *
+	 * @param local Local interface address or null address for 'all'
+	 * @param dgrams Datagrams; addr must point to a full InetAddress (sockaddr_storage)
+	 * @param count Number of datagrams
+	 * @return Number of datagrams that appear to have been sent
+	 */
+	template<typename PHY_HANDLER_TYPE>
+	inline unsigned int udpSendBatch(Phy<PHY_HANDLER_TYPE> &phy,const InetAddress &local,const PhyDatagram *dgrams,unsigned int count) const
+	{
+		if (local) {
+			Mutex::Lock _l(_lock);
+			for(typename std::vector<_Binding>::const_iterator i(_bindings.begin());i!=_bindings.end();++i) {
+				if (i->address == local)
+					return phy.udpSendBatch(i->udpSock,dgrams,count);
+			}
+			return 0;
+		} else {
+			unsigned int sent = 0;
+			for(unsigned int k=0;k<count;++k) {
+				if (udpSend(phy,local,*(reinterpret_cast<const InetAddress *>(dgrams[k].addr)),dgrams[k].data,(unsigned int)dgrams[k].len))
+					++sent;
+			}
+			return sent;
+		}
+	}
+
+	/**
+	 * @param local Local interface address
+	 * @return True if a UDP socket is currently bound to this address
+	 */
+	inline bool isBound(const InetAddress &local) const
+	{
+		Mutex::Lock _l(_lock);
+		for(std::vector<_Binding>::const_iterator i(_bindings.begin());i!=_bindings.end();++i) {
+			if (i->address == local)
+				return true;
+		}
+		return false;
+	}
+
 	/**
 	 * @return All currently bound local interface addresses
 	 */
@@ -29,6 +29,7 @@
 #include <sys/ioctl.h>
 #include <sys/wait.h>
 #include <sys/select.h>
+#include <sys/socket.h>
 #include <netinet/in.h>
 #include <net/if_arp.h>
 #include <arpa/inet.h>
@@ -36,6 +37,8 @@
 #include <linux/if_tun.h>
 #include <linux/if_addr.h>
 #include <linux/if_ether.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include <ifaddrs.h>
 
 #include <algorithm>
@@ -55,6 +58,69 @@ namespace ZeroTier {
 
 static Mutex __tapCreateLock;
 
+// Hash IP source and destination (or MACs for non-IP) to pick a queue for a flow
+static inline unsigned int _flowHash(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len)
+{
+	const uint8_t *const p = reinterpret_cast<const uint8_t *>(data);
+	uint64_t h;
+	if ((etherType == ZT_ETHERTYPE_IPV4)&&(len >= 20)) {
+		h = 0;
+		for(unsigned int i=12;i<20;++i) // source and destination IPv4 addresses
+			h = (h << 8) ^ (h >> 56) ^ (uint64_t)p[i];
+	} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(len >= 40)) {
+		h = 0;
+		for(unsigned int i=8;i<40;++i) // source and destination IPv6 addresses
+			h = (h << 8) ^ (h >> 56) ^ (uint64_t)p[i];
+	} else {
+		h = from.toInt() ^ (to.toInt() << 16);
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return (unsigned int)h;
+}
+
+// Read all pending rtnetlink notifications and return true if any concern the device
+static bool _netlinkDeviceChanged(int s,unsigned int ifIndex)
+{
+	char buf[16384];
+	bool changed = false;
+	for(;;) {
+		const ssize_t n = ::recv(s,buf,sizeof(buf),MSG_DONTWAIT);
+		if (n < 0) {
+			if (errno == ENOBUFS) { // notifications were dropped, so anything may have changed
+				changed = true;
+				continue;
+			}
+			break;
+		} else if (n == 0) {
+			break;
+		}
+		int len = (int)n;
+		for(struct nlmsghdr *nh=(struct nlmsghdr *)buf;NLMSG_OK(nh,len);nh=NLMSG_NEXT(nh,len)) {
+			switch(nh->nlmsg_type) {
+				case RTM_NEWLINK:
+				case RTM_DELLINK:
+					if ((NLMSG_PAYLOAD(nh,0) >= sizeof(struct ifinfomsg))&&((unsigned int)((const struct ifinfomsg *)NLMSG_DATA(nh))->ifi_index == ifIndex))
+						changed = true;
+					break;
+				case RTM_NEWADDR:
+				case RTM_DELADDR:
+#ifdef RTM_NEWMULTICAST
+				case RTM_NEWMULTICAST:
+				case RTM_DELMULTICAST:
+#endif
+					if ((NLMSG_PAYLOAD(nh,0) >= sizeof(struct ifaddrmsg))&&((unsigned int)((const struct ifaddrmsg *)NLMSG_DATA(nh))->ifa_index == ifIndex))
+						changed = true;
+					break;
+				default:
+					break;
+			}
+		}
+	}
+	return changed;
+}
+
 LinuxEthernetTap::LinuxEthernetTap(
 	const char *homePath,
 	const MAC &mac,
@@ -68,12 +134,16 @@ LinuxEthernetTap::LinuxEthernetTap(
 	_arg(arg),
 	_nwid(nwid),
 	_homePath(homePath),
+	_lastMulticastScan(0),
+	_netlinkSocket(-1),
+	_ifIndex(0),
 	_mtu(mtu),
-	_fd(0),
+	_queueCount(0),
 	_enabled(true)
 {
 	char procpath[128],nwids[32];
 	struct stat sbuf;
+	int fd;
 
 	Utils::snprintf(nwids,sizeof(nwids),"%.16llx",nwid);
 
@@ -82,13 +152,24 @@ LinuxEthernetTap::LinuxEthernetTap(
 	if (mtu > 2800)
 		throw std::runtime_error("max tap MTU is 2800");
 
-	_fd = ::open("/dev/net/tun",O_RDWR);
-	if (_fd <= 0) {
-		_fd = ::open("/dev/tun",O_RDWR);
-		if (_fd <= 0)
+	const char *tunPath = "/dev/net/tun";
+	fd = ::open(tunPath,O_RDWR);
+	if (fd <= 0) {
+		tunPath = "/dev/tun";
+		fd = ::open(tunPath,O_RDWR);
+		if (fd <= 0)
 			throw std::runtime_error(std::string("could not open TUN/TAP device: ") + strerror(errno));
 	}
 
+	unsigned int wantQueues = 1;
+#ifdef IFF_MULTI_QUEUE
+	{
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		if (cpus > 1)
+			wantQueues = ((unsigned long)cpus > ZT_LINUX_TAP_MAX_QUEUES) ? ZT_LINUX_TAP_MAX_QUEUES : (unsigned int)cpus;
+	}
+#endif
+
 	struct ifreq ifr;
 	memset(&ifr,0,sizeof(ifr));
 
@@ -114,20 +195,31 @@ LinuxEthernetTap::LinuxEthernetTap(
 		} while (stat(procpath,&sbuf) == 0); // try zt#++ until we find one that does not exist
 	}
 
-	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
-	if (ioctl(_fd,TUNSETIFF,(void *)&ifr) < 0) {
-		::close(_fd);
-		throw std::runtime_error("unable to configure TUN/TAP device for TAP operation");
+	short tapFlags = IFF_TAP | IFF_NO_PI;
+#ifdef IFF_MULTI_QUEUE
+	if (wantQueues > 1)
+		tapFlags |= IFF_MULTI_QUEUE;
+#endif
+	ifr.ifr_flags = tapFlags;
+	if (ioctl(fd,TUNSETIFF,(void *)&ifr) < 0) {
+		// Kernels before 3.8 do not know IFF_MULTI_QUEUE, so retry with one queue
+		wantQueues = 1;
+		tapFlags = IFF_TAP | IFF_NO_PI;
+		ifr.ifr_flags = tapFlags;
+		if (ioctl(fd,TUNSETIFF,(void *)&ifr) < 0) {
+			::close(fd);
+			throw std::runtime_error("unable to configure TUN/TAP device for TAP operation");
+		}
 	}
 
 	_dev = ifr.ifr_name;
 
-	::ioctl(_fd,TUNSETPERSIST,0); // valgrind may generate a false alarm here
+	::ioctl(fd,TUNSETPERSIST,0); // valgrind may generate a false alarm here
 
 	// Open an arbitrary socket to talk to netlink
 	int sock = socket(AF_INET,SOCK_DGRAM,0);
 	if (sock <= 0) {
-		::close(_fd);
+		::close(fd);
 		throw std::runtime_error("unable to open netlink socket");
 	}
 
@@ -135,7 +227,7 @@ LinuxEthernetTap::LinuxEthernetTap(
 	ifr.ifr_ifru.ifru_hwaddr.sa_family = ARPHRD_ETHER;
 	mac.copyTo(ifr.ifr_ifru.ifru_hwaddr.sa_data,6);
 	if (ioctl(sock,SIOCSIFHWADDR,(void *)&ifr) < 0) {
-		::close(_fd);
+		::close(fd);
 		::close(sock);
 		throw std::runtime_error("unable to configure TAP hardware (MAC) address");
 		return;
@@ -144,33 +236,77 @@ LinuxEthernetTap::LinuxEthernetTap(
 	// Set MTU
 	ifr.ifr_ifru.ifru_mtu = (int)mtu;
 	if (ioctl(sock,SIOCSIFMTU,(void *)&ifr) < 0) {
-		::close(_fd);
+		::close(fd);
 		::close(sock);
 		throw std::runtime_error("unable to configure TAP MTU");
 	}
 
-	if (fcntl(_fd,F_SETFL,fcntl(_fd,F_GETFL) & ~O_NONBLOCK) == -1) {
-		::close(_fd);
+	if (fcntl(fd,F_SETFL,fcntl(fd,F_GETFL) & ~O_NONBLOCK) == -1) {
+		::close(fd);
 		throw std::runtime_error("unable to set flags on file descriptor for TAP device");
 	}
 
 	/* Bring interface up */
 	if (ioctl(sock,SIOCGIFFLAGS,(void *)&ifr) < 0) {
-		::close(_fd);
+		::close(fd);
 		::close(sock);
 		throw std::runtime_error("unable to get TAP interface flags");
 	}
 	ifr.ifr_flags |= IFF_UP;
 	if (ioctl(sock,SIOCSIFFLAGS,(void *)&ifr) < 0) {
-		::close(_fd);
+		::close(fd);
 		::close(sock);
 		throw std::runtime_error("unable to set TAP interface flags");
 	}
 
+	if (ioctl(sock,SIOCGIFINDEX,(void *)&ifr) == 0)
+		_ifIndex = (unsigned int)ifr.ifr_ifindex;
+
 	::close(sock);
 
+	// Subscribe to address and multicast membership notifications. Without
+	// membership notifications (Linux 6.5+) they aren't enough to tell when
+	// to rescan, so in that case scanMulticastGroups() just polls.
+#if defined(RTNLGRP_IPV4_MCADDR) && defined(RTNLGRP_IPV6_MCADDR)
+	if (_ifIndex) {
+		_netlinkSocket = ::socket(AF_NETLINK,SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,NETLINK_ROUTE);
+		if (_netlinkSocket >= 0) {
+			struct sockaddr_nl nladdr;
+			memset(&nladdr,0,sizeof(nladdr));
+			nladdr.nl_family = AF_NETLINK;
+			nladdr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+			int g4 = RTNLGRP_IPV4_MCADDR,g6 = RTNLGRP_IPV6_MCADDR;
+			if ( (::bind(_netlinkSocket,(struct sockaddr *)&nladdr,sizeof(nladdr)) != 0) ||
+			     (::setsockopt(_netlinkSocket,SOL_NETLINK,NETLINK_ADD_MEMBERSHIP,&g4,sizeof(g4)) != 0) ||
+			     (::setsockopt(_netlinkSocket,SOL_NETLINK,NETLINK_ADD_MEMBERSHIP,&g6,sizeof(g6)) != 0) ) {
+				::close(_netlinkSocket);
+				_netlinkSocket = -1;
+			}
+		}
+	}
+#endif
+
 	// Set close-on-exec so that devices cannot persist if we fork/exec for update
-	::fcntl(_fd,F_SETFD,fcntl(_fd,F_GETFD) | FD_CLOEXEC);
+	::fcntl(fd,F_SETFD,fcntl(fd,F_GETFD) | FD_CLOEXEC);
+
+	_queues[0].fd = fd;
+	_queueCount = 1;
+
+	// Attach additional queues to the device; if this fails we just use fewer
+	while (_queueCount < wantQueues) {
+		int qfd = ::open(tunPath,O_RDWR);
+		if (qfd <= 0)
+			break;
+		memset(&ifr,0,sizeof(ifr));
+		Utils::scopy(ifr.ifr_name,sizeof(ifr.ifr_name),_dev.c_str());
+		ifr.ifr_flags = tapFlags;
+		if ((ioctl(qfd,TUNSETIFF,(void *)&ifr) < 0)||(fcntl(qfd,F_SETFL,fcntl(qfd,F_GETFL) & ~O_NONBLOCK) == -1)) {
+			::close(qfd);
+			break;
+		}
+		::fcntl(qfd,F_SETFD,fcntl(qfd,F_GETFD) | FD_CLOEXEC);
+		_queues[_queueCount++].fd = qfd;
+	}
 
 	(void)::pipe(_shutdownSignalPipe);
 
@@ -178,16 +314,23 @@ LinuxEthernetTap::LinuxEthernetTap(
 	devmap.add(nwids,_dev.c_str());
 	OSUtils::writeFile((_homePath + ZT_PATH_SEPARATOR_S + "devicemap").c_str(),(const void *)devmap.data(),devmap.sizeBytes());
 
-	_thread = Thread::start(this);
+	for(unsigned int q=0;q<_queueCount;++q) {
+		_queues[q].tap = this;
+		_queues[q].thread = Thread::start(&(_queues[q]));
+	}
 }
 
 LinuxEthernetTap::~LinuxEthernetTap()
 {
-	(void)::write(_shutdownSignalPipe[1],"\0",1); // causes thread to exit
-	Thread::join(_thread);
-	::close(_fd);
+	(void)::write(_shutdownSignalPipe[1],"\0",1); // causes all reader threads to exit
+	for(unsigned int q=0;q<_queueCount;++q)
+		Thread::join(_queues[q].thread);
+	for(unsigned int q=0;q<_queueCount;++q)
+		::close(_queues[q].fd);
 	::close(_shutdownSignalPipe[0]);
 	::close(_shutdownSignalPipe[1]);
+	if (_netlinkSocket >= 0)
+		::close(_netlinkSocket);
 }
 
 void LinuxEthernetTap::setEnabled(bool en)
@@ -302,13 +445,15 @@ std::vector<InetAddress> LinuxEthernetTap::ips() const
 void LinuxEthernetTap::put(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len)
 {
 	char putBuf[8194];
-	if ((_fd > 0)&&(len <= _mtu)&&(_enabled)) {
+	if ((_queueCount)&&(len <= _mtu)&&(_enabled)) {
+		// Keep each flow on one queue so concurrent writers do not reorder it
+		const int fd = (_queueCount > 1) ? _queues[_flowHash(from,to,etherType,data,len) % _queueCount].fd : _queues[0].fd;
 		to.copyTo(putBuf,6);
 		from.copyTo(putBuf + 6,6);
 		*((uint16_t *)(putBuf + 12)) = htons((uint16_t)etherType);
 		memcpy(putBuf + 14,data,len);
 		len += 14;
-		(void)::write(_fd,putBuf,len);
+		(void)::write(fd,putBuf,len);
 	}
 }
 
@@ -327,6 +472,13 @@ void LinuxEthernetTap::scanMulticastGroups(std::vector<MulticastGroup> &added,st
 	unsigned char mac[6];
 	std::vector<MulticastGroup> newGroups;
 
+	if (_netlinkSocket >= 0) {
+		const uint64_t now = OSUtils::now();
+		if ((!_netlinkDeviceChanged(_netlinkSocket,_ifIndex))&&((now - _lastMulticastScan) < ZT_LINUX_TAP_MULTICAST_RESCAN_INTERVAL))
+			return;
+		_lastMulticastScan = now;
+	}
+
 	int fd = ::open("/proc/net/dev_mcast",O_RDONLY);
 	if (fd > 0) {
 		char buf[131072];
@@ -370,7 +522,7 @@ void LinuxEthernetTap::scanMulticastGroups(std::vector<MulticastGroup> &added,st
 	_multicastGroups.swap(newGroups);
 }
 
-void LinuxEthernetTap::threadMain()
+void LinuxEthernetTap::_readLoop(int fd)
 	throw()
 {
 	fd_set readfds,nullfds;
@@ -382,19 +534,19 @@ void LinuxEthernetTap::threadMain()
 
 	FD_ZERO(&readfds);
 	FD_ZERO(&nullfds);
-	nfds = (int)std::max(_shutdownSignalPipe[0],_fd) + 1;
+	nfds = (int)std::max(_shutdownSignalPipe[0],fd) + 1;
 
 	r = 0;
 	for(;;) {
 		FD_SET(_shutdownSignalPipe[0],&readfds);
-		FD_SET(_fd,&readfds);
+		FD_SET(fd,&readfds);
 		select(nfds,&readfds,&nullfds,&nullfds,(struct timeval *)0);
 
 		if (FD_ISSET(_shutdownSignalPipe[0],&readfds)) // writes to shutdown pipe terminate thread
 			break;
 
-		if (FD_ISSET(_fd,&readfds)) {
-			n = (int)::read(_fd,getBuf + r,sizeof(getBuf) - r);
+		if (FD_ISSET(fd,&readfds)) {
+			n = (int)::read(fd,getBuf + r,sizeof(getBuf) - r);
 			if (n < 0) {
 				if ((errno != EINTR)&&(errno != ETIMEDOUT))
 					break;
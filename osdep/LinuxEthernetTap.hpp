@@ -29,10 +29,42 @@
 #include "../node/MulticastGroup.hpp"
 #include "Thread.hpp"
 
+/**
+ * Maximum number of tap queues (and reader threads) per device
+ *
+ * The actual number is the number of online CPUs up to this limit. Define
+ * this as 1 to build single-queue taps.
+ */
+#ifndef ZT_LINUX_TAP_MAX_QUEUES
+#define ZT_LINUX_TAP_MAX_QUEUES 8
+#endif
+
+/**
+ * How often multicast groups are rescanned from procfs with no netlink notification
+ *
+ * This catches memberships added without an rtnetlink notification, such as
+ * raw link-layer subscriptions from packet sockets.
+ */
+#ifndef ZT_LINUX_TAP_MULTICAST_RESCAN_INTERVAL
+#define ZT_LINUX_TAP_MULTICAST_RESCAN_INTERVAL 60000
+#endif
+
 namespace ZeroTier {
 
 /**
  * Linux Ethernet tap using kernel tun/tap driver
+ *
+ * On kernels supporting IFF_MULTI_QUEUE (3.8+) the device is opened with one
+ * file descriptor per queue, each serviced by its own reader thread. The
+ * kernel steers frames to queues by flow hash, so each flow is delivered in
+ * order by a single thread while separate flows are handled in parallel.
+ * The frame handler is therefore called concurrently from all queue threads
+ * and must be thread-safe.
+ *
+ * If the kernel reports IPv4 and IPv6 multicast membership changes over
+ * rtnetlink, scanMulticastGroups() only rereads /proc/net/dev_mcast after a
+ * notification for this device (or every ZT_LINUX_TAP_MULTICAST_RESCAN_INTERVAL).
+ * Otherwise it rereads it on every call.
  */
 class LinuxEthernetTap
 {
@@ -59,19 +91,43 @@ public:
 	void setFriendlyName(const char *friendlyName);
 	void scanMulticastGroups(std::vector<MulticastGroup> &added,std::vector<MulticastGroup> &removed);
 
-	void threadMain()
-		throw();
+	/**
+	 * @return Number of queues (and reader threads) this device is using
+	 */
+	inline unsigned int queueCount() const throw() { return _queueCount; }
 
 private:
+	struct _Queue
+	{
+		_Queue() : tap((LinuxEthernetTap *)0),fd(-1),thread() {}
+
+		void threadMain()
+			throw()
+		{
+			tap->_readLoop(fd);
+		}
+
+		LinuxEthernetTap *tap;
+		int fd;
+		Thread thread;
+	};
+
+	// Runs in each queue's thread; calls _handler concurrently with other queues
+	void _readLoop(int fd)
+		throw();
+
 	void (*_handler)(void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int);
 	void *_arg;
 	uint64_t _nwid;
-	Thread _thread;
 	std::string _homePath;
 	std::string _dev;
 	std::vector<MulticastGroup> _multicastGroups;
+	uint64_t _lastMulticastScan;
+	int _netlinkSocket; // rtnetlink socket for address and multicast notifications, or -1 to always rescan
+	unsigned int _ifIndex;
 	unsigned int _mtu;
-	int _fd;
+	_Queue _queues[ZT_LINUX_TAP_MAX_QUEUES];
+	unsigned int _queueCount;
 	int _shutdownSignalPipe[2];
 	volatile bool _enabled;
 };
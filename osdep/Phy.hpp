@@ -23,6 +23,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <stdint.h>
+
 #include <list>
 #include <stdexcept>
 
@@ -59,18 +61,42 @@
 #ifndef IPV6_DONTFRAG
 #define IPV6_DONTFRAG 62
 #endif
+// On Linux we use epoll() unless told otherwise at build time
+#ifndef ZT_PHY_NO_EPOLL
+#define ZT_PHY_USE_EPOLL 1
+#endif
+// ... and recvmmsg()/sendmmsg() to move several datagrams per system call
+#ifndef ZT_PHY_NO_MMSG
+#define ZT_PHY_HAVE_MMSG 1
+#endif
+#endif
+
+#ifdef ZT_PHY_USE_EPOLL
+#include <sys/epoll.h>
 #endif
 
 #define ZT_PHY_SOCKFD_TYPE int
 #define ZT_PHY_SOCKFD_NULL (-1)
 #define ZT_PHY_SOCKFD_VALID(s) ((s) > -1)
 #define ZT_PHY_CLOSE_SOCKET(s) ::close(s)
+#ifdef ZT_PHY_USE_EPOLL
+// epoll() has no fd_set ceiling; this is just a sanity limit (same as default fs.nr_open)
+#define ZT_PHY_MAX_SOCKETS 1048576
+// Maximum number of readiness events to fetch per epoll_wait()
+#define ZT_PHY_EPOLL_MAX_EVENTS 256
+#else
 #define ZT_PHY_MAX_SOCKETS (FD_SETSIZE)
+#endif
 #define ZT_PHY_MAX_INTERCEPTS ZT_PHY_MAX_SOCKETS
 #define ZT_PHY_SOCKADDR_STORAGE_TYPE struct sockaddr_storage
 
 #endif // Windows or not
 
+/**
+ * Maximum number of datagrams moved by one recvmmsg() or sendmmsg() call
+ */
+#define ZT_PHY_UDP_BATCH_SIZE 16
+
 namespace ZeroTier {
 
 /**
@@ -78,6 +104,16 @@ namespace ZeroTier {
  */
 typedef void PhySocket;
 
+/**
+ * A datagram in a batch received or sent with a single system call
+ */
+struct PhyDatagram
+{
+	const struct sockaddr *addr; // sender on receive, destination on send
+	void *data;
+	unsigned long len;
+};
+
 /**
  * Simple templated non-blocking sockets implementation
  *
@@ -90,6 +126,7 @@ typedef void PhySocket;
  * For all platforms:
  *
  * phyOnDatagram(PhySocket *sock,void **uptr,const struct sockaddr *localAddr,const struct sockaddr *from,void *data,unsigned long len)
+ * phyOnDatagramBatch(PhySocket *sock,void **uptr,const struct sockaddr *localAddr,const PhyDatagram *dgrams,unsigned int count)
  * phyOnTcpConnect(PhySocket *sock,void **uptr,bool success)
  * phyOnTcpAccept(PhySocket *sockL,PhySocket *sockN,void **uptrL,void **uptrN,const struct sockaddr *from)
  * phyOnTcpClose(PhySocket *sock,void **uptr)
@@ -115,6 +152,12 @@ typedef void PhySocket;
  * uptr: sockL and uptrL for the listen socket, and sockN and uptrN for
  * the new TCP connection socket that has just been created.
  *
+ * Where recvmmsg() is available (Linux) UDP sockets are read up to
+ * ZT_PHY_UDP_BATCH_SIZE datagrams at a time and DATAGRAM_BATCH is called
+ * once per batch instead of DATAGRAM once per packet. Elsewhere DATAGRAM is
+ * used. Handlers must treat the two identically. Datagrams in a batch are
+ * limited to 128KiB / ZT_PHY_UDP_BATCH_SIZE bytes; larger ones are dropped.
+ *
  * Handlers are always called. On outgoing TCP connection, CONNECT is always
  * called on either success or failure followed by DATA and/or WRITABLE as
  * indicated. On socket close, handlers are called unless close() is told
@@ -122,6 +165,11 @@ typedef void PhySocket;
  * handler, and in that case close() can be told not to call handlers to
  * prevent recursion.
  *
+ * On Linux the default I/O backend is edge-triggered epoll(), which only
+ * visits sockets that are actually ready and is not limited by FD_SETSIZE.
+ * Define ZT_PHY_NO_EPOLL to use select() everywhere. Handler semantics are
+ * identical for both backends.
+ *
  * This isn't thread-safe with the exception of whack(), which is safe to
  * call from another thread to abort poll().
  */
@@ -150,15 +198,23 @@ private:
 		ZT_PHY_SOCKFD_TYPE sock;
 		void *uptr; // user-settable pointer
 		ZT_PHY_SOCKADDR_STORAGE_TYPE saddr; // remote for TCP_OUT and TCP_IN, local for TCP_LISTEN, RAW, and UDP
+#ifdef ZT_PHY_USE_EPOLL
+		uint32_t events; // EPOLLIN and/or EPOLLOUT as currently requested
+#endif
 	};
 
 	std::list<PhySocketImpl> _socks;
+#ifdef ZT_PHY_USE_EPOLL
+	int _epfd;
+	bool _haveClosed; // closed sockets awaiting removal at the end of poll()
+#else
 	fd_set _readfds;
 	fd_set _writefds;
 #if defined(_WIN32) || defined(_WIN64)
 	fd_set _exceptfds;
 #endif
 	long _nfds;
+#endif
 
 	ZT_PHY_SOCKFD_TYPE _whackReceiveSocket;
 	ZT_PHY_SOCKFD_TYPE _whackSendSocket;
@@ -166,6 +222,110 @@ private:
 	bool _noDelay;
 	bool _noCheck;
 
+	// Begin watching a new socket for readability and/or writability
+	inline bool _watch(PhySocketImpl &sws,bool readable,bool writable)
+	{
+#ifdef ZT_PHY_USE_EPOLL
+		struct epoll_event ev;
+		memset(&ev,0,sizeof(ev));
+		sws.events = (readable ? (uint32_t)EPOLLIN : (uint32_t)0) | (writable ? (uint32_t)EPOLLOUT : (uint32_t)0);
+		ev.events = sws.events | _edgeTrigger(sws.type);
+		ev.data.ptr = (void *)&sws;
+		return (::epoll_ctl(_epfd,EPOLL_CTL_ADD,sws.sock,&ev) == 0);
+#else
+		if ((long)sws.sock > _nfds)
+			_nfds = (long)sws.sock;
+		if (readable)
+			FD_SET(sws.sock,&_readfds);
+		if (writable)
+			FD_SET(sws.sock,&_writefds);
+		return true;
+#endif
+	}
+
+#ifdef ZT_PHY_USE_EPOLL
+	// Sockets we own are non-blocking and are drained until EAGAIN, so they can
+	// be edge-triggered. Unix domain connections may be wrapped fds of unknown
+	// blocking mode and are read once per event, so they stay level-triggered.
+	static inline uint32_t _edgeTrigger(const PhySocketType t) throw()
+	{
+		return ((t == ZT_PHY_SOCKET_UNIX_IN)||(t == ZT_PHY_SOCKET_FD)) ? (uint32_t)0 : (uint32_t)EPOLLET;
+	}
+
+	// Change requested events; this also re-arms the edge trigger, so a socket
+	// that is already readable or writable will be reported on the next poll()
+	inline void _rewatch(PhySocketImpl &sws,uint32_t events)
+	{
+		struct epoll_event ev;
+		memset(&ev,0,sizeof(ev));
+		sws.events = events;
+		ev.events = events | _edgeTrigger(sws.type);
+		ev.data.ptr = (void *)&sws;
+		::epoll_ctl(_epfd,EPOLL_CTL_MOD,sws.sock,&ev);
+	}
+#endif
+
+	// Receive and dispatch datagrams until the socket would block
+	inline void _udpDrain(PhySocketImpl *s,char *buf,unsigned long bufSize)
+	{
+#ifdef ZT_PHY_HAVE_MMSG
+		struct mmsghdr msgs[ZT_PHY_UDP_BATCH_SIZE];
+		struct iovec iov[ZT_PHY_UDP_BATCH_SIZE];
+		struct sockaddr_storage from[ZT_PHY_UDP_BATCH_SIZE];
+		PhyDatagram dgrams[ZT_PHY_UDP_BATCH_SIZE];
+		const unsigned long slotSize = bufSize / ZT_PHY_UDP_BATCH_SIZE;
+		for(unsigned int i=0;i<ZT_PHY_UDP_BATCH_SIZE;++i) {
+			iov[i].iov_base = buf + (slotSize * i);
+			iov[i].iov_len = slotSize;
+		}
+		while (s->type == ZT_PHY_SOCKET_UDP) {
+			memset(msgs,0,sizeof(msgs));
+			memset(from,0,sizeof(from));
+			for(unsigned int i=0;i<ZT_PHY_UDP_BATCH_SIZE;++i) {
+				msgs[i].msg_hdr.msg_name = (void *)&(from[i]);
+				msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+				msgs[i].msg_hdr.msg_iov = &(iov[i]);
+				msgs[i].msg_hdr.msg_iovlen = 1;
+			}
+			const int n = ::recvmmsg(s->sock,msgs,ZT_PHY_UDP_BATCH_SIZE,MSG_DONTWAIT,(struct timespec *)0);
+			if (n <= 0) {
+				if ((n < 0)&&(errno == EINTR))
+					continue;
+				break;
+			}
+			unsigned int count = 0;
+			for(int i=0;i<n;++i) {
+				if ((msgs[i].msg_len > 0)&&((msgs[i].msg_hdr.msg_flags & MSG_TRUNC) == 0)) {
+					dgrams[count].addr = (const struct sockaddr *)&(from[i]);
+					dgrams[count].data = iov[i].iov_base;
+					dgrams[count].len = (unsigned long)msgs[i].msg_len;
+					++count;
+				}
+			}
+			if (count) {
+				try {
+					_handler->phyOnDatagramBatch((PhySocket *)s,&(s->uptr),(const struct sockaddr *)&(s->saddr),dgrams,count);
+				} catch ( ... ) {}
+			}
+			if (n < ZT_PHY_UDP_BATCH_SIZE)
+				break; // a short batch means the receive queue was empty
+		}
+#else
+		struct sockaddr_storage ss;
+		while (s->type == ZT_PHY_SOCKET_UDP) {
+			memset(&ss,0,sizeof(ss));
+			socklen_t slen = sizeof(ss);
+			long n = (long)::recvfrom(s->sock,buf,bufSize,0,(struct sockaddr *)&ss,&slen);
+			if (n > 0) {
+				try {
+					_handler->phyOnDatagram((PhySocket *)s,&(s->uptr),(const struct sockaddr *)&(s->saddr),(const struct sockaddr *)&ss,(void *)buf,(unsigned long)n);
+				} catch ( ... ) {}
+			} else if (n < 0)
+				break;
+		}
+#endif
+	}
+
 public:
 	/**
 	 * @param handler Pointer of type HANDLER_PTR_TYPE to handler
@@ -175,8 +335,10 @@ public:
 	Phy(HANDLER_PTR_TYPE handler,bool noDelay,bool noCheck) :
 		_handler(handler)
 	{
+#ifndef ZT_PHY_USE_EPOLL
 		FD_ZERO(&_readfds);
 		FD_ZERO(&_writefds);
+#endif
 
 #if defined(_WIN32) || defined(_WIN64)
 		FD_ZERO(&_exceptfds);
@@ -212,7 +374,25 @@ public:
 			throw std::runtime_error("unable to create pipes for select() abort");
 #endif // Windows or not
 
+#ifdef ZT_PHY_USE_EPOLL
+		_epfd = ::epoll_create1(EPOLL_CLOEXEC);
+		if (_epfd < 0) {
+			::close(pipes[0]);
+			::close(pipes[1]);
+			throw std::runtime_error("unable to create epoll descriptor");
+		}
+		{
+			// The whack pipe is level-triggered and is the only entry with a NULL data pointer
+			struct epoll_event ev;
+			memset(&ev,0,sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.ptr = (void *)0;
+			::epoll_ctl(_epfd,EPOLL_CTL_ADD,pipes[0],&ev);
+		}
+		_haveClosed = false;
+#else
 		_nfds = (pipes[0] > pipes[1]) ? (long)pipes[0] : (long)pipes[1];
+#endif
 		_whackReceiveSocket = pipes[0];
 		_whackSendSocket = pipes[1];
 		_noDelay = noDelay;
@@ -227,6 +407,9 @@ public:
 		}
 		ZT_PHY_CLOSE_SOCKET(_whackReceiveSocket);
 		ZT_PHY_CLOSE_SOCKET(_whackSendSocket);
+#ifdef ZT_PHY_USE_EPOLL
+		::close(_epfd);
+#endif
 	}
 
 	/**
@@ -297,14 +480,15 @@ public:
 			return (PhySocket *)0;
 		}
 		PhySocketImpl &sws = _socks.back();
-		if ((long)fd > _nfds)
-			_nfds = (long)fd;
-		FD_SET(fd,&_readfds);
 		sws.type = ZT_PHY_SOCKET_UNIX_IN; /* TODO: Type was changed to allow for CBs with new RPC model */
 		sws.sock = fd;
 		sws.uptr = uptr;
 		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
 		// no sockaddr for this socket type, leave saddr null
+		if (!_watch(sws,true,false)) {
+			_socks.pop_back();
+			return (PhySocket *)0;
+		}
 		return (PhySocket *)&sws;
 	}
 
@@ -402,14 +586,16 @@ public:
 		}
 		PhySocketImpl &sws = _socks.back();
 
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		FD_SET(s,&_readfds);
 		sws.type = ZT_PHY_SOCKET_UDP;
 		sws.sock = s;
 		sws.uptr = uptr;
 		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
 		memcpy(&(sws.saddr),localAddress,(localAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+		if (!_watch(sws,true,false)) {
+			_socks.pop_back();
+			ZT_PHY_CLOSE_SOCKET(s);
+			return (PhySocket *)0;
+		}
 
 		return (PhySocket *)&sws;
 	}
@@ -451,6 +637,64 @@ public:
 #endif
 	}
 
+	/**
+	 * Send several UDP packets from the same socket
+	 *
+	 * This uses sendmmsg() where available to send up to ZT_PHY_UDP_BATCH_SIZE
+	 * datagrams per system call, and otherwise behaves like calling udpSend()
+	 * for each. A datagram sendmmsg() fails on is retried alone with udpSend(),
+	 * and does not stop the rest from being sent.
+	 *
+	 * @param sock UDP socket
+	 * @param dgrams Datagrams with destination addresses (must be correct type for socket)
+	 * @param count Number of datagrams
+	 * @return Number of datagrams that appear to have been sent successfully
+	 */
+	inline unsigned int udpSendBatch(PhySocket *sock,const PhyDatagram *dgrams,unsigned int count)
+	{
+		unsigned int sent = 0;
+#ifdef ZT_PHY_HAVE_MMSG
+		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
+		struct mmsghdr msgs[ZT_PHY_UDP_BATCH_SIZE];
+		struct iovec iov[ZT_PHY_UDP_BATCH_SIZE];
+		unsigned int i = 0;
+		while (i < count) {
+			const unsigned int n = ((count - i) > ZT_PHY_UDP_BATCH_SIZE) ? ZT_PHY_UDP_BATCH_SIZE : (count - i);
+			memset(msgs,0,sizeof(struct mmsghdr) * n);
+			for(unsigned int j=0;j<n;++j) {
+				const PhyDatagram &d = dgrams[i + j];
+				iov[j].iov_base = d.data;
+				iov[j].iov_len = d.len;
+				msgs[j].msg_hdr.msg_name = (void *)d.addr;
+				msgs[j].msg_hdr.msg_namelen = (d.addr->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+				msgs[j].msg_hdr.msg_iov = &(iov[j]);
+				msgs[j].msg_hdr.msg_iovlen = 1;
+			}
+			const int r = ::sendmmsg(sws.sock,msgs,n,0);
+			if (r > 0) {
+				for(int j=0;j<r;++j) {
+					if ((unsigned long)msgs[j].msg_len == dgrams[i + j].len)
+						++sent;
+				}
+				i += (unsigned int)r;
+			} else if ((r < 0)&&(errno == EINTR)) {
+				continue;
+			} else {
+				// Give the datagram that failed one plain sendto() as udpSend() would, then go on
+				if (udpSend(sock,dgrams[i].addr,dgrams[i].data,dgrams[i].len))
+					++sent;
+				++i;
+			}
+		}
+#else
+		for(unsigned int i=0;i<count;++i) {
+			if (udpSend(sock,dgrams[i].addr,dgrams[i].data,dgrams[i].len))
+				++sent;
+		}
+#endif
+		return sent;
+	}
+
 #ifdef __UNIX_LIKE__
 	/**
 	 * Listen for connections on a Unix domain socket
@@ -496,14 +740,16 @@ public:
 		}
 		PhySocketImpl &sws = _socks.back();
 
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		FD_SET(s,&_readfds);
 		sws.type = ZT_PHY_SOCKET_UNIX_LISTEN;
 		sws.sock = s;
 		sws.uptr = uptr;
 		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
 		memcpy(&(sws.saddr),&sun,sizeof(struct sockaddr_un));
+		if (!_watch(sws,true,false)) {
+			_socks.pop_back();
+			ZT_PHY_CLOSE_SOCKET(s);
+			return (PhySocket *)0;
+		}
 
 		return (PhySocket *)&sws;
 	}
@@ -562,14 +808,16 @@ public:
 		}
 		PhySocketImpl &sws = _socks.back();
 
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		FD_SET(s,&_readfds);
 		sws.type = ZT_PHY_SOCKET_TCP_LISTEN;
 		sws.sock = s;
 		sws.uptr = uptr;
 		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
 		memcpy(&(sws.saddr),localAddress,(localAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+		if (!_watch(sws,true,false)) {
+			_socks.pop_back();
+			ZT_PHY_CLOSE_SOCKET(s);
+			return (PhySocket *)0;
+		}
 
 		return (PhySocket *)&sws;
 	}
@@ -647,22 +895,21 @@ public:
 		}
 		PhySocketImpl &sws = _socks.back();
 
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		if (connected) {
-			FD_SET(s,&_readfds);
-			sws.type = ZT_PHY_SOCKET_TCP_OUT_CONNECTED;
-		} else {
-			FD_SET(s,&_writefds);
-#if defined(_WIN32) || defined(_WIN64)
-			FD_SET(s,&_exceptfds);
-#endif
-			sws.type = ZT_PHY_SOCKET_TCP_OUT_PENDING;
-		}
+		sws.type = (connected) ? ZT_PHY_SOCKET_TCP_OUT_CONNECTED : ZT_PHY_SOCKET_TCP_OUT_PENDING;
 		sws.sock = s;
 		sws.uptr = uptr;
 		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
 		memcpy(&(sws.saddr),remoteAddress,(remoteAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+		if (!_watch(sws,connected,!connected)) {
+			_socks.pop_back();
+			ZT_PHY_CLOSE_SOCKET(s);
+			connected = false;
+			return (PhySocket *)0;
+		}
+#if defined(_WIN32) || defined(_WIN64)
+		if (!connected)
+			FD_SET(s,&_exceptfds);
+#endif
 
 		if ((callConnectHandler)&&(connected)) {
 			try {
@@ -810,11 +1057,16 @@ public:
 	inline const void setNotifyWritable(PhySocket *sock,bool notifyWritable)
 	{
 		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
+#ifdef ZT_PHY_USE_EPOLL
+		if (sws.type != ZT_PHY_SOCKET_CLOSED)
+			_rewatch(sws,(notifyWritable) ? (sws.events | (uint32_t)EPOLLOUT) : (sws.events & ~((uint32_t)EPOLLOUT)));
+#else
 		if (notifyWritable) {
 			FD_SET(sws.sock,&_writefds);
 		} else {
 			FD_CLR(sws.sock,&_writefds);
 		}
+#endif
 	}
 
 	/**
@@ -830,11 +1082,16 @@ public:
 	inline const void setNotifyReadable(PhySocket *sock,bool notifyReadable)
 	{
 		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
+#ifdef ZT_PHY_USE_EPOLL
+		if (sws.type != ZT_PHY_SOCKET_CLOSED)
+			_rewatch(sws,(notifyReadable) ? (sws.events | (uint32_t)EPOLLIN) : (sws.events & ~((uint32_t)EPOLLIN)));
+#else
 		if (notifyReadable) {
 			FD_SET(sws.sock,&_readfds);
 		} else {
 			FD_CLR(sws.sock,&_readfds);
 		}
+#endif
 	}
 
 	/**
@@ -846,6 +1103,208 @@ public:
 	 *
 	 * @param timeout Timeout in milliseconds or 0 for none (forever)
 	 */
+#ifdef ZT_PHY_USE_EPOLL
+	inline void poll(unsigned long timeout)
+	{
+		char buf[131072];
+		struct sockaddr_storage ss;
+		struct epoll_event events[ZT_PHY_EPOLL_MAX_EVENTS];
+
+		const int nev = ::epoll_wait(_epfd,events,ZT_PHY_EPOLL_MAX_EVENTS,(timeout > 0) ? (int)timeout : -1);
+
+		for(int i=0;i<nev;++i) {
+			PhySocketImpl *const s = reinterpret_cast<PhySocketImpl *>(events[i].data.ptr);
+			const uint32_t ev = events[i].events;
+
+			if (!s) {
+				char tmp[16];
+				::read(_whackReceiveSocket,tmp,16);
+				continue;
+			}
+
+			// Entries closed by a handler earlier in this batch remain valid (but
+			// CLOSED) until the end of poll(), so this is safe.
+			switch (s->type) {
+
+				case ZT_PHY_SOCKET_TCP_OUT_PENDING:
+					if ((ev & (EPOLLOUT|EPOLLERR|EPOLLHUP)) != 0) {
+						socklen_t slen = sizeof(ss);
+						if (::getpeername(s->sock,(struct sockaddr *)&ss,&slen) != 0) {
+							this->close((PhySocket *)s,true);
+						} else {
+							s->type = ZT_PHY_SOCKET_TCP_OUT_CONNECTED;
+							_rewatch(*s,(uint32_t)EPOLLIN);
+							try {
+								_handler->phyOnTcpConnect((PhySocket *)s,&(s->uptr),true);
+							} catch ( ... ) {}
+						}
+					}
+					break;
+
+				case ZT_PHY_SOCKET_TCP_OUT_CONNECTED:
+				case ZT_PHY_SOCKET_TCP_IN:
+					if ((ev & (EPOLLIN|EPOLLERR|EPOLLHUP)) != 0) {
+						while ((s->events & EPOLLIN) != 0) { // cleared if closed or if handler stops reads
+							long n = (long)::recv(s->sock,buf,sizeof(buf),0);
+							if (n > 0) {
+								try {
+									_handler->phyOnTcpData((PhySocket *)s,&(s->uptr),(void *)buf,(unsigned long)n);
+								} catch ( ... ) {}
+							} else if ((n < 0)&&(errno == EINTR)) {
+								continue;
+							} else if ((n < 0)&&((errno == EAGAIN)||(errno == EWOULDBLOCK))) {
+								break;
+							} else {
+								this->close((PhySocket *)s,true);
+								break;
+							}
+						}
+					}
+					if (((ev & EPOLLOUT) != 0)&&((s->events & EPOLLOUT) != 0)) {
+						try {
+							_handler->phyOnTcpWritable((PhySocket *)s,&(s->uptr));
+						} catch ( ... ) {}
+						// Re-arm if the handler still wants to write, giving the same
+						// "called while writable" behavior as select()
+						if ((s->events & EPOLLOUT) != 0)
+							_rewatch(*s,s->events);
+					}
+					break;
+
+				case ZT_PHY_SOCKET_TCP_LISTEN:
+					if ((ev & EPOLLIN) != 0) {
+						for(;;) {
+							memset(&ss,0,sizeof(ss));
+							socklen_t slen = sizeof(ss);
+							ZT_PHY_SOCKFD_TYPE newSock = ::accept(s->sock,(struct sockaddr *)&ss,&slen);
+							if (!ZT_PHY_SOCKFD_VALID(newSock)) {
+								if ((errno == EINTR)||(errno == ECONNABORTED))
+									continue;
+								break;
+							}
+							if (_socks.size() >= ZT_PHY_MAX_SOCKETS) {
+								ZT_PHY_CLOSE_SOCKET(newSock);
+								continue;
+							}
+							{ int f = (_noDelay ? 1 : 0); setsockopt(newSock,IPPROTO_TCP,TCP_NODELAY,(char *)&f,sizeof(f)); }
+							fcntl(newSock,F_SETFL,O_NONBLOCK);
+							try {
+								_socks.push_back(PhySocketImpl());
+							} catch ( ... ) {
+								ZT_PHY_CLOSE_SOCKET(newSock);
+								continue;
+							}
+							PhySocketImpl &sws = _socks.back();
+							sws.type = ZT_PHY_SOCKET_TCP_IN;
+							sws.sock = newSock;
+							sws.uptr = (void *)0;
+							memcpy(&(sws.saddr),&ss,sizeof(struct sockaddr_storage));
+							if (!_watch(sws,true,false)) {
+								_socks.pop_back();
+								ZT_PHY_CLOSE_SOCKET(newSock);
+								continue;
+							}
+							try {
+								_handler->phyOnTcpAccept((PhySocket *)s,(PhySocket *)&sws,&(s->uptr),&(sws.uptr),(const struct sockaddr *)&(sws.saddr));
+							} catch ( ... ) {}
+							if (s->type == ZT_PHY_SOCKET_CLOSED)
+								break;
+						}
+					}
+					break;
+
+				case ZT_PHY_SOCKET_UDP:
+					if (((ev & EPOLLIN) != 0)&&((s->events & EPOLLIN) != 0))
+						_udpDrain(s,buf,sizeof(buf));
+					break;
+
+				case ZT_PHY_SOCKET_UNIX_IN: {
+#ifdef __UNIX_LIKE__
+					if (((ev & EPOLLOUT) != 0)&&((s->events & EPOLLOUT) != 0)) {
+						try {
+							_handler->phyOnUnixWritable((PhySocket *)s,&(s->uptr),false);
+						} catch ( ... ) {}
+					}
+					if (((ev & (EPOLLIN|EPOLLERR|EPOLLHUP)) != 0)&&((s->events & EPOLLIN) != 0)) {
+						long n = (long)::read(s->sock,buf,sizeof(buf));
+						if (n <= 0) {
+							this->close((PhySocket *)s,true);
+						} else {
+							try {
+								_handler->phyOnUnixData((PhySocket *)s,&(s->uptr),(void *)buf,(unsigned long)n);
+							} catch ( ... ) {}
+						}
+					}
+#endif // __UNIX_LIKE__
+				}	break;
+
+				case ZT_PHY_SOCKET_UNIX_LISTEN:
+#ifdef __UNIX_LIKE__
+					if ((ev & EPOLLIN) != 0) {
+						for(;;) {
+							memset(&ss,0,sizeof(ss));
+							socklen_t slen = sizeof(ss);
+							ZT_PHY_SOCKFD_TYPE newSock = ::accept(s->sock,(struct sockaddr *)&ss,&slen);
+							if (!ZT_PHY_SOCKFD_VALID(newSock)) {
+								if ((errno == EINTR)||(errno == ECONNABORTED))
+									continue;
+								break;
+							}
+							if (_socks.size() >= ZT_PHY_MAX_SOCKETS) {
+								ZT_PHY_CLOSE_SOCKET(newSock);
+								continue;
+							}
+							fcntl(newSock,F_SETFL,O_NONBLOCK);
+							try {
+								_socks.push_back(PhySocketImpl());
+							} catch ( ... ) {
+								ZT_PHY_CLOSE_SOCKET(newSock);
+								continue;
+							}
+							PhySocketImpl &sws = _socks.back();
+							sws.type = ZT_PHY_SOCKET_UNIX_IN;
+							sws.sock = newSock;
+							sws.uptr = (void *)0;
+							memcpy(&(sws.saddr),&ss,sizeof(struct sockaddr_storage));
+							if (!_watch(sws,true,false)) {
+								_socks.pop_back();
+								ZT_PHY_CLOSE_SOCKET(newSock);
+								continue;
+							}
+							try {
+								//_handler->phyOnUnixAccept((PhySocket *)s,(PhySocket *)&sws,&(s->uptr),&(sws.uptr));
+							} catch ( ... ) {}
+						}
+					}
+#endif // __UNIX_LIKE__
+					break;
+
+				case ZT_PHY_SOCKET_FD: {
+					const bool readable = (((ev & EPOLLIN) != 0)&&((s->events & EPOLLIN) != 0));
+					const bool writable = (((ev & EPOLLOUT) != 0)&&((s->events & EPOLLOUT) != 0));
+					if ((readable)||(writable)) {
+						try {
+							//_handler->phyOnFileDescriptorActivity((PhySocket *)s,&(s->uptr),readable,writable);
+						} catch ( ... ) {}
+					}
+				}	break;
+
+				default:
+					break;
+
+			}
+		}
+
+		if (_haveClosed) {
+			_haveClosed = false;
+			for(typename std::list<PhySocketImpl>::iterator s(_socks.begin());s!=_socks.end();) {
+				if (s->type == ZT_PHY_SOCKET_CLOSED)
+					_socks.erase(s++);
+				else ++s;
+			}
+		}
+	}
+#else // select()
 	inline void poll(unsigned long timeout)
 	{
 		char buf[131072];
@@ -956,19 +1415,8 @@ public:
 					break;
 
 				case ZT_PHY_SOCKET_UDP:
-					if (FD_ISSET(s->sock,&rfds)) {
-						for(;;) {
-							memset(&ss,0,sizeof(ss));
-							socklen_t slen = sizeof(ss);
-							long n = (long)::recvfrom(s->sock,buf,sizeof(buf),0,(struct sockaddr *)&ss,&slen);
-							if (n > 0) {
-								try {
-									_handler->phyOnDatagram((PhySocket *)&(*s),&(s->uptr),(const struct sockaddr *)&(s->saddr),(const struct sockaddr *)&ss,(void *)buf,(unsigned long)n);
-								} catch ( ... ) {}
-							} else if (n < 0)
-								break;
-						}
-					}
+					if (FD_ISSET(s->sock,&rfds))
+						_udpDrain(&(*s),buf,sizeof(buf));
 					break;
 
 				case ZT_PHY_SOCKET_UNIX_IN: {
@@ -1042,6 +1490,7 @@ public:
 			else ++s;
 		}
 	}
+#endif // epoll() or select()
 
 	/**
 	 * @param sock Socket to close
@@ -1055,10 +1504,19 @@ public:
 		if (sws.type == ZT_PHY_SOCKET_CLOSED)
 			return;
 
+#ifdef ZT_PHY_USE_EPOLL
+		{
+			struct epoll_event ev; // must be non-NULL on kernels before 2.6.9
+			memset(&ev,0,sizeof(ev));
+			::epoll_ctl(_epfd,EPOLL_CTL_DEL,sws.sock,&ev);
+			sws.events = 0;
+		}
+#else
 		FD_CLR(sws.sock,&_readfds);
 		FD_CLR(sws.sock,&_writefds);
 #if defined(_WIN32) || defined(_WIN64)
 		FD_CLR(sws.sock,&_exceptfds);
+#endif
 #endif
 
 		if (sws.type != ZT_PHY_SOCKET_FD)
@@ -1097,6 +1555,9 @@ public:
 		// Causes entry to be deleted from list in poll(), ignored elsewhere
 		sws.type = ZT_PHY_SOCKET_CLOSED;
 
+#ifdef ZT_PHY_USE_EPOLL
+		_haveClosed = true;
+#else
 		if ((long)sws.sock >= (long)_nfds) {
 			long nfds = (long)_whackSendSocket;
 			if ((long)_whackReceiveSocket > nfds)
@@ -1107,6 +1568,7 @@ public:
 			}
 			_nfds = nfds;
 		}
+#endif
 	}
 };
 
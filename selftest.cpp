@@ -25,6 +25,7 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <list>
 
 #include "node/Constants.hpp"
 #include "node/Hashtable.hpp"
@@ -45,6 +46,8 @@
 #include "node/CertificateOfMembership.hpp"
 #include "node/Node.hpp"
 #include "node/IncomingPacket.hpp"
+#include "node/SizeClassPool.hpp"
+#include "node/TimerWheel.hpp"
 
 #include "osdep/OSUtils.hpp"
 #include "osdep/Phy.hpp"
@@ -189,41 +192,113 @@ static int testCrypto()
 	std::cout << "[crypto] Salsa20 SSE: DISABLED" << std::endl;
 #endif
 
-	std::cout << "[crypto] Benchmarking Salsa20/12... "; std::cout.flush();
-	{
-		unsigned char *bb = (unsigned char *)::malloc(1234567);
-		for(unsigned int i=0;i<1234567;++i)
-			bb[i] = (unsigned char)i;
-		Salsa20 s20(s20TV0Key,256,s20TV0Iv);
-		double bytes = 0.0;
-		uint64_t start = OSUtils::now();
-		for(unsigned int i=0;i<200;++i) {
-			s20.encrypt12(bb,bb,1234567);
-			bytes += 1234567.0;
+	for(unsigned int k=0;k<Salsa20::kernelCount();++k) {
+		std::cout << "[crypto] Testing Salsa20 kernel " << Salsa20::kernelName(k) << "... "; std::cout.flush();
+		Salsa20::setKernel(k);
+
+		// Long enough to go through every multi-block kernel and the one-block tail
+		const unsigned int tlen = 4096 + 64 + 37;
+		memset(buf1,0,tlen);
+		s20.init(s20TV0Key,256,s20TV0Iv);
+		s20.encrypt20(buf1,buf2,tlen);
+		if (memcmp(buf2,s20TV0Ks,64)) {
+			std::cout << "FAIL (test vector 0)" << std::endl;
+			return -1;
 		}
-		uint64_t end = OSUtils::now();
-		SHA512::hash(buf1,bb,1234567);
-		std::cout << ((bytes / 1048576.0) / ((double)(end - start) / 1000.0)) << " MiB/second (" << Utils::hex(buf1,16) << ')' << std::endl;
-		::free((void *)bb);
+		s20.init(s2012TV0Key,256,s2012TV0Iv);
+		s20.encrypt12(buf1,buf3,tlen);
+		if (memcmp(buf3,s2012TV0Ks,64)) {
+			std::cout << "FAIL (test vector 1)" << std::endl;
+			return -1;
+		}
+		if (k == 0) {
+			memcpy(fuzzbuf,buf2,tlen);
+			memcpy(fuzzbuf + tlen,buf3,tlen);
+		} else if ((memcmp(fuzzbuf,buf2,tlen))||(memcmp(fuzzbuf + tlen,buf3,tlen))) {
+			std::cout << "FAIL (differs from " << Salsa20::kernelName(0) << ")" << std::endl;
+			return -1;
+		}
+
+		// Splitting a stream over calls must give the same result
+		s20.init(s2012TV0Key,256,s2012TV0Iv);
+		s20.encrypt12(buf1,buf2,1024);
+		s20.encrypt12(buf1 + 1024,buf2 + 1024,tlen - 1024);
+		if (memcmp(buf2,buf3,tlen)) {
+			std::cout << "FAIL (split stream)" << std::endl;
+			return -1;
+		}
+
+		// Interleaved independent streams must match separate encrypt12() calls
+		Salsa20 ms[19],ss[19];
+		Salsa20 *msp[19];
+		const void *min[19];
+		void *mout[19];
+		unsigned int mlen[19];
+		for(unsigned int i=0;i<19;++i) {
+			char mkey[32],miv[8];
+			for(unsigned int j=0;j<32;++j) mkey[j] = (char)rand();
+			for(unsigned int j=0;j<8;++j) miv[j] = (char)rand();
+			ms[i].init(mkey,256,miv);
+			ss[i].init(mkey,256,miv);
+			msp[i] = &(ms[i]);
+			mlen[i] = (i * 53) % 700;
+			min[i] = buf1;
+			mout[i] = buf2 + (i * 700);
+		}
+		Salsa20::encrypt12Multi(msp,min,mout,mlen,19);
+		Salsa20::encrypt12Multi(msp,min,mout,mlen,19); // second pass continues each stream
+		for(unsigned int i=0;i<19;++i) {
+			ss[i].encrypt12(buf1,buf3,mlen[i]);
+			ss[i].encrypt12(buf1,buf3,mlen[i]);
+			if (memcmp(buf2 + (i * 700),buf3,mlen[i])) {
+				std::cout << "FAIL (encrypt12Multi, stream " << i << ")" << std::endl;
+				return -1;
+			}
+		}
+
+		std::cout << "PASS" << std::endl;
 	}
 
-	std::cout << "[crypto] Benchmarking Salsa20/20... "; std::cout.flush();
-	{
-		unsigned char *bb = (unsigned char *)::malloc(1234567);
-		for(unsigned int i=0;i<1234567;++i)
-			bb[i] = (unsigned char)i;
-		Salsa20 s20(s20TV0Key,256,s20TV0Iv);
-		double bytes = 0.0;
-		uint64_t start = OSUtils::now();
-		for(unsigned int i=0;i<200;++i) {
-			s20.encrypt20(bb,bb,1234567);
-			bytes += 1234567.0;
+	for(unsigned int k=0;k<Salsa20::kernelCount();++k) {
+		Salsa20::setKernel(k);
+
+		std::cout << "[crypto] Benchmarking Salsa20/12 (" << Salsa20::kernelName(k) << ")... "; std::cout.flush();
+		{
+			unsigned char *bb = (unsigned char *)::malloc(1234567);
+			for(unsigned int i=0;i<1234567;++i)
+				bb[i] = (unsigned char)i;
+			Salsa20 s20(s20TV0Key,256,s20TV0Iv);
+			double bytes = 0.0;
+			uint64_t start = OSUtils::now();
+			for(unsigned int i=0;i<200;++i) {
+				s20.encrypt12(bb,bb,1234567);
+				bytes += 1234567.0;
+			}
+			uint64_t end = OSUtils::now();
+			SHA512::hash(buf1,bb,1234567);
+			std::cout << ((bytes / 1048576.0) / ((double)(end - start) / 1000.0)) << " MiB/second (" << Utils::hex(buf1,16) << ')' << std::endl;
+			::free((void *)bb);
+		}
+
+		std::cout << "[crypto] Benchmarking Salsa20/20 (" << Salsa20::kernelName(k) << ")... "; std::cout.flush();
+		{
+			unsigned char *bb = (unsigned char *)::malloc(1234567);
+			for(unsigned int i=0;i<1234567;++i)
+				bb[i] = (unsigned char)i;
+			Salsa20 s20(s20TV0Key,256,s20TV0Iv);
+			double bytes = 0.0;
+			uint64_t start = OSUtils::now();
+			for(unsigned int i=0;i<200;++i) {
+				s20.encrypt20(bb,bb,1234567);
+				bytes += 1234567.0;
+			}
+			uint64_t end = OSUtils::now();
+			SHA512::hash(buf1,bb,1234567);
+			std::cout << ((bytes / 1048576.0) / ((double)(end - start) / 1000.0)) << " MiB/second (" << Utils::hex(buf1,16) << ')' << std::endl;
+			::free((void *)bb);
 		}
-		uint64_t end = OSUtils::now();
-		SHA512::hash(buf1,bb,1234567);
-		std::cout << ((bytes / 1048576.0) / ((double)(end - start) / 1000.0)) << " MiB/second (" << Utils::hex(buf1,16) << ')' << std::endl;
-		::free((void *)bb);
 	}
+	Salsa20::setKernel(~((unsigned int)0));
 
 	std::cout << "[crypto] Testing SHA-512... "; std::cout.flush();
 	SHA512::hash(buf1,sha512TV0Input,(unsigned int)strlen(sha512TV0Input));
@@ -246,22 +321,59 @@ static int testCrypto()
 	}
 	std::cout << "PASS" << std::endl;
 
-	std::cout << "[crypto] Benchmarking Poly1305... "; std::cout.flush();
-	{
-		unsigned char *bb = (unsigned char *)::malloc(1234567);
-		for(unsigned int i=0;i<1234567;++i)
-			bb[i] = (unsigned char)i;
-		double bytes = 0.0;
-		uint64_t start = OSUtils::now();
-		for(unsigned int i=0;i<200;++i) {
-			Poly1305::compute(buf1,bb,1234567,poly1305TV0Key);
-			bytes += 1234567.0;
+	for(unsigned int k=0;k<Poly1305::kernelCount();++k) {
+		std::cout << "[crypto] Testing Poly1305 " << Poly1305::kernelName(k) << "... "; std::cout.flush();
+		Poly1305::setKernel(k);
+		for(unsigned int i=0;i<sizeof(buf2);++i)
+			buf2[i] = (unsigned char)(i * 7);
+		// All lengths near the SIMD cutoff and stride boundaries, plus a long one
+		for(unsigned int len=0;len<=sizeof(buf2);len=((len < 1100) ? (len + 1) : (len + 1021))) {
+			unsigned char tag[16],ref[16];
+			Poly1305::compute(tag,buf2,len,poly1305TV1Key);
+			Poly1305::setKernel(0);
+			Poly1305::compute(ref,buf2,len,poly1305TV1Key);
+			Poly1305::setKernel(k);
+			if (memcmp(tag,ref,16)) {
+				std::cout << "FAIL (length " << len << ")" << std::endl;
+				return -1;
+			}
 		}
-		uint64_t end = OSUtils::now();
-		std::cout << ((bytes / 1048576.0) / ((double)(end - start) / 1000.0)) << " MiB/second" << std::endl;
-		::free((void *)bb);
+		// All-ones input and key stress the carry paths
+		memset(buf3,0xff,sizeof(buf3));
+		{
+			unsigned char tag[16],ref[16];
+			Poly1305::compute(tag,buf3,sizeof(buf3),buf3);
+			Poly1305::setKernel(0);
+			Poly1305::compute(ref,buf3,sizeof(buf3),buf3);
+			Poly1305::setKernel(k);
+			if (memcmp(tag,ref,16)) {
+				std::cout << "FAIL (carry)" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "PASS" << std::endl;
 	}
 
+	for(unsigned int k=0;k<Poly1305::kernelCount();++k) {
+		Poly1305::setKernel(k);
+		std::cout << "[crypto] Benchmarking Poly1305 (" << Poly1305::kernelName(k) << ")... "; std::cout.flush();
+		{
+			unsigned char *bb = (unsigned char *)::malloc(1234567);
+			for(unsigned int i=0;i<1234567;++i)
+				bb[i] = (unsigned char)i;
+			double bytes = 0.0;
+			uint64_t start = OSUtils::now();
+			for(unsigned int i=0;i<200;++i) {
+				Poly1305::compute(buf1,bb,1234567,poly1305TV0Key);
+				bytes += 1234567.0;
+			}
+			uint64_t end = OSUtils::now();
+			std::cout << ((bytes / 1048576.0) / ((double)(end - start) / 1000.0)) << " MiB/second" << std::endl;
+			::free((void *)bb);
+		}
+	}
+	Poly1305::setKernel(~((unsigned int)0));
+
 	/*
 	for(unsigned int d=8;d<=10;++d) {
 		for(int k=0;k<8;++k) {
@@ -275,35 +387,169 @@ static int testCrypto()
 	}
 	*/
 
-	std::cout << "[crypto] Testing C25519 and Ed25519 against test vectors... "; std::cout.flush();
-	for(int k=0;k<ZT_NUM_C25519_TEST_VECTORS;++k) {
-		C25519::Pair p1,p2;
-		memcpy(p1.pub.data,C25519_TEST_VECTORS[k].pub1,p1.pub.size());
-		memcpy(p1.priv.data,C25519_TEST_VECTORS[k].priv1,p1.priv.size());
-		memcpy(p2.pub.data,C25519_TEST_VECTORS[k].pub2,p2.pub.size());
-		memcpy(p2.priv.data,C25519_TEST_VECTORS[k].priv2,p2.priv.size());
-		C25519::agree(p1,p2.pub,buf1,64);
-		C25519::agree(p2,p1.pub,buf2,64);
-		if (memcmp(buf1,buf2,64)) {
+	for(unsigned int kn=0;kn<C25519::kernelCount();++kn) {
+		C25519::setKernel(kn);
+		std::cout << "[crypto] Testing C25519 and Ed25519 (" << C25519::kernelName(kn) << ") against test vectors... "; std::cout.flush();
+		for(int k=0;k<ZT_NUM_C25519_TEST_VECTORS;++k) {
+			C25519::Pair p1,p2;
+			memcpy(p1.pub.data,C25519_TEST_VECTORS[k].pub1,p1.pub.size());
+			memcpy(p1.priv.data,C25519_TEST_VECTORS[k].priv1,p1.priv.size());
+			memcpy(p2.pub.data,C25519_TEST_VECTORS[k].pub2,p2.pub.size());
+			memcpy(p2.priv.data,C25519_TEST_VECTORS[k].priv2,p2.priv.size());
+			C25519::agree(p1,p2.pub,buf1,64);
+			C25519::agree(p2,p1.pub,buf2,64);
+			if (memcmp(buf1,buf2,64)) {
+				std::cout << "FAIL (1)" << std::endl;
+				return -1;
+			}
+			if (memcmp(buf1,C25519_TEST_VECTORS[k].agreement,64)) {
+				std::cout << "FAIL (2)" << std::endl;
+				return -1;
+			}
+			C25519::Signature sig1 = C25519::sign(p1,buf1,64);
+			if (memcmp(sig1.data,C25519_TEST_VECTORS[k].agreementSignedBy1,64)) {
+				std::cout << "FAIL (3)" << std::endl;
+				return -1;
+			}
+			C25519::Signature sig2 = C25519::sign(p2,buf1,64);
+			if (memcmp(sig2.data,C25519_TEST_VECTORS[k].agreementSignedBy2,64)) {
+				std::cout << "FAIL (4)" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	for(unsigned int kn=1;kn<C25519::kernelCount();++kn) {
+		std::cout << "[crypto] Testing C25519 and Ed25519 (" << C25519::kernelName(kn) << ") against " << C25519::kernelName(0) << "... "; std::cout.flush();
+		for(unsigned int i=0;i<256;++i) {
+			C25519::Pair p1 = C25519::generate();
+			C25519::Pair p2;
+			Utils::getSecureRandom(p2.pub.data,(unsigned int)p2.pub.size()); // arbitrary points, not necessarily valid or reduced
+			if (i < 8)
+				memset(p2.pub.data,(i & 1) ? 0xff : 0x00,32);
+			for(unsigned int k=0;k<sizeof(buf1);++k)
+				buf1[k] = (unsigned char)rand();
+
+			C25519::setKernel(0);
+			C25519::agree(p1.priv,p2.pub,buf2,64);
+			C25519::Signature rsig = C25519::sign(p1,buf1,sizeof(buf1));
+			const bool rv = C25519::verify(p2.pub,buf1,sizeof(buf1),rsig);
+
+			C25519::setKernel(kn);
+			C25519::agree(p1.priv,p2.pub,buf3,64);
+			C25519::Signature fsig = C25519::sign(p1,buf1,sizeof(buf1));
+			const bool fv = C25519::verify(p2.pub,buf1,sizeof(buf1),fsig);
+
+			if ((memcmp(buf2,buf3,64))||(rsig != fsig)||(rv != fv)) {
+				std::cout << "FAIL (" << i << ")" << std::endl;
+				return -1;
+			}
+
+			// Key pairs made by either must work with the other
+			C25519::Pair p3 = C25519::generate();
+			C25519::Signature sig = C25519::sign(p3,buf1,sizeof(buf1));
+			C25519::setKernel(0);
+			if ((!C25519::verify(p3.pub,buf1,sizeof(buf1),sig))||(C25519::verify(p3.pub,buf1,sizeof(buf1) - 1,sig))) {
+				std::cout << "FAIL (verify " << i << ")" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	for(unsigned int kn=0;kn<C25519::kernelCount();++kn) {
+		C25519::setKernel(kn);
+		std::cout << "[crypto] Testing Ed25519 batch verification (" << C25519::kernelName(kn) << ")... "; std::cout.flush();
+		C25519::Pair signers[4];
+		for(unsigned int i=0;i<4;++i)
+			signers[i] = C25519::generate();
+		unsigned char msgs[19][64];
+		C25519::Signature sigs[19];
+		const C25519::Public *keys[19];
+		const void *msgp[19];
+		unsigned int lens[19];
+		const void *sigp[19];
+		bool ok[19];
+		for(unsigned int i=0;i<19;++i) {
+			Utils::getSecureRandom(msgs[i],sizeof(msgs[i]));
+			sigs[i] = C25519::sign(signers[i % 4],msgs[i],sizeof(msgs[i]));
+			keys[i] = &(signers[i % 4].pub);
+			msgp[i] = msgs[i];
+			lens[i] = sizeof(msgs[i]);
+			sigp[i] = sigs[i].data;
+		}
+		if (!C25519::verifyBatch(keys,msgp,lens,sigp,19,ok)) {
 			std::cout << "FAIL (1)" << std::endl;
 			return -1;
 		}
-		if (memcmp(buf1,C25519_TEST_VECTORS[k].agreement,64)) {
-			std::cout << "FAIL (2)" << std::endl;
-			return -1;
+		for(unsigned int i=0;i<19;++i) {
+			if (!ok[i]) {
+				std::cout << "FAIL (2)" << std::endl;
+				return -1;
+			}
 		}
-		C25519::Signature sig1 = C25519::sign(p1,buf1,64);
-		if (memcmp(sig1.data,C25519_TEST_VECTORS[k].agreementSignedBy1,64)) {
-			std::cout << "FAIL (3)" << std::endl;
-			return -1;
+		for(unsigned int b=0;b<19;++b) {
+			C25519::Signature bad(sigs[b]);
+			bad.data[rand() % 64] ^= (unsigned char)(1 << (rand() & 7)); // R or S
+			sigp[b] = bad.data;
+			if ((b & 1) != 0)
+				keys[(b + 1) % 19] = &(signers[((b + 1) % 4 + 1) % 4].pub); // and a wrong key
+			const bool all = C25519::verifyBatch(keys,msgp,lens,sigp,19,ok);
+			for(unsigned int i=0;i<19;++i) {
+				const bool expect = ((i != b)&&(((b & 1) == 0)||(i != ((b + 1) % 19))));
+				if ((ok[i] != expect)||(all)) {
+					std::cout << "FAIL (3)" << std::endl;
+					return -1;
+				}
+			}
+			sigp[b] = sigs[b].data;
+			keys[(b + 1) % 19] = &(signers[((b + 1) % 19) % 4].pub);
 		}
-		C25519::Signature sig2 = C25519::sign(p2,buf1,64);
-		if (memcmp(sig2.data,C25519_TEST_VECTORS[k].agreementSignedBy2,64)) {
-			std::cout << "FAIL (4)" << std::endl;
-			return -1;
+		std::cout << "PASS" << std::endl;
+	}
+
+	for(unsigned int kn=0;kn<C25519::kernelCount();++kn) {
+		C25519::setKernel(kn);
+		C25519::Pair p1 = C25519::generate();
+		C25519::Pair p2 = C25519::generate();
+
+		std::cout << "[crypto] Benchmarking C25519 key agreement (" << C25519::kernelName(kn) << ")... "; std::cout.flush();
+		uint64_t start = OSUtils::now();
+		for(unsigned int i=0;i<1000;++i)
+			C25519::agree(p1,p2.pub,buf1,64);
+		uint64_t end = OSUtils::now();
+		std::cout << (1000.0 / ((double)(end - start) / 1000.0)) << " agreements/second" << std::endl;
+
+		std::cout << "[crypto] Benchmarking Ed25519 verify (" << C25519::kernelName(kn) << ")... "; std::cout.flush();
+		C25519::Signature sig = C25519::sign(p1,buf1,64);
+		unsigned int ok = 0;
+		start = OSUtils::now();
+		for(unsigned int i=0;i<1000;++i)
+			ok += (unsigned int)C25519::verify(p1.pub,buf1,64,sig);
+		end = OSUtils::now();
+		std::cout << (1000.0 / ((double)(end - start) / 1000.0)) << " verifications/second (" << ok << " valid)" << std::endl;
+
+		std::cout << "[crypto] Benchmarking Ed25519 batch verify (" << C25519::kernelName(kn) << ")... "; std::cout.flush();
+		const C25519::Public *keys[8];
+		const void *msgp[8];
+		unsigned int lens[8];
+		const void *sigp[8];
+		bool oks[8];
+		for(unsigned int i=0;i<8;++i) {
+			keys[i] = &(p1.pub);
+			msgp[i] = buf1;
+			lens[i] = 64;
+			sigp[i] = sig.data;
 		}
+		ok = 0;
+		start = OSUtils::now();
+		for(unsigned int i=0;i<125;++i)
+			ok += (unsigned int)C25519::verifyBatch(keys,msgp,lens,sigp,8,oks) * 8;
+		end = OSUtils::now();
+		std::cout << (1000.0 / ((double)(end - start) / 1000.0)) << " verifications/second (" << ok << " valid)" << std::endl;
 	}
-	std::cout << "PASS" << std::endl;
+	C25519::setKernel(~((unsigned int)0));
 
 	std::cout << "[crypto] Testing C25519 ECC key agreement... "; std::cout.flush();
 	for(unsigned int i=0;i<100;++i) {
@@ -579,7 +825,71 @@ static int testPacket()
 		return -1;
 	}
 
+	{	// Known answer, to catch accidental changes to the wire format
+		unsigned char katKey[32];
+		for(unsigned int i=0;i<32;++i)
+			katKey[i] = (unsigned char)(i * 3);
+		Packet kat(Address(0x0102030405ULL),Address(0x0a0b0c0d0eULL),Packet::VERB_FRAME);
+		for(unsigned int i=0;i<8;++i)
+			kat[i] = (unsigned char)(0xf0 + i); // fixed IV
+		for(unsigned int i=0;i<300;++i)
+			kat.append((unsigned char)i);
+		kat.armor(Packet::ArmorKey(katKey),true);
+		if (Utils::hex(kat.field(ZT_PACKET_IDX_MAC,8),8) != "f5f8eb04755a163f") {
+			std::cout << "FAIL (known answer)" << std::endl;
+			return -1;
+		}
+	}
+
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[packet] Testing batch armor/dearmor... "; std::cout.flush();
+	{
+		unsigned char batchKeys[21][32];
+		Packet::ArmorKey armorKeys[21];
+		Packet orig[21],single[21],batch[21];
+		Packet *bp[21];
+		const Packet::ArmorKey *kp[21];
+		bool ok[21];
+		for(unsigned int i=0;i<21;++i) {
+			for(unsigned int k=0;k<32;++k)
+				batchKeys[i][k] = (unsigned char)rand();
+			orig[i].reset(Address((uint64_t)(i + 1)),Address((uint64_t)(i + 100)),Packet::VERB_FRAME);
+			const unsigned int plen = (i * 97) % 1400; // mix of short and long, aligned and not
+			for(unsigned int k=0;k<plen;++k)
+				orig[i].append((unsigned char)rand());
+			single[i] = orig[i];
+			batch[i] = orig[i];
+			single[i].armor(batchKeys[i],(i % 3) != 0);
+			bp[i] = &(batch[i]);
+			armorKeys[i].init(batchKeys[i]);
+			kp[i] = &(armorKeys[i]);
+		}
+		for(unsigned int i=0;i<21;++i) {
+			Packet::armorBatch(bp + i,kp + i,1,(i % 3) != 0);
+			if (batch[i] != single[i]) {
+				std::cout << "FAIL (armor mismatch, packet " << i << ")" << std::endl;
+				return -1;
+			}
+			batch[i] = orig[i];
+		}
+		Packet::armorBatch(bp,kp,7,false);
+		Packet::armorBatch(bp + 7,kp + 7,14,true);
+		batch[20][ZT_PACKET_IDX_VERB + 1] ^= 0x01; // corrupt one packet
+		Packet::dearmorBatch(bp,kp,21,ok);
+		for(unsigned int i=0;i<21;++i) {
+			if (ok[i] != (i != 20)) {
+				std::cout << "FAIL (dearmor authentication, packet " << i << ")" << std::endl;
+				return -1;
+			}
+			if ((i != 20)&&(memcmp(batch[i].field(ZT_PACKET_IDX_VERB,orig[i].size() - ZT_PACKET_IDX_VERB),orig[i].field(ZT_PACKET_IDX_VERB,orig[i].size() - ZT_PACKET_IDX_VERB),orig[i].size() - ZT_PACKET_IDX_VERB))) {
+				std::cout << "FAIL (dearmor mismatch, packet " << i << ")" << std::endl;
+				return -1;
+			}
+		}
+	}
 	std::cout << "PASS" << std::endl;
+
 	return 0;
 }
 
@@ -749,6 +1059,107 @@ static int testOther()
 	}
 	std::cout << "PASS" << std::endl;
 
+	std::cout << "[other] Testing SizeClassPool... "; std::cout.flush();
+	{
+		for(unsigned long sz=1;sz<=ZT_SIZE_CLASS_POOL_MAX_SIZE;++sz) {
+			const unsigned int c = SizeClassPool::sizeClass(sz);
+			const unsigned long cs = SizeClassPool::classSize(c);
+			if ((c >= ZT_SIZE_CLASS_POOL_CLASSES)||(cs < sz)||((sz > 64)&&((cs - sz) * 4 >= cs))||((c)&&(SizeClassPool::classSize(c - 1) >= sz))) {
+				std::cout << "FAILED! (bad size class " << c << " for " << sz << " bytes)" << std::endl;
+				return -1;
+			}
+		}
+
+		std::vector< std::pair<unsigned char *,unsigned long> > blocks;
+		for(unsigned int k=0;k<20000;++k) {
+			if ((blocks.empty())||(rand() & 1)) {
+				const unsigned long sz = (unsigned long)(rand() % (ZT_SIZE_CLASS_POOL_MAX_SIZE + 2048)) + 1;
+				unsigned char *const b = reinterpret_cast<unsigned char *>(SizeClassPool::alloc(sz));
+				memset(b,(int)(sz & 0xff),sz);
+				blocks.push_back(std::pair<unsigned char *,unsigned long>(b,sz));
+			} else {
+				const unsigned int i = (unsigned int)rand() % (unsigned int)blocks.size();
+				for(unsigned long j=0;j<blocks[i].second;++j) {
+					if (blocks[i].first[j] != (unsigned char)(blocks[i].second & 0xff)) {
+						std::cout << "FAILED! (block overwritten)" << std::endl;
+						return -1;
+					}
+				}
+				SizeClassPool::free(blocks[i].first,blocks[i].second);
+				blocks[i] = blocks.back();
+				blocks.pop_back();
+			}
+		}
+		for(unsigned int i=0;i<blocks.size();++i)
+			SizeClassPool::free(blocks[i].first,blocks[i].second);
+
+		std::list< Packet,PoolAllocator<Packet> > pl;
+		for(unsigned int k=0;k<64;++k)
+			pl.push_back(Packet());
+		pl.clear();
+
+		unsigned long sysAllocs = 0,idle = 0;
+		for(unsigned int c=0;c<ZT_SIZE_CLASS_POOL_CLASSES;++c) {
+			SizeClassPool::Stats st;
+			SizeClassPool::stats(c,st);
+			sysAllocs += st.systemAllocs;
+			idle += st.idle;
+		}
+		if (!sysAllocs) {
+			std::cout << "FAILED! (no allocations in stats)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (" << sysAllocs << " system allocations, " << idle << " idle blocks)" << std::endl;
+	}
+
+	std::cout << "[other] Testing TimerWheel... "; std::cout.flush();
+	{
+		uint64_t now = 1500000000123ULL;
+		TimerWheel<unsigned int> tw(now);
+		std::vector<uint64_t> deadlines,scheduledAt;
+		std::vector<unsigned int> fired;
+		for(unsigned int k=0;k<20000;++k) {
+			scheduledAt.push_back(now);
+			// Mostly within the first two levels, some far enough out to need the third
+			deadlines.push_back(now + (((rand() & 7) == 0) ? ((uint64_t)rand() % 60000000ULL) : ((uint64_t)rand() % 600000ULL)));
+			tw.schedule(k,deadlines.back());
+			fired.push_back(0);
+		}
+		std::vector<unsigned int> due;
+		unsigned long total = 0;
+		while (tw.size()) {
+			const uint64_t prev = now;
+			now += (uint64_t)(rand() % 200000) + 1;
+			due.clear();
+			tw.expire(now,due);
+			for(std::vector<unsigned int>::const_iterator k(due.begin());k!=due.end();++k) {
+				const uint64_t d = deadlines[*k];
+				if ((d > now)||((d > scheduledAt[*k])&&(((prev / ZT_CORE_TIMER_TASK_GRANULARITY) * ZT_CORE_TIMER_TASK_GRANULARITY) >= d))) {
+					std::cout << "FAILED! (timer " << *k << " fired at wrong time)" << std::endl;
+					return -1;
+				}
+				++total;
+				if ((++fired[*k] == 1)&&((*k & 3) == 0)) {
+					// Reschedule some timers from within the run, a few of them in the past
+					scheduledAt[*k] = now;
+					deadlines[*k] = now + (uint64_t)(rand() % 100000) - 500;
+					tw.schedule(*k,deadlines[*k]);
+				}
+			}
+			if (now > 1500000000123ULL + 200000000ULL) {
+				std::cout << "FAILED! (" << tw.size() << " timers never fired)" << std::endl;
+				return -1;
+			}
+		}
+		for(unsigned int k=0;k<(unsigned int)fired.size();++k) {
+			if (!fired[k]) {
+				std::cout << "FAILED! (timer " << k << " never fired)" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "PASS (" << total << " timers fired)" << std::endl;
+	}
+
 	std::cout << "[other] Testing hex encode/decode... "; std::cout.flush();
 	for(unsigned int k=0;k<1000;++k) {
 		unsigned int flen = (rand() % 8194) + 1;
@@ -847,6 +1258,11 @@ struct TestPhyHandlers
 		++phyTestUdpPacketCount;
 	}
 
+	inline void phyOnDatagramBatch(PhySocket *sock,void **uptr,const struct sockaddr *localAddr,const PhyDatagram *dgrams,unsigned int count)
+	{
+		phyTestUdpPacketCount += count;
+	}
+
 	inline void phyOnTcpConnect(PhySocket *sock,void **uptr,bool success)
 	{
 		if (success) {
@@ -948,6 +1364,29 @@ static int testPhy()
 	}
 	std::cout << "got " << phyTestUdpPacketCount << " packets, OK" << std::endl;
 
+	std::cout << "[phy] Testing UDP batch send/receive... "; std::cout.flush();
+	{
+		PhyDatagram dgrams[ZT_PHY_UDP_BATCH_SIZE * 2];
+		for(unsigned int i=0;i<(ZT_PHY_UDP_BATCH_SIZE * 2);++i) {
+			dgrams[i].addr = (const struct sockaddr *)&bindaddr;
+			dgrams[i].data = udpTestPayload;
+			dgrams[i].len = sizeof(udpTestPayload);
+		}
+		const unsigned long expected = phyTestUdpPacketCount + (ZT_PHY_UDP_BATCH_SIZE * 2);
+		if (testPhyInstance->udpSendBatch(udpListenSock,dgrams,ZT_PHY_UDP_BATCH_SIZE * 2) != (ZT_PHY_UDP_BATCH_SIZE * 2)) {
+			std::cout << "FAILED (send)." << std::endl;
+			return -1;
+		}
+		timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
+		while ((OSUtils::now() < timeoutAt)&&(phyTestUdpPacketCount < expected))
+			testPhyInstance->poll(100);
+		if (phyTestUdpPacketCount != expected) {
+			std::cout << "FAILED (receive)." << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "OK" << std::endl;
+
 	std::cout << "[phy] Testing TCP... "; std::cout.flush();
 	timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
 	while ((OSUtils::now() < timeoutAt)&&(phyTestTcpByteCount < (ZT_TEST_PHY_NUM_VALID_TCP_CONNECTS * ZT_TEST_PHY_TCP_MESSAGE_SIZE))) {
@@ -69,22 +69,26 @@ public:
 		std::vector<std::string> lines(Utils::split(cf.c_str(),"\r\n","",""));
 		for(std::vector<std::string>::iterator l(lines.begin());l!=lines.end();++l) {
 			std::vector<std::string> fields(Utils::split(l->c_str()," \t","",""));
-			if ((fields.size() < 5)||(fields[0][0] == '#')||(fields[0] != myAddressStr))
+			if ((fields.size() < 3)||(fields[0][0] == '#')||(fields[0] != myAddressStr))
 				continue;
 
 			// <address> geo <CSV path> <ip start column> <ip end column> <latitutde column> <longitude column>
+			// <address> geo <compiled index path>
 			if (fields[1] == "geo") {
-				if ((fields.size() >= 7)&&(OSUtils::fileExists(fields[2].c_str()))) {
-					int ipStartColumn = Utils::strToInt(fields[3].c_str());
-					int ipEndColumn = Utils::strToInt(fields[4].c_str());
-					int latitudeColumn = Utils::strToInt(fields[5].c_str());
-					int longitudeColumn = Utils::strToInt(fields[6].c_str());
+				if (OSUtils::fileExists(fields[2].c_str())) {
+					int ipStartColumn = (fields.size() > 3) ? Utils::strToInt(fields[3].c_str()) : -1;
+					int ipEndColumn = (fields.size() > 4) ? Utils::strToInt(fields[4].c_str()) : -1;
+					int latitudeColumn = (fields.size() > 5) ? Utils::strToInt(fields[5].c_str()) : -1;
+					int longitudeColumn = (fields.size() > 6) ? Utils::strToInt(fields[6].c_str()) : -1;
 					if (_geo.load(fields[2].c_str(),ipStartColumn,ipEndColumn,latitudeColumn,longitudeColumn) <= 0)
 						throw std::runtime_error(std::string("failed to load geo-ip data from ")+fields[2]);
 				}
 				continue;
 			}
 
+			if (fields.size() < 5)
+				continue;
+
 			// <address> <ID> <name> <backplane IP/port(s)> <ZT frontplane IP/port(s)> <x,y,z>
 			int id = Utils::strToUInt(fields[1].c_str());
 			if ((id < 0)||(id > ZT_CLUSTER_MAX_MEMBERS))
@@ -19,6 +19,14 @@
 #ifdef ZT_ENABLE_CLUSTER
 
 #include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#ifndef __WINDOWS__
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 
 #include <cmath>
 
@@ -29,76 +37,274 @@
 
 #define ZT_CLUSTERGEOIPSERVICE_FILE_MODIFICATION_CHECK_EVERY 10000
 
+#define ZT_CLUSTERGEOIPSERVICE_HEADER_SIZE 32
+#define ZT_CLUSTERGEOIPSERVICE_TABLE_SIZE ((65537 * 4) + 4)
+
 namespace ZeroTier {
 
+static inline void _geoIpMemoryBarrier() throw()
+{
+#ifdef __GNUC__
+	__sync_synchronize();
+#else
+#ifdef __WINDOWS__
+	MemoryBarrier();
+#endif
+#endif
+}
+
+ClusterGeoIpService::_Db::_Db() :
+	v4Table((const uint32_t *)0),
+	v4((const _V4E *)0),
+	v4Count(0),
+	v6Table((const uint32_t *)0),
+	v6((const _V6E *)0),
+	v6Count(0),
+	_data((void *)0),
+	_size(0),
+	_mapped(false)
+{
+}
+
+ClusterGeoIpService::_Db::~_Db()
+{
+	if (_data) {
+#ifndef __WINDOWS__
+		if (_mapped) {
+			munmap(_data,_size);
+			return;
+		}
+#endif
+		::free(_data);
+	}
+}
+
+bool ClusterGeoIpService::_Db::attach(const char *path)
+{
+#ifdef __WINDOWS__
+	std::string buf;
+	if ((!OSUtils::readFile(path,buf))||(buf.length() == 0))
+		return false;
+	void *const d = ::malloc(buf.length());
+	if (!d)
+		return false;
+	memcpy(d,buf.data(),buf.length());
+	return attach(d,(unsigned long)buf.length());
+#else
+	const int fd = ::open(path,O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if ((fstat(fd,&st) != 0)||(st.st_size <= 0)) {
+		::close(fd);
+		return false;
+	}
+	void *const d = mmap((void *)0,(size_t)st.st_size,PROT_READ,MAP_SHARED,fd,0);
+	::close(fd);
+	if (d == MAP_FAILED)
+		return false;
+	_data = d;
+	_size = (unsigned long)st.st_size;
+	_mapped = true;
+	return _parse();
+#endif
+}
+
+bool ClusterGeoIpService::_Db::attach(void *buf,unsigned long len)
+{
+	_data = buf;
+	_size = len;
+	_mapped = false;
+	return _parse();
+}
+
+bool ClusterGeoIpService::_Db::_parse()
+{
+	const uint8_t *const d = reinterpret_cast<const uint8_t *>(_data);
+	if ((_size < (ZT_CLUSTERGEOIPSERVICE_HEADER_SIZE + (ZT_CLUSTERGEOIPSERVICE_TABLE_SIZE * 2)))||(memcmp(d,ZT_CLUSTERGEOIPSERVICE_INDEX_MAGIC,8) != 0))
+		return false;
+
+	const uint32_t n4 = Utils::ntoh(*reinterpret_cast<const uint32_t *>(d + 8));
+	const uint32_t n6 = Utils::ntoh(*reinterpret_cast<const uint32_t *>(d + 12));
+	if (((uint64_t)ZT_CLUSTERGEOIPSERVICE_HEADER_SIZE + (ZT_CLUSTERGEOIPSERVICE_TABLE_SIZE * 2) + ((uint64_t)n4 * sizeof(_V4E)) + ((uint64_t)n6 * sizeof(_V6E))) != (uint64_t)_size)
+		return false;
+
+	unsigned long ptr = ZT_CLUSTERGEOIPSERVICE_HEADER_SIZE;
+	v4Table = reinterpret_cast<const uint32_t *>(d + ptr);
+	ptr += ZT_CLUSTERGEOIPSERVICE_TABLE_SIZE;
+	v4 = reinterpret_cast<const _V4E *>(d + ptr);
+	ptr += n4 * sizeof(_V4E);
+	v6Table = reinterpret_cast<const uint32_t *>(d + ptr);
+	ptr += ZT_CLUSTERGEOIPSERVICE_TABLE_SIZE;
+	v6 = reinterpret_cast<const _V6E *>(d + ptr);
+
+	// Tables must be in bounds since lookups trust them
+	uint32_t p4 = 0,p6 = 0;
+	for(unsigned int k=0;k<65537;++k) {
+		const uint32_t t4 = Utils::ntoh(v4Table[k]);
+		const uint32_t t6 = Utils::ntoh(v6Table[k]);
+		if ((t4 < p4)||(t4 > n4)||(t6 < p6)||(t6 > n6))
+			return false;
+		p4 = t4;
+		p6 = t6;
+	}
+	if ((p4 != n4)||(p6 != n6))
+		return false;
+
+	v4Count = n4;
+	v6Count = n6;
+	return true;
+}
+
 ClusterGeoIpService::ClusterGeoIpService() :
-	_pathToCsv(),
+	_path(),
 	_ipStartColumn(-1),
 	_ipEndColumn(-1),
 	_latitudeColumn(-1),
 	_longitudeColumn(-1),
-	_lastFileCheckTime(0),
-	_csvModificationTime(0),
-	_csvFileSize(0)
+	_modificationTime(0),
+	_fileSize(0),
+	_generation(0),
+	_run(true),
+	_threadStarted(false)
 {
+	_db[0] = (_Db *)0;
+	_db[1] = (_Db *)0;
 }
 
 ClusterGeoIpService::~ClusterGeoIpService()
 {
+	_run = false;
+	if (_threadStarted)
+		Thread::join(_thread);
+	delete _db[0];
+	delete _db[1];
 }
 
-bool ClusterGeoIpService::locate(const InetAddress &ip,int &x,int &y,int &z)
+long ClusterGeoIpService::load(const char *path,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn)
 {
 	Mutex::Lock _l(_lock);
+	const long n = _load(path,ipStartColumn,ipEndColumn,latitudeColumn,longitudeColumn);
+	if ((n > 0)&&(!_threadStarted)) {
+		_thread = Thread::start(this);
+		_threadStarted = true;
+	}
+	return n;
+}
+
+long ClusterGeoIpService::compile(const char *pathToCsv,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn,const char *pathToIndex)
+{
+	std::vector<_V4E> v4db;
+	std::vector<_V6E> v6db;
+	if (!_readCsv(pathToCsv,ipStartColumn,ipEndColumn,latitudeColumn,longitudeColumn,v4db,v6db))
+		return -1;
+
+	unsigned long len = 0;
+	void *const idx = _buildIndex(v4db,v6db,len);
+	if (!idx)
+		return -1;
 
-	if ((_pathToCsv.length() > 0)&&((OSUtils::now() - _lastFileCheckTime) > ZT_CLUSTERGEOIPSERVICE_FILE_MODIFICATION_CHECK_EVERY)) {
-		_lastFileCheckTime = OSUtils::now();
-		if ((_csvFileSize != OSUtils::getFileSize(_pathToCsv.c_str()))||(_csvModificationTime != OSUtils::getLastModified(_pathToCsv.c_str())))
-			_load(_pathToCsv.c_str(),_ipStartColumn,_ipEndColumn,_latitudeColumn,_longitudeColumn);
-	}
-
-	/* We search by looking up the upper bound of the sorted vXdb vectors
-	 * and then iterating down for a matching IP range. We stop when we hit
-	 * the beginning or an entry whose start and end are before the IP we
-	 * are searching. */
-
-	if ((ip.ss_family == AF_INET)&&(_v4db.size() > 0)) {
-		_V4E key;
-		key.start = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&ip)->sin_addr.s_addr));
-		std::vector<_V4E>::const_iterator i(std::upper_bound(_v4db.begin(),_v4db.end(),key));
-		while (i != _v4db.begin()) {
-			--i;
-			if ((key.start >= i->start)&&(key.start <= i->end)) {
-				x = i->x;
-				y = i->y;
-				z = i->z;
-				//printf("%s : %f,%f %d,%d,%d\n",ip.toIpString().c_str(),i->lat,i->lon,x,y,z);
+	// Written beside the target and renamed over it, since running services may have the old one mapped
+	const std::string tmp(std::string(pathToIndex) + ".tmp");
+	FILE *f = fopen(tmp.c_str(),"wb");
+	if (!f) {
+		::free(idx);
+		return -1;
+	}
+	const bool ok = (fwrite(idx,len,1,f) == 1);
+	fclose(f);
+	::free(idx);
+	if (ok) {
+#ifdef __WINDOWS__
+		OSUtils::rm(pathToIndex);
+#endif
+		if (::rename(tmp.c_str(),pathToIndex) == 0)
+			return (long)(v4db.size() + v6db.size());
+	}
+	OSUtils::rm(tmp.c_str());
+	return -1;
+}
+
+bool ClusterGeoIpService::locate(const InetAddress &ip,int &x,int &y,int &z) const
+{
+	_DbReader _r(*this);
+	const _Db *const db = _r.db();
+	if (!db)
+		return false;
+
+	/* The table gives the range of entries that start within the IP's /16
+	 * (or first 16 bits for IPv6). We search that for the last entry that
+	 * starts at or before the IP, which may be the one just before the range
+	 * if the IP is covered by an entry that starts in an earlier block. */
+
+	if ((ip.ss_family == AF_INET)&&(db->v4Count > 0)) {
+		const uint32_t a = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&ip)->sin_addr.s_addr));
+		const unsigned int k = (unsigned int)(a >> 16);
+		uint32_t lo = Utils::ntoh(db->v4Table[k]);
+		uint32_t hi = Utils::ntoh(db->v4Table[k + 1]);
+		while (lo < hi) {
+			const uint32_t mid = lo + ((hi - lo) / 2);
+			if (Utils::ntoh(db->v4[mid].start) <= a)
+				lo = mid + 1;
+			else hi = mid;
+		}
+		if (lo) {
+			const _V4E &e = db->v4[lo - 1];
+			if (a <= Utils::ntoh(e.end)) {
+				x = (int16_t)Utils::ntoh((uint16_t)e.x);
+				y = (int16_t)Utils::ntoh((uint16_t)e.y);
+				z = (int16_t)Utils::ntoh((uint16_t)e.z);
 				return true;
-			} else if ((key.start > i->start)&&(key.start > i->end))
-				break;
-		}
-	} else if ((ip.ss_family == AF_INET6)&&(_v6db.size() > 0)) {
-		_V6E key;
-		memcpy(key.start,reinterpret_cast<const struct sockaddr_in6 *>(&ip)->sin6_addr.s6_addr,16);
-		std::vector<_V6E>::const_iterator i(std::upper_bound(_v6db.begin(),_v6db.end(),key));
-		while (i != _v6db.begin()) {
-			--i;
-			const int s_vs_s = memcmp(key.start,i->start,16);
-			const int s_vs_e = memcmp(key.start,i->end,16);
-			if ((s_vs_s >= 0)&&(s_vs_e <= 0)) {
-				x = i->x;
-				y = i->y;
-				z = i->z;
-				//printf("%s : %f,%f %d,%d,%d\n",ip.toIpString().c_str(),i->lat,i->lon,x,y,z);
+			}
+		}
+	} else if ((ip.ss_family == AF_INET6)&&(db->v6Count > 0)) {
+		const uint8_t *const a = reinterpret_cast<const struct sockaddr_in6 *>(&ip)->sin6_addr.s6_addr;
+		const unsigned int k = ((unsigned int)a[0] << 8) | (unsigned int)a[1];
+		uint32_t lo = Utils::ntoh(db->v6Table[k]);
+		uint32_t hi = Utils::ntoh(db->v6Table[k + 1]);
+		while (lo < hi) {
+			const uint32_t mid = lo + ((hi - lo) / 2);
+			if (memcmp(db->v6[mid].start,a,16) <= 0)
+				lo = mid + 1;
+			else hi = mid;
+		}
+		if (lo) {
+			const _V6E &e = db->v6[lo - 1];
+			if (memcmp(a,e.end,16) <= 0) {
+				x = (int16_t)Utils::ntoh((uint16_t)e.x);
+				y = (int16_t)Utils::ntoh((uint16_t)e.y);
+				z = (int16_t)Utils::ntoh((uint16_t)e.z);
 				return true;
-			} else if ((s_vs_s > 0)&&(s_vs_e > 0))
-				break;
+			}
 		}
 	}
 
 	return false;
 }
 
+bool ClusterGeoIpService::available() const
+{
+	_DbReader _r(*this);
+	const _Db *const db = _r.db();
+	return ((db)&&((db->v4Count + db->v6Count) > 0));
+}
+
+void ClusterGeoIpService::threadMain()
+	throw()
+{
+	while (_run) {
+		for(unsigned long t=0;((_run)&&(t<ZT_CLUSTERGEOIPSERVICE_FILE_MODIFICATION_CHECK_EVERY));t+=250)
+			Thread::sleep(250);
+		if (!_run)
+			break;
+		try {
+			Mutex::Lock _l(_lock);
+			if ((_path.length() > 0)&&((_fileSize != OSUtils::getFileSize(_path.c_str()))||(_modificationTime != OSUtils::getLastModified(_path.c_str()))))
+				_load(_path.c_str(),_ipStartColumn,_ipEndColumn,_latitudeColumn,_longitudeColumn);
+		} catch ( ... ) {}
+	}
+}
+
 void ClusterGeoIpService::_parseLine(const char *line,std::vector<_V4E> &v4db,std::vector<_V6E> &v6db,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn)
 {
 	std::vector<std::string> ls(Utils::split(line,",\t","\\","\"'"));
@@ -123,39 +329,34 @@ void ClusterGeoIpService::_parseLine(const char *line,std::vector<_V4E> &v4db,st
 				v4db.push_back(_V4E());
 				v4db.back().start = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&ipStart)->sin_addr.s_addr));
 				v4db.back().end = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&ipEnd)->sin_addr.s_addr));
-				v4db.back().lat = (float)lat;
-				v4db.back().lon = (float)lon;
 				v4db.back().x = x;
 				v4db.back().y = y;
 				v4db.back().z = z;
+				v4db.back().reserved = 0;
+				if (v4db.back().end < v4db.back().start)
+					v4db.pop_back();
 				//printf("%s - %s : %d,%d,%d\n",ipStart.toIpString().c_str(),ipEnd.toIpString().c_str(),x,y,z);
 			} else if (ipStart.ss_family == AF_INET6) {
 				v6db.push_back(_V6E());
 				memcpy(v6db.back().start,reinterpret_cast<const struct sockaddr_in6 *>(&ipStart)->sin6_addr.s6_addr,16);
 				memcpy(v6db.back().end,reinterpret_cast<const struct sockaddr_in6 *>(&ipEnd)->sin6_addr.s6_addr,16);
-				v6db.back().lat = (float)lat;
-				v6db.back().lon = (float)lon;
 				v6db.back().x = x;
 				v6db.back().y = y;
 				v6db.back().z = z;
+				v6db.back().reserved = 0;
+				if (memcmp(v6db.back().end,v6db.back().start,16) < 0)
+					v6db.pop_back();
 				//printf("%s - %s : %d,%d,%d\n",ipStart.toIpString().c_str(),ipEnd.toIpString().c_str(),x,y,z);
 			}
 		}
 	}
 }
 
-long ClusterGeoIpService::_load(const char *pathToCsv,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn)
+bool ClusterGeoIpService::_readCsv(const char *pathToCsv,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn,std::vector<_V4E> &v4db,std::vector<_V6E> &v6db)
 {
-	// assumes _lock is locked
-
 	FILE *f = fopen(pathToCsv,"rb");
 	if (!f)
-		return -1;
-
-	std::vector<_V4E> v4db;
-	std::vector<_V6E> v6db;
-	v4db.reserve(16777216);
-	v6db.reserve(16777216);
+		return false;
 
 	char buf[4096];
 	char linebuf[1024];
@@ -171,7 +372,7 @@ long ClusterGeoIpService::_load(const char *pathToCsv,int ipStartColumn,int ipEn
 					_parseLine(linebuf,v4db,v6db,ipStartColumn,ipEndColumn,latitudeColumn,longitudeColumn);
 				}
 				lineptr = 0;
-			} else if (lineptr < (unsigned int)sizeof(linebuf))
+			} else if (lineptr < (unsigned int)(sizeof(linebuf) - 1))
 				linebuf[lineptr++] = buf[i];
 		}
 	}
@@ -182,27 +383,166 @@ long ClusterGeoIpService::_load(const char *pathToCsv,int ipStartColumn,int ipEn
 
 	fclose(f);
 
-	if ((v4db.size() > 0)||(v6db.size() > 0)) {
-		std::sort(v4db.begin(),v4db.end());
-		std::sort(v6db.begin(),v6db.end());
+	// Sort by start and trim overlaps so that ranges can be binary searched
+	std::stable_sort(v4db.begin(),v4db.end());
+	std::stable_sort(v6db.begin(),v6db.end());
+	{
+		std::vector<_V4E> tmp;
+		tmp.reserve(v4db.size());
+		for(std::vector<_V4E>::const_iterator e(v4db.begin());e!=v4db.end();++e) {
+			if ((!tmp.empty())&&(e->start <= tmp.back().end)) {
+				if (e->start == tmp.back().start)
+					tmp.pop_back();
+				else tmp.back().end = e->start - 1;
+			}
+			tmp.push_back(*e);
+		}
+		v4db.swap(tmp);
+	}
+	{
+		std::vector<_V6E> tmp;
+		tmp.reserve(v6db.size());
+		for(std::vector<_V6E>::const_iterator e(v6db.begin());e!=v6db.end();++e) {
+			if ((!tmp.empty())&&(memcmp(e->start,tmp.back().end,16) <= 0)) {
+				if (memcmp(e->start,tmp.back().start,16) == 0) {
+					tmp.pop_back();
+				} else {
+					memcpy(tmp.back().end,e->start,16);
+					for(int i=15;i>=0;--i) { // end = start - 1
+						if (tmp.back().end[i]--)
+							break;
+					}
+				}
+			}
+			tmp.push_back(*e);
+		}
+		v6db.swap(tmp);
+	}
 
-		_pathToCsv = pathToCsv;
-		_ipStartColumn = ipStartColumn;
-		_ipEndColumn = ipEndColumn;
-		_latitudeColumn = latitudeColumn;
-		_longitudeColumn = longitudeColumn;
+	return true;
+}
 
-		_lastFileCheckTime = OSUtils::now();
-		_csvModificationTime = OSUtils::getLastModified(pathToCsv);
-		_csvFileSize = OSUtils::getFileSize(pathToCsv);
+void *ClusterGeoIpService::_buildIndex(const std::vector<_V4E> &v4db,const std::vector<_V6E> &v6db,unsigned long &len)
+{
+	len = ZT_CLUSTERGEOIPSERVICE_HEADER_SIZE + (ZT_CLUSTERGEOIPSERVICE_TABLE_SIZE * 2) + (unsigned long)(v4db.size() * sizeof(_V4E)) + (unsigned long)(v6db.size() * sizeof(_V6E));
+	uint8_t *const d = reinterpret_cast<uint8_t *>(::malloc(len));
+	if (!d)
+		return (void *)0;
+	memset(d,0,ZT_CLUSTERGEOIPSERVICE_HEADER_SIZE);
+	memcpy(d,ZT_CLUSTERGEOIPSERVICE_INDEX_MAGIC,8);
+	*reinterpret_cast<uint32_t *>(d + 8) = Utils::hton((uint32_t)v4db.size());
+	*reinterpret_cast<uint32_t *>(d + 12) = Utils::hton((uint32_t)v6db.size());
+
+	uint8_t *p = d + ZT_CLUSTERGEOIPSERVICE_HEADER_SIZE;
+	{
+		uint32_t *const t = reinterpret_cast<uint32_t *>(p);
+		unsigned long i = 0;
+		for(unsigned int k=0;k<65537;++k) {
+			while ((i < v4db.size())&&((uint64_t)v4db[i].start < ((uint64_t)k << 16)))
+				++i;
+			t[k] = Utils::hton((uint32_t)i);
+		}
+		t[65537] = 0; // pad
+		p += ZT_CLUSTERGEOIPSERVICE_TABLE_SIZE;
+
+		_V4E *const e = reinterpret_cast<_V4E *>(p);
+		for(unsigned long j=0;j<v4db.size();++j) {
+			e[j].start = Utils::hton(v4db[j].start);
+			e[j].end = Utils::hton(v4db[j].end);
+			e[j].x = (int16_t)Utils::hton((uint16_t)v4db[j].x);
+			e[j].y = (int16_t)Utils::hton((uint16_t)v4db[j].y);
+			e[j].z = (int16_t)Utils::hton((uint16_t)v4db[j].z);
+			e[j].reserved = 0;
+		}
+		p += v4db.size() * sizeof(_V4E);
+	}
+	{
+		uint32_t *const t = reinterpret_cast<uint32_t *>(p);
+		unsigned long i = 0;
+		for(unsigned int k=0;k<65537;++k) {
+			while ((i < v6db.size())&&((((unsigned int)v6db[i].start[0] << 8) | (unsigned int)v6db[i].start[1]) < k))
+				++i;
+			t[k] = Utils::hton((uint32_t)i);
+		}
+		t[65537] = 0; // pad
+		p += ZT_CLUSTERGEOIPSERVICE_TABLE_SIZE;
+
+		_V6E *const e = reinterpret_cast<_V6E *>(p);
+		for(unsigned long j=0;j<v6db.size();++j) {
+			memcpy(e[j].start,v6db[j].start,16);
+			memcpy(e[j].end,v6db[j].end,16);
+			e[j].x = (int16_t)Utils::hton((uint16_t)v6db[j].x);
+			e[j].y = (int16_t)Utils::hton((uint16_t)v6db[j].y);
+			e[j].z = (int16_t)Utils::hton((uint16_t)v6db[j].z);
+			e[j].reserved = 0;
+		}
+	}
 
-		_v4db.swap(v4db);
-		_v6db.swap(v6db);
+	return d;
+}
 
-		return (long)(_v4db.size() + _v6db.size());
+long ClusterGeoIpService::_load(const char *path,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn)
+{
+	// assumes _lock is locked
+
+	bool isIndex = false;
+	{
+		FILE *f = fopen(path,"rb");
+		if (!f)
+			return -1;
+		char magic[8];
+		isIndex = ((fread(magic,1,8,f) == 8)&&(!memcmp(magic,ZT_CLUSTERGEOIPSERVICE_INDEX_MAGIC,8)));
+		fclose(f);
+	}
+
+	// Size and time are taken first so a change during loading is picked up next check
+	const uint64_t modificationTime = OSUtils::getLastModified(path);
+	const int64_t fileSize = OSUtils::getFileSize(path);
+
+	_Db *ndb = new _Db();
+	if (isIndex) {
+		if (!ndb->attach(path)) {
+			delete ndb;
+			return -1;
+		}
 	} else {
+		std::vector<_V4E> v4db;
+		std::vector<_V6E> v6db;
+		unsigned long len = 0;
+		void *idx = (void *)0;
+		if ((!_readCsv(path,ipStartColumn,ipEndColumn,latitudeColumn,longitudeColumn,v4db,v6db))||(!(idx = _buildIndex(v4db,v6db,len)))||(!ndb->attach(idx,len))) {
+			delete ndb;
+			return -1;
+		}
+	}
+
+	const long count = (long)(ndb->v4Count + ndb->v6Count);
+	if (count <= 0) {
+		delete ndb;
 		return 0;
 	}
+
+	_path = path;
+	_ipStartColumn = ipStartColumn;
+	_ipEndColumn = ipEndColumn;
+	_latitudeColumn = latitudeColumn;
+	_longitudeColumn = longitudeColumn;
+	_modificationTime = modificationTime;
+	_fileSize = fileSize;
+
+	// Publish the new database in the unused slot, then wait for lookups
+	// still using the old one to finish before freeing it.
+	const unsigned int g = _generation;
+	_db[(g + 1) & 1] = ndb;
+	_geoIpMemoryBarrier();
+	_generation = g + 1;
+	_geoIpMemoryBarrier();
+	while ((int)_readers[g & 1] != 0)
+		Thread::sleep(1);
+	delete _db[g & 1];
+	_db[g & 1] = (_Db *)0;
+
+	return count;
 }
 
 } // namespace ZeroTier
@@ -34,18 +34,33 @@
 #include "../node/Mutex.hpp"
 #include "../node/NonCopyable.hpp"
 #include "../node/InetAddress.hpp"
+#include "../node/AtomicCounter.hpp"
+#include "../osdep/Thread.hpp"
+
+/**
+ * First eight bytes of a compiled geo-IP index file
+ */
+#define ZT_CLUSTERGEOIPSERVICE_INDEX_MAGIC "ZTGEOIP1"
 
 namespace ZeroTier {
 
 /**
- * Loads a GeoIP CSV into memory for fast lookup, reloading as needed
+ * Geo-IP database for fast lookup, reloaded in the background as needed
  *
  * This was designed around the CSV from https://db-ip.com but can be used
  * with any similar GeoIP CSV database that is presented in the form of an
  * IP range and lat/long coordinates.
  *
- * It loads the whole database into memory, which can be kind of large. If
- * the CSV file changes, the changes are loaded automatically.
+ * A CSV can be loaded directly, or first turned into a compact binary index
+ * with compile() (see geoip/mkgeoip.cpp) which is then memory mapped. In
+ * memory the two look the same: ranges sorted by start address with a table
+ * of where each /16 (or IPv6 first 16 bits) begins, so a lookup is one table
+ * read and a binary search over a few entries.
+ *
+ * Lookups don't take any locks. If the file changes it's reloaded by a
+ * background thread and the new database replaces the old one in a single
+ * pointer swap, so lookups carry on against the old one while a big CSV is
+ * parsed.
  */
 class ClusterGeoIpService : NonCopyable
 {
@@ -54,24 +69,37 @@ public:
 	~ClusterGeoIpService();
 
 	/**
-	 * Load or reload CSV file
+	 * Load or reload a CSV file or compiled index
 	 *
 	 * CSV column indexes start at zero. CSVs can be quoted with single or
 	 * double quotes. Whitespace before or after commas is ignored. Backslash
-	 * may be used for escaping whitespace as well.
+	 * may be used for escaping whitespace as well. Columns are ignored if the
+	 * file is a compiled index.
 	 *
-	 * @param pathToCsv Path to (uncompressed) CSV file
+	 * @param path Path to (uncompressed) CSV file or compiled index
 	 * @param ipStartColumn Column with IP range start
 	 * @param ipEndColumn Column with IP range end (inclusive)
 	 * @param latitudeColumn Column with latitude
 	 * @param longitudeColumn Column with longitude
 	 * @return Number of valid records loaded or -1 on error (invalid file, not found, etc.)
 	 */
-	inline long load(const char *pathToCsv,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn)
-	{
-		Mutex::Lock _l(_lock);
-		return _load(pathToCsv,ipStartColumn,ipEndColumn,latitudeColumn,longitudeColumn);
-	}
+	long load(const char *path,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn);
+
+	/**
+	 * Build a compiled index from a CSV file
+	 *
+	 * Overlapping ranges are trimmed so that within the overlap the range
+	 * that starts later wins.
+	 *
+	 * @param pathToCsv Path to (uncompressed) CSV file
+	 * @param ipStartColumn Column with IP range start
+	 * @param ipEndColumn Column with IP range end (inclusive)
+	 * @param latitudeColumn Column with latitude
+	 * @param longitudeColumn Column with longitude
+	 * @param pathToIndex Path to write index to
+	 * @return Number of records written or -1 on error
+	 */
+	static long compile(const char *pathToCsv,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn,const char *pathToIndex);
 
 	/**
 	 * Attempt to locate an IP
@@ -85,55 +113,126 @@ public:
 	 * @param z Reference to variable to receive Z
 	 * @return True if coordinates were set
 	 */
-	bool locate(const InetAddress &ip,int &x,int &y,int &z);
+	bool locate(const InetAddress &ip,int &x,int &y,int &z) const;
 
 	/**
 	 * @return True if IP database/service is available for queries (otherwise locate() will always be false)
 	 */
-	inline bool available() const
-	{
-		Mutex::Lock _l(_lock);
-		return ((_v4db.size() + _v6db.size()) > 0);
-	}
+	bool available() const;
+
+	/**
+	 * Background reload loop (started by first successful load())
+	 */
+	void threadMain()
+		throw();
 
 private:
+	// Index file and in-memory layout, all integers big-endian:
+	//   <[8] ZT_CLUSTERGEOIPSERVICE_INDEX_MAGIC>
+	//   <[4] number of IPv4 ranges>
+	//   <[4] number of IPv6 ranges>
+	//   <[16] reserved, zero>
+	//   <[4 * 65537] IPv4 /16 table> <[4] pad> <[16 * n] IPv4 ranges>
+	//   <[4 * 65537] IPv6 /16 table> <[4] pad> <[40 * n] IPv6 ranges>
+	// Table entry k is the number of ranges that start before k << 16 (or
+	// k << 112), and entry 65536 is the total.
+
 	struct _V4E
 	{
 		uint32_t start;
 		uint32_t end;
-		float lat,lon;
 		int16_t x,y,z;
+		int16_t reserved;
 
-		inline bool operator<(const _V4E &e) const { return (start < e.start); }
+		inline bool operator<(const _V4E &e) const { return (start < e.start); } // host byte order only
 	};
 
 	struct _V6E
 	{
 		uint8_t start[16];
 		uint8_t end[16];
-		float lat,lon;
 		int16_t x,y,z;
+		int16_t reserved;
 
 		inline bool operator<(const _V6E &e) const { return (memcmp(start,e.start,16) < 0); }
 	};
 
+	// A loaded database, either mapped from an index file or built in memory from a CSV
+	class _Db : NonCopyable
+	{
+	public:
+		_Db();
+		~_Db();
+
+		bool attach(const char *path);
+		bool attach(void *buf,unsigned long len); // takes ownership of buf (malloc'd)
+
+		const uint32_t *v4Table;
+		const _V4E *v4;
+		uint32_t v4Count;
+		const uint32_t *v6Table;
+		const _V6E *v6;
+		uint32_t v6Count;
+
+	private:
+		bool _parse();
+
+		void *_data;
+		unsigned long _size;
+		bool _mapped;
+	};
+
+	// Marks a lock-free read of the current database for the life of this object
+	class _DbReader : NonCopyable
+	{
+	public:
+		_DbReader(const ClusterGeoIpService &s) throw() :
+			_s(s)
+		{
+			for(;;) {
+				const unsigned int g = _s._generation;
+				++_s._readers[g & 1];
+				if (_s._generation == g) {
+					_slot = g & 1;
+					break;
+				}
+				--_s._readers[g & 1]; // raced with a reload, try again
+			}
+		}
+		~_DbReader() { --_s._readers[_slot]; }
+		inline const _Db *db() const throw() { return _s._db[_slot]; }
+	private:
+		const ClusterGeoIpService &_s;
+		unsigned int _slot;
+	};
+
+	// CSV ranges are parsed in host byte order, then converted by _buildIndex()
 	static void _parseLine(const char *line,std::vector<_V4E> &v4db,std::vector<_V6E> &v6db,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn);
-	long _load(const char *pathToCsv,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn);
+	static bool _readCsv(const char *pathToCsv,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn,std::vector<_V4E> &v4db,std::vector<_V6E> &v6db);
+	static void *_buildIndex(const std::vector<_V4E> &v4db,const std::vector<_V6E> &v6db,unsigned long &len);
+	long _load(const char *path,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn);
 
-	std::string _pathToCsv;
+	// Guards everything below except _db, _generation and _readers, and serializes reloads
+	Mutex _lock;
+
+	std::string _path;
 	int _ipStartColumn;
 	int _ipEndColumn;
 	int _latitudeColumn;
 	int _longitudeColumn;
 
-	uint64_t _lastFileCheckTime;
-	uint64_t _csvModificationTime;
-	int64_t _csvFileSize;
+	uint64_t _modificationTime;
+	int64_t _fileSize;
 
-	std::vector<_V4E> _v4db;
-	std::vector<_V6E> _v6db;
+	// The current database is _db[_generation & 1]. A reload replaces the
+	// other slot, which is only freed once nobody is still reading it.
+	_Db *volatile _db[2];
+	volatile unsigned int _generation;
+	mutable AtomicCounter _readers[2];
 
-	Mutex _lock;
+	Thread _thread;
+	volatile bool _run;
+	bool _threadStarted;
 };
 
 } // namespace ZeroTier
@@ -408,6 +408,8 @@ unsigned int ControlPlane::handleRequest(
 					"\t\"versionRev\": %d,\n"
 					"\t\"version\": \"%d.%d.%d\",\n"
 					"\t\"clock\": %llu,\n"
+					"\t\"deferredPacketsQueued\": %lu,\n"
+					"\t\"deferredPacketsDropped\": %lu,\n"
 					"\t\"cluster\": %s\n"
 					"}\n",
 					status.address,
@@ -421,6 +423,8 @@ unsigned int ControlPlane::handleRequest(
 					ZEROTIER_ONE_VERSION_REVISION,
 					ZEROTIER_ONE_VERSION_MAJOR,ZEROTIER_ONE_VERSION_MINOR,ZEROTIER_ONE_VERSION_REVISION,
 					(unsigned long long)OSUtils::now(),
+					status.deferredPacketsQueued,
+					status.deferredPacketsDropped,
 					((clusterJson.length() > 0) ? clusterJson.c_str() : "null"));
 				responseBody = json;
 				scode = 200;
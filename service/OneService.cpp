@@ -39,7 +39,9 @@
 
 #include "../node/Constants.hpp"
 #include "../node/Mutex.hpp"
+#include "../node/BinarySemaphore.hpp"
 #include "../node/Node.hpp"
+#include "../node/Packet.hpp"
 #include "../node/Utils.hpp"
 #include "../node/InetAddress.hpp"
 #include "../node/MAC.hpp"
@@ -144,6 +146,18 @@ namespace ZeroTier { typedef BSDEthernetTap EthernetTap; }
 // How often to check for local interface addresses
 #define ZT_LOCAL_INTERFACE_CHECK_INTERVAL 60000
 
+// Maximum number of outgoing UDP packets to hold while processing a received batch
+#define ZT_UDP_SEND_QUEUE_SIZE 64
+
+// Maximum number of packet worker threads
+#define ZT_MAX_PACKET_WORKERS 64
+
+// Maximum number of background threads for deferred packets
+#define ZT_MAX_DEFERRED_PACKET_WORKERS 64
+
+// Received packets each packet worker can have waiting before more are dropped
+#define ZT_PACKET_WORKER_QUEUE_SIZE 256
+
 namespace ZeroTier {
 
 namespace {
@@ -480,6 +494,64 @@ struct TcpConnection
 // Used to pseudo-randomize local source port picking
 static volatile unsigned int _udpPortPickerCounter = 0;
 
+#ifdef __WINDOWS__
+#define ZT_ONE_SERVICE_TLS __declspec(thread)
+#else
+#define ZT_ONE_SERVICE_TLS __thread
+#endif
+
+// Service whose UDP send queue is being filled by this thread, if any
+static ZT_ONE_SERVICE_TLS OneServiceImpl *_udpSendQueueOwner = (OneServiceImpl *)0;
+
+// A packet processing thread and its queue of received UDP packets
+struct PacketWorker
+{
+	PacketWorker() : parent((OneServiceImpl *)0),head(0),count(0),run(true),thread() {}
+
+	// Queues a filled node packet buffer, returns false if queue is full (caller still owns buffer)
+	inline bool enqueue(const struct sockaddr *localAddr,const struct sockaddr *from,void *buf,unsigned int len)
+	{
+		bool wasEmpty;
+		{
+			Mutex::Lock _l(lock);
+			if (count >= ZT_PACKET_WORKER_QUEUE_SIZE)
+				return false;
+			Datagram &d = q[(head + count) % ZT_PACKET_WORKER_QUEUE_SIZE];
+			memcpy(&(d.localAddr),localAddr,sizeof(struct sockaddr_storage));
+			memcpy(&(d.from),from,sizeof(struct sockaddr_storage));
+			d.buf = buf;
+			d.len = len;
+			wasEmpty = (count++ == 0);
+		}
+		if (wasEmpty)
+			wake.post();
+		return true;
+	}
+
+	// Stop and join thread, then free anything left in queue
+	void stop();
+
+	void threadMain()
+		throw();
+
+	struct Datagram
+	{
+		struct sockaddr_storage localAddr;
+		struct sockaddr_storage from;
+		void *buf; // from Node::getWirePacketBuffer()
+		unsigned int len;
+	};
+
+	OneServiceImpl *parent;
+	Datagram q[ZT_PACKET_WORKER_QUEUE_SIZE];
+	unsigned int head; // next entry to process
+	unsigned int count; // entries from head that are waiting or being processed
+	volatile bool run;
+	Mutex lock;
+	BinarySemaphore wake;
+	Thread thread;
+};
+
 class OneServiceImpl : public OneService
 {
 public:
@@ -525,8 +597,32 @@ public:
 	// Last potential sleep/wake event
 	uint64_t _lastRestart;
 
-	// Deadline for the next background task service function
+	// Deadline for the next background task service function; tap and packet
+	// worker threads only move it earlier (see _mergeBackgroundTaskDeadline())
 	volatile uint64_t _nextBackgroundTaskDeadline;
+	Mutex _nextBackgroundTaskDeadline_m;
+
+	// Outgoing UDP packets generated by the poll thread while it processes a
+	// received batch, sent via Binder::udpSendBatch() when the batch is done.
+	// Only touched by the poll thread (see _udpSendQueueOwner).
+	struct UdpSendQueueEntry
+	{
+		InetAddress local;
+		InetAddress remote;
+		unsigned int bindingNo;
+		unsigned int len;
+		char data[ZT_UDP_DEFAULT_PAYLOAD_MTU];
+	};
+	UdpSendQueueEntry _udpSendQueue[ZT_UDP_SEND_QUEUE_SIZE];
+	unsigned int _udpSendQueueLen;
+
+	// Packet processing threads if enabled (see newInstance())
+	PacketWorker *_packetWorkers;
+	unsigned int _packetWorkerCount;
+
+	// Node background threads for deferred packets, joined after node is deleted
+	Thread _deferredWorkers[ZT_MAX_DEFERRED_PACKET_WORKERS];
+	unsigned int _deferredWorkerCount;
 
 	// Configured networks
 	struct NetworkState
@@ -551,7 +647,14 @@ public:
 
 	// Active TCP/IP connections
 	std::set< TcpConnection * > _tcpConnections; // no mutex for this since it's done in the main loop thread only
-	TcpConnection *_tcpFallbackTunnel;
+	TcpConnection *_tcpFallbackTunnel; // only changed by main loop thread, which locks _tcpFallbackTunnel_m to do so
+
+	// Wire sends can come from any thread, but Phy<> may only be touched by the
+	// main loop thread, so these ask it to do things after its next poll()
+	InetAddress _tcpFallbackConnectTo;
+	volatile bool _tcpFallbackConnectWanted;
+	volatile bool _tcpFallbackWritableWanted;
+	Mutex _tcpFallbackTunnel_m;
 
 	// Termination status information
 	ReasonForTermination _termReason;
@@ -576,7 +679,7 @@ public:
 
 	// end member variables ----------------------------------------------------
 
-	OneServiceImpl(const char *hp,unsigned int port) :
+	OneServiceImpl(const char *hp,unsigned int port,unsigned int packetWorkers,unsigned int deferredWorkers) :
 		_homePath((hp) ? hp : ".")
 		,_tcpFallbackResolver(ZT_TCP_FALLBACK_RELAY)
 #ifdef ZT_ENABLE_NETWORK_CONTROLLER
@@ -591,7 +694,13 @@ public:
 #endif
 		,_lastRestart(0)
 		,_nextBackgroundTaskDeadline(0)
+		,_udpSendQueueLen(0)
+		,_packetWorkers((PacketWorker *)0)
+		,_packetWorkerCount((packetWorkers > ZT_MAX_PACKET_WORKERS) ? ZT_MAX_PACKET_WORKERS : packetWorkers)
+		,_deferredWorkerCount((deferredWorkers > ZT_MAX_DEFERRED_PACKET_WORKERS) ? ZT_MAX_DEFERRED_PACKET_WORKERS : deferredWorkers)
 		,_tcpFallbackTunnel((TcpConnection *)0)
+		,_tcpFallbackConnectWanted(false)
+		,_tcpFallbackWritableWanted(false)
 		,_termReason(ONE_STILL_RUNNING)
 #ifdef ZT_USE_MINIUPNPC
 		,_portMapper((PortMapper *)0)
@@ -861,9 +970,18 @@ public:
 				}
 			}
 
-			// Start two background threads to handle expensive ops out of line
-			Thread::start(_node);
-			Thread::start(_node);
+			// Start background threads to handle expensive ops out of line
+			for(unsigned int i=0;i<_deferredWorkerCount;++i)
+				_deferredWorkers[i] = Thread::start(_node);
+
+			// Start packet processing threads if enabled
+			if (_packetWorkerCount) {
+				_packetWorkers = new PacketWorker[_packetWorkerCount];
+				for(unsigned int i=0;i<_packetWorkerCount;++i) {
+					_packetWorkers[i].parent = this;
+					_packetWorkers[i].thread = Thread::start(&(_packetWorkers[i]));
+				}
+			}
 
 			_nextBackgroundTaskDeadline = 0;
 			uint64_t clockShouldBe = OSUtils::now();
@@ -915,8 +1033,10 @@ public:
 
 				uint64_t dl = _nextBackgroundTaskDeadline;
 				if (dl <= now) {
-					_node->processBackgroundTasks(now,&_nextBackgroundTaskDeadline);
-					dl = _nextBackgroundTaskDeadline;
+					volatile uint64_t ndl = dl;
+					_node->processBackgroundTasks(now,&ndl);
+					Mutex::Lock _l(_nextBackgroundTaskDeadline_m);
+					_nextBackgroundTaskDeadline = dl = ndl;
 				}
 
 #ifdef ZT_AUTO_UPDATE
@@ -970,6 +1090,25 @@ public:
 				const unsigned long delay = (dl > now) ? (unsigned long)(dl - now) : 100;
 				clockShouldBe = now + (uint64_t)delay;
 				_phy.poll(delay);
+
+				if ((_tcpFallbackConnectWanted)||(_tcpFallbackWritableWanted)) {
+					InetAddress connectTo;
+					bool writable = false;
+					{
+						Mutex::Lock _l(_tcpFallbackTunnel_m);
+						if (_tcpFallbackConnectWanted)
+							connectTo = _tcpFallbackConnectTo;
+						writable = ((_tcpFallbackWritableWanted)&&(_tcpFallbackTunnel));
+						_tcpFallbackConnectWanted = false;
+						_tcpFallbackWritableWanted = false;
+					}
+					if (writable)
+						_phy.setNotifyWritable(_tcpFallbackTunnel->sock,true);
+					if (connectTo) {
+						bool connected = false;
+						_phy.tcpConnect(reinterpret_cast<const struct sockaddr *>(&connectTo),connected);
+					}
+				}
 			}
 		} catch (std::exception &exc) {
 			Mutex::Lock _l(_termReason_m);
@@ -981,6 +1120,13 @@ public:
 			_fatalErrorMessage = "unexpected exception in main thread";
 		}
 
+		if (_packetWorkers) {
+			for(unsigned int i=0;i<_packetWorkerCount;++i)
+				_packetWorkers[i].stop();
+			delete [] _packetWorkers;
+			_packetWorkers = (PacketWorker *)0;
+		}
+
 		try {
 			while (!_tcpConnections.empty())
 				_phy.close((*_tcpConnections.begin())->sock);
@@ -995,8 +1141,10 @@ public:
 
 		delete _controlPlane;
 		_controlPlane = (ControlPlane *)0;
-		delete _node;
+		delete _node; // waits for background threads to leave the node
 		_node = (Node *)0;
+		for(unsigned int i=0;i<_deferredWorkerCount;++i)
+			Thread::join(_deferredWorkers[i]);
 
 		return _termReason;
 	}
@@ -1220,13 +1368,59 @@ public:
 		if ((len >= 16)&&(reinterpret_cast<const InetAddress *>(from)->ipScope() == InetAddress::IP_SCOPE_GLOBAL))
 			_lastDirectReceiveFromGlobal = OSUtils::now();
 
-		const ZT_ResultCode rc = _node->processWirePacket(
+		if ((_packetWorkers)&&(len <= ZT_UDP_DEFAULT_PAYLOAD_MTU)) {
+			// Copy once into a node packet buffer, which the worker then hands to the node
+			void *pbData = (void *)0;
+			unsigned int pbCapacity = 0;
+			void *const pb = _node->getWirePacketBuffer(&pbData,&pbCapacity);
+			memcpy(pbData,data,len);
+			if (!_packetWorkers[_packetWorkerFor(data,len) % _packetWorkerCount].enqueue(localAddr,from,pb,(unsigned int)len))
+				_node->freeWirePacketBuffer(pb); // dropped if worker is backed up
+		} else {
+			processReceivedPacket(localAddr,from,data,len);
+		}
+	}
+
+	// Called from phyOnDatagram()
+	inline void processReceivedPacket(const struct sockaddr *localAddr,const struct sockaddr *from,const void *data,unsigned long len)
+	{
+		_processWirePacketResult(_node->processWirePacket(
 			OSUtils::now(),
 			reinterpret_cast<const struct sockaddr_storage *>(localAddr),
 			(const struct sockaddr_storage *)from, // Phy<> uses sockaddr_storage, so it'll always be that big
 			data,
 			len,
-			&_nextBackgroundTaskDeadline);
+			&_nextBackgroundTaskDeadline));
+	}
+
+	// Called from packet worker threads, takes ownership of buffer
+	inline void processReceivedPacketBuffer(const struct sockaddr *localAddr,const struct sockaddr *from,void *buf,unsigned int len)
+	{
+		volatile uint64_t dl = _nextBackgroundTaskDeadline;
+		_processWirePacketResult(_node->processWirePacketBuffer(
+			OSUtils::now(),
+			reinterpret_cast<const struct sockaddr_storage *>(localAddr),
+			(const struct sockaddr_storage *)from,
+			buf,
+			len,
+			&dl));
+		_mergeBackgroundTaskDeadline(dl);
+	}
+
+	/* Threads other than the main loop pass the core a copy of the background
+	 * task deadline and merge it back here. The deadline only ever moves
+	 * earlier this way, so a lost race just means an early wakeup. */
+	inline void _mergeBackgroundTaskDeadline(const uint64_t dl)
+	{
+		if (dl < _nextBackgroundTaskDeadline) {
+			Mutex::Lock _l(_nextBackgroundTaskDeadline_m);
+			if (dl < _nextBackgroundTaskDeadline)
+				_nextBackgroundTaskDeadline = dl;
+		}
+	}
+
+	inline void _processWirePacketResult(const ZT_ResultCode rc)
+	{
 		if (ZT_ResultCode_isFatal(rc)) {
 			char tmp[256];
 			Utils::snprintf(tmp,sizeof(tmp),"fatal error code from processWirePacket: %d",(int)rc);
@@ -1237,6 +1431,32 @@ public:
 		}
 	}
 
+	/* Pick a value to divide packets among workers: the source address for
+	 * packets and packet heads so each peer stays on one worker, or the
+	 * packet ID for fragments since these carry no source. A fragmented
+	 * packet is decoded by whichever worker completes it, but fragmented
+	 * packets could arrive out of order anyway. */
+	static inline unsigned int _packetWorkerFor(const void *data,unsigned long len)
+	{
+		const uint8_t *const b = reinterpret_cast<const uint8_t *>(data);
+		if ((len > ZT_PROTO_MIN_FRAGMENT_LENGTH)&&(b[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_INDICATOR] == ZT_PACKET_FRAGMENT_INDICATOR)) {
+			return (((unsigned int)b[0] << 24) | ((unsigned int)b[1] << 16) | ((unsigned int)b[2] << 8) | (unsigned int)b[3]) ^ (((unsigned int)b[4] << 24) | ((unsigned int)b[5] << 16) | ((unsigned int)b[6] << 8) | (unsigned int)b[7]);
+		} else if (len >= ZT_PROTO_MIN_PACKET_LENGTH) {
+			const uint8_t *const a = b + ZT_PACKET_IDX_SOURCE;
+			return (((unsigned int)a[0] << 24) | ((unsigned int)a[1] << 16) | ((unsigned int)a[2] << 8) | (unsigned int)a[3]) ^ (unsigned int)a[4];
+		}
+		return 0;
+	}
+
+	inline void phyOnDatagramBatch(PhySocket *sock,void **uptr,const struct sockaddr *localAddr,const PhyDatagram *dgrams,unsigned int count)
+	{
+		_udpSendQueueOwner = this;
+		for(unsigned int i=0;i<count;++i)
+			phyOnDatagram(sock,uptr,localAddr,dgrams[i].addr,dgrams[i].data,dgrams[i].len);
+		_udpSendQueueOwner = (OneServiceImpl *)0;
+		_flushUdpSendQueue();
+	}
+
 	inline void phyOnTcpConnect(PhySocket *sock,void **uptr,bool success)
 	{
 		if (!success)
@@ -1270,6 +1490,7 @@ public:
 		tc->writeBuf.push_back((char)(ZEROTIER_ONE_VERSION_REVISION & 0xff));
 		_phy.setNotifyWritable(sock,true);
 
+		Mutex::Lock _l(_tcpFallbackTunnel_m);
 		_tcpFallbackTunnel = tc;
 	}
 
@@ -1307,8 +1528,10 @@ public:
 	{
 		TcpConnection *tc = (TcpConnection *)*uptr;
 		if (tc) {
-			if (tc == _tcpFallbackTunnel)
+			if (tc == _tcpFallbackTunnel) {
+				Mutex::Lock _l(_tcpFallbackTunnel_m); // wait for any sender still using it
 				_tcpFallbackTunnel = (TcpConnection *)0;
+			}
 			_tcpConnections.erase(tc);
 			delete tc;
 		}
@@ -1581,21 +1804,35 @@ public:
 			return 0;
 		}
 
-		FILE *f = fopen(p.c_str(),"wb");
+		// Write to a temporary file and rename it over the old one so a crash
+		// leaves either the old or the new contents, never a partial file.
+		const std::string tmp(p + ".tmp");
+		FILE *f = fopen(tmp.c_str(),"wb");
 		if (!f)
 			return -1;
-		if (fwrite(data,len,1,f) == 1) {
-			fclose(f);
-			if (secure)
-				OSUtils::lockDownFile(p.c_str(),false);
-			return 0;
-		} else {
-			fclose(f);
-			OSUtils::rm(p.c_str());
+		const bool ok = (fwrite(data,len,1,f) == 1);
+		if ((fclose(f) != 0)||(!ok)) {
+			OSUtils::rm(tmp.c_str());
 			return -1;
 		}
+		if (secure)
+			OSUtils::lockDownFile(tmp.c_str(),false);
+#ifdef __WINDOWS__
+		if (!MoveFileExA(tmp.c_str(),p.c_str(),MOVEFILE_REPLACE_EXISTING)) {
+#else
+		if (::rename(tmp.c_str(),p.c_str()) != 0) {
+#endif
+			OSUtils::rm(tmp.c_str());
+			return -1;
+		}
+		return 0;
 	}
 
+	/* Called from whatever thread is in the node: the main loop, packet
+	 * workers, tap reader threads and DeferredPackets threads. UDP goes out via
+	 * Binder, which holds its lock for the whole send (including the TTL change
+	 * for TTL-limited sends), and sendto() itself is thread-safe. Phy<> socket
+	 * state is not, so TCP fallback changes are handed to the main loop. */
 	inline int nodeWirePacketSendFunction(const struct sockaddr_storage *localAddr,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl)
 	{
 		unsigned int fromBindingNo = 0;
@@ -1623,10 +1860,13 @@ public:
 				// valid direct traffic we'll stop using it and close the socket after a while.
 				const uint64_t now = OSUtils::now();
 				if (((now - _lastDirectReceiveFromGlobal) > ZT_TCP_FALLBACK_AFTER)&&((now - _lastRestart) > ZT_TCP_FALLBACK_AFTER)) {
+					Mutex::Lock _l(_tcpFallbackTunnel_m);
 					if (_tcpFallbackTunnel) {
-						Mutex::Lock _l(_tcpFallbackTunnel->writeBuf_m);
-						if (!_tcpFallbackTunnel->writeBuf.length())
-							_phy.setNotifyWritable(_tcpFallbackTunnel->sock,true);
+						Mutex::Lock _l2(_tcpFallbackTunnel->writeBuf_m);
+						if (!_tcpFallbackTunnel->writeBuf.length()) {
+							_tcpFallbackWritableWanted = true;
+							_phy.whack();
+						}
 						unsigned long mlen = len + 7;
 						_tcpFallbackTunnel->writeBuf.push_back((char)0x17);
 						_tcpFallbackTunnel->writeBuf.push_back((char)0x03);
@@ -1643,10 +1883,10 @@ public:
 							if (!_tcpFallbackResolver.running())
 								_tcpFallbackResolver.resolveNow();
 						} else {
-							bool connected = false;
-							InetAddress addr(tunnelIps[(unsigned long)now % tunnelIps.size()]);
-							addr.setPort(ZT_TCP_FALLBACK_RELAY_PORT);
-							_phy.tcpConnect(reinterpret_cast<const struct sockaddr *>(&addr),connected);
+							_tcpFallbackConnectTo = tunnelIps[(unsigned long)now % tunnelIps.size()];
+							_tcpFallbackConnectTo.setPort(ZT_TCP_FALLBACK_RELAY_PORT);
+							_tcpFallbackConnectWanted = true;
+							_phy.whack();
 						}
 					}
 				}
@@ -1670,9 +1910,50 @@ public:
 			return 0; // silently break UDP
 #endif
 
+		// If this is the poll thread processing a received batch, queue this to
+		// go out with the rest of the replies it generates. Packets needing a
+		// TTL or sent from the wildcard address go out now, and a packet is only
+		// queued (and reported sent) if a socket is bound to its local address,
+		// which is the check an immediate send would fail on.
+		if ((_udpSendQueueOwner == this)&&(ttl == 0)&&(len <= ZT_UDP_DEFAULT_PAYLOAD_MTU)&&(*(reinterpret_cast<const InetAddress *>(localAddr)))) {
+			if (!_bindings[fromBindingNo].isBound(*(reinterpret_cast<const InetAddress *>(localAddr))))
+				return -1;
+			if (_udpSendQueueLen >= ZT_UDP_SEND_QUEUE_SIZE)
+				_flushUdpSendQueue();
+			UdpSendQueueEntry &qe = _udpSendQueue[_udpSendQueueLen++];
+			qe.local = *(reinterpret_cast<const InetAddress *>(localAddr));
+			qe.remote = *(reinterpret_cast<const InetAddress *>(addr));
+			qe.bindingNo = fromBindingNo;
+			qe.len = len;
+			memcpy(qe.data,data,len);
+			return 0;
+		}
+
 		return (_bindings[fromBindingNo].udpSend(_phy,*(reinterpret_cast<const InetAddress *>(localAddr)),*(reinterpret_cast<const InetAddress *>(addr)),data,len,ttl)) ? 0 : -1;
 	}
 
+	// Send everything in _udpSendQueue, grouping runs with the same binding and
+	// local address into one batch; poll thread only
+	inline void _flushUdpSendQueue()
+	{
+		PhyDatagram dgrams[ZT_UDP_SEND_QUEUE_SIZE];
+		unsigned int i = 0;
+		while (i < _udpSendQueueLen) {
+			const UdpSendQueueEntry &first = _udpSendQueue[i];
+			unsigned int n = 0;
+			while (((i + n) < _udpSendQueueLen)&&(_udpSendQueue[i + n].bindingNo == first.bindingNo)&&(_udpSendQueue[i + n].local == first.local)) {
+				UdpSendQueueEntry &qe = _udpSendQueue[i + n];
+				dgrams[n].addr = reinterpret_cast<const struct sockaddr *>(&(qe.remote));
+				dgrams[n].data = (void *)qe.data;
+				dgrams[n].len = qe.len;
+				++n;
+			}
+			_bindings[first.bindingNo].udpSendBatch(_phy,first.local,dgrams,n);
+			i += n;
+		}
+		_udpSendQueueLen = 0;
+	}
+
 	inline void nodeVirtualNetworkFrameFunction(uint64_t nwid,void **nuptr,uint64_t sourceMac,uint64_t destMac,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
 	{
 		NetworkState *n = reinterpret_cast<NetworkState *>(*nuptr);
@@ -1705,9 +1986,15 @@ public:
 		return 1;
 	}
 
+	/* Called concurrently from every reader thread of a multi-queue tap. Node
+	 * entry points are safe to call from several threads at once (the poll
+	 * thread, packet workers and DeferredPackets already do), so the only
+	 * shared state here is the deadline, which is merged back under a lock. */
 	inline void tapFrameHandler(uint64_t nwid,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
 	{
-		_node->processVirtualNetworkFrame(OSUtils::now(),nwid,from.toInt(),to.toInt(),etherType,vlanId,data,len,&_nextBackgroundTaskDeadline);
+		volatile uint64_t dl = _nextBackgroundTaskDeadline;
+		_node->processVirtualNetworkFrame(OSUtils::now(),nwid,from.toInt(),to.toInt(),etherType,vlanId,data,len,&dl);
+		_mergeBackgroundTaskDeadline(dl);
 	}
 
 	inline void onHttpRequestToServer(TcpConnection *tc)
@@ -1987,7 +2274,55 @@ std::string OneService::autoUpdateUrl()
 	return std::string();
 }
 
-OneService *OneService::newInstance(const char *hp,unsigned int port) { return new OneServiceImpl(hp,port); }
+void PacketWorker::threadMain()
+	throw()
+{
+	for(;;) {
+		unsigned int h,n;
+		{
+			Mutex::Lock _l(lock);
+			h = head;
+			n = count;
+		}
+
+		if (!run)
+			break;
+		if (!n) {
+			wake.wait();
+			continue;
+		}
+
+		// Entries up to n are not touched by enqueue() until we advance head
+		for(unsigned int i=0;i<n;++i) {
+			const Datagram &d = q[(h + i) % ZT_PACKET_WORKER_QUEUE_SIZE];
+			try {
+				parent->processReceivedPacketBuffer(reinterpret_cast<const struct sockaddr *>(&(d.localAddr)),reinterpret_cast<const struct sockaddr *>(&(d.from)),d.buf,d.len);
+			} catch ( ... ) {}
+		}
+
+		{
+			Mutex::Lock _l(lock);
+			head = (head + n) % ZT_PACKET_WORKER_QUEUE_SIZE;
+			count -= n;
+		}
+	}
+}
+
+void PacketWorker::stop()
+{
+	run = false;
+	wake.post();
+	Thread::join(thread);
+
+	Mutex::Lock _l(lock);
+	while (count) {
+		parent->_node->freeWirePacketBuffer(q[head].buf);
+		head = (head + 1) % ZT_PACKET_WORKER_QUEUE_SIZE;
+		--count;
+	}
+}
+
+OneService *OneService::newInstance(const char *hp,unsigned int port,unsigned int packetWorkers,unsigned int deferredWorkers) { return new OneServiceImpl(hp,port,packetWorkers,deferredWorkers); }
 OneService::~OneService() {}
 
 } // namespace ZeroTier
@@ -21,6 +21,8 @@
 
 #include <string>
 
+#include "../node/Constants.hpp"
+
 namespace ZeroTier {
 
 /**
@@ -108,12 +110,25 @@ public:
 	 * which is used by the CLI and can be used to see which port was chosen if
 	 * 0 (random port) is picked.
 	 *
+	 * By default all received packets are processed by the thread that calls
+	 * run(). If packetWorkers is nonzero, that many worker threads are started
+	 * instead and received packets are divided among them by sending peer so
+	 * that each peer's packets are still handled in order.
+	 *
+	 * Expensive packets such as HELLOs from new peers are handed off to
+	 * deferredWorkers background threads. If this is 0 they are processed
+	 * inline like everything else.
+	 *
 	 * @param hp Home path
 	 * @param port TCP and UDP port for packets and HTTP control (if 0, pick random port)
+	 * @param packetWorkers Number of packet processing threads or 0 to process in run() thread
+	 * @param deferredWorkers Number of background threads for expensive packets
 	 */
 	static OneService *newInstance(
 		const char *hp,
-		unsigned int port);
+		unsigned int port,
+		unsigned int packetWorkers = 0,
+		unsigned int deferredWorkers = ZT_DEFERRED_PACKETS_WORKERS);
 
 	virtual ~OneService();
 